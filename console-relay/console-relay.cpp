@@ -0,0 +1,296 @@
+// Library "console-relay"
+//
+// The C API of include/console-tools/console_relay.h on top of the relay of pipe-to-con.
+
+#include <console-tools/broker.h>
+#include <console-tools/console_relay.h>
+#include <console-tools/io.h>
+#include <console-tools/relay.h>
+#include <console-tools/utf.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+// The same broker, that "pipe-to-con --pid <PID> --broker" starts.
+constexpr std::string_view BROKER_TOOL_NAME{ "pipe-to-con" };
+// The first version of console_relay_options ends after `flags`.
+constexpr std::size_t OPTIONS_V1_SIZE{ offsetof(console_relay_options, flags) + sizeof(uint32_t) };
+
+struct console_relay_session {
+	std::unique_ptr<byte_stream> stream{};
+	bool to_console{ true };
+	text_encoding encoding{ text_encoding::utf16le };
+	// Holds a reference to the attach of this process to the console (Windows).
+	bool attached{ false };
+	// UTF-16LE from a broker: the byte stream may end a read in the middle of a code
+	// unit. Its first byte waits here for the next console_relay_read().
+	std::optional<char> carry{ std::nullopt };
+	uint32_t os_error{ 0 };
+};
+
+namespace {
+
+console_in_or_out ConsoleSide(const console_relay_session& session) {
+	return session.to_console ? console_in_or_out::out : console_in_or_out::in;
+}
+
+// Like the session of a secondary process, that "pipe-to-con --pid <PID>" asks for.
+// connect_local() accepts only a broker of the same user.
+std::unique_ptr<byte_stream> ConnectToBroker(uint32_t pid, const console_relay_session& session) {
+	broker_connection connection = connect_to_broker(broker_endpoint(BROKER_TOOL_NAME, pid),
+		fmt::format("--{}-secondary {}--buffer-size {}", (session.to_console ? "to" : "from"),
+			(session.encoding == text_encoding::utf8 ? "--utf8 " : ""), DEFAULT_BUFFER_SIZE));
+	if (connection.status != broker_status::accepted)
+		return nullptr;
+	return std::move(connection.stream);
+}
+
+#if defined(_WIN32)
+// The console, that this process was attached to for sessions, and the number of them.
+// The sessions of a console, that the process was attached to already, count as well,
+// because the last one detaches again.
+std::mutex g_attach_mutex{};
+uint32_t g_attached_pid{ 0 };
+std::size_t g_attached_sessions{ 0 };
+
+// The console of the host before the first attach: another process of it, that keeps it
+// alive and leads back to it, and which standard handles were on it.
+struct host_console {
+	DWORD companion{ 0 };
+	bool std_on_console[3]{};
+};
+std::optional<host_console> g_host_console{ std::nullopt };
+constexpr DWORD STD_HANDLES[3]{ STD_INPUT_HANDLE, STD_OUTPUT_HANDLE, STD_ERROR_HANDLE };
+
+// Notes the console of the host, before FreeConsole(). Returns false, if the host has a
+// console, that no other process keeps: FreeConsole() would end it for good.
+bool RememberHostConsole() {
+	g_host_console.reset();
+	std::vector<DWORD> PIDs(64);
+	DWORD count{ 0 };
+	for (;;) {
+		count = GetConsoleProcessList(PIDs.data(), static_cast<DWORD>(PIDs.size()));
+		if (count <= PIDs.size())
+			break;
+		PIDs.resize(count);
+	}
+	// No console at all.
+	if (count == 0)
+		return true;
+	auto other = std::find_if(PIDs.begin(), PIDs.begin() + count, [](DWORD PID) { return PID != GetCurrentProcessId(); });
+	if (other == PIDs.begin() + count)
+		return false;
+	host_console host{ .companion{*other} };
+	for (std::size_t i = 0; i < std::size(STD_HANDLES); ++i) {
+		DWORD mode{};
+		host.std_on_console[i] = GetConsoleMode(GetStdHandle(STD_HANDLES[i]), &mode) != 0;
+	}
+	g_host_console = host;
+	return true;
+}
+
+// Leaves the console of the sessions and attaches back to the console of the host, with
+// new handles for the standard handles, that were on it. Not, if the companion has ended
+// meanwhile.
+void RestoreHostConsole() {
+	(void)FreeConsole();
+	if (!g_host_console)
+		return;
+	if (AttachConsole(g_host_console->companion)) {
+		for (std::size_t i = 0; i < std::size(STD_HANDLES); ++i) {
+			if (!g_host_console->std_on_console[i])
+				continue;
+			HANDLE handle = CreateFileA((STD_HANDLES[i] == STD_INPUT_HANDLE) ? "CONIN$" : "CONOUT$", GENERIC_READ | GENERIC_WRITE,
+				FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+			if (handle != INVALID_HANDLE_VALUE)
+				(void)SetStdHandle(STD_HANDLES[i], handle);
+		}
+	}
+	g_host_console.reset();
+}
+
+bool IsAttachedTo(uint32_t pid) {
+	std::lock_guard lock{ g_attach_mutex };
+	return g_attached_sessions > 0 && g_attached_pid == pid;
+}
+
+int32_t AttachSession(uint32_t pid, console_relay_session& session) {
+	std::lock_guard lock{ g_attach_mutex };
+	if (g_attached_sessions > 0 && g_attached_pid != pid)
+		return CONSOLE_RELAY_E_BUSY;
+	if (g_attached_sessions == 0) {
+		if (!RememberHostConsole())
+			return CONSOLE_RELAY_E_BUSY;
+		(void)FreeConsole();
+		if (!AttachConsole(pid)) {
+			RestoreHostConsole();
+			return CONSOLE_RELAY_E_NO_ROUTE;
+		}
+	}
+	std::unique_ptr<console> target = open_process_console(pid, ConsoleSide(session));
+	if (!target) {
+		if (g_attached_sessions == 0)
+			RestoreHostConsole();
+		return CONSOLE_RELAY_E_NO_ROUTE;
+	}
+	session.stream = open_console_stream(std::move(target), session.encoding);
+	session.attached = true;
+	g_attached_pid = pid;
+	++g_attached_sessions;
+	return CONSOLE_RELAY_OK;
+}
+
+void DetachSession(console_relay_session& session) {
+	if (!session.attached)
+		return;
+	std::lock_guard lock{ g_attach_mutex };
+	if (--g_attached_sessions == 0) {
+		RestoreHostConsole();
+		g_attached_pid = 0;
+	}
+	session.attached = false;
+}
+#endif
+
+int32_t OpenSession(uint32_t pid, const console_relay_options& options, console_relay_session& session) {
+#if defined(_WIN32)
+	if (IsAttachedTo(pid))
+		return AttachSession(pid, session);
+#endif
+	if (std::unique_ptr<console> target = open_process_console(pid, ConsoleSide(session))) {
+		session.stream = open_console_stream(std::move(target), session.encoding);
+		return CONSOLE_RELAY_OK;
+	}
+	if (!(options.flags & CONSOLE_RELAY_NO_BROKER)) {
+		session.stream = ConnectToBroker(pid, session);
+		if (session.stream)
+			return CONSOLE_RELAY_OK;
+	}
+#if defined(_WIN32)
+	if (options.flags & CONSOLE_RELAY_ALLOW_ATTACH)
+		return AttachSession(pid, session);
+#endif
+	return CONSOLE_RELAY_E_NO_ROUTE;
+}
+
+} // namespace
+
+uint32_t console_relay_api_version(void) {
+	return CONSOLE_RELAY_API_VERSION;
+}
+
+int32_t console_relay_open(uint32_t pid, const console_relay_options* options, console_relay_session** session) {
+	if (session == nullptr)
+		return CONSOLE_RELAY_E_ARGUMENT;
+	*session = nullptr;
+	if (options == nullptr || options->size < OPTIONS_V1_SIZE
+		|| (options->direction != CONSOLE_RELAY_TO_CONSOLE && options->direction != CONSOLE_RELAY_FROM_CONSOLE)
+		|| (options->encoding != CONSOLE_RELAY_UTF16LE && options->encoding != CONSOLE_RELAY_UTF8))
+		return CONSOLE_RELAY_E_ARGUMENT;
+
+	// No exception leaves the library.
+	try {
+		auto opened = std::make_unique<console_relay_session>();
+		opened->to_console = (options->direction == CONSOLE_RELAY_TO_CONSOLE);
+		opened->encoding = (options->encoding == CONSOLE_RELAY_UTF8) ? text_encoding::utf8 : text_encoding::utf16le;
+		const int32_t result = OpenSession(pid, *options, *opened);
+		if (result == CONSOLE_RELAY_OK)
+			*session = opened.release();
+		return result;
+	}
+	catch (const std::bad_alloc&) {
+		return CONSOLE_RELAY_E_MEMORY;
+	}
+	catch (...) {
+		return CONSOLE_RELAY_E_IO;
+	}
+}
+
+int32_t console_relay_write(console_relay_session* session, const void* data, size_t size) {
+	if (session == nullptr || !session->to_console || (data == nullptr && size > 0))
+		return CONSOLE_RELAY_E_ARGUMENT;
+	try {
+		std::span<const char> bytes{ static_cast<const char*>(data), size };
+		while (!bytes.empty()) {
+			io_result result = session->stream->write(bytes);
+			if (!result.ok() || result.count == 0) {
+				session->os_error = result.error_code;
+				return CONSOLE_RELAY_E_IO;
+			}
+			bytes = bytes.subspan(result.count);
+		}
+		return session->stream->flush() ? CONSOLE_RELAY_OK : CONSOLE_RELAY_E_IO;
+	}
+	catch (const std::bad_alloc&) {
+		return CONSOLE_RELAY_E_MEMORY;
+	}
+	catch (...) {
+		return CONSOLE_RELAY_E_IO;
+	}
+}
+
+int32_t console_relay_read(console_relay_session* session, void* buffer, size_t size, size_t* count) {
+	if (count != nullptr)
+		*count = 0;
+	const std::size_t unit_size = (session != nullptr && session->encoding == text_encoding::utf16le) ? sizeof(char16_t) : 1;
+	if (session == nullptr || session->to_console || buffer == nullptr || count == nullptr || size < unit_size)
+		return CONSOLE_RELAY_E_ARGUMENT;
+	try {
+		// Whole code units only: the stream of a broker has no notion of them.
+		std::span<char> bytes{ static_cast<char*>(buffer), size / unit_size * unit_size };
+		std::size_t received{ 0 };
+		if (session->carry) {
+			bytes[0] = *session->carry;
+			session->carry.reset();
+			received = 1;
+		}
+		while (received < unit_size) {
+			io_result result = session->stream->read(bytes.subspan(received));
+			// A half code unit at the end is dropped.
+			if (result.status == io_status::eof)
+				return CONSOLE_RELAY_END;
+			if (!result.ok()) {
+				session->os_error = result.error_code;
+				return CONSOLE_RELAY_E_IO;
+			}
+			received += result.count;
+		}
+		if (received % unit_size != 0) {
+			session->carry = bytes[received - 1];
+			--received;
+		}
+		*count = received;
+		return CONSOLE_RELAY_OK;
+	}
+	catch (const std::bad_alloc&) {
+		return CONSOLE_RELAY_E_MEMORY;
+	}
+	catch (...) {
+		return CONSOLE_RELAY_E_IO;
+	}
+}
+
+uint32_t console_relay_os_error(const console_relay_session* session) {
+	return (session != nullptr) ? session->os_error : 0;
+}
+
+void console_relay_close(console_relay_session* session) {
+	if (session == nullptr)
+		return;
+	session->stream.reset();
+#if defined(_WIN32)
+	DetachSession(*session);
+#endif
+	delete session;
+}
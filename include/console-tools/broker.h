@@ -0,0 +1,78 @@
+#pragma once
+#include "console-tools/io.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The broker of a target console: a long-lived process, that is attached to the
+// console of one PID and serves the sessions of many invocations of a tool over a
+// local endpoint (io.h). The invocations connect and stream, instead of spawning a
+// secondary process, that attaches to the console again every time.
+//
+// The protocol is a handful of frames: a 32-bit little-endian length, then the bytes.
+//   client -> broker  the arguments of the session, separated by spaces, in the form
+//                     of the command line of a secondary process
+//   broker -> client  an empty frame, if the session runs, or the reason, why not
+// After that, the connection carries the stream of the session, until one side
+// closes it. Each tool defines, which direction the stream goes.
+
+// The endpoint of the broker of `tool` (e.g. "pipe-to-con") for the console of `pid`.
+std::string broker_endpoint(std::string_view tool, uint32_t pid);
+
+bool write_frame(byte_sink& out, std::string_view payload);
+
+// Returns std::nullopt, if the stream ends early or the frame is longer than `max_size`.
+std::optional<std::string> read_frame(byte_source& in, std::size_t max_size);
+
+// One session on the side of the broker.
+class broker_session {
+public:
+	broker_session(std::unique_ptr<byte_stream> connection, std::string arguments);
+
+	// Closes the connection. A session, that was neither accepted nor rejected, is rejected.
+	~broker_session();
+
+	broker_session(const broker_session&) = delete;
+	broker_session& operator=(const broker_session&) = delete;
+
+	// The arguments of the client, split at the spaces.
+	const std::vector<std::string_view>& arguments() const { return m_arguments; }
+
+	// Tells the client, that the stream starts. Returns false, if the client has gone.
+	bool accept();
+	void reject(std::string_view reason);
+
+	// The stream of the session, after accept().
+	std::unique_ptr<byte_stream>& connection() { return m_connection; }
+
+private:
+	std::unique_ptr<byte_stream> m_connection;
+	std::string m_argument_text;
+	std::vector<std::string_view> m_arguments{};
+	bool m_answered{ false };
+};
+
+using broker_session_handler = std::function<void(broker_session& session)>;
+
+// Accepts clients on `listener` and runs `handler` for each session in a thread of its
+// own. Returns, when the listener fails, after all sessions have ended.
+void serve_broker_sessions(local_listener& listener, const broker_session_handler& handler);
+
+enum class broker_status : uint32_t {
+	absent,   // nobody listens on the endpoint; the caller spawns a secondary process
+	rejected, // `reason` tells why
+	accepted  // `stream` carries the session
+};
+
+struct broker_connection {
+	broker_status status{ broker_status::absent };
+	std::unique_ptr<byte_stream> stream{};
+	std::string reason{};
+};
+
+broker_connection connect_to_broker(std::string_view endpoint, std::string_view arguments);
@@ -0,0 +1,95 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// The relay of pipe-to-con as a library with a C API (console-relay.dll), for services,
+// that push text into a console many times, without a process per message.
+//
+// A session is one direction to or from the console of a PID, in the encoding of the
+// pipe of pipe-to-con: UTF-16LE through the console API, or UTF-8 bytes. The library
+// reaches the console the cheapest way, that works:
+//   1. directly, if this process shares the console (Windows), or through the terminal
+//      of /proc/<pid>/fd/0 (Linux), like pipe-to-con without a secondary process
+//   2. through the broker of "pipe-to-con --pid <PID> --broker", if one runs
+//   3. with CONSOLE_RELAY_ALLOW_ATTACH, by attaching this process to the console
+//      (Windows). A process has one console, so sessions with other consoles, that
+//      were attached to, must be closed first. The own console of the process is left
+//      meanwhile: the last session attaches back to it, through another process of it,
+//      and points the standard handles, that were on it, to new console handles (not
+//      the streams of the C runtime). A console without another process would end, so
+//      the attach is refused with CONSOLE_RELAY_E_BUSY then.
+//
+// The API is stable: functions are only added, and console_relay_options only grows
+// at its end, with `size` telling the library, which fields the caller knows.
+
+#if defined(CONSOLE_RELAY_BUILD) && defined(_WIN32)
+#define CONSOLE_RELAY_API __declspec(dllexport)
+#elif defined(CONSOLE_RELAY_DLL) && defined(_WIN32)
+#define CONSOLE_RELAY_API __declspec(dllimport)
+#elif defined(CONSOLE_RELAY_BUILD)
+#define CONSOLE_RELAY_API __attribute__((visibility("default")))
+#else
+#define CONSOLE_RELAY_API
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define CONSOLE_RELAY_API_VERSION 1u
+
+// Directions of a session.
+#define CONSOLE_RELAY_TO_CONSOLE   1u
+#define CONSOLE_RELAY_FROM_CONSOLE 2u
+
+// Encodings of the bytes of a session.
+#define CONSOLE_RELAY_UTF16LE 0u
+#define CONSOLE_RELAY_UTF8    1u
+
+// Flags of a session.
+#define CONSOLE_RELAY_NO_BROKER    0x1u // do not ask a broker
+#define CONSOLE_RELAY_ALLOW_ATTACH 0x2u // attach this process to the console as the last resort
+
+// Results. The negative ones are errors.
+#define CONSOLE_RELAY_OK           0
+#define CONSOLE_RELAY_END          1  // console_relay_read(): the other side has closed
+#define CONSOLE_RELAY_E_ARGUMENT  -1  // a parameter is invalid, or the session has the other direction
+#define CONSOLE_RELAY_E_NO_ROUTE  -2  // none of the ways reaches the console of the PID
+#define CONSOLE_RELAY_E_BUSY      -3  // attaching would detach the sessions of another console, or end the own one
+#define CONSOLE_RELAY_E_IO        -4  // console_relay_os_error() tells more
+#define CONSOLE_RELAY_E_MEMORY    -5
+
+typedef struct console_relay_session console_relay_session;
+
+typedef struct console_relay_options {
+	// sizeof(console_relay_options) of the caller.
+	uint32_t size;
+	uint32_t direction;
+	uint32_t encoding;
+	uint32_t flags;
+} console_relay_options;
+
+// CONSOLE_RELAY_API_VERSION of the library, which may be newer than the header.
+CONSOLE_RELAY_API uint32_t console_relay_api_version(void);
+
+// Opens a session with the console of `pid`. On success, `*session` is set and must be
+// passed to console_relay_close() later. Sessions are independent of each other; one
+// session must not be used by two threads at the same time.
+CONSOLE_RELAY_API int32_t console_relay_open(uint32_t pid, const console_relay_options* options, console_relay_session** session);
+
+// Writes all `size` bytes. With UTF-16LE, an odd byte at the end waits for the next write.
+CONSOLE_RELAY_API int32_t console_relay_write(console_relay_session* session, const void* data, size_t size);
+
+// Reads at most `size` bytes, at least one, unless the result is not CONSOLE_RELAY_OK.
+// Blocks until input arrives. With UTF-16LE, only whole code units are read.
+CONSOLE_RELAY_API int32_t console_relay_read(console_relay_session* session, void* buffer, size_t size, size_t* count);
+
+// The GetLastError() or errno of the last CONSOLE_RELAY_E_IO of the session.
+CONSOLE_RELAY_API uint32_t console_relay_os_error(const console_relay_session* session);
+
+// Closes the session. The other side sees the end of the stream. Accepts NULL.
+CONSOLE_RELAY_API void console_relay_close(console_relay_session* session);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+#include "console-tools/helper.h"
+
+#include <chrono>
+#include <cstdint>
+
+// Ctrl events with a confirmation, that the handler of this process saw them.
+//
+// The handler counts the events in an atomic counter and then signals a waitable object
+// (an auto-reset event on Windows, a self-pipe on POSIX), so a waiter wakes up as soon
+// as the handler ran, instead of polling a flag. On POSIX, ctrl-c is SIGINT and
+// ctrl-break is SIGQUIT.
+
+constexpr std::chrono::milliseconds DEFAULT_CTRL_EVENT_WAIT_TIMEOUT{ 1000 };
+
+// Handles ctrl-c and ctrl-break for this process, while it exists. Only one at a time.
+class ctrl_event_handler {
+public:
+	ctrl_event_handler();
+	~ctrl_event_handler();
+
+	ctrl_event_handler(const ctrl_event_handler&) = delete;
+	ctrl_event_handler& operator=(const ctrl_event_handler&) = delete;
+
+	// False, if the handler could not be set. Then the events end the process as usual.
+	bool installed() const { return m_installed; }
+
+	// Events, that the handler saw so far. Read it before the event is generated.
+	uint64_t handled() const;
+
+	// Waits, until more than `seen` events were handled, at most for `timeout`.
+	bool wait(uint64_t seen, std::chrono::milliseconds timeout) const;
+
+private:
+	bool m_installed{ false };
+};
+
+// Sends `event` to the process group `group`. 0 stands for all processes of the console
+// (Windows) or the own process group (POSIX). On failure, the error is in GetLastError()
+// or errno.
+bool generate_ctrl_event(ConsoleCtrlEvent event, uint32_t group);
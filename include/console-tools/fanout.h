@@ -0,0 +1,84 @@
+#pragma once
+#include "console-tools/io.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One input, many targets: the sink behind the relay of "pipe-to-con --pid A --pid B ...".
+//
+// Every write is copied once into a reference-counted chunk. The queue of each target
+// holds a reference, not a copy, and the chunk is freed, when the last target has
+// written it. Each target has a writer thread of its own, so a slow target falls
+// behind, instead of holding up the others, up to the lag limit. Past that, the
+// lag policy decides.
+
+enum class lag_policy : uint32_t {
+	block,     // the input waits for the slow target, and with it all targets
+	drop,      // the slow target misses the chunks, until it has caught up
+	disconnect // the slow target is closed, the others go on
+};
+
+std::optional<lag_policy> parse_lag_policy(std::string_view str);
+
+std::string_view lag_policy_to_string(lag_policy policy);
+
+constexpr std::size_t DEFAULT_MAX_LAG{ 1024u * 1024u };
+
+struct fanout_option {
+	lag_policy policy{ lag_policy::block };
+	// Bytes, that a target may have queued, before the policy applies.
+	std::size_t max_lag{ DEFAULT_MAX_LAG };
+	// Chunks are only cut at multiples of this (2 for UTF-16), so that a dropped
+	// chunk takes whole code units with it.
+	std::size_t unit_size{ 1 };
+};
+
+struct fanout_target {
+	// For messages, e.g. "process 1234".
+	std::string name{};
+	std::unique_ptr<byte_sink> sink{};
+};
+
+struct fanout_result {
+	std::string name{};
+	uint64_t bytes_written{ 0 };
+	// Bytes of the input, that the target did not get.
+	uint64_t bytes_dropped{ 0 };
+	// Closed by lag_policy::disconnect.
+	bool disconnected{ false };
+	// A write failed, e.g. because the reader has gone.
+	bool failed{ false };
+};
+
+class fanout_sink final : public byte_sink {
+public:
+	fanout_sink(std::vector<fanout_target> targets, fanout_option option);
+
+	// Calls finish(), if that has not happened yet.
+	~fanout_sink() override;
+
+	fanout_sink(const fanout_sink&) = delete;
+	fanout_sink& operator=(const fanout_sink&) = delete;
+
+	// Queues `buffer` for every target. Fails only, when no target is left.
+	io_result write(std::span<const char> buffer) override;
+
+	// End of the input: waits, until every target has written its queue, and closes
+	// the targets, so that their readers see the end of the stream.
+	std::vector<fanout_result> finish();
+
+private:
+	struct target_state;
+
+	void publish(std::span<const char> bytes);
+
+	fanout_option m_option;
+	std::vector<std::unique_ptr<target_state>> m_targets{};
+	// The start of a code unit, that the last write did not complete.
+	std::vector<char> m_carry{};
+	bool m_finished{ false };
+};
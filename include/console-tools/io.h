@@ -0,0 +1,255 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+
+// Thin I/O layer under the relay loops.
+//
+// The relay code only talks to `byte_source`, `byte_sink`, `console_source`
+// and `console_sink`. The Win32 backend (shared/io_win32.cpp) maps them to
+// ReadFile/WriteFile/ReadConsoleW/WriteConsoleW, the POSIX backend
+// (shared/io_posix.cpp) maps them to read/write on pipes and pseudo-terminals.
+
+#if defined(_WIN32)
+using native_handle_t = HANDLE;
+#else
+using native_handle_t = int;
+
+// The console mode bits have the values of the Windows SDK.
+// The POSIX backend maps some of them to termios flags, see io_posix.cpp.
+constexpr uint32_t ENABLE_PROCESSED_INPUT             = 0x0001;
+constexpr uint32_t ENABLE_LINE_INPUT                  = 0x0002;
+constexpr uint32_t ENABLE_ECHO_INPUT                  = 0x0004;
+constexpr uint32_t ENABLE_VIRTUAL_TERMINAL_INPUT      = 0x0200;
+
+constexpr uint32_t ENABLE_PROCESSED_OUTPUT            = 0x0001;
+constexpr uint32_t ENABLE_WRAP_AT_EOL_OUTPUT          = 0x0002;
+constexpr uint32_t ENABLE_VIRTUAL_TERMINAL_PROCESSING = 0x0004;
+constexpr uint32_t DISABLE_NEWLINE_AUTO_RETURN        = 0x0008;
+#endif
+
+enum class console_in_or_out :uint32_t {
+	undefined,
+	in,
+	out
+};
+
+enum class std_stream : uint32_t {
+	in,
+	out,
+	err
+};
+
+enum class io_status : uint32_t {
+	ok,
+	eof,   // the other end is closed, `count` is zero
+	error  // `error_code` holds GetLastError() or errno
+};
+
+struct io_result {
+	io_status status{ io_status::ok };
+	std::size_t count{ 0 };
+	uint32_t error_code{ 0 };
+
+	bool ok() const { return status == io_status::ok; }
+};
+
+// The result of a read or write on a non-blocking handle, that had nothing to do right
+// now (EAGAIN). Nothing was read or written then; the call is repeated later.
+bool io_would_block(const io_result& result);
+
+class byte_source {
+public:
+	virtual ~byte_source() = default;
+
+	// Reads at most `buffer.size()` bytes. Blocks until at least one byte is
+	// available or the other end is closed.
+	virtual io_result read(std::span<char> buffer) = 0;
+
+	virtual std::optional<native_handle_t> handle() const { return std::nullopt; }
+
+	// The handle, if the stream may be switched to non-blocking mode: a read, that
+	// would block, fails then with io_would_block() and loses nothing. The coroutine
+	// core (relay_async.h) waits for the handle then, instead of blocking in read().
+	virtual std::optional<native_handle_t> pollable_handle() const { return std::nullopt; }
+};
+
+class byte_sink {
+public:
+	virtual ~byte_sink() = default;
+
+	// Writes at most `buffer.size()` bytes. Short writes are possible.
+	virtual io_result write(std::span<const char> buffer) = 0;
+
+	virtual bool flush() { return true; }
+
+	virtual std::optional<native_handle_t> handle() const { return std::nullopt; }
+
+	// Like byte_source::pollable_handle(), for write().
+	virtual std::optional<native_handle_t> pollable_handle() const { return std::nullopt; }
+};
+
+class console_source {
+public:
+	virtual ~console_source() = default;
+
+	// Reads at most `buffer.size()` UTF-16 code units.
+	virtual io_result read_utf16(std::span<char16_t> buffer) = 0;
+
+	// Typed input is waiting, so the next read_utf16() returns without delay.
+	// Callers use this to decide, whether to flush their output first.
+	virtual bool has_pending_input() const { return false; }
+
+	virtual std::optional<uint32_t> get_mode() const = 0;
+	virtual bool set_mode(uint32_t mode) = 0;
+
+	// Like byte_source::pollable_handle(), for read_utf16().
+	virtual std::optional<native_handle_t> pollable_handle() const { return std::nullopt; }
+};
+
+class console_sink {
+public:
+	virtual ~console_sink() = default;
+
+	// Writes at most `buffer.size()` UTF-16 code units. Short writes are possible.
+	virtual io_result write_utf16(std::span<const char16_t> buffer) = 0;
+
+	virtual std::optional<uint32_t> get_mode() const = 0;
+	virtual bool set_mode(uint32_t mode) = 0;
+
+	// Like byte_source::pollable_handle(), for write_utf16(). Code units, that are
+	// reported as written, may still wait in the sink then; a call with an empty
+	// `buffer` writes them.
+	virtual std::optional<native_handle_t> pollable_handle() const { return std::nullopt; }
+};
+
+class byte_stream : public byte_source, public byte_sink {
+public:
+	std::optional<native_handle_t> handle() const override = 0;
+	std::optional<native_handle_t> pollable_handle() const override { return std::nullopt; }
+};
+
+class console : public console_source, public console_sink {
+public:
+	std::optional<uint32_t> get_mode() const override = 0;
+	bool set_mode(uint32_t mode) override = 0;
+	virtual std::optional<native_handle_t> handle() const = 0;
+	std::optional<native_handle_t> pollable_handle() const override { return std::nullopt; }
+};
+
+// A sink on top of a CRT stream. It keeps the stdio buffering of `file`.
+class file_sink final : public byte_sink {
+public:
+	explicit file_sink(FILE* file) : m_file{ file } {}
+
+	io_result write(std::span<const char> buffer) override {
+		std::size_t written = std::fwrite(buffer.data(), 1, buffer.size(), m_file);
+		if (written == 0 && !buffer.empty())
+			return io_result{ .status{io_status::error} };
+		return io_result{ .count{written} };
+	}
+
+	bool flush() override { return std::fflush(m_file) == 0; }
+
+#if !defined(_WIN32)
+	// Callers, that write to the descriptor directly, flush() first.
+	std::optional<native_handle_t> handle() const override { return ::fileno(m_file); }
+#endif
+
+private:
+	FILE* m_file;
+};
+
+struct pipe_pair {
+	std::unique_ptr<byte_stream> read_end{};
+	std::unique_ptr<byte_stream> write_end{};
+};
+
+std::optional<native_handle_t> get_std_handle(std_stream which);
+
+// Wraps a pipe, file or character device. With `take_ownership`, the handle is
+// closed by the destructor.
+std::unique_ptr<byte_stream> open_byte_stream(native_handle_t handle, bool take_ownership = false);
+
+// Returns nullptr, if `handle` is not a console (or not a terminal on POSIX).
+std::unique_ptr<console> open_console(native_handle_t handle, console_in_or_out type, bool take_ownership = false);
+
+// The console of process `pid`, opened in this process, without AttachConsole() and
+// without a secondary process. On Windows only, if this process is attached to the
+// same console already (CONIN$ or CONOUT$ then). On Linux the terminal behind
+// /proc/<pid>/fd/0, if it is one and we may open it. Returns nullptr otherwise.
+std::unique_ptr<console> open_process_console(uint32_t pid, console_in_or_out type);
+
+// `pid` uses the console of this process (Windows), or the terminal on our stdin (POSIX).
+bool shares_console_with(uint32_t pid);
+
+std::optional<pipe_pair> create_pipe();
+
+// Moves all bytes from `in` to `out` inside the kernel, without copying them through
+// user space (splice() on Linux). Returns std::nullopt, if the handles do not allow
+// this; the caller copies the remaining bytes itself then. Otherwise returns, whether
+// all bytes up to the end of `in` arrived in `out`.
+std::optional<bool> transfer_in_kernel(byte_source& in, byte_sink& out);
+
+std::string io_error_message(uint32_t error_code);
+
+// Ends a read, that another thread waits in. The reading thread reads through read();
+// after interrupt(), that read and all later ones fail with io_status::error. On
+// Windows through CancelSynchronousIo(), on POSIX through a pipe, that the read waits
+// for, together with the pollable_handle() of the source. There, the read of a source
+// without one is not interrupted.
+class read_interrupter {
+public:
+	read_interrupter();
+	~read_interrupter();
+	read_interrupter(const read_interrupter&) = delete;
+	read_interrupter& operator=(const read_interrupter&) = delete;
+
+	// Only from one thread.
+	io_result read(byte_source& in, std::span<char> buffer);
+
+	// From any thread. On Windows, it returns, once the read, that was running, has ended.
+	void interrupt();
+
+private:
+	struct state;
+	std::unique_ptr<state> m_state;
+};
+
+// A local endpoint, where the processes of the current user connect to each other:
+// a named pipe "\\.\pipe\console-tools-<name>" on Windows, a unix domain socket in
+// $XDG_RUNTIME_DIR (or /tmp) on POSIX. `name` is plain ASCII without slashes.
+class local_listener {
+public:
+	virtual ~local_listener() = default;
+
+	// Blocks until the next client connects. Returns nullptr on failure.
+	virtual std::unique_ptr<byte_stream> accept() = 0;
+};
+
+// Returns nullptr, if `name` cannot be bound, e.g. because another process listens there.
+std::unique_ptr<local_listener> listen_local(std::string_view name);
+
+// Returns nullptr, if nobody listens on `name`, or if the listener runs as another user.
+// On Windows, the listener can identify the caller, but not impersonate it.
+std::unique_ptr<byte_stream> connect_local(std::string_view name);
+
+#if !defined(_WIN32)
+struct pty_pair {
+	// The side of the terminal emulator.
+	std::unique_ptr<byte_stream> master{};
+	// The side of the program running in the terminal.
+	std::unique_ptr<console> slave{};
+};
+
+std::optional<pty_pair> open_pty();
+#endif
@@ -0,0 +1,164 @@
+#pragma once
+#include "console-tools/io.h"
+#include "console-tools/utf.h"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The copy loops of pipe-to-con. They only depend on the interfaces of io.h,
+// so they run unchanged on top of the Win32 console and on top of a POSIX pty.
+
+constexpr std::size_t DEFAULT_BUFFER_SIZE{ 512 };
+constexpr std::size_t MIN_BUFFER_SIZE{ 16 };
+constexpr std::size_t MAX_BUFFER_SIZE{ 64u * 1024u * 1024u };
+constexpr std::size_t MAX_ADAPTIVE_BUFFER_SIZE{ 1024u * 1024u };
+
+// Value of the option "--buffer-size".
+struct buffer_size_option {
+	std::size_t size{ DEFAULT_BUFFER_SIZE };
+	// Grow while reads come back full, shrink while they stay small.
+	bool adaptive{ false };
+};
+
+// Accepts a number of bytes with an optional suffix "k" or "M" (e.g. "64k"),
+// or "auto" for an adaptive buffer.
+std::optional<buffer_size_option> parse_buffer_size_option(std::string_view str);
+
+std::string buffer_size_option_to_string(buffer_size_option option);
+
+// The buffer of one relay loop. The loop reads into `data()`/`size()` and reports
+// each read with `update()`. Growing and shrinking keep the first bytes of the
+// buffer, so a carried over byte survives a resize.
+class relay_buffer {
+public:
+	explicit relay_buffer(buffer_size_option option);
+
+	char* data() { return m_storage.data(); }
+	std::size_t size() const { return m_storage.size(); }
+
+	void update(std::size_t bytes_read, std::size_t bytes_requested);
+
+private:
+	std::vector<char> m_storage;
+	bool m_adaptive;
+	unsigned m_full_reads{ 0 };
+	unsigned m_small_reads{ 0 };
+};
+
+// Reads UTF-16LE bytes from `pipe` and writes them to `console`.
+// An odd byte at the end of a read is carried over to the next round.
+bool ReadPipeWriteConsole(byte_source& pipe, console_sink& console, buffer_size_option buffer_size = {});
+
+// Reads UTF-16 from `console` and writes the raw code units to `pipe`.
+bool ReadConsoleWritePipe(console_source& console, byte_sink& pipe, buffer_size_option buffer_size = {});
+
+// A console as a stream of bytes in `encoding`, like the pipe of pipe-to-con: UTF-16LE
+// through the console API, where an odd byte waits for the next write, or the bytes
+// of the handle as they are for UTF-8. For a console, that is reached without a
+// secondary process (open_process_console()).
+std::unique_ptr<byte_stream> open_console_stream(std::unique_ptr<console> target, text_encoding encoding);
+
+// Copies bytes without looking at them. Where transfer_in_kernel() accepts both
+// handles, the bytes do not pass through user space at all.
+bool ReadHandleWriteFileByteWise(byte_source& in, byte_sink& out, buffer_size_option buffer_size = {});
+
+// Reads text in the encoding `from` and writes it in the encoding `to` (utf.h).
+// Without a conversion, this is ReadHandleWriteFileByteWise.
+bool ReadHandleWriteFileTranscoded(byte_source& in, byte_sink& out, text_encoding from, text_encoding to, buffer_size_option buffer_size = {});
+
+// Writes UTF-16 text as UTF-8 to a byte_sink, for the tools that read from the
+// console and write to a pipe or a file. The text is collected in a buffer, that
+// is reused for the whole run, and reaches `out` with one write per flush(), not
+// one per piece. A surrogate pair, that is split between two pieces, is kept back.
+class utf8_writer {
+public:
+	explicit utf8_writer(byte_sink& out, std::size_t flush_threshold = 64u * 1024u);
+
+	// Appends `text`. Flushes on its own, once `flush_threshold` bytes are waiting.
+	bool write(std::u16string_view text);
+
+	// Writes the waiting bytes to `out`. A kept back high surrogate stays.
+	bool flush();
+
+	// End of the text: a kept back high surrogate becomes U+FFFD, then flush().
+	bool finish();
+
+	// Number of batches handed to `out` so far.
+	std::size_t writes() const { return m_writes; }
+
+private:
+	byte_sink& m_out;
+	std::size_t m_flush_threshold;
+	utf16_to_utf8_converter m_encoder{};
+	// Grows to the largest batch and stays there.
+	std::vector<char> m_buffer{};
+	std::size_t m_used{ 0 };
+	std::size_t m_writes{ 0 };
+};
+
+// Value of the option "--pipeline". With a pipeline, a reader thread fills a bounded
+// ring (spsc_ring.h), while the calling thread drains it. Reading from the pipe and
+// writing to the console overlap, instead of taking turns.
+struct pipeline_option {
+	// Upper limit for the ring. Its capacity is the largest power of two below, but
+	// at least room for two reads.
+	std::size_t memory_cap{ 0 };
+};
+
+// Accepts a number of bytes with an optional suffix "k" or "M".
+std::optional<pipeline_option> parse_pipeline_option(std::string_view str);
+
+std::string pipeline_option_to_string(pipeline_option option);
+
+// Like ReadPipeWriteConsole, but with a read-ahead pipeline. Every read asks for
+// at most `buffer_size.size` bytes, the adaptive mode is not used.
+bool ReadPipeWriteConsolePipelined(byte_source& pipe, console_sink& console, buffer_size_option buffer_size, pipeline_option pipeline);
+
+// Like ReadHandleWriteFileByteWise, but with a read-ahead pipeline.
+bool ReadHandleWriteFileByteWisePipelined(byte_source& in, byte_sink& out, buffer_size_option buffer_size, pipeline_option pipeline);
+
+// Which direction ends a duplex session (relay_duplex()).
+enum class duplex_end : uint32_t {
+	both,     // waits for both directions
+	either,   // the first direction, that ends, ends the session
+	incoming  // the session ends with the incoming direction
+};
+
+// One direction of a duplex session: relays to or from `stream`, e.g. with
+// ReadPipeWriteConsole. The stream is closed afterwards, if the relay has not done it.
+using duplex_relay = std::function<bool(std::unique_ptr<byte_stream>& stream)>;
+
+// Relays both directions of a duplex session at once (option "--duplex"), each in a
+// thread of its own, and returns, once `end` is reached: true, if the directions, that
+// have ended by then, succeeded. A direction, that is still running then, usually
+// blocks in a read of a console or a pipe, which cannot be interrupted. Its thread is
+// left behind with its stream and a copy of its relay, so the relay must not refer to
+// anything of the caller, unless `end` is duplex_end::both. It ends with the process,
+// or when the other side closes.
+bool relay_duplex(std::unique_ptr<byte_stream> outgoing, const duplex_relay& write_outgoing,
+	std::unique_ptr<byte_stream> incoming, const duplex_relay& read_incoming, duplex_end end);
+
+// Value of the option "--io-uring": the number of buffers, that are in flight at
+// the same time. Every buffer has `buffer_size.size` bytes.
+struct io_uring_option {
+	unsigned queue_depth{ 4 };
+};
+
+constexpr unsigned MIN_IO_URING_QUEUE_DEPTH{ 2 };
+constexpr unsigned MAX_IO_URING_QUEUE_DEPTH{ 64 };
+
+std::optional<io_uring_option> parse_io_uring_option(std::string_view str);
+
+std::string io_uring_option_to_string(io_uring_option option);
+
+// Like ReadHandleWriteFileByteWise, but on io_uring (Linux, shared/relay_uring.cpp).
+// A read and the write of its buffer go to the kernel as one linked chain.
+// Returns std::nullopt without touching the streams, if io_uring is not
+// available or the streams have no handles; the caller runs the blocking loop then.
+// `syscalls` receives the number of io_uring_enter() calls.
+std::optional<bool> ReadHandleWriteFileByteWiseUring(byte_source& in, byte_sink& out, buffer_size_option buffer_size,
+	io_uring_option uring, std::size_t* syscalls = nullptr);
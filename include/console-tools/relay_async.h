@@ -0,0 +1,229 @@
+#pragma once
+#include "console-tools/io.h"
+#include "console-tools/relay.h"
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+
+// The relay loops as coroutines, so that many of them share one thread.
+//
+// A relay is a relay_task, that awaits its reads and writes (async_read() and the
+// others) instead of blocking in them. An io_scheduler runs the tasks: a call, that
+// would block, suspends its task, and the scheduler resumes it, once the handle is
+// ready (epoll on Linux). Only streams with a pollable_handle() (io.h) are waited
+// for; the others are read and written blocking, within the task. Where the platform
+// has no backend (Windows, like relay_loop.h), all of them are, so the tasks still
+// run, but one after the other.
+
+class io_scheduler;
+
+// The coroutine of a relay. Its result is the one of the blocking loops: true, if
+// everything up to the end of the input arrived. A task starts suspended; it runs
+// either within another task (co_await), or on its own (io_scheduler::spawn()).
+// The streams, that a task refers to, must live until it has ended.
+class [[nodiscard]] relay_task {
+public:
+	struct promise_type;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	struct promise_type {
+		io_scheduler* scheduler{ nullptr };
+		// The task, that awaits this one.
+		std::coroutine_handle<> continuation{};
+		bool result{ false };
+
+		relay_task get_return_object() { return relay_task{ handle_type::from_promise(*this) }; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		auto final_suspend() noexcept {
+			struct final_awaiter {
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(handle_type finished) noexcept {
+					if (std::coroutine_handle<> continuation = finished.promise().continuation)
+						return continuation;
+					return std::noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+			return final_awaiter{};
+		}
+
+		void return_value(bool success) { result = success; }
+		// Like an exception, that leaves the thread of a blocking relay.
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	relay_task() = default;
+	relay_task(relay_task&& other) noexcept : m_handle{ std::exchange(other.m_handle, {}) } {}
+	relay_task& operator=(relay_task&& other) noexcept {
+		if (this != &other) {
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, {});
+		}
+		return *this;
+	}
+	~relay_task() {
+		if (m_handle)
+			m_handle.destroy();
+	}
+
+	// Runs the task within the awaiting one, on the same scheduler. Returns its result.
+	auto operator co_await() && noexcept {
+		struct awaiter {
+			handle_type task;
+			bool await_ready() noexcept { return !task || task.done(); }
+			std::coroutine_handle<> await_suspend(handle_type awaiting) noexcept {
+				task.promise().scheduler = awaiting.promise().scheduler;
+				task.promise().continuation = awaiting;
+				return task;
+			}
+			bool await_resume() noexcept { return task && task.promise().result; }
+		};
+		return awaiter{ m_handle };
+	}
+
+	handle_type handle() const { return m_handle; }
+
+private:
+	explicit relay_task(handle_type handle) : m_handle{ handle } {}
+
+	handle_type m_handle{};
+};
+
+// A call, that waits for its handle (io_scheduler::wait()).
+class io_waiter {
+public:
+	// The handle is ready, or has failed. Called once per wait().
+	virtual void ready() = 0;
+
+protected:
+	~io_waiter() = default;
+};
+
+struct io_scheduler_counters {
+	uint64_t tasks_started{ 0 };
+	uint64_t tasks_ended{ 0 };
+	// Calls, that would have blocked, so that their task was suspended.
+	uint64_t suspensions{ 0 };
+	uint64_t wakeups{ 0 };
+};
+
+class io_scheduler {
+public:
+	// Called in the thread of run(), when a task of spawn() ends. `success` is false,
+	// if the relay failed, or run() gave up on the task.
+	using done_function = std::function<void(bool success)>;
+
+	virtual ~io_scheduler() = default;
+
+	// Hands over a task. It starts in run(). Only from the thread of run(), also
+	// from a task or a done_function.
+	virtual void spawn(relay_task task, done_function done = {}) = 0;
+
+	// Runs the tasks, until all of them have ended. Returns, whether all succeeded.
+	// The handles, that were switched to non-blocking mode, are switched back before
+	// it returns, so the streams of the tasks must stay open until then.
+	virtual bool run() = 0;
+
+	// Only from the thread of run(), or after run() returned.
+	virtual io_scheduler_counters counters() const = 0;
+
+	// For the awaitables below. Switches `handle` to non-blocking mode, if the
+	// scheduler can wait for it.
+	virtual bool prepare(native_handle_t handle) = 0;
+
+	// For the awaitables below. Calls `waiter.ready()` once, when `handle` is
+	// readable, or writable with `for_writing`. One waiter per handle and direction.
+	// Returns false, if the handle cannot be waited for.
+	virtual bool wait(native_handle_t handle, bool for_writing, io_waiter& waiter) = 0;
+};
+
+// epoll on Linux. Elsewhere, or if epoll fails, a scheduler, that runs the tasks one
+// after the other, with blocking calls.
+std::unique_ptr<io_scheduler> create_io_scheduler();
+
+// Awaitable of one call of a stream. The call is made at once; if it would block,
+// the task is suspended, until the handle is ready, and the call is made again.
+// The result of the call is the result of co_await.
+template<class call_type>
+class io_awaitable final : private io_waiter {
+public:
+	io_awaitable(std::optional<native_handle_t> handle, bool for_writing, call_type call)
+		: m_handle{ handle }, m_for_writing{ for_writing }, m_call{ std::move(call) } {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(relay_task::handle_type task) {
+		m_task = task;
+		m_scheduler = task.promise().scheduler;
+		if (!m_handle || m_scheduler == nullptr || !m_scheduler->prepare(*m_handle)) {
+			m_result = m_call();
+			return false;
+		}
+		return !attempt();
+	}
+
+	io_result await_resume() const noexcept { return m_result; }
+
+private:
+	// Returns true, once the call is done.
+	bool attempt() {
+		m_result = m_call();
+		// If the handle cannot be waited for, the call fails with EAGAIN.
+		return !io_would_block(m_result) || !m_scheduler->wait(*m_handle, m_for_writing, *this);
+	}
+
+	void ready() override {
+		if (attempt())
+			m_task.resume();
+	}
+
+	std::optional<native_handle_t> m_handle;
+	bool m_for_writing;
+	call_type m_call;
+	relay_task::handle_type m_task{};
+	io_scheduler* m_scheduler{ nullptr };
+	io_result m_result{};
+};
+
+inline auto async_read(byte_source& in, std::span<char> buffer) {
+	return io_awaitable{ in.pollable_handle(), false, [&in, buffer] { return in.read(buffer); } };
+}
+
+inline auto async_write(byte_sink& out, std::span<const char> buffer) {
+	return io_awaitable{ out.pollable_handle(), true, [&out, buffer] { return out.write(buffer); } };
+}
+
+inline auto async_read_utf16(console_source& console, std::span<char16_t> buffer) {
+	return io_awaitable{ console.pollable_handle(), false, [&console, buffer] { return console.read_utf16(buffer); } };
+}
+
+// An empty `buffer` writes the code units, that wait in the console (io.h).
+inline auto async_write_utf16(console_sink& console, std::span<const char16_t> buffer) {
+	return io_awaitable{ console.pollable_handle(), true, [&console, buffer] { return console.write_utf16(buffer); } };
+}
+
+// The relay loops of relay.h. ReadPipeWriteConsole() and the others run these tasks
+// with run_relay().
+
+// Reads UTF-16LE bytes from `pipe` and writes them to `console`. An odd byte at the
+// end of a read is carried over to the next round.
+relay_task ReadPipeWriteConsoleAsync(byte_source& pipe, console_sink& console, buffer_size_option buffer_size = {});
+
+// Reads UTF-16 from `console` and writes the raw code units to `pipe`.
+relay_task ReadConsoleWritePipeAsync(console_source& console, byte_sink& pipe, buffer_size_option buffer_size = {});
+
+// Copies bytes without looking at them. transfer_in_kernel() is only tried, if the
+// scheduler waits for neither stream, because it would block the thread.
+relay_task ReadHandleWriteFileByteWiseAsync(byte_source& in, byte_sink& out, buffer_size_option buffer_size = {});
+
+// Runs one task to its end in the calling thread, with blocking calls, and leaves the
+// mode of the handles alone. For callers, that have no other relay to interleave with it.
+bool run_relay(relay_task task);
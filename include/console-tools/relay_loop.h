@@ -0,0 +1,56 @@
+#pragma once
+#include "console-tools/io.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Many byte-wise relays in one thread, for a broker with hundreds of sessions.
+//
+// Every session is a pair of a source and a sink with handles. The loop switches them
+// to non-blocking mode and waits for all of them at once (epoll on Linux). A session
+// owns a buffer only while bytes wait for its sink; an idle session costs a few dozen
+// bytes. The buffer is bounded: while it is full, the source is not read, so a slow
+// sink throttles only its own source. Each session gets at most one read per round,
+// so a busy session cannot starve the idle ones.
+
+struct relay_loop_option {
+	// Size of the buffer of a session, that has bytes in flight.
+	std::size_t buffer_size{ 16u * 1024u };
+};
+
+struct relay_loop_counters {
+	uint64_t sessions_started{ 0 };
+	uint64_t sessions_ended{ 0 };
+	uint64_t bytes{ 0 };
+	uint64_t wakeups{ 0 };
+	// Buffers, that exist right now, in the sessions and in the pool.
+	uint64_t buffers_allocated{ 0 };
+};
+
+class relay_loop {
+public:
+	// Called in the thread of the loop, when a session ends. `success` is false after
+	// an error of the source or the sink.
+	using done_function = std::function<void(bool success)>;
+
+	virtual ~relay_loop() = default;
+
+	// Hands over a session. Safe to call from any thread, also while run() is busy.
+	// Returns false, if a stream has no handle or the loop cannot watch it.
+	virtual bool add(std::unique_ptr<byte_source> in, std::unique_ptr<byte_sink> out, done_function done = {}) = 0;
+
+	// Relays, until stop() is called. Sessions, that are still open then, are closed.
+	virtual void run() = 0;
+
+	// Safe to call from any thread and from a done_function.
+	virtual void stop() = 0;
+
+	// Only from the thread of the loop, or after run() returned.
+	virtual relay_loop_counters counters() const = 0;
+};
+
+// Returns nullptr, where there is no backend for the platform. The callers keep a
+// thread per session there. Windows has none yet: anonymous pipes and consoles
+// cannot be waited for, without turning every handle into an overlapped one.
+std::unique_ptr<relay_loop> create_relay_loop(relay_loop_option option = {});
@@ -0,0 +1,183 @@
+#pragma once
+#include "console-tools/io.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Statistics for the option "--stats" of pipe-to-con and stty.
+//
+// The streams of a relay are wrapped into the stats_* classes below. They count
+// every call and measure, how long it blocks. The relay loops stay unchanged.
+// The wrappers do not pass on the handles, so with "--stats" neither
+// transfer_in_kernel() nor io_uring is used: the numbers are the ones of the copy loop.
+
+// Value of the options "--stats" and "--stats-interval".
+struct stats_option {
+	// Additionally print a JSON line every `interval`. Zero: only the summary at the end.
+	std::chrono::milliseconds interval{ 0 };
+};
+
+// Durations in nanoseconds, in buckets of an eighth of a power of two. The
+// percentiles are accurate to about 12%. Safe to read, while another thread records.
+class latency_histogram {
+public:
+	void record(uint64_t nanoseconds);
+
+	uint64_t count() const;
+
+	// Upper end of the bucket, that holds the `fraction` percentile (0.5 for the median).
+	uint64_t percentile(double fraction) const;
+
+	uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+private:
+	static constexpr std::size_t LINEAR_BUCKETS{ 16 };
+	static constexpr std::size_t SUB_BUCKETS{ 8 };
+	static constexpr std::size_t BUCKETS{ LINEAR_BUCKETS + (64 - 4) * SUB_BUCKETS };
+
+	std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+	std::atomic<uint64_t> m_max{ 0 };
+};
+
+// The calls of one kind, e.g. all WriteConsoleW() calls of a relay.
+struct relay_io_counters {
+	std::atomic<uint64_t> calls{ 0 };
+	// Bytes, or UTF-16 code units for the console.
+	std::atomic<uint64_t> units{ 0 };
+	// Writes, that took less than offered. The relay loops write the rest with another call.
+	std::atomic<uint64_t> partial_writes{ 0 };
+	std::atomic<uint64_t> blocked_ns{ 0 };
+};
+
+struct relay_stats {
+	relay_io_counters file_reads{};
+	relay_io_counters console_reads{};
+	relay_io_counters file_writes{};
+	relay_io_counters console_writes{};
+	// From the end of a read to the start of the next one: the time, that the relay
+	// spends on a chunk. With "--pipeline", the time until the chunk is in the ring.
+	latency_histogram chunk_latency{};
+	std::chrono::steady_clock::time_point start{ std::chrono::steady_clock::now() };
+};
+
+std::string relay_stats_to_json(const relay_stats& stats, std::string_view relay);
+
+void print_relay_stats(FILE* stream, const relay_stats& stats, std::string_view relay);
+
+// Notes the chunk latency and the blocked time of the reads of one relay.
+class stats_read_clock {
+public:
+	explicit stats_read_clock(relay_stats& stats) : m_stats{ stats } {}
+
+	std::chrono::steady_clock::time_point start();
+	void stop(std::chrono::steady_clock::time_point started, relay_io_counters& counters, const io_result& result);
+
+private:
+	relay_stats& m_stats;
+	std::optional<std::chrono::steady_clock::time_point> m_last_read_done{};
+};
+
+class stats_byte_source final : public byte_source {
+public:
+	stats_byte_source(byte_source& inner, relay_stats& stats) : m_inner{ inner }, m_stats{ stats }, m_clock{ stats } {}
+
+	io_result read(std::span<char> buffer) override;
+
+private:
+	byte_source& m_inner;
+	relay_stats& m_stats;
+	stats_read_clock m_clock;
+};
+
+class stats_console_source final : public console_source {
+public:
+	stats_console_source(console_source& inner, relay_stats& stats) : m_inner{ inner }, m_stats{ stats }, m_clock{ stats } {}
+
+	io_result read_utf16(std::span<char16_t> buffer) override;
+	bool has_pending_input() const override { return m_inner.has_pending_input(); }
+	std::optional<uint32_t> get_mode() const override { return m_inner.get_mode(); }
+	bool set_mode(uint32_t mode) override { return m_inner.set_mode(mode); }
+
+private:
+	console_source& m_inner;
+	relay_stats& m_stats;
+	stats_read_clock m_clock;
+};
+
+class stats_byte_sink final : public byte_sink {
+public:
+	stats_byte_sink(byte_sink& inner, relay_stats& stats) : m_inner{ inner }, m_stats{ stats } {}
+
+	io_result write(std::span<const char> buffer) override;
+	bool flush() override { return m_inner.flush(); }
+
+private:
+	byte_sink& m_inner;
+	relay_stats& m_stats;
+};
+
+class stats_console_sink final : public console_sink {
+public:
+	stats_console_sink(console_sink& inner, relay_stats& stats) : m_inner{ inner }, m_stats{ stats } {}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override;
+	std::optional<uint32_t> get_mode() const override { return m_inner.get_mode(); }
+	bool set_mode(uint32_t mode) override { return m_inner.set_mode(mode); }
+
+private:
+	console_sink& m_inner;
+	relay_stats& m_stats;
+};
+
+inline stats_byte_source count_calls(byte_source& inner, relay_stats& stats) { return stats_byte_source{ inner, stats }; }
+inline stats_console_source count_calls(console_source& inner, relay_stats& stats) { return stats_console_source{ inner, stats }; }
+inline stats_byte_sink count_calls(byte_sink& inner, relay_stats& stats) { return stats_byte_sink{ inner, stats }; }
+inline stats_console_sink count_calls(console_sink& inner, relay_stats& stats) { return stats_console_sink{ inner, stats }; }
+
+// Prints the JSON lines of "--stats-interval" from a thread of its own, and the
+// summary, when it is destroyed.
+class stats_reporter {
+public:
+	stats_reporter(const relay_stats& stats, std::string_view relay, stats_option option, FILE* stream);
+	~stats_reporter();
+
+	stats_reporter(const stats_reporter&) = delete;
+	stats_reporter& operator=(const stats_reporter&) = delete;
+
+private:
+	const relay_stats& m_stats;
+	std::string m_relay;
+	stats_option m_option;
+	FILE* m_stream;
+	std::mutex m_mutex{};
+	std::condition_variable m_stop_requested{};
+	bool m_stop{ false };
+	std::thread m_thread{};
+};
+
+// Runs `relay(in, out)`. With `option`, the streams are wrapped first, and the
+// statistics go to `report` under the name `relay_name`. The stream types are
+// given explicitly, because a console is a source and a sink:
+//   relay_with_stats<byte_source, console_sink>(option, "pipe -> console", stderr, *pipe, *con, ...)
+template<class source_type, class sink_type, class relay_function>
+bool relay_with_stats(const std::optional<stats_option>& option, std::string_view relay_name, FILE* report,
+	source_type& in, sink_type& out, relay_function relay)
+{
+	if (!option)
+		return relay(in, out);
+
+	relay_stats stats{};
+	stats_reporter reporter{ stats, relay_name, *option, report };
+	auto counted_in = count_calls(in, stats);
+	auto counted_out = count_calls(out, stats);
+	return relay(counted_in, counted_out);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "console-tools/io.h"
+
+#include <cstdint>
+#include <memory>
+
+// A one-way byte stream between two processes through shared memory: the
+// spsc_byte_ring of spsc_ring.h in a mapping, that both processes map. Bytes are copied
+// into the ring and out of it, without a system call, as long as neither side has to
+// sleep. A side, that sleeps, is woken across the process boundary: with two
+// inheritable events on Windows, with futexes on the shared flags on Linux (memfd).
+//
+// The creator passes shared_handle() to the other process like the end of a pipe, e.g.
+// with "--handle" of pipe-to-con, and the other process calls open_shm_ring().
+
+constexpr std::size_t DEFAULT_SHM_RING_CAPACITY{ 1024u * 1024u };
+
+enum class shm_ring_side : uint32_t {
+	producer, // writes into the ring
+	consumer  // reads from the ring
+};
+
+class shm_ring_stream : public byte_stream {
+public:
+	// The other process. Without it, a side, that waits for a process, that died, would
+	// wait forever, because shared memory has no end of the stream like a pipe. The
+	// opener knows the creator. The creator calls this right after it started the other
+	// process: the mapping names the opener only, once it opened the ring, and the
+	// creator would wait forever for a process, that died before.
+	virtual void set_peer(uint32_t pid) = 0;
+
+	// The handle of the mapping, inheritable (Windows) or a descriptor with FD_CLOEXEC
+	// (Linux, for fork()). Owned by the stream.
+	virtual native_handle_t shared_handle() const = 0;
+
+	// No handle for splice() or io_uring, the relays copy.
+	std::optional<native_handle_t> handle() const override { return std::nullopt; }
+};
+
+// Returns nullptr, where shared memory is not supported (POSIX without Linux) or the
+// mapping cannot be created. `capacity` is rounded up to a power of two.
+std::unique_ptr<shm_ring_stream> create_shm_ring(std::size_t capacity, shm_ring_side side);
+
+// The other end of a ring of create_shm_ring(), with the opposite side. Takes ownership
+// of `handle`. Returns nullptr, if `handle` is no ring.
+std::unique_ptr<shm_ring_stream> open_shm_ring(native_handle_t handle, shm_ring_side side);
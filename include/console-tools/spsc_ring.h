@@ -0,0 +1,225 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <thread>
+
+// A lock-free ring of bytes for exactly one producer and one consumer thread.
+//
+// The producer asks for `write_span()`, reads or copies into it and publishes
+// the bytes with `commit()`. The consumer asks for `read_span()`, writes the
+// bytes somewhere and frees them with `release()`. Both spans are contiguous
+// views into the ring, so the relay loops can call read() and write() directly
+// on the ring storage. Several bytes are committed and released at once.
+
+constexpr std::size_t CACHE_LINE_SIZE{ 64 };
+
+// The positions of both sides. They only grow; the position in the storage is
+// `position & (capacity - 1)`. The highest bit marks the side as closed.
+struct spsc_ring_indices {
+	static constexpr uint64_t CLOSED_BIT{ uint64_t{ 1 } << 63 };
+
+	// Written by the producer: number of bytes committed so far.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{ 0 };
+	// Set by the consumer, while it sleeps on `head`. Without a sleeper, commit() skips the wake-up call.
+	std::atomic<uint32_t> consumer_waiting{ 0 };
+	// Written by the consumer: number of bytes released so far.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{ 0 };
+	// Set by the producer, while it sleeps on `tail`.
+	std::atomic<uint32_t> producer_waiting{ 0 };
+};
+static_assert(sizeof(spsc_ring_indices) == 2 * CACHE_LINE_SIZE);
+
+// How a side sleeps and wakes the other one, if the ring is shared between processes.
+// The wait/notify of std::atomic only works inside one process. With a wakeup, the
+// waiting flags of spsc_ring_indices are the words to sleep on: the sleeper sets its
+// flag to 1, and the other side wakes it by setting the flag back to 0.
+class spsc_ring_wakeup {
+public:
+	virtual ~spsc_ring_wakeup() = default;
+
+	// Sleeps, while `flag` is 1. Returns false, if the other side is gone.
+	virtual bool wait(std::atomic<uint32_t>& flag) = 0;
+
+	// Called after `flag` was set to 0.
+	virtual void wake(std::atomic<uint32_t>& flag) = 0;
+};
+
+class spsc_byte_ring {
+public:
+	// `storage.size()` must be a power of two. Without `wakeup`, both sides must be in
+	// this process.
+	spsc_byte_ring(spsc_ring_indices& indices, std::span<char> storage, spsc_ring_wakeup* wakeup = nullptr)
+		: m_indices{ &indices }, m_data{ storage.data() }, m_capacity{ storage.size() }, m_wakeup{ wakeup }
+	{
+		assert(std::has_single_bit(m_capacity));
+	}
+
+	std::size_t capacity() const { return m_capacity; }
+
+	// --- producer ---
+
+	// The free space up to the end of the storage. Empty, if the ring is full.
+	std::span<char> write_span() {
+		const uint64_t head = m_producer.own & ~spsc_ring_indices::CLOSED_BIT;
+		const std::size_t offset = static_cast<std::size_t>(head) & (m_capacity - 1);
+		std::size_t free = m_capacity - static_cast<std::size_t>(head - m_producer.cached_other);
+		// Only look at the consumer's cache line, if the cached position is too old to be useful.
+		if (free < std::min(m_capacity / 2, m_capacity - offset)) {
+			m_producer.cached_other = m_indices->tail.load(std::memory_order_acquire) & ~spsc_ring_indices::CLOSED_BIT;
+			free = m_capacity - static_cast<std::size_t>(head - m_producer.cached_other);
+		}
+		return std::span<char>(m_data + offset, std::min(free, m_capacity - offset));
+	}
+
+	void commit(std::size_t count) {
+		m_producer.own += count;
+		// seq_cst pairs with the flag in wait_for_data(): either the consumer sees the new
+		// position before it sleeps, or we see its flag and wake it up.
+		m_indices->head.store(m_producer.own, std::memory_order_seq_cst);
+		wake(m_indices->consumer_waiting, m_indices->head);
+	}
+
+	// Blocks, until the consumer released bytes or closed its side. Returns false, if
+	// the wakeup found the consumer gone.
+	bool wait_for_space() {
+		for (int i = 0; i < SPIN_COUNT; ++i) {
+			const uint64_t tail = m_indices->tail.load(std::memory_order_acquire);
+			if ((tail & spsc_ring_indices::CLOSED_BIT) || (m_producer.own & ~spsc_ring_indices::CLOSED_BIT) - tail < m_capacity)
+				break;
+			std::this_thread::yield();
+		}
+		m_indices->producer_waiting.store(1, std::memory_order_seq_cst);
+		const uint64_t seen = m_indices->tail.load(std::memory_order_seq_cst);
+		const uint64_t head = m_producer.own & ~spsc_ring_indices::CLOSED_BIT;
+		bool alive{ true };
+		if (!(seen & spsc_ring_indices::CLOSED_BIT) && head - (seen & ~spsc_ring_indices::CLOSED_BIT) == m_capacity)
+			alive = sleep(m_indices->producer_waiting, m_indices->tail, seen);
+		m_indices->producer_waiting.store(0, std::memory_order_relaxed);
+		m_producer.cached_other = m_indices->tail.load(std::memory_order_acquire) & ~spsc_ring_indices::CLOSED_BIT;
+		return alive;
+	}
+
+	// No more bytes will be committed.
+	void close_producer() {
+		m_producer.own |= spsc_ring_indices::CLOSED_BIT;
+		m_indices->head.fetch_or(spsc_ring_indices::CLOSED_BIT, std::memory_order_seq_cst);
+		wake(m_indices->consumer_waiting, m_indices->head);
+	}
+
+	// The consumer does not want any more bytes.
+	bool consumer_closed() const {
+		return (m_indices->tail.load(std::memory_order_acquire) & spsc_ring_indices::CLOSED_BIT) != 0;
+	}
+
+	// --- consumer ---
+
+	// The committed bytes up to the end of the storage. Empty, if the ring is empty.
+	std::span<const char> read_span() {
+		const uint64_t tail = m_consumer.own & ~spsc_ring_indices::CLOSED_BIT;
+		if (m_consumer.cached_other == tail)
+			m_consumer.cached_other = m_indices->head.load(std::memory_order_acquire) & ~spsc_ring_indices::CLOSED_BIT;
+		const std::size_t available = static_cast<std::size_t>(m_consumer.cached_other - tail);
+		const std::size_t offset = static_cast<std::size_t>(tail) & (m_capacity - 1);
+		const std::size_t contiguous = std::min(available, m_capacity - offset);
+		return std::span<const char>(m_data + offset, contiguous);
+	}
+
+	void release(std::size_t count) {
+		m_consumer.own += count;
+		m_indices->tail.store(m_consumer.own, std::memory_order_seq_cst);
+		wake(m_indices->producer_waiting, m_indices->tail);
+	}
+
+	// Blocks, until the producer committed more than `available` bytes or closed its side.
+	// Returns false, if the wakeup found the producer gone.
+	bool wait_for_data(std::size_t available = 0) {
+		for (int i = 0; i < SPIN_COUNT; ++i) {
+			const uint64_t head = m_indices->head.load(std::memory_order_acquire);
+			if ((head & spsc_ring_indices::CLOSED_BIT) || head - (m_consumer.own & ~spsc_ring_indices::CLOSED_BIT) > available)
+				break;
+			std::this_thread::yield();
+		}
+		m_indices->consumer_waiting.store(1, std::memory_order_seq_cst);
+		const uint64_t seen = m_indices->head.load(std::memory_order_seq_cst);
+		const uint64_t tail = m_consumer.own & ~spsc_ring_indices::CLOSED_BIT;
+		bool alive{ true };
+		if (!(seen & spsc_ring_indices::CLOSED_BIT) && seen - tail <= available)
+			alive = sleep(m_indices->consumer_waiting, m_indices->head, seen);
+		m_indices->consumer_waiting.store(0, std::memory_order_relaxed);
+		m_consumer.cached_other = m_indices->head.load(std::memory_order_acquire) & ~spsc_ring_indices::CLOSED_BIT;
+		return alive;
+	}
+
+	// The producer closed its side. Bytes may still be in the ring.
+	bool producer_closed() const {
+		return (m_indices->head.load(std::memory_order_acquire) & spsc_ring_indices::CLOSED_BIT) != 0;
+	}
+
+	// No more bytes will be released. A waiting producer wakes up.
+	void close_consumer() {
+		m_consumer.own |= spsc_ring_indices::CLOSED_BIT;
+		m_indices->tail.fetch_or(spsc_ring_indices::CLOSED_BIT, std::memory_order_seq_cst);
+		wake(m_indices->producer_waiting, m_indices->tail);
+	}
+
+private:
+	bool sleep(std::atomic<uint32_t>& flag, std::atomic<uint64_t>& position, uint64_t seen) {
+		if (m_wakeup != nullptr)
+			return m_wakeup->wait(flag);
+		position.wait(seen, std::memory_order_acquire);
+		return true;
+	}
+
+	// After `position` moved: wakes the other side, if it sleeps on it.
+	void wake(std::atomic<uint32_t>& flag, std::atomic<uint64_t>& position) {
+		if (m_wakeup == nullptr) {
+			if (flag.load(std::memory_order_seq_cst))
+				position.notify_one();
+		}
+		else if (flag.exchange(0, std::memory_order_seq_cst)) {
+			m_wakeup->wake(flag);
+		}
+	}
+
+	// Before a side goes to sleep, it gives the other side a few chances to run.
+	static constexpr int SPIN_COUNT{ 16 };
+
+	// Local to one side: its own position and the last seen position of the other side.
+	struct alignas(CACHE_LINE_SIZE) side {
+		uint64_t own{ 0 };
+		uint64_t cached_other{ 0 };
+	};
+
+	spsc_ring_indices* m_indices;
+	char* m_data;
+	std::size_t m_capacity;
+	spsc_ring_wakeup* m_wakeup;
+	side m_producer{};
+	side m_consumer{};
+};
+
+// A ring, that owns its storage and indices.
+class spsc_byte_ring_buffer : public spsc_byte_ring {
+public:
+	// `capacity` is rounded up to a power of two.
+	explicit spsc_byte_ring_buffer(std::size_t capacity)
+		: spsc_byte_ring_buffer(std::make_unique<spsc_ring_indices>(), std::make_unique<char[]>(std::bit_ceil(capacity)), std::bit_ceil(capacity))
+	{
+	}
+
+private:
+	spsc_byte_ring_buffer(std::unique_ptr<spsc_ring_indices> indices, std::unique_ptr<char[]> storage, std::size_t capacity)
+		: spsc_byte_ring(*indices, std::span<char>(storage.get(), capacity)),
+		m_indices_storage{ std::move(indices) }, m_storage{ std::move(storage) }
+	{
+	}
+
+	std::unique_ptr<spsc_ring_indices> m_indices_storage;
+	std::unique_ptr<char[]> m_storage;
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+
+// Tracepoints for a timeline of the relays, viewable in chrome://tracing or Perfetto.
+//
+// They are compiled in with the preprocessor flag CONSOLE_TOOLS_TRACE=1. Without it,
+// trace_scope and trace_session are empty classes with inline constructors, and the
+// tracepoints disappear from the generated code.
+//
+// With it, every thread appends its events to a buffer of its own, without a lock.
+// trace_session writes the buffers of all threads as Chrome trace-event JSON, when it
+// is destroyed at the end of main(). The file is "<program>-<pid>.trace.json" in the
+// directory of the environment variable CONSOLE_TOOLS_TRACE_DIR (default: the current
+// directory). The clock is the same in all processes, so the files of pipe-to-con's
+// primary and secondary process line up, when they are loaded together.
+
+#if !defined(CONSOLE_TOOLS_TRACE)
+#define CONSOLE_TOOLS_TRACE 0
+#endif
+
+constexpr bool TRACE_ENABLED{ CONSOLE_TOOLS_TRACE != 0 };
+
+namespace trace_detail {
+
+int64_t now_ns();
+void record_complete(const char* name, const char* category, int64_t start_ns, int64_t end_ns, const char* arg_name, int64_t arg);
+void record_instant(const char* name, const char* category, const char* arg_name, int64_t arg);
+void set_thread_name(const char* name);
+void write_file(const char* program_name);
+
+} // namespace trace_detail
+
+// A span from the constructor to the destructor. `name`, `category` and the name of
+// the argument are string literals; they are not copied.
+template<bool enabled>
+class basic_trace_scope {
+public:
+	basic_trace_scope(const char* name, const char* category)
+		: m_name{ name }, m_category{ category }, m_start_ns{ trace_detail::now_ns() } {}
+	~basic_trace_scope() {
+		trace_detail::record_complete(m_name, m_category, m_start_ns, trace_detail::now_ns(), m_arg_name, m_arg);
+	}
+
+	basic_trace_scope(const basic_trace_scope&) = delete;
+	basic_trace_scope& operator=(const basic_trace_scope&) = delete;
+
+	// One number for the "args" of the event, e.g. the bytes of a read.
+	void set_arg(const char* name, int64_t value) {
+		m_arg_name = name;
+		m_arg = value;
+	}
+
+private:
+	const char* m_name;
+	const char* m_category;
+	int64_t m_start_ns;
+	const char* m_arg_name{ nullptr };
+	int64_t m_arg{ 0 };
+};
+
+template<>
+class basic_trace_scope<false> {
+public:
+	basic_trace_scope(const char*, const char*) {}
+
+	basic_trace_scope(const basic_trace_scope&) = delete;
+	basic_trace_scope& operator=(const basic_trace_scope&) = delete;
+
+	void set_arg(const char*, int64_t) {}
+};
+
+using trace_scope = basic_trace_scope<TRACE_ENABLED>;
+
+// Runs `call` inside a trace_scope and returns its result. For calls in conditions:
+//   if (!trace_call("AttachConsole", "process", [&] { return AttachConsole(PID); }))
+template<class call_function>
+decltype(auto) trace_call(const char* name, const char* category, call_function call) {
+	trace_scope trace{ name, category };
+	return call();
+}
+
+// An event without a duration, e.g. the odd byte, that a relay carries to the next read.
+inline void trace_instant(const char* name, const char* category, const char* arg_name = nullptr, int64_t arg = 0) {
+	if constexpr (TRACE_ENABLED)
+		trace_detail::record_instant(name, category, arg_name, arg);
+}
+
+// Names the calling thread in the timeline.
+inline void trace_thread_name(const char* name) {
+	if constexpr (TRACE_ENABLED)
+		trace_detail::set_thread_name(name);
+}
+
+// Writes the trace file, when it is destroyed. One at the top of main(); all other
+// threads must have ended by then.
+template<bool enabled>
+class basic_trace_session {
+public:
+	explicit basic_trace_session(const char* program_name) : m_program_name{ program_name } {
+		trace_detail::set_thread_name("main");
+	}
+	~basic_trace_session() { trace_detail::write_file(m_program_name); }
+
+	basic_trace_session(const basic_trace_session&) = delete;
+	basic_trace_session& operator=(const basic_trace_session&) = delete;
+
+private:
+	const char* m_program_name;
+};
+
+template<>
+class basic_trace_session<false> {
+public:
+	explicit basic_trace_session(const char*) {}
+
+	basic_trace_session(const basic_trace_session&) = delete;
+	basic_trace_session& operator=(const basic_trace_session&) = delete;
+};
+
+using trace_session = basic_trace_session<TRACE_ENABLED>;
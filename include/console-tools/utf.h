@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+// Streaming conversion between UTF-8 and UTF-16LE for the relay loops.
+//
+// The input arrives in pieces, as the pipe delivers it. A UTF-8 sequence, a
+// UTF-16 code unit or a surrogate pair, that is split between two pieces, is
+// kept back and completed with the next piece. Invalid input becomes U+FFFD.
+// Unlike nowide, the character after an invalid sequence or a lone surrogate
+// is kept (the "maximal subpart" rule of the Unicode standard).
+//
+// Runs of ASCII take a SIMD path (SSE2, or AVX2 where the CPU has it), the rest
+// is converted one code point at a time.
+
+enum class text_encoding : uint32_t {
+	utf8,
+	utf16le
+};
+
+// Accepts "utf8", "utf-8", "utf16", "utf-16", "utf16le" and "utf-16le".
+std::optional<text_encoding> parse_text_encoding(std::string_view str);
+
+std::string_view text_encoding_to_string(text_encoding encoding);
+
+// Name of the kernel in use: "avx2", "sse2" or "scalar".
+std::string_view utf_kernel_name();
+
+// Only use the scalar code. For benchmarks and tests.
+void utf_force_scalar(bool scalar);
+
+// Index of the first code unit in `text`, that equals one of `units` (1 to 4
+// code units), or text.size(). For the control characters in typed or pasted text.
+std::size_t find_any_of(std::u16string_view text, std::u16string_view units);
+
+class utf8_to_utf16_converter {
+public:
+	// Room for the output of `convert()`.
+	static constexpr std::size_t max_output(std::size_t input_bytes) { return input_bytes + 3; }
+
+	// Converts `in` and writes the code units to `out`, which has room for
+	// max_output(in.size()) code units. Returns the number of code units written.
+	std::size_t convert(std::span<const char> in, char16_t* out);
+
+	// End of the input. An incomplete sequence becomes U+FFFD. Returns the number
+	// of code units written to `out` (0 or 1).
+	std::size_t finish(char16_t* out);
+
+private:
+	// The start of a sequence, that the last piece did not complete.
+	unsigned char m_pending[4]{};
+	std::size_t m_pending_count{ 0 };
+};
+
+class utf16_to_utf8_converter {
+public:
+	// Room for the output of `convert_bytes()` and `convert()`.
+	static constexpr std::size_t max_output(std::size_t input_bytes) { return (input_bytes / 2 + 2) * 3; }
+
+	// Converts UTF-16LE bytes. An odd byte at the end is kept for the next call.
+	// `out` has room for max_output(in.size()) bytes. Returns the number of bytes written.
+	std::size_t convert_bytes(std::span<const char> in, char* out);
+
+	// Converts code units. `out` has room for max_output(in.size() * 2) bytes.
+	std::size_t convert(std::span<const char16_t> in, char* out);
+
+	// End of the input. A lone high surrogate or an odd byte becomes U+FFFD.
+	// `out` has room for 6 bytes.
+	std::size_t finish(char* out);
+
+private:
+	char16_t m_high_surrogate{ 0 };
+	bool m_has_odd_byte{ false };
+	unsigned char m_odd_byte{ 0 };
+};
@@ -1,617 +1,1107 @@
-#include <Windows.h>
-#include <io.h>
-#include <fcntl.h>
-#include <optional>
-#include <memory>
-#include <cassert>
-#include <console-tools/helper.h>
-#include <thread>
-#include <chrono>
-
-#include <fmt/core.h>
-
-
-#if !defined(UNICODE)
-#error macro UNICODE is not defined
-#endif
-
-#if !defined(_UNICODE)
-#error macro _UNICODE is not defined
-#endif
-
-constexpr const char8_t UTF_8_test_1[] = u8"ü";
-static_assert(sizeof(UTF_8_test_1) == 3);
-static_assert(UTF_8_test_1[0] == static_cast<char8_t>(0xC3u));
-static_assert(UTF_8_test_1[1] == static_cast<char8_t>(0xBCu));
-static_assert(UTF_8_test_1[2] == static_cast<char8_t>(0x0u));
-
-constexpr const char UTF_8_test_2[] = "ü";
-static_assert(sizeof(UTF_8_test_2) == 3);
-static_assert(UTF_8_test_2[0] == static_cast<char>(0xC3u));
-static_assert(UTF_8_test_2[1] == static_cast<char>(0xBCu));
-static_assert(UTF_8_test_2[2] == static_cast<char>(0x0u));
-
-
-bool ReadPipeWriteConsole(HANDLE hPipe)
-{
-	constexpr const DWORD BUFF_SIZE{ 512 };
-	static_assert(BUFF_SIZE % sizeof(wchar_t) == 0);
-	alignas(wchar_t) char szBuffer[BUFF_SIZE]{};
-	constexpr const auto element_size{ sizeof(szBuffer[0]) };
-	static_assert(element_size == 1);
-	bool success_ret = true;
-
-
-	HANDLE hStdOut = nullptr;
-	hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
-	if (hStdOut == INVALID_HANDLE_VALUE || hStdOut == nullptr)
-	{
-		fmt::print(stderr, "GetStdHandle(STD_OUTPUT_HANDLE) failed with {:#x}\n", GetLastError());
-		hStdOut = nullptr;
-		success_ret = false;
-		goto cleanup;
-	}
-
-	{
-		DWORD dummy;
-		if (!GetConsoleMode(hStdOut, &dummy)) {
-			fmt::print(stderr, "stdout is not a console\n");
-			success_ret = false;
-			goto cleanup;
-		}
-	}
-
-	{
-		char* const read_end_ptr = (&szBuffer[0]) + BUFF_SIZE;
-		static_assert(sizeof(wchar_t) == 2);
-
-		// read_start_ptr is either:
-		// - odd: `&szBuffer[1]`
-		// - even: `&szBuffer[2]`
-		char* read_start_ptr = &szBuffer[sizeof(wchar_t)]; // we begin with even.
-		// If read_start_ptr is odd, than we have one byte more from the last round in `szBuffer[0]`.
-		// So it is reasonable to begin with even, because in the beginning we don't have a byte from the last round.
-
-		do {
-			DWORD dwBytesRead{};
-			bool bRead = ReadFile(hPipe, read_start_ptr, (read_end_ptr - read_start_ptr), &dwBytesRead, nullptr);
-			if (!bRead)
-				break;
-			if (dwBytesRead == 0)
-				break;
-			if (dwBytesRead > (read_end_ptr - read_start_ptr)) {
-				fmt::print(stderr, "Unexpected error when using ReadFile(): More bytes read than requested.\n");
-				success_ret = false;
-				goto cleanup;
-			}
-
-			// Do have an extra byte from the last round? (Yes, if odd).
-			const bool read_start_ptr_odd = (std::bit_cast<uintptr_t>(read_start_ptr) % 2) != 0;
-
-			// Add +1, if we have an additonal byte from the last round
-			const DWORD number_of_bytes_available = dwBytesRead + (read_start_ptr_odd ? 1 : 0);
-			const bool available_odd = (number_of_bytes_available % 2) != 0;
-
-
-			const DWORD absolute_number_of_wchars_to_write = number_of_bytes_available / sizeof(wchar_t); // round down
-			const char* write_start_ptr = read_start_ptr_odd ? (read_start_ptr - 1) : read_start_ptr; // must be even. So subtract 1, to make it even.
-			assert(write_start_ptr == &szBuffer[0] || write_start_ptr == &szBuffer[2]);
-			DWORD absolute_number_of_wchars_written = 0;
-			DWORD number_of_wchars_written = 0;
-			bool success_write = true;
-			if (absolute_number_of_wchars_to_write > 0)
-			{
-				while
-					(
-						absolute_number_of_wchars_written < absolute_number_of_wchars_to_write
-						&&
-						(
-							success_write = ::WriteConsoleW(
-								/* _In_             HANDLE  hConsoleOutput,         */ hStdOut,
-								/* _In_       const VOID * lpBuffer,                */ write_start_ptr + (absolute_number_of_wchars_written * sizeof(wchar_t)),
-								/* _In_             DWORD   nNumberOfCharsToWrite,  */ absolute_number_of_wchars_to_write - absolute_number_of_wchars_written,
-								/* _Out_opt_        LPDWORD lpNumberOfCharsWritten, */ &number_of_wchars_written,
-								/* _Reserved_       LPVOID  lpReserved              */ nullptr
-							)
-							)
-						&&
-						number_of_wchars_written > 0
-						) {
-					absolute_number_of_wchars_written += number_of_wchars_written;
-				}
-			}
-
-			if
-				(
-					!success_write
-					||
-					absolute_number_of_wchars_written != absolute_number_of_wchars_to_write
-				) {
-				success_ret = false;
-				goto cleanup;
-			}
-			
-			// If the number of availble bytes is odd, than one byte couldn't be written, 
-			// because we can only write an even number of bytes, because the size of wchar_t is 2 bytes.
-			if (available_odd) {
-				szBuffer[0] = *(read_start_ptr + dwBytesRead - 1);
-				read_start_ptr = &szBuffer[1]; // make the read_start_ptr odd, to signal that we have one byte more
-			}
-			else {
-				read_start_ptr = &szBuffer[sizeof(wchar_t)];
-			}
-
-		} while (true);
-	}
-cleanup:
-	// hStdOut does not have to be closed
-
-	return success_ret;
-}
-bool ReadConsoleWritePipe(HANDLE hPipe)
-{
-	constexpr const DWORD BUFF_SIZE{ 512 };
-	static_assert(BUFF_SIZE % sizeof(wchar_t) == 0);
-	alignas(wchar_t) char szBuffer[BUFF_SIZE]{};
-	constexpr const auto element_size{ sizeof(szBuffer[0]) };
-	static_assert(element_size == 1);
-
-
-	HANDLE hStdIn = GetStdHandle(STD_INPUT_HANDLE);
-	if (hStdIn == INVALID_HANDLE_VALUE || hStdIn == nullptr)
-	{
-		fmt::print(stderr, "GetStdHandle(STD_INPUT_HANDLE) failed with {:#x}\n", GetLastError());
-		return false;
-	}
-
-	{
-		DWORD dummy;
-		if (!GetConsoleMode(hStdIn, &dummy)) {
-			fmt::print(stderr, "stdin is not a console\n");
-			return false;
-		}
-	}
-
-	DWORD dwWideCharsRead{};
-	size_t bytesWritten{};
-	bool bRead{ false };
-
-	do {
-		bRead = ReadConsoleW(hStdIn, szBuffer, BUFF_SIZE/sizeof(wchar_t), &dwWideCharsRead, nullptr);
-		if (!bRead)
-			break;
-		if (dwWideCharsRead == 0)
-			break;
-		if (dwWideCharsRead*sizeof(wchar_t) > BUFF_SIZE) {
-			fmt::print(stderr, "Unexpected error when using ReadConsoleW().\n");
-			//goto cleanup;
-			return false;
-		}
-
-		{
-			const DWORD absolute_number_of_bytes_to_write = dwWideCharsRead * sizeof(wchar_t);
-			DWORD absolute_number_of_bytes_written = 0;
-			DWORD number_of_bytes_written = 0;
-			bool success = true;
-			while
-			(
-				absolute_number_of_bytes_written < absolute_number_of_bytes_to_write
-				&&
-				(
-					success = WriteFile(
-						/*[in]                HANDLE       hFile,                  */ hPipe,
-						/*[in]                LPCVOID      lpBuffer,               */ &szBuffer[absolute_number_of_bytes_written],
-						/*[in]                DWORD        nNumberOfBytesToWrite,  */ absolute_number_of_bytes_to_write - absolute_number_of_bytes_written,
-						/*[out, optional]     LPDWORD      lpNumberOfBytesWritten, */ &number_of_bytes_written,
-						/*[in, out, optional] LPOVERLAPPED lpOverlapped            */ nullptr
-					)
-				)
-				&&
-				number_of_bytes_written > 0
-			){
-				absolute_number_of_bytes_written += number_of_bytes_written;
-			}
-			
-			if
-			(
-				!success
-				||
-				absolute_number_of_bytes_written != absolute_number_of_bytes_to_write
-			){
-				return false;
-			}
-		}
-
-	} while (true);
-
-	return true;
-}
-
-bool ReadHandleWriteFileByteWise(HANDLE hIn, FILE* fOut) {
-	
-	constexpr const DWORD BUFF_SIZE{ 512 };
-	char szBuffer[BUFF_SIZE]{};
-	constexpr const auto element_size{ sizeof(szBuffer[0]) };
-	static_assert(element_size == 1);
-
-	DWORD dwBytesRead{};
-	size_t bytesWritten{};
-	bool bRead{ false };
-
-	do {
-		bRead = ReadFile(hIn, szBuffer, BUFF_SIZE, &dwBytesRead, nullptr);
-		if (!bRead)
-			break;
-		if (dwBytesRead == 0)
-			break;
-		if (dwBytesRead > BUFF_SIZE) {
-			fmt::print(stderr, "Unexpected error when using ReadFile().\n");
-			return false;
-		}
-
-		std::string_view sv(szBuffer, dwBytesRead);
-		fmt::print(fOut, "{}", sv); // this can also print zero bytes ('\0' ASCII NUL)
-	} while (true);
-	
-	return true;
-}
-
-std::optional<FILE*> HandleToFilePtr(HANDLE handle, const char* mode) {
-	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(handle), 0);
-	if (fd == -1)
-		return std::nullopt;
-	FILE* file = _fdopen(fd, mode);
-	if (file == nullptr)
-		return std::nullopt;
-	return file;
-}
-
-bool ReadStdInWritePipeUTF8(HANDLE& hPipe) {
-	HANDLE hStdIn = GetStdHandle(STD_INPUT_HANDLE);
-	if (hStdIn == INVALID_HANDLE_VALUE || hStdIn == nullptr)
-	{
-		fmt::print(stderr, "GetStdHandle(STD_INPUT_HANDLE) failed with {:#x}\n", GetLastError());
-		return false;
-	}
-
-	{
-		DWORD dummy;
-		if (GetConsoleMode(hStdIn, &dummy)) {
-			fmt::print(stderr, "stdin is a console\n");
-			return false;
-		}
-	}
-
-	auto fOut_opt = HandleToFilePtr(hPipe, "w");
-	if (!fOut_opt.has_value()) {
-		fmt::print(stderr, "cannot convert pipe handle to FILE*");
-		return false;
-	}
-	FILE* fOut = fOut_opt.value();
-	bool success = ReadHandleWriteFileByteWise(hStdIn, fOut_opt.value());
-cleanup:
-	// Close Pipe
-	if (0 != fclose(fOut)) {
-		return false;
-	}
-	hPipe = nullptr;
-	return success;
-}
-
-bool ReadPipeWriteStdOutUTF8(HANDLE hPipe) {
-
-	HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
-	if (hStdOut == INVALID_HANDLE_VALUE || hStdOut == nullptr)
-	{
-		fmt::print(stderr, "GetStdHandle(STD_OUTPUT_HANDLE) failed with {:#x}\n", GetLastError());
-		return false;
-	}
-	auto fOut_opt = HandleToFilePtr(hStdOut, "r");
-	if (!fOut_opt.has_value()) {
-		fmt::print(stderr, "cannot convert pipe handle to FILE*");
-		return false;
-	}
-
-	return ReadHandleWriteFileByteWise(hPipe, fOut_opt.value());
-}
-
-bool ReadOrWrite(HANDLE& hPipe, bool bReadFromPipe, bool is_utf8) {
-	if (bReadFromPipe) {
-		if (is_utf8) {
-			return ReadPipeWriteStdOutUTF8(hPipe);
-		}
-		else {
-			return ReadPipeWriteConsole(hPipe);
-		}
-	}
-	else {
-		if (is_utf8) {
-			return ReadStdInWritePipeUTF8(hPipe);
-		}
-		else {
-			return ReadConsoleWritePipe(hPipe);
-		}
-	}
-}
-
-
-bool AttachToConsole(uint32_t PID) {
-	if (!FreeConsole()) {
-		auto error = GetLastError();
-		auto message = get_error_message(error);
-		fmt::print(stderr, "FreeConsole() failed, but we are ignoring that. The error is {:#x} with message is {}{}{}\n",
-			error, quote_open, message.value_or(""), quote_close);
-	}
-	static_assert(sizeof(PID) == sizeof(DWORD) && std::is_unsigned_v<decltype(PID)> == std::is_unsigned_v<DWORD>);
-	if (!AttachConsole(PID)) {
-		auto error = GetLastError();
-		auto message = get_error_message(error);
-		fmt::print(stderr, "AttachConsole({}) failed with error {} - {}", PID, error, indent_message("  ", message.value_or("")));
-		return false;
-	}
-}
-
-bool SpawnSelf(uint32_t pid, bool to_secondary, bool is_utf8) {
-
-	bool ret_value = false;
-	DWORD exitCode{};
-	std::string prog_path{};
-	STARTUPINFOA startupinfo{};
-	PROCESS_INFORMATION procinfo{};
-	std::string cmd_line{};
-	std::unique_ptr<char[]> mutable_cmd_line_buf{};
-
-	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
-
-	HANDLE h_read{ nullptr };
-	HANDLE h_write{ nullptr };
-	if (!CreatePipe(&h_read, &h_write, &sa, 0)) {
-		fmt::print(stderr, "Failed to create pipe\n");
-		goto cleanup;
-	}
-
-	{
-		auto prog_path_opt = GetProgPath(stderr);
-		if (!prog_path_opt.has_value()) {
-			goto cleanup;
-		}
-		prog_path = *prog_path_opt;
-	}
-
-	{
-		HANDLE& handle_for_secondary = to_secondary ? h_read : h_write;
-		HANDLE& handle_for_us = to_secondary ? h_write : h_read;
-
-		if (!SetHandleInformation(handle_for_us, HANDLE_FLAG_INHERIT, 0)) {
-			fmt::println(stderr, "Failed to disable inheritance of a Handle");
-			goto cleanup;
-		}
-
-		startupinfo.cb = sizeof(startupinfo);
-
-		//startupinfo.hStdError  = GetStdHandle(STD_ERROR_HANDLE);
-		//startupinfo.hStdOutput = INVALID_HANDLE_VALUE;
-		//startupinfo.hStdInput  = INVALID_HANDLE_VALUE;
-		//startupinfo.dwFlags   |= STARTF_USESTDHANDLES;
-		cmd_line = fmt::format("\"{}\" --pid {} --handle {} --secondary --{}-secondary {}",
-			prog_path, pid, std::bit_cast<uintptr_t>(handle_for_secondary),
-			(to_secondary ? "to" : "from"),
-			(is_utf8 ? "--utf8":"")
-		);
-
-		mutable_cmd_line_buf = std::make_unique<char[]>(cmd_line.length() + 1);
-		std::memcpy(mutable_cmd_line_buf.get(), cmd_line.c_str(), cmd_line.length() * sizeof(char));
-		mutable_cmd_line_buf.get()[cmd_line.length()] = '\0';
-
-
-		if (!CreateProcessA(prog_path.c_str(), mutable_cmd_line_buf.get(), nullptr, nullptr, true, 0, nullptr, nullptr, &startupinfo, &procinfo)) {
-			auto error = GetLastError();
-			fmt::print(stderr, "Couldn't create child process - {:#x} {}\n", error, get_error_message(error).value_or(""));
-			goto cleanup;
-		}
-		CloseHandle(procinfo.hThread);
-		procinfo.hThread = nullptr;
-
-		CloseHandle(handle_for_secondary);
-		handle_for_secondary = nullptr;
-
-		bool rw_result = ReadOrWrite(handle_for_us, !to_secondary, is_utf8);
-
-		WaitForSingleObject(procinfo.hProcess, INFINITE);
-
-		if (0 == GetExitCodeProcess(procinfo.hProcess, &exitCode)) {
-			fmt::print(stderr, "Failed to get Exit Code of Process.\n");
-			goto cleanup;
-		}
-
-		if (exitCode != 0) {
-			fmt::print(stderr, "Child process failed with exited code: {}", exitCode);
-			goto cleanup;
-		}
-
-		//hPipeListenerThread = reinterpret_cast<HANDLE>(_beginthread(PipeListener, 0, hPipeIn));
-		ret_value = rw_result;
-	}
-cleanup:
-	if (procinfo.hProcess != nullptr) {
-		CloseHandle(procinfo.hProcess);
-		procinfo.hProcess = nullptr;
-	}
-	if (procinfo.hThread != nullptr) {
-		CloseHandle(procinfo.hThread);
-		procinfo.hThread = nullptr;
-	}
-
-	if (h_read) {
-		CloseHandle(h_read);
-		h_read = nullptr;
-	}
-	if (h_write) {
-		CloseHandle(h_write);
-		h_write = nullptr;
-	}
-		
-	return ret_value;
-}
-
-
-void PrintUsage(FILE* stream) {
-	fmt::print(stream,
-		"Usage:\n"
-		"  pipe-to-con [--pid <PID>] {{--to-secondary|--from-secondary}} [--secondary]\n"
-	);
-}
-
-
-int main(int argc, const char* argv[])
-{
-	_set_fmode(_O_BINARY);
-	_setmode(_fileno(stdout), _O_BINARY);
-	_setmode(_fileno(stderr), _O_BINARY);
-	_setmode(_fileno(stdin), _O_BINARY);
-
-	if(false){
-		fmt::println("wait for debugger debug break");
-		while (!IsDebuggerPresent()) {
-			using namespace std::chrono_literals;
-			std::this_thread::sleep_for(10ms);
-		}
-		DebugBreak();
-	}
-
-	if (GetACP() != 65001) {
-		fmt::print(stderr, "The Active Code Page (ACP) for this process is not UTF-8 (65001).\n"
-			"Command line parsing is not supported.\n"
-			"Your version of Windows might be to old, so that the manifest embedded in the executable is not read. "
-			"The manifest specifies, that this executable wants UTF-8 as ACP.\n"
-			"As a workaround you can activate \"Beta: Use Unicode UTF-8 for worldwide language support\":\n"
-			"  - Press Win+R\n"
-			"  - Type \"intl.cpl\"\n"
-			"  - Goto Tab \"Administrative\"\n"
-			"  - Click on \"Change system locale\"\n"
-			"  - Set Checkbox \"Beta: Use Unicode UTF-8 for worldwide language support\"\n"
-			"\n");
-		//PrintUsage(stderr);
-		return 1;
-	}
-
-	std::optional<uint32_t> PID{ std::nullopt };
-	std::optional<intptr_t> handle_in_or_out{ std::nullopt };
-	bool to_secondary { false };
-	bool from_secondary { false };
-	bool secondary{ false };
-	bool utf8{ false };
-
-
-	for (int i = 1; i < argc; ++i) {
-		std::string_view current_arg{ argv[i] };
-		std::optional<std::string_view> next_arg{ std::nullopt };
-
-		{
-			int next_index = i + 1;
-			bool next_available = next_index < argc;
-			if (next_available)
-				next_arg = argv[next_index];
-		}
-
-		auto check_next_arg = [&](std::string_view option_name) -> bool {
-			if (!next_arg) {
-				fmt::print(stderr, "Value for option '{}' is missing.\n", option_name);
-				PrintUsage(stderr);
-				return false;
-			}
-			i += 1;
-			return true;
-		};
-
-		if (current_arg == "--pid") {
-			if (!check_next_arg("--pid"))
-				return 1;
-
-			PID = string_to_uint<uint32_t>(*next_arg);
-			if (!PID) {
-				fmt::print(stderr, "Process identifier supplied for option \"--pid\" is not a number in base ten.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-		}
-		else if (current_arg == "--to-secondary") {
-			to_secondary = true;
-		}
-		else if (current_arg == "--from-secondary") {
-			from_secondary = true;
-		}
-		else if (current_arg == "--secondary") {
-			secondary = true;
-		}
-		else if (current_arg == "--utf8") {
-			utf8 = true;
-		}
-		else if (current_arg == "--handle") {
-			if (!check_next_arg("--handle"))
-				return 1;
-			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
-			if (!opt_uint) {
-				fmt::print(stderr, "value for option \"--handle\" is not a number or not in range.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			handle_in_or_out = std::bit_cast<intptr_t>(opt_uint.value());
-		}
-		else {
-			fmt::print(stderr, "Argument {}{}{} could not be interpreted\n", quote_open, current_arg, quote_close);
-			PrintUsage(stderr);
-			return 1;
-		}
-	}
-
-	if (!PID.has_value()) {
-		fmt::print(stderr,
-				"Error: Must specify a process identifier with the option \"--pid\"\n");
-		return 1;
-	}
-
-	if (to_secondary == from_secondary) {
-		if (to_secondary) {
-			fmt::print(stderr,
-					"Error: You are not allowed to set both options "
-					"\"--to-secondary\" and \"from-secondary\"\n");
-		}else{
-			fmt::print(stderr,
-					"Error: You must specifiy one of these options: "
-					"\"--to-secondary\", \"from-secondary\"\n");
-		}
-		return 1;
-	}
-
-	if (secondary) {
-		if(!handle_in_or_out.has_value()) {
-			fmt::print(stderr,
-					"Error: You must specify a handle value, for the secondary process.\n");
-			return 1;
-		}
-		const intptr_t handle_intptr = handle_in_or_out.value();
-		HANDLE handle = std::bit_cast<HANDLE>(handle_intptr);
-		const bool is_handle_input = to_secondary;
-		if(!AttachToConsole(PID.value())) {
-			return 1;
-		}
-		if (!ReadOrWrite(handle, is_handle_input, utf8)) {
-			return 1;
-		}
-		return 0;
-	}else{
-		if(handle_in_or_out.has_value()) {
-			fmt::print(stderr,
-					"Error: You must not specify a handle value, for the primary process.\n");
-			return 1;
-		}
-		if (!SpawnSelf(PID.value(), to_secondary, utf8)){
-			return 1;
-		}
-		return 0;
-	}
-	
-
-	return 0;
-}
+#include <Windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <optional>
+#include <memory>
+#include <cassert>
+#include <console-tools/broker.h>
+#include <console-tools/fanout.h>
+#include <console-tools/helper.h>
+#include <console-tools/io.h>
+#include <console-tools/relay.h>
+#include <console-tools/relay_async.h>
+#include <console-tools/relay_loop.h>
+#include <console-tools/relay_stats.h>
+#include <console-tools/shm_ring.h>
+#include <console-tools/trace.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+
+#if !defined(UNICODE)
+#error macro UNICODE is not defined
+#endif
+
+#if !defined(_UNICODE)
+#error macro _UNICODE is not defined
+#endif
+
+constexpr const char8_t UTF_8_test_1[] = u8"ü";
+static_assert(sizeof(UTF_8_test_1) == 3);
+static_assert(UTF_8_test_1[0] == static_cast<char8_t>(0xC3u));
+static_assert(UTF_8_test_1[1] == static_cast<char8_t>(0xBCu));
+static_assert(UTF_8_test_1[2] == static_cast<char8_t>(0x0u));
+
+constexpr const char UTF_8_test_2[] = "ü";
+static_assert(sizeof(UTF_8_test_2) == 3);
+static_assert(UTF_8_test_2[0] == static_cast<char>(0xC3u));
+static_assert(UTF_8_test_2[1] == static_cast<char>(0xBCu));
+static_assert(UTF_8_test_2[2] == static_cast<char>(0x0u));
+
+
+// How the primary and the secondary process exchange the bytes.
+enum class transport_kind : uint32_t {
+	pipe, // an anonymous pipe
+	shm   // a ring in shared memory (shm_ring.h)
+};
+
+std::optional<transport_kind> ParseTransport(std::string_view str) {
+	if (str == "pipe")
+		return transport_kind::pipe;
+	if (str == "shm")
+		return transport_kind::shm;
+	return std::nullopt;
+}
+
+// Options of the relay, that the primary process passes on to the secondary process.
+struct relay_options {
+	// The console side and the pipe use UTF-8 bytes instead of the UTF-16 console API.
+	bool utf8{ false };
+	buffer_size_option buffer_size{};
+	std::optional<pipeline_option> pipeline{ std::nullopt };
+	std::optional<io_uring_option> io_uring{ std::nullopt };
+	// Only in the primary process: its stdin or stdout is a byte stream in this
+	// encoding, which is converted from or to the encoding of the pipe.
+	std::optional<text_encoding> stream_encoding{ std::nullopt };
+	// Statistics of the relay on stderr. Each process reports its own relay.
+	std::optional<stats_option> stats{ std::nullopt };
+	// Only between the primary and a secondary process. A broker keeps its pipes.
+	transport_kind transport{ transport_kind::pipe };
+};
+
+text_encoding PipeEncoding(const relay_options& options) {
+	return options.utf8 ? text_encoding::utf8 : text_encoding::utf16le;
+}
+
+std::string SecondaryArguments(const relay_options& options) {
+	std::string stats_arguments{};
+	if (options.stats) {
+		stats_arguments = options.stats->interval.count() > 0
+			? fmt::format(" --stats-interval {}", options.stats->interval.count())
+			: std::string{ " --stats" };
+	}
+	return fmt::format("{}--buffer-size {}{}",
+		(options.utf8 ? "--utf8 " : ""),
+		buffer_size_option_to_string(options.buffer_size),
+		(options.pipeline ? " --pipeline " + pipeline_option_to_string(*options.pipeline) : "") +
+		(options.io_uring ? " --io-uring " + io_uring_option_to_string(*options.io_uring) : "") +
+		stats_arguments
+	);
+}
+
+// The byte-wise relay of the "--utf8" and the transcoding modes, in the variant the options ask for.
+bool RelayBytes(byte_source& in, byte_sink& out, text_encoding from, text_encoding to, const relay_options& options) {
+	if (from != to)
+		return ReadHandleWriteFileTranscoded(in, out, from, to, options.buffer_size);
+	if (options.io_uring) {
+		// Falls through to the blocking loops, where io_uring is not available.
+		if (auto success = ReadHandleWriteFileByteWiseUring(in, out, options.buffer_size, *options.io_uring))
+			return *success;
+	}
+	if (options.pipeline)
+		return ReadHandleWriteFileByteWisePipelined(in, out, options.buffer_size, *options.pipeline);
+	return ReadHandleWriteFileByteWise(in, out, options.buffer_size);
+}
+
+bool ReadPipeWriteStdOutConsole(byte_source& pipe, const relay_options& options)
+{
+	auto hStdOut = get_std_handle(std_stream::out);
+	if (!hStdOut.has_value())
+	{
+		fmt::print(stderr, "GetStdHandle(STD_OUTPUT_HANDLE) failed with {:#x}\n", GetLastError());
+		return false;
+	}
+
+	// hStdOut does not have to be closed
+	auto console = open_console(*hStdOut, console_in_or_out::out);
+	if (!console) {
+		fmt::print(stderr, "stdout is not a console\n");
+		return false;
+	}
+
+	return relay_with_stats<byte_source, console_sink>(options.stats, "pipe -> console", stderr, pipe, *console, [&](byte_source& in, console_sink& out) {
+		if (options.pipeline)
+			return ReadPipeWriteConsolePipelined(in, out, options.buffer_size, *options.pipeline);
+		return run_relay(ReadPipeWriteConsoleAsync(in, out, options.buffer_size));
+	});
+}
+
+bool ReadStdInConsoleWritePipe(byte_sink& pipe, const relay_options& options)
+{
+	auto hStdIn = get_std_handle(std_stream::in);
+	if (!hStdIn.has_value())
+	{
+		fmt::print(stderr, "GetStdHandle(STD_INPUT_HANDLE) failed with {:#x}\n", GetLastError());
+		return false;
+	}
+
+	auto console = open_console(*hStdIn, console_in_or_out::in);
+	if (!console) {
+		fmt::print(stderr, "stdin is not a console\n");
+		return false;
+	}
+
+	return relay_with_stats<console_source, byte_sink>(options.stats, "console -> pipe", stderr, *console, pipe, [&](console_source& in, byte_sink& out) {
+		return run_relay(ReadConsoleWritePipeAsync(in, out, options.buffer_size));
+	});
+}
+
+bool ReadStdInWritePipeBytes(byte_sink& pipe, const relay_options& options) {
+	auto hStdIn = get_std_handle(std_stream::in);
+	if (!hStdIn.has_value())
+	{
+		fmt::print(stderr, "GetStdHandle(STD_INPUT_HANDLE) failed with {:#x}\n", GetLastError());
+		return false;
+	}
+
+	if (open_console(*hStdIn, console_in_or_out::in)) {
+		fmt::print(stderr, "stdin is a console\n");
+		return false;
+	}
+
+	// Both ends as plain handles, no CRT stream in between.
+	auto in = open_byte_stream(*hStdIn);
+	const text_encoding pipe_encoding = PipeEncoding(options);
+	return relay_with_stats<byte_source, byte_sink>(options.stats, "stdin -> pipe", stderr, *in, pipe, [&](byte_source& from, byte_sink& to) {
+		return RelayBytes(from, to, options.stream_encoding.value_or(pipe_encoding), pipe_encoding, options);
+	});
+}
+
+bool ReadPipeWriteStdOutBytes(byte_source& pipe, const relay_options& options) {
+
+	auto hStdOut = get_std_handle(std_stream::out);
+	if (!hStdOut.has_value())
+	{
+		fmt::print(stderr, "GetStdHandle(STD_OUTPUT_HANDLE) failed with {:#x}\n", GetLastError());
+		return false;
+	}
+	// Nothing else is printed to stdout. Flush the CRT anyway, before writing to the handle directly.
+	std::fflush(stdout);
+
+	auto out = open_byte_stream(*hStdOut);
+	const text_encoding pipe_encoding = PipeEncoding(options);
+	return relay_with_stats<byte_source, byte_sink>(options.stats, "pipe -> stdout", stderr, pipe, *out, [&](byte_source& from, byte_sink& to) {
+		return RelayBytes(from, to, pipe_encoding, options.stream_encoding.value_or(pipe_encoding), options);
+	});
+}
+
+// `pipe` is the pipe to the other process, or the connection to the broker. After
+// writing, it is closed, because the other side reads up to the end of the stream.
+bool ReadOrWrite(std::unique_ptr<byte_stream>& pipe, bool bReadFromPipe, const relay_options& options) {
+	if (bReadFromPipe) {
+		if (options.utf8 || options.stream_encoding) {
+			return ReadPipeWriteStdOutBytes(*pipe, options);
+		}
+		else {
+			return ReadPipeWriteStdOutConsole(*pipe, options);
+		}
+	}
+	else {
+		bool success{ false };
+		if (options.utf8 || options.stream_encoding) {
+			success = ReadStdInWritePipeBytes(*pipe, options);
+		}
+		else {
+			success = ReadStdInConsoleWritePipe(*pipe, options);
+		}
+		pipe.reset();
+		return success;
+	}
+}
+
+
+// The console of `PID` as a stream in this process, if this process is attached to it
+// already: no secondary process, no inherited handle, no pipe in between. Returns
+// nullptr otherwise.
+std::unique_ptr<byte_stream> OpenDirect(uint32_t PID, bool to_secondary, const relay_options& options) {
+	trace_scope trace{ "open direct", "process" };
+	std::unique_ptr<console> target = open_process_console(PID, to_secondary ? console_in_or_out::out : console_in_or_out::in);
+	if (!target)
+		return nullptr;
+	return open_console_stream(std::move(target), PipeEncoding(options));
+}
+
+bool AttachToConsole(uint32_t PID) {
+	if (!FreeConsole()) {
+		auto error = GetLastError();
+		auto message = get_error_message(error);
+		fmt::print(stderr, "FreeConsole() failed, but we are ignoring that. The error is {:#x} with message is {}{}{}\n",
+			error, quote_open, message.value_or(""), quote_close);
+	}
+	static_assert(sizeof(PID) == sizeof(DWORD) && std::is_unsigned_v<decltype(PID)> == std::is_unsigned_v<DWORD>);
+	if (!trace_call("AttachConsole", "process", [&] { return AttachConsole(PID); })) {
+		auto error = GetLastError();
+		auto message = get_error_message(error);
+		fmt::print(stderr, "AttachConsole({}) failed with error {} - {}", PID, error, indent_message("  ", message.value_or("")));
+		return false;
+	}
+	return true;
+}
+
+// A secondary process, that relays between its end of a pipe and the console of its PID.
+struct secondary_process {
+	HANDLE process{ nullptr };
+	// Our end of the pipe.
+	std::unique_ptr<byte_stream> pipe{};
+	// Only with "--duplex": `pipe` goes to the console, this one comes back from it.
+	std::unique_ptr<byte_stream> return_pipe{};
+};
+
+// One direction between us and a secondary process, before it starts: a pipe, or a
+// ring in shared memory with "--transport shm".
+struct secondary_channel {
+	std::unique_ptr<byte_stream> ours{};
+	// Inherited by the secondary process.
+	HANDLE for_secondary{ nullptr };
+	// The ring in `ours`, if it is one.
+	shm_ring_stream* ring{ nullptr };
+};
+
+bool CreateSecondaryChannel(bool to_secondary, transport_kind transport, secondary_channel& channel) {
+	if (transport == transport_kind::shm) {
+		std::unique_ptr<shm_ring_stream> ring = create_shm_ring(DEFAULT_SHM_RING_CAPACITY, to_secondary ? shm_ring_side::producer : shm_ring_side::consumer);
+		if (!ring) {
+			fmt::print(stderr, "Failed to create the shared memory ring - {:#x}\n", GetLastError());
+			return false;
+		}
+		// The mapping of a ring is inherited like the end of a pipe, but stays ours as well.
+		channel.for_secondary = ring->shared_handle();
+		channel.ring = ring.get();
+		channel.ours = std::move(ring);
+		return true;
+	}
+
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
+	HANDLE h_read{ nullptr };
+	HANDLE h_write{ nullptr };
+	if (!CreatePipe(&h_read, &h_write, &sa, 0)) {
+		fmt::print(stderr, "Failed to create pipe\n");
+		return false;
+	}
+	HANDLE pipe_for_us = to_secondary ? h_write : h_read;
+	HANDLE pipe_for_secondary = to_secondary ? h_read : h_write;
+	if (!SetHandleInformation(pipe_for_us, HANDLE_FLAG_INHERIT, 0)) {
+		fmt::println(stderr, "Failed to disable inheritance of a Handle");
+		CloseHandle(h_read);
+		CloseHandle(h_write);
+		return false;
+	}
+	channel.for_secondary = pipe_for_secondary;
+	channel.ours = open_byte_stream(pipe_for_us, true);
+	return true;
+}
+
+// Closes the end of the pipe, that the secondary process has inherited (or not, if it
+// did not start). The mapping of a ring is closed with the ring.
+void CloseSecondaryEnd(secondary_channel& channel) {
+	if (!channel.ring && channel.for_secondary != nullptr)
+		CloseHandle(channel.for_secondary);
+	channel.for_secondary = nullptr;
+}
+
+// Both `to_secondary` and `from_secondary` for "--duplex".
+std::optional<secondary_process> StartSecondary(uint32_t pid, bool to_secondary, bool from_secondary, const relay_options& options) {
+
+	const bool duplex = to_secondary && from_secondary;
+	std::optional<secondary_process> started{ std::nullopt };
+	std::string prog_path{};
+	STARTUPINFOA startupinfo{};
+	PROCESS_INFORMATION procinfo{};
+	std::string cmd_line{};
+	std::unique_ptr<char[]> mutable_cmd_line_buf{};
+
+	// With "--duplex", `channel` goes to the console and `return_channel` comes back.
+	secondary_channel channel{};
+	secondary_channel return_channel{};
+	if (!CreateSecondaryChannel(to_secondary, options.transport, channel)) {
+		goto cleanup;
+	}
+	if (duplex && !CreateSecondaryChannel(false, options.transport, return_channel)) {
+		goto cleanup;
+	}
+
+	{
+		auto prog_path_opt = GetProgPath(stderr);
+		if (!prog_path_opt.has_value()) {
+			goto cleanup;
+		}
+		prog_path = *prog_path_opt;
+	}
+
+	{
+		startupinfo.cb = sizeof(startupinfo);
+
+		//startupinfo.hStdError  = GetStdHandle(STD_ERROR_HANDLE);
+		//startupinfo.hStdOutput = INVALID_HANDLE_VALUE;
+		//startupinfo.hStdInput  = INVALID_HANDLE_VALUE;
+		//startupinfo.dwFlags   |= STARTF_USESTDHANDLES;
+		const std::string direction = duplex
+			? fmt::format("--duplex --return-handle {}", std::bit_cast<uintptr_t>(return_channel.for_secondary))
+			: fmt::format("--{}-secondary", (to_secondary ? "to" : "from"));
+		cmd_line = fmt::format("\"{}\" --pid {} --handle {} --secondary {} {}{}",
+			prog_path, pid, std::bit_cast<uintptr_t>(channel.for_secondary),
+			direction,
+			SecondaryArguments(options),
+			(channel.ring ? " --transport shm" : "")
+		);
+
+		mutable_cmd_line_buf = std::make_unique<char[]>(cmd_line.length() + 1);
+		std::memcpy(mutable_cmd_line_buf.get(), cmd_line.c_str(), cmd_line.length() * sizeof(char));
+		mutable_cmd_line_buf.get()[cmd_line.length()] = '\0';
+
+
+		if (!trace_call("CreateProcess", "process", [&] { return CreateProcessA(prog_path.c_str(), mutable_cmd_line_buf.get(), nullptr, nullptr, true, 0, nullptr, nullptr, &startupinfo, &procinfo); })) {
+			auto error = GetLastError();
+			fmt::print(stderr, "Couldn't create child process - {:#x} {}\n", error, get_error_message(error).value_or(""));
+			goto cleanup;
+		}
+		CloseHandle(procinfo.hThread);
+		procinfo.hThread = nullptr;
+
+		// A ring has no end of the stream, when the secondary process dies.
+		for (secondary_channel* ring_channel : { &channel, &return_channel }) {
+			if (ring_channel->ring)
+				ring_channel->ring->set_peer(procinfo.dwProcessId);
+		}
+		started = secondary_process{ .process{procinfo.hProcess}, .pipe{std::move(channel.ours)}, .return_pipe{std::move(return_channel.ours)} };
+		procinfo.hProcess = nullptr;
+	}
+cleanup:
+	if (procinfo.hProcess != nullptr) {
+		CloseHandle(procinfo.hProcess);
+		procinfo.hProcess = nullptr;
+	}
+	if (procinfo.hThread != nullptr) {
+		CloseHandle(procinfo.hThread);
+		procinfo.hThread = nullptr;
+	}
+
+	CloseSecondaryEnd(channel);
+	CloseSecondaryEnd(return_channel);
+
+	return started;
+}
+
+// Waits for the end of the secondary process and closes its handle. Returns, whether it succeeded.
+bool WaitForSecondary(secondary_process& secondary) {
+	bool ret_value = false;
+	DWORD exitCode{};
+
+	trace_call("wait for child", "process", [&] { return WaitForSingleObject(secondary.process, INFINITE); });
+
+	if (0 == GetExitCodeProcess(secondary.process, &exitCode)) {
+		fmt::print(stderr, "Failed to get Exit Code of Process.\n");
+	}
+	else if (exitCode != 0) {
+		fmt::print(stderr, "Child process failed with exited code: {}", exitCode);
+	}
+	else {
+		ret_value = true;
+	}
+	CloseHandle(secondary.process);
+	secondary.process = nullptr;
+	return ret_value;
+}
+
+bool SpawnSelf(uint32_t pid, bool to_secondary, const relay_options& options) {
+	std::optional<secondary_process> secondary = StartSecondary(pid, to_secondary, !to_secondary, options);
+	if (!secondary)
+		return false;
+	bool rw_result = ReadOrWrite(secondary->pipe, !to_secondary, options);
+	//hPipeListenerThread = reinterpret_cast<HANDLE>(_beginthread(PipeListener, 0, hPipeIn));
+	return WaitForSecondary(*secondary) && rw_result;
+}
+
+
+void PrintUsage(FILE* stream) {
+	fmt::print(stream,
+		"Usage:\n"
+		"  pipe-to-con [--pid <PID>] {{--to-secondary|--from-secondary}} [--utf8] [--buffer-size <size>] [--pipeline <cap>] [--io-uring <depth>]\n"
+		"              [--from-encoding <enc>] [--to-encoding <enc>] [--stats] [--stats-interval <ms>] [--transport <kind>]\n"
+		"              [--no-broker] [--no-direct] [--secondary]\n"
+		"  pipe-to-con --pid <PID> --duplex [<options of the relay>]\n"
+		"  pipe-to-con --pid <PID> --broker\n"
+		"  pipe-to-con --pid <PID> --pid <PID> [--pid <PID> ...] --to-secondary [--lag-policy <policy>] [--max-lag <lag>] [<options of the relay>]\n"
+		"\n"
+		"<size>    Size of the relay buffer in bytes, optionally with the suffix \"k\" or \"M\"\n"
+		"          (default: {}). \"auto\" grows the buffer while the input keeps\n"
+		"          it full and shrinks it again for interactive traffic.\n"
+		"\n"
+		"<cap>     Reads ahead in a separate thread, while the console is written.\n"
+		"          <cap> limits the memory of the read-ahead ring, in bytes, optionally\n"
+		"          with the suffix \"k\" or \"M\". Every read asks for <size> bytes at most.\n"
+		"\n"
+		"<depth>   With \"--utf8\", relays on io_uring with <depth> buffers of <size> bytes\n"
+		"          ({} to {}). Where io_uring is not available (e.g. on Windows), the\n"
+		"          option has no effect.\n"
+		"\n"
+		"<enc>     \"utf8\" or \"utf16\". With \"--to-secondary\", \"--from-encoding\" is the\n"
+		"          encoding of stdin and \"--to-encoding\" the one of the console; with\n"
+		"          \"--from-secondary\" it is the other way round. stdin or stdout is then\n"
+		"          read or written as a byte stream and converted. The console is written\n"
+		"          or read through the UTF-16 console API, or as bytes for \"utf8\" (like\n"
+		"          \"--utf8\"). Split characters and surrogate pairs are kept together.\n"
+		"\n"
+		"--stats   At the end, print the number of reads and writes, the bytes or code units,\n"
+		"          the partial writes, the time blocked in reads and in writes, and the\n"
+		"          latency of the chunks (p50/p99/max) to stderr. Both processes report their\n"
+		"          own relay. In-kernel copies and io_uring are not used with this option.\n"
+		"\n"
+		"<ms>      Like \"--stats\", and every <ms> milliseconds a JSON line with the\n"
+		"          numbers so far.\n"
+		"\n"
+		"<kind>    How the bytes get to the secondary process: \"pipe\" (default) or \"shm\",\n"
+		"          a ring of {} bytes in shared memory. A chunk costs no system call\n"
+		"          there, as long as neither side waits for the other. A broker always\n"
+		"          uses its pipes.\n"
+		"\n"
+		"--duplex  stdin goes to the console, while the input of the console comes to\n"
+		"          stdout, both at once through one secondary process with two pipes (or\n"
+		"          two sessions of a broker). The session ends with stdin, or when the\n"
+		"          console input or stdout end. Not with \"--from-encoding\" and\n"
+		"          \"--to-encoding\".\n"
+		"\n"
+		"--broker  Attaches to the console of <PID> once and stays, until <PID> ends. Meanwhile\n"
+		"          it relays for every \"pipe-to-con --pid <PID>\", that connects to its named\n"
+		"          pipe, instead of a new secondary process. Run it in the background, e.g.\n"
+		"          with \"start /b\". Without a broker, a secondary process is spawned as before.\n"
+		"\n"
+		"--no-broker  Spawns a secondary process, even if a broker serves the console.\n"
+		"\n"
+		"--no-direct  Spawns a secondary process (or uses a broker), even if pipe-to-con is\n"
+		"          attached to the console of <PID> already. Otherwise it relays to or from\n"
+		"          CONOUT$ or CONIN$ itself then, without a second process and a pipe.\n"
+		"\n"
+		"--pid     Given more than once, stdin goes to the consoles of all these processes.\n"
+		"          Every read is relayed to all of them. Each console gets its own\n"
+		"          secondary process (or broker session), so a slow console does not hold\n"
+		"          up the others, until it is <lag> bytes behind (default: {}, optionally\n"
+		"          with the suffix \"k\" or \"M\").\n"
+		"\n"
+		"<policy>  What happens to a console, that is <lag> bytes behind:\n"
+		"          \"block\" (default) stdin is not read, until it catches up\n"
+		"          \"drop\"       it misses the input, until it catches up\n"
+		"          \"disconnect\" its secondary process gets the end of the stream, the\n"
+		"                       others go on\n",
+		DEFAULT_BUFFER_SIZE, MIN_IO_URING_QUEUE_DEPTH, MAX_IO_URING_QUEUE_DEPTH, DEFAULT_SHM_RING_CAPACITY, DEFAULT_MAX_LAG
+	);
+}
+
+
+// The command line of pipe-to-con, and the arguments of a session of the broker.
+struct command_line {
+	// More than one only with "--to-secondary" in the primary process: the input
+	// goes to the consoles of all of them.
+	std::vector<uint32_t> PIDs{};
+	std::optional<intptr_t> handle_in_or_out{ std::nullopt };
+	bool to_secondary{ false };
+	bool from_secondary{ false };
+	// Both directions at once, through one secondary process.
+	bool duplex{ false };
+	// Only with "--duplex" in the secondary process: the pipe back to the primary process.
+	std::optional<intptr_t> return_handle{ std::nullopt };
+	bool secondary{ false };
+	// Serve the sessions of other invocations for the console of PID.
+	bool broker{ false };
+	// Spawn a secondary process, even if a broker serves the console.
+	bool no_broker{ false };
+	// Spawn a secondary process (or use the broker), even if this process shares the console.
+	bool no_direct{ false };
+	relay_options options{};
+	std::optional<text_encoding> from_encoding{ std::nullopt };
+	std::optional<text_encoding> to_encoding{ std::nullopt };
+	// What happens to a target, that falls behind the others.
+	fanout_option fanout{};
+};
+
+std::optional<command_line> ParseArguments(const std::vector<std::string_view>& args, FILE* err) {
+	command_line parsed{};
+
+	for (std::size_t i = 0; i < args.size(); ++i) {
+		std::string_view current_arg{ args[i] };
+		std::optional<std::string_view> next_arg{ std::nullopt };
+
+		{
+			std::size_t next_index = i + 1;
+			bool next_available = next_index < args.size();
+			if (next_available)
+				next_arg = args[next_index];
+		}
+
+		auto check_next_arg = [&](std::string_view option_name) -> bool {
+			if (!next_arg) {
+				fmt::print(err, "Value for option '{}' is missing.\n", option_name);
+				PrintUsage(err);
+				return false;
+			}
+			i += 1;
+			return true;
+		};
+
+		if (current_arg == "--pid") {
+			if (!check_next_arg("--pid"))
+				return std::nullopt;
+
+			auto PID = string_to_uint<uint32_t>(*next_arg);
+			if (!PID) {
+				fmt::print(err, "Process identifier supplied for option \"--pid\" is not a number in base ten.\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			if (std::find(parsed.PIDs.begin(), parsed.PIDs.end(), *PID) != parsed.PIDs.end()) {
+				fmt::print(err, "Process identifier {} is given twice.\n", *PID);
+				return std::nullopt;
+			}
+			parsed.PIDs.push_back(*PID);
+		}
+		else if (current_arg == "--lag-policy") {
+			if (!check_next_arg("--lag-policy"))
+				return std::nullopt;
+			auto policy = parse_lag_policy(*next_arg);
+			if (!policy) {
+				fmt::print(err, "value for option \"--lag-policy\" is neither \"block\", \"drop\" nor \"disconnect\".\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.fanout.policy = *policy;
+		}
+		else if (current_arg == "--max-lag") {
+			if (!check_next_arg("--max-lag"))
+				return std::nullopt;
+			auto max_lag = parse_buffer_size_option(*next_arg);
+			if (!max_lag || max_lag->adaptive) {
+				fmt::print(err, "value for option \"--max-lag\" is not an even number between {} and {}.\n", MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.fanout.max_lag = max_lag->size;
+		}
+		else if (current_arg == "--to-secondary") {
+			parsed.to_secondary = true;
+		}
+		else if (current_arg == "--from-secondary") {
+			parsed.from_secondary = true;
+		}
+		else if (current_arg == "--duplex") {
+			parsed.duplex = true;
+		}
+		else if (current_arg == "--secondary") {
+			parsed.secondary = true;
+		}
+		else if (current_arg == "--broker") {
+			parsed.broker = true;
+		}
+		else if (current_arg == "--no-broker") {
+			parsed.no_broker = true;
+		}
+		else if (current_arg == "--no-direct") {
+			parsed.no_direct = true;
+		}
+		else if (current_arg == "--utf8") {
+			parsed.options.utf8 = true;
+		}
+		else if (current_arg == "--buffer-size") {
+			if (!check_next_arg("--buffer-size"))
+				return std::nullopt;
+			auto opt_buffer_size = parse_buffer_size_option(*next_arg);
+			if (!opt_buffer_size) {
+				fmt::print(err, "value for option \"--buffer-size\" is not an even number between {} and {}, or \"auto\".\n", MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.options.buffer_size = *opt_buffer_size;
+		}
+		else if (current_arg == "--pipeline") {
+			if (!check_next_arg("--pipeline"))
+				return std::nullopt;
+			parsed.options.pipeline = parse_pipeline_option(*next_arg);
+			if (!parsed.options.pipeline) {
+				fmt::print(err, "value for option \"--pipeline\" is not an even number between {} and {}.\n", MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+				PrintUsage(err);
+				return std::nullopt;
+			}
+		}
+		else if (current_arg == "--io-uring") {
+			if (!check_next_arg("--io-uring"))
+				return std::nullopt;
+			parsed.options.io_uring = parse_io_uring_option(*next_arg);
+			if (!parsed.options.io_uring) {
+				fmt::print(err, "value for option \"--io-uring\" is not a number between {} and {}.\n", MIN_IO_URING_QUEUE_DEPTH, MAX_IO_URING_QUEUE_DEPTH);
+				PrintUsage(err);
+				return std::nullopt;
+			}
+		}
+		else if (current_arg == "--from-encoding" || current_arg == "--to-encoding") {
+			if (!check_next_arg(current_arg))
+				return std::nullopt;
+			auto encoding = parse_text_encoding(*next_arg);
+			if (!encoding) {
+				fmt::print(err, "value for option \"{}\" is neither \"utf8\" nor \"utf16\".\n", current_arg);
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			(current_arg == "--from-encoding" ? parsed.from_encoding : parsed.to_encoding) = encoding;
+		}
+		else if (current_arg == "--stats") {
+			parsed.options.stats = parsed.options.stats.value_or(stats_option{});
+		}
+		else if (current_arg == "--stats-interval") {
+			if (!check_next_arg("--stats-interval"))
+				return std::nullopt;
+			auto milliseconds = string_to_uint<uint32_t>(*next_arg);
+			if (!milliseconds || *milliseconds == 0) {
+				fmt::print(err, "value for option \"--stats-interval\" is not a positive number of milliseconds.\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.options.stats = stats_option{ .interval{std::chrono::milliseconds{*milliseconds}} };
+		}
+		else if (current_arg == "--transport") {
+			if (!check_next_arg("--transport"))
+				return std::nullopt;
+			auto transport = ParseTransport(*next_arg);
+			if (!transport) {
+				fmt::print(err, "value for option \"--transport\" is neither \"pipe\" nor \"shm\".\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.options.transport = *transport;
+		}
+		else if (current_arg == "--handle") {
+			if (!check_next_arg("--handle"))
+				return std::nullopt;
+			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
+			if (!opt_uint) {
+				fmt::print(err, "value for option \"--handle\" is not a number or not in range.\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.handle_in_or_out = std::bit_cast<intptr_t>(opt_uint.value());
+		}
+		else if (current_arg == "--return-handle") {
+			if (!check_next_arg("--return-handle"))
+				return std::nullopt;
+			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
+			if (!opt_uint) {
+				fmt::print(err, "value for option \"--return-handle\" is not a number or not in range.\n");
+				PrintUsage(err);
+				return std::nullopt;
+			}
+			parsed.return_handle = std::bit_cast<intptr_t>(opt_uint.value());
+		}
+		else {
+			fmt::print(err, "Argument {}{}{} could not be interpreted\n", quote_open, current_arg, quote_close);
+			PrintUsage(err);
+			return std::nullopt;
+		}
+	}
+	return parsed;
+}
+
+
+constexpr std::string_view BROKER_TOOL_NAME{ "pipe-to-con" };
+
+// Opens a session with the broker of the console of `PID` (option "--broker"). Returns
+// std::nullopt, if no broker serves that console; the caller spawns a secondary process
+// then. Returns nullptr, if the broker rejected the session.
+std::optional<std::unique_ptr<byte_stream>> OpenBrokerSession(uint32_t PID, bool to_secondary, const relay_options& options) {
+	// The broker relays like a secondary process. The conversion of "--from-encoding"
+	// and "--to-encoding" stays here, like with a secondary process.
+	broker_connection connection = connect_to_broker(broker_endpoint(BROKER_TOOL_NAME, PID),
+		fmt::format("--{}-secondary {}", (to_secondary ? "to" : "from"), SecondaryArguments(options)));
+	switch (connection.status) {
+	case broker_status::absent:
+		return std::nullopt;
+	case broker_status::rejected:
+		fmt::print(stderr, "The broker of the console of process {} rejected the session: {}\n", PID, connection.reason);
+		return nullptr;
+	case broker_status::accepted:
+		break;
+	}
+	return std::move(connection.stream);
+}
+
+// Relays through the broker of the console of `PID`. Returns std::nullopt, if no
+// broker serves that console.
+std::optional<bool> RelayThroughBroker(uint32_t PID, bool to_secondary, const relay_options& options) {
+	std::optional<std::unique_ptr<byte_stream>> session = OpenBrokerSession(PID, to_secondary, options);
+	if (!session)
+		return std::nullopt;
+	if (!*session)
+		return false;
+	return ReadOrWrite(*session, !to_secondary, options);
+}
+
+// Option "--pid" more than once: every read of stdin goes to the consoles of all PIDs,
+// each through its broker or a secondary process of its own (fanout.h).
+bool FanOut(const command_line& arguments, const relay_options& options) {
+	bool success{ true };
+	std::vector<fanout_target> targets{};
+	std::vector<secondary_process> secondaries{};
+	for (uint32_t PID : arguments.PIDs) {
+		std::optional<std::unique_ptr<byte_stream>> session{ std::nullopt };
+		if (!arguments.no_direct) {
+			if (auto direct = OpenDirect(PID, true, options))
+				session = std::move(direct);
+		}
+		if (!session && !arguments.no_broker)
+			session = OpenBrokerSession(PID, true, options);
+		if (session && !*session) {
+			success = false;
+			continue;
+		}
+		if (!session) {
+			std::optional<secondary_process> secondary = StartSecondary(PID, true, false, options);
+			if (!secondary) {
+				success = false;
+				continue;
+			}
+			session = std::move(secondary->pipe);
+			secondaries.push_back(std::move(*secondary));
+		}
+		targets.push_back(fanout_target{ .name{fmt::format("process {}", PID)}, .sink{std::move(*session)} });
+	}
+	if (targets.empty())
+		return false;
+
+	fanout_option fanout = arguments.fanout;
+	fanout.unit_size = (PipeEncoding(options) == text_encoding::utf16le) ? sizeof(char16_t) : 1;
+	fanout_sink sink{ std::move(targets), fanout };
+	const bool relayed = (options.utf8 || options.stream_encoding)
+		? ReadStdInWritePipeBytes(sink, options)
+		: ReadStdInConsoleWritePipe(sink, options);
+
+	for (const fanout_result& result : sink.finish()) {
+		if (result.failed) {
+			fmt::print(stderr, "The relay to {} failed after {} bytes.\n", result.name, result.bytes_written);
+			success = false;
+		}
+		else if (result.disconnected) {
+			fmt::print(stderr, "{} fell behind by more than {} bytes and was disconnected after {} bytes.\n",
+				result.name, fanout.max_lag, result.bytes_written);
+		}
+		else if (result.bytes_dropped > 0) {
+			fmt::print(stderr, "{} fell behind and missed {} bytes.\n", result.name, result.bytes_dropped);
+		}
+	}
+	for (secondary_process& secondary : secondaries)
+		success = WaitForSecondary(secondary) && success;
+	return relayed && success;
+}
+
+// Relays both directions of "--duplex" at once: we write `outgoing` and read `incoming`,
+// like ReadOrWrite() does for one direction. In the primary process, stdin goes out
+// and stdout gets, what comes in; in the secondary process, the console input goes out.
+bool RelayDuplex(std::unique_ptr<byte_stream> outgoing, std::unique_ptr<byte_stream> incoming, const relay_options& options, duplex_end end) {
+	// The relays own a copy of the options, because one of them may be left behind.
+	return relay_duplex(
+		std::move(outgoing), [options](std::unique_ptr<byte_stream>& pipe) { return ReadOrWrite(pipe, false, options); },
+		std::move(incoming), [options](std::unique_ptr<byte_stream>& pipe) { return ReadOrWrite(pipe, true, options); },
+		end);
+}
+
+// Option "--duplex": stdin goes to the console of `PID`, while the input of that
+// console comes back to stdout. Both directions take the same way: the direct path,
+// two sessions of the broker, or one secondary process with two pipes.
+bool RunDuplex(const command_line& arguments, const relay_options& options) {
+	const uint32_t PID = arguments.PIDs.front();
+	if (!arguments.no_direct) {
+		std::unique_ptr<byte_stream> to_console = OpenDirect(PID, true, options);
+		std::unique_ptr<byte_stream> from_console = to_console ? OpenDirect(PID, false, options) : nullptr;
+		if (from_console)
+			return RelayDuplex(std::move(to_console), std::move(from_console), options, duplex_end::either);
+	}
+	if (!arguments.no_broker) {
+		std::optional<std::unique_ptr<byte_stream>> to_console = OpenBrokerSession(PID, true, options);
+		if (to_console) {
+			if (!*to_console)
+				return false;
+			std::optional<std::unique_ptr<byte_stream>> from_console = OpenBrokerSession(PID, false, options);
+			if (!from_console || !*from_console) {
+				fmt::print(stderr, "The broker of the console of process {} did not open the second direction.\n", PID);
+				return false;
+			}
+			return RelayDuplex(std::move(*to_console), std::move(*from_console), options, duplex_end::either);
+		}
+	}
+
+	std::optional<secondary_process> secondary = StartSecondary(PID, true, true, options);
+	if (!secondary)
+		return false;
+	// The secondary process ends the session, when one of its directions ends, and we
+	// see the end of its return pipe then. That way, the input of the console, that it
+	// has read until then, still reaches stdout.
+	const bool relayed = RelayDuplex(std::move(secondary->pipe), std::move(secondary->return_pipe), options, duplex_end::incoming);
+	if (!relayed) {
+		// stdout is gone. The secondary process may wait for input of the console,
+		// that nobody would read.
+		TerminateProcess(secondary->process, 1);
+	}
+	return WaitForSecondary(*secondary) && relayed;
+}
+
+// Hands a session of the broker to `loop`, if it is a plain copy of bytes: UTF-8, without
+// statistics and without the options of the blocking loops, and both ends can be waited
+// for. The loop owns the streams then. Returns false, and leaves `connection` alone, if
+// the session needs its own thread.
+bool AddToRelayLoop(relay_loop& loop, std::unique_ptr<byte_stream>& connection, bool bReadFromPipe, const relay_options& options) {
+	if (!options.utf8 || options.stream_encoding || options.stats || options.pipeline || options.io_uring)
+		return false;
+	auto console_handle = get_std_handle(bReadFromPipe ? std_stream::out : std_stream::in);
+	if (!console_handle)
+		return false;
+	std::unique_ptr<byte_stream> console = open_byte_stream(*console_handle);
+	if (!console->pollable_handle() || !connection->pollable_handle())
+		return false;
+	// A session, that the loop still rejects, ends with its streams.
+	if (bReadFromPipe)
+		(void)loop.add(std::move(connection), std::move(console));
+	else
+		(void)loop.add(std::move(console), std::move(connection));
+	return true;
+}
+
+// Attaches to the console of `PID` once and relays the sessions of other invocations,
+// each like a secondary process, until `PID` ends.
+bool RunBroker(uint32_t PID) {
+	auto listener = listen_local(broker_endpoint(BROKER_TOOL_NAME, PID));
+	if (!listener) {
+		fmt::print(stderr, "Could not create the endpoint of the broker. Does a broker for process {} run already?\n", PID);
+		return false;
+	}
+
+	// The handle keeps the PID from being reused, while we wait for the process.
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, PID);
+	if (hProcess == nullptr) {
+		auto error = GetLastError();
+		fmt::print(stderr, "OpenProcess({}) failed with error {} - {}", PID, error, indent_message("  ", get_error_message(error).value_or("")));
+		return false;
+	}
+	if (!AttachToConsole(PID)) {
+		CloseHandle(hProcess);
+		return false;
+	}
+	// The broker keeps the console alive, so it must not outlive the target process.
+	// Sessions, that are still running, end with it.
+	std::thread([hProcess] {
+		WaitForSingleObject(hProcess, INFINITE);
+		ExitProcess(0);
+	}).detach();
+
+	// Byte-wise sessions share one thread, where the platform has a relay loop. The
+	// others, and all sessions without a loop (Windows so far), keep a thread each.
+	std::unique_ptr<relay_loop> loop = create_relay_loop();
+	std::thread loop_thread{};
+	if (loop) {
+		loop_thread = std::thread([&loop] {
+			trace_thread_name("relay loop");
+			loop->run();
+		});
+	}
+
+	serve_broker_sessions(*listener, [&loop](broker_session& session) {
+		std::optional<command_line> request = ParseArguments(session.arguments(), stderr);
+		if (!request || request->to_secondary == request->from_secondary) {
+			session.reject("The arguments of the session are not valid.");
+			return;
+		}
+		if (!session.accept())
+			return;
+		if (loop && AddToRelayLoop(*loop, session.connection(), request->to_secondary, request->options))
+			return;
+		(void)ReadOrWrite(session.connection(), request->to_secondary, request->options);
+	});
+	fmt::print(stderr, "The broker stopped accepting sessions.\n");
+	if (loop) {
+		loop->stop();
+		loop_thread.join();
+	}
+	return false;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	trace_session trace{ "pipe-to-con" };
+	_set_fmode(_O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+	_setmode(_fileno(stderr), _O_BINARY);
+	_setmode(_fileno(stdin), _O_BINARY);
+
+	if(false){
+		fmt::println("wait for debugger debug break");
+		while (!IsDebuggerPresent()) {
+			using namespace std::chrono_literals;
+			std::this_thread::sleep_for(10ms);
+		}
+		DebugBreak();
+	}
+
+	if (GetACP() != 65001) {
+		fmt::print(stderr, "The Active Code Page (ACP) for this process is not UTF-8 (65001).\n"
+			"Command line parsing is not supported.\n"
+			"Your version of Windows might be to old, so that the manifest embedded in the executable is not read. "
+			"The manifest specifies, that this executable wants UTF-8 as ACP.\n"
+			"As a workaround you can activate \"Beta: Use Unicode UTF-8 for worldwide language support\":\n"
+			"  - Press Win+R\n"
+			"  - Type \"intl.cpl\"\n"
+			"  - Goto Tab \"Administrative\"\n"
+			"  - Click on \"Change system locale\"\n"
+			"  - Set Checkbox \"Beta: Use Unicode UTF-8 for worldwide language support\"\n"
+			"\n");
+		//PrintUsage(stderr);
+		return 1;
+	}
+
+	std::optional<command_line> parsed = ParseArguments(std::vector<std::string_view>(argv + 1, argv + argc), stderr);
+	if (!parsed)
+		return 1;
+	const command_line& arguments = *parsed;
+	relay_options options = arguments.options;
+
+	if (arguments.PIDs.empty()) {
+		fmt::print(stderr,
+				"Error: Must specify a process identifier with the option \"--pid\"\n");
+		return 1;
+	}
+
+	if (arguments.PIDs.size() > 1 && (arguments.broker || arguments.secondary || arguments.from_secondary || arguments.duplex)) {
+		fmt::print(stderr,
+				"Error: The option \"--pid\" can only be given more than once with \"--to-secondary\" in the primary process.\n");
+		return 1;
+	}
+
+	if (arguments.broker) {
+		if (arguments.secondary || arguments.handle_in_or_out || arguments.to_secondary || arguments.from_secondary || arguments.duplex) {
+			fmt::print(stderr,
+					"Error: The option \"--broker\" takes no direction and no handle. The clients choose them.\n");
+			return 1;
+		}
+		if (!RunBroker(arguments.PIDs.front())) {
+			return 1;
+		}
+		return 0;
+	}
+
+	if (arguments.duplex) {
+		if (arguments.to_secondary || arguments.from_secondary) {
+			fmt::print(stderr,
+					"Error: The option \"--duplex\" relays both directions. "
+					"Do not add \"--to-secondary\" or \"--from-secondary\"\n");
+			return 1;
+		}
+		if (arguments.from_encoding || arguments.to_encoding) {
+			fmt::print(stderr,
+					"Error: The options \"--from-encoding\" and \"--to-encoding\" are not supported with \"--duplex\".\n");
+			return 1;
+		}
+	}
+	else if (arguments.to_secondary == arguments.from_secondary) {
+		if (arguments.to_secondary) {
+			fmt::print(stderr,
+					"Error: You are not allowed to set both options "
+					"\"--to-secondary\" and \"from-secondary\"\n");
+		}else{
+			fmt::print(stderr,
+					"Error: You must specifiy one of these options: "
+					"\"--to-secondary\", \"from-secondary\"\n");
+		}
+		return 1;
+	}
+
+	if (arguments.from_encoding || arguments.to_encoding) {
+		if (arguments.secondary) {
+			fmt::print(stderr,
+					"Error: The options \"--from-encoding\" and \"--to-encoding\" are only for the primary process.\n");
+			return 1;
+		}
+		// The pipe and the secondary process use the encoding of the console side. The
+		// primary process converts between its stdin or stdout and the pipe.
+		const std::optional<text_encoding>& console_side = arguments.to_secondary ? arguments.to_encoding : arguments.from_encoding;
+		const std::optional<text_encoding>& stream_side = arguments.to_secondary ? arguments.from_encoding : arguments.to_encoding;
+		const text_encoding console_encoding = console_side.value_or(PipeEncoding(options));
+		options.utf8 = (console_encoding == text_encoding::utf8);
+		options.stream_encoding = stream_side.value_or(console_encoding);
+	}
+
+	if (arguments.secondary) {
+		if(!arguments.handle_in_or_out.has_value()) {
+			fmt::print(stderr,
+					"Error: You must specify a handle value, for the secondary process.\n");
+			return 1;
+		}
+		if (arguments.return_handle.has_value() != arguments.duplex) {
+			fmt::print(stderr,
+					"Error: The secondary process gets a return handle with \"--duplex\", and only then.\n");
+			return 1;
+		}
+		const intptr_t handle_intptr = arguments.handle_in_or_out.value();
+		HANDLE handle = std::bit_cast<HANDLE>(handle_intptr);
+		const bool is_handle_input = arguments.to_secondary || arguments.duplex;
+		if(!AttachToConsole(arguments.PIDs.front())) {
+			return 1;
+		}
+		auto open_pipe = [&](HANDLE pipe_handle, bool is_input) -> std::unique_ptr<byte_stream> {
+			if (options.transport != transport_kind::shm)
+				return open_byte_stream(pipe_handle, true);
+			// We read from the ring with "--to-secondary" and write into it otherwise.
+			auto ring = open_shm_ring(pipe_handle, is_input ? shm_ring_side::consumer : shm_ring_side::producer);
+			if (!ring)
+				fmt::print(stderr, "Error: The handle is no shared memory ring.\n");
+			return ring;
+		};
+		std::unique_ptr<byte_stream> pipe = open_pipe(handle, is_handle_input);
+		if (!pipe) {
+			return 1;
+		}
+		if (arguments.duplex) {
+			std::unique_ptr<byte_stream> return_pipe = open_pipe(std::bit_cast<HANDLE>(*arguments.return_handle), false);
+			if (!return_pipe) {
+				return 1;
+			}
+			// Whichever direction ends first, ends the session: the blocking reads of the
+			// other one cannot be interrupted, but the end of this process closes the pipes.
+			if (!RelayDuplex(std::move(return_pipe), std::move(pipe), options, duplex_end::either)) {
+				return 1;
+			}
+			return 0;
+		}
+		if (!ReadOrWrite(pipe, is_handle_input, options)) {
+			return 1;
+		}
+		return 0;
+	}else{
+		if(arguments.handle_in_or_out.has_value() || arguments.return_handle.has_value()) {
+			fmt::print(stderr,
+					"Error: You must not specify a handle value, for the primary process.\n");
+			return 1;
+		}
+		if (arguments.PIDs.size() > 1) {
+			return FanOut(arguments, options) ? 0 : 1;
+		}
+		if (arguments.duplex) {
+			return RunDuplex(arguments, options) ? 0 : 1;
+		}
+		if (!arguments.no_direct) {
+			if (auto direct = OpenDirect(arguments.PIDs.front(), arguments.to_secondary, options))
+				return ReadOrWrite(direct, !arguments.to_secondary, options) ? 0 : 1;
+		}
+		if (!arguments.no_broker) {
+			if (auto relayed = RelayThroughBroker(arguments.PIDs.front(), arguments.to_secondary, options)) {
+				return *relayed ? 0 : 1;
+			}
+		}
+		if (!SpawnSelf(arguments.PIDs.front(), arguments.to_secondary, options)){
+			return 1;
+		}
+		return 0;
+	}
+	
+
+	return 0;
+}
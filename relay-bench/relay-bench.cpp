@@ -0,0 +1,2790 @@
+// Program "relay-bench"
+//
+// Measures the relay loops of shared/relay.cpp on top of the I/O layer of
+// the current platform (Win32 pipes, or POSIX pipes and pseudo-terminals).
+
+#include <console-tools/broker.h>
+#include <console-tools/console_relay.h>
+#include <console-tools/ctrl_event.h>
+#include <console-tools/helper.h>
+#include <console-tools/io.h>
+#include <console-tools/relay.h>
+#include <console-tools/relay_async.h>
+#include <console-tools/relay_loop.h>
+#include <console-tools/shm_ring.h>
+#include <console-tools/spsc_ring.h>
+#include <console-tools/utf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if __has_include(<nowide/utf/convert.hpp>)
+#include <nowide/utf/convert.hpp>
+#define RELAY_BENCH_HAS_NOWIDE 1
+#endif
+
+// Number of calls to operator new, for the allocation counts of "echo". All forms of
+// operator new and delete are replaced, so that each delete frees, what its new allocated.
+std::atomic<std::size_t> g_allocations{ 0 };
+
+// The deletes free through functions, that are not inlined. Otherwise GCC sees free() on
+// a pointer from operator new at the call sites (-Wmismatched-new-delete).
+#if defined(_MSC_VER)
+#define RELAY_BENCH_NOINLINE __declspec(noinline)
+#else
+#define RELAY_BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+namespace {
+void* counted_malloc(std::size_t size) noexcept {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void* counted_aligned_malloc(std::size_t size, std::align_val_t alignment) noexcept {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	const auto align = static_cast<std::size_t>(alignment);
+#if defined(_WIN32)
+	return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+	// aligned_alloc() wants a multiple of the alignment.
+	return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif
+}
+
+RELAY_BENCH_NOINLINE void plain_free(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+RELAY_BENCH_NOINLINE void aligned_free(void* ptr) noexcept {
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+}
+
+void* operator new(std::size_t size) {
+	if (void* ptr = counted_malloc(size))
+		return ptr;
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	return counted_malloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return counted_malloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	if (void* ptr = counted_aligned_malloc(size, alignment))
+		return ptr;
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return ::operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return counted_aligned_malloc(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return counted_aligned_malloc(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+	plain_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+	aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+	aligned_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+	aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+	aligned_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+	aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+	aligned_free(ptr);
+}
+
+struct bench_args {
+	std::size_t megabytes{ 64 };
+	std::size_t chunk_size{ 64u * 1024u };
+	// Simulated speed of the producer and of the console in MB/s.
+	std::size_t read_rate{ 200 };
+	std::size_t write_rate{ 200 };
+	// Only for "suite" and "duplex". Without it, the default of the tools.
+	std::optional<buffer_size_option> buffer_size{ std::nullopt };
+};
+
+// Sleeps, so that the bytes passed to `consume()` flow with `rate` MB/s on average.
+class pacer {
+public:
+	explicit pacer(std::size_t rate) : m_rate{ rate } {}
+
+	void consume(std::size_t bytes) {
+		if (m_rate == 0)
+			return;
+		auto now = std::chrono::steady_clock::now();
+		if (m_next < now)
+			m_next = now;
+		m_next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(static_cast<double>(bytes) / (static_cast<double>(m_rate) * 1e6)));
+		std::this_thread::sleep_until(m_next);
+	}
+
+private:
+	std::size_t m_rate;
+	std::chrono::steady_clock::time_point m_next{};
+};
+
+// A producer of UTF-16LE text, that needs time for every chunk.
+class paced_source final : public byte_source {
+public:
+	paced_source(std::size_t total, std::size_t chunk_size, std::size_t rate)
+		: m_remaining{ total }, m_chunk_size{ chunk_size }, m_pacer{ rate } {}
+
+	io_result read(std::span<char> buffer) override {
+		if (m_remaining == 0)
+			return io_result{ .status{io_status::eof} };
+		// Odd sizes on purpose, so that code units are split between reads.
+		std::size_t count = std::min({ buffer.size(), m_chunk_size - 1, m_remaining });
+		for (std::size_t i = 0; i < count; ++i)
+			buffer[i] = ((m_position + i) % 2 == 0) ? 'a' : '\0';
+		m_position += count;
+		m_remaining -= count;
+		m_pacer.consume(count);
+		return io_result{ .count{count} };
+	}
+
+private:
+	std::size_t m_remaining;
+	std::size_t m_chunk_size;
+	std::size_t m_position{ 0 };
+	pacer m_pacer;
+};
+
+// A console, that needs time to render.
+class paced_console final : public console_sink {
+public:
+	explicit paced_console(std::size_t rate) : m_pacer{ rate } {}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override {
+		for (char16_t c : buffer)
+			if (c != u'a')
+				++corrupted;
+		code_units += buffer.size();
+		m_pacer.consume(buffer.size() * sizeof(char16_t));
+		return io_result{ .count{buffer.size()} };
+	}
+
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+
+	std::size_t code_units{ 0 };
+	std::size_t corrupted{ 0 };
+
+private:
+	pacer m_pacer;
+};
+
+// A console, that is gone: every write fails.
+class failing_console final : public console_sink {
+public:
+	io_result write_utf16(std::span<const char16_t>) override { return io_result{ .status{io_status::error} }; }
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+};
+
+// A console, that accepts every write, but takes no code unit.
+class stalled_console final : public console {
+public:
+	io_result read_utf16(std::span<char16_t>) override { return io_result{ .status{io_status::eof} }; }
+	io_result write_utf16(std::span<const char16_t>) override { return io_result{}; }
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+	std::optional<native_handle_t> handle() const override { return std::nullopt; }
+};
+
+// Counts the reads. It does not pass on the handle, so the relay always takes the copy loop.
+class counting_source final : public byte_source {
+public:
+	explicit counting_source(byte_source& inner) : m_inner{ inner } {}
+
+	io_result read(std::span<char> buffer) override {
+		++reads;
+		return m_inner.read(buffer);
+	}
+
+	std::size_t reads{ 0 };
+
+private:
+	byte_source& m_inner;
+};
+
+// Counts the writes. Like counting_source, it hides the handle.
+class counting_sink final : public byte_sink {
+public:
+	explicit counting_sink(byte_sink& inner) : m_inner{ inner } {}
+
+	io_result write(std::span<const char> buffer) override {
+		++writes;
+		return m_inner.write(buffer);
+	}
+
+	std::size_t writes{ 0 };
+
+private:
+	byte_sink& m_inner;
+};
+
+class null_sink final : public byte_sink {
+public:
+	io_result write(std::span<const char> buffer) override {
+		bytes += buffer.size();
+		return io_result{ .count{buffer.size()} };
+	}
+
+	std::size_t bytes{ 0 };
+};
+
+// Writes `total` bytes in chunks of `chunk_size` into `sink` and closes it afterwards.
+std::thread StartProducer(std::unique_ptr<byte_stream> sink, std::size_t total, std::size_t chunk_size) {
+	return std::thread([sink = std::move(sink), total, chunk_size]() mutable {
+		std::vector<char> chunk(chunk_size, 'x');
+		for (std::size_t i = 0; i < chunk.size(); i += 80)
+			chunk[i] = '\n';
+
+		std::size_t remaining = total;
+		while (remaining > 0) {
+			std::size_t offset = 0;
+			std::size_t to_write = std::min(remaining, chunk.size());
+			while (offset < to_write) {
+				io_result result = sink->write(std::span<const char>(chunk.data() + offset, to_write - offset));
+				if (!result.ok() || result.count == 0)
+					return;
+				offset += result.count;
+			}
+			remaining -= to_write;
+		}
+		sink.reset(); // EOF for the reader
+	});
+}
+
+bool BenchBufferSize(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+
+	std::vector<buffer_size_option> options{};
+	for (std::size_t size = DEFAULT_BUFFER_SIZE; size <= MAX_ADAPTIVE_BUFFER_SIZE; size *= 4)
+		options.push_back(buffer_size_option{ .size{size} });
+	options.push_back(buffer_size_option{ .adaptive{true} });
+
+	fmt::print("ReadHandleWriteFileByteWise, {} MiB through a pipe, written in chunks of {} bytes\n\n", args.megabytes, args.chunk_size);
+	fmt::print("{:>12}  {:>10}  {:>10}  {:>12}\n", "buffer-size", "MB/s", "reads", "reads/MB");
+
+	for (auto option : options) {
+		auto pipe = create_pipe();
+		if (!pipe) {
+			fmt::print(stderr, "Failed to create pipe\n");
+			return false;
+		}
+
+		counting_source source{ *pipe->read_end };
+		null_sink sink{};
+
+		auto start = std::chrono::steady_clock::now();
+		std::thread producer = StartProducer(std::move(pipe->write_end), total, args.chunk_size);
+		bool success = ReadHandleWriteFileByteWise(source, sink, option);
+		producer.join();
+		auto stop = std::chrono::steady_clock::now();
+
+		if (!success || sink.bytes != total) {
+			fmt::print(stderr, "Relay failed after {} bytes\n", sink.bytes);
+			return false;
+		}
+
+		const double seconds = std::chrono::duration<double>(stop - start).count();
+		const double megabytes = static_cast<double>(total) / 1e6;
+		fmt::print("{:>12}  {:>10.1f}  {:>10}  {:>12.1f}\n",
+			buffer_size_option_to_string(option), megabytes / seconds, source.reads, static_cast<double>(source.reads) / megabytes);
+	}
+	return true;
+}
+
+// The console fails, while the pipe stays open without data: the pipelined relay must
+// return false, like the sequential one, instead of waiting for its reader.
+bool CheckPipelineConsoleFailure(std::size_t chunk_size) {
+	auto pipe = create_pipe();
+	if (!pipe)
+		return false;
+	const std::string text(64, 'a');
+	if (pipe->write_end->write(text).count != text.size())
+		return false;
+
+	struct outcome {
+		std::atomic<bool> ended{ false };
+		bool success{ true };
+	};
+	auto result = std::make_shared<outcome>();
+	std::shared_ptr<byte_stream> source{ std::move(pipe->read_end) };
+	const auto start = std::chrono::steady_clock::now();
+	std::thread relay([result, source, chunk_size] {
+		failing_console console{};
+		result->success = ReadPipeWriteConsolePipelined(*source, console, buffer_size_option{ .size{chunk_size} },
+			pipeline_option{ .memory_cap{4 * chunk_size} });
+		result->ended.store(true, std::memory_order_release);
+	});
+	while (!result->ended.load(std::memory_order_acquire) && std::chrono::steady_clock::now() - start < std::chrono::seconds{ 5 })
+		std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+	const auto stop = std::chrono::steady_clock::now();
+
+	const bool ended = result->ended.load(std::memory_order_acquire);
+	if (ended)
+		relay.join();
+	else
+		relay.detach(); // stuck in the read; it ends with the process
+	const bool ok = ended && !result->success;
+	fmt::print("\nFailing console with an idle pipe: {} after {:.1f} ms\n",
+		ok ? "ok" : "FAILED", std::chrono::duration<double>(stop - start).count() * 1e3);
+	return ok;
+}
+
+// The stream of open_console_stream() on a console, that takes nothing: the write has to fail.
+bool CheckStalledConsoleStream() {
+	auto result = std::make_shared<std::atomic<int>>(-1);
+	const auto start = std::chrono::steady_clock::now();
+	std::thread writer([result] {
+		std::unique_ptr<byte_stream> stream = open_console_stream(std::make_unique<stalled_console>(), text_encoding::utf16le);
+		const char text[4]{ 'a', '\0', 'b', '\0' };
+		result->store(stream->write(text).ok() ? 1 : 0, std::memory_order_release);
+	});
+	while (result->load(std::memory_order_acquire) < 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds{ 5 })
+		std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+	const auto stop = std::chrono::steady_clock::now();
+
+	const bool ended = result->load(std::memory_order_acquire) >= 0;
+	if (ended)
+		writer.join();
+	else
+		writer.detach(); // spins; it ends with the process
+	const bool ok = ended && result->load() == 0;
+	fmt::print("Console stream, that takes nothing: {} after {:.1f} ms\n",
+		ok ? "ok" : "FAILED", std::chrono::duration<double>(stop - start).count() * 1e3);
+	return ok;
+}
+
+bool BenchPipeline(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const buffer_size_option buffer_size{ .size{args.chunk_size} };
+
+	fmt::print("ReadPipeWriteConsole, {} MiB, producer {} MB/s, console {} MB/s, buffers of {} bytes\n\n",
+		args.megabytes, args.read_rate, args.write_rate, args.chunk_size);
+	fmt::print("{:>16}  {:>10}  {:>10}\n", "pipeline", "MB/s", "seconds");
+
+	std::vector<std::optional<pipeline_option>> pipelines{ std::nullopt };
+	for (std::size_t slots : { 2u, 4u, 16u })
+		pipelines.push_back(pipeline_option{ .memory_cap{slots * args.chunk_size} });
+
+	for (auto pipeline : pipelines) {
+		paced_source source{ total, args.chunk_size, args.read_rate };
+		paced_console console{ args.write_rate };
+
+		auto start = std::chrono::steady_clock::now();
+		bool success = pipeline
+			? ReadPipeWriteConsolePipelined(source, console, buffer_size, *pipeline)
+			: ReadPipeWriteConsole(source, console, buffer_size);
+		auto stop = std::chrono::steady_clock::now();
+
+		if (!success || console.code_units != total / 2 || console.corrupted != 0) {
+			fmt::print(stderr, "Relay failed: {} code units, {} corrupted\n", console.code_units, console.corrupted);
+			return false;
+		}
+
+		const double seconds = std::chrono::duration<double>(stop - start).count();
+		fmt::print("{:>16}  {:>10.1f}  {:>10.3f}\n",
+			pipeline ? pipeline_option_to_string(*pipeline) : std::string{ "none" },
+			static_cast<double>(total) / 1e6 / seconds, seconds);
+	}
+	return CheckPipelineConsoleFailure(args.chunk_size) && CheckStalledConsoleStream();
+}
+
+// Reads everything from `source` and throws it away. Returns the number of bytes.
+std::thread StartDrain(std::unique_ptr<byte_stream> source, std::size_t& total) {
+	return std::thread([source = std::move(source), &total]() mutable {
+		std::vector<char> buffer(64u * 1024u);
+		while (true) {
+			io_result result = source->read(buffer);
+			if (!result.ok())
+				break;
+			total += result.count;
+		}
+	});
+}
+
+bool BenchZeroCopy(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const buffer_size_option buffer_size{ .size{args.chunk_size} };
+
+	fmt::print("ReadHandleWriteFileByteWise, {} MiB from a pipe into a pipe, buffers of {} bytes\n\n", args.megabytes, args.chunk_size);
+	fmt::print("{:>12}  {:>10}  {:>10}\n", "path", "MB/s", "seconds");
+
+	for (bool zero_copy : { false, true }) {
+		auto in_pipe = create_pipe();
+		auto out_pipe = create_pipe();
+		if (!in_pipe || !out_pipe) {
+			fmt::print(stderr, "Failed to create pipe\n");
+			return false;
+		}
+
+		std::size_t drained{ 0 };
+		auto start = std::chrono::steady_clock::now();
+		std::thread producer = StartProducer(std::move(in_pipe->write_end), total, args.chunk_size);
+		std::thread drain = StartDrain(std::move(out_pipe->read_end), drained);
+		bool success{ false };
+		{
+			auto out = std::move(out_pipe->write_end);
+			if (zero_copy) {
+				success = ReadHandleWriteFileByteWise(*in_pipe->read_end, *out, buffer_size);
+			}
+			else {
+				counting_source source{ *in_pipe->read_end };
+				success = ReadHandleWriteFileByteWise(source, *out, buffer_size);
+			}
+		}
+		producer.join();
+		drain.join();
+		auto stop = std::chrono::steady_clock::now();
+
+		if (!success || drained != total) {
+			fmt::print(stderr, "Relay failed after {} bytes\n", drained);
+			return false;
+		}
+
+		const double seconds = std::chrono::duration<double>(stop - start).count();
+		fmt::print("{:>12}  {:>10.1f}  {:>10.3f}\n", zero_copy ? "zero-copy" : "copy",
+			static_cast<double>(total) / 1e6 / seconds, seconds);
+	}
+	return true;
+}
+
+bool BenchIoUring(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const buffer_size_option buffer_size{ .size{args.chunk_size} };
+
+	fmt::print("ReadHandleWriteFileByteWise, {} MiB from a pipe into a pipe, buffers of {} bytes\n\n", args.megabytes, args.chunk_size);
+	fmt::print("{:>12}  {:>10}  {:>10}  {:>12}\n", "io-uring", "MB/s", "syscalls", "syscalls/MB");
+
+	std::vector<std::optional<io_uring_option>> variants{ std::nullopt };
+	for (unsigned depth : { 2u, 4u, 16u })
+		variants.push_back(io_uring_option{ .queue_depth{depth} });
+
+	for (auto variant : variants) {
+		auto in_pipe = create_pipe();
+		auto out_pipe = create_pipe();
+		if (!in_pipe || !out_pipe) {
+			fmt::print(stderr, "Failed to create pipe\n");
+			return false;
+		}
+
+		std::size_t drained{ 0 };
+		std::size_t syscalls{ 0 };
+		auto start = std::chrono::steady_clock::now();
+		std::thread producer = StartProducer(std::move(in_pipe->write_end), total, args.chunk_size);
+		std::thread drain = StartDrain(std::move(out_pipe->read_end), drained);
+		std::optional<bool> success{};
+		{
+			auto out = std::move(out_pipe->write_end);
+			if (variant) {
+				success = ReadHandleWriteFileByteWiseUring(*in_pipe->read_end, *out, buffer_size, *variant, &syscalls);
+				if (!success) {
+					fmt::print("{:>12}  io_uring is not available\n", io_uring_option_to_string(*variant));
+					out.reset();
+					in_pipe->read_end.reset();
+					producer.join();
+					drain.join();
+					continue;
+				}
+			}
+			else {
+				// The shape of the ReadFile/WriteFile loop: one read and one write per buffer.
+				counting_source source{ *in_pipe->read_end };
+				counting_sink sink{ *out };
+				success = ReadHandleWriteFileByteWise(source, sink, buffer_size);
+				syscalls = source.reads + sink.writes;
+			}
+		}
+		producer.join();
+		drain.join();
+		auto stop = std::chrono::steady_clock::now();
+
+		if (!*success || drained != total) {
+			fmt::print(stderr, "Relay failed after {} bytes\n", drained);
+			return false;
+		}
+
+		const double seconds = std::chrono::duration<double>(stop - start).count();
+		const double megabytes = static_cast<double>(total) / 1e6;
+		fmt::print("{:>12}  {:>10.1f}  {:>10}  {:>12.1f}\n",
+			variant ? io_uring_option_to_string(*variant) : std::string{ "blocking" },
+			megabytes / seconds, syscalls, static_cast<double>(syscalls) / megabytes);
+	}
+	return true;
+}
+
+// Repeats `sample` up to `total` bytes, in whole characters.
+std::string MakeText(std::string_view sample, std::size_t total) {
+	std::string text{};
+	text.reserve(total + sample.size());
+	while (text.size() < total)
+		text += sample;
+	return text;
+}
+
+// Converts `text` in chunks of `chunk_size` bytes, like the relay does, and returns MB/s of input.
+template<class convert_function>
+double MeasureConversion(std::size_t input_bytes, convert_function convert) {
+	auto start = std::chrono::steady_clock::now();
+	std::size_t output = convert();
+	auto stop = std::chrono::steady_clock::now();
+	if (output == 0)
+		return 0.0;
+	return static_cast<double>(input_bytes) / 1e6 / std::chrono::duration<double>(stop - start).count();
+}
+
+bool BenchUtf(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const std::size_t chunk = args.chunk_size;
+
+	struct scenario {
+		std::string_view name;
+		std::string_view sample;
+	};
+	const scenario scenarios[]{
+		{ "ascii", "The quick brown fox jumps over the lazy dog, 0123456789.\r\n" },
+		{ "latin", "Gr\xC3\xBC\xC3\x9F" "e aus K\xC3\xB6ln, sch\xC3\xB6ne Gr\xC3\xBC\xC3\x9F" "e.\r\n" },
+		{ "cjk", "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE\xE6\x96\x87\xE7\xAB\xA0\xE3\x80\x82\r\n" },
+		{ "emoji", "\xF0\x9F\x98\x80\xF0\x9F\x8E\x89 ok \xF0\x9F\x91\x8D\r\n" },
+	};
+
+	fmt::print("UTF-8 <-> UTF-16, {} MiB of UTF-8 per scenario, chunks of {} bytes, kernel {}\n\n", args.megabytes, chunk, utf_kernel_name());
+	fmt::print("{:>8}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "", "8->16", "8->16", "8->16", "16->8", "16->8", "16->8");
+	fmt::print("{:>8}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "MB/s", "simd", "scalar", "nowide", "simd", "scalar", "nowide");
+
+	for (const scenario& current : scenarios) {
+		const std::string utf8 = MakeText(current.sample, total);
+		std::vector<char16_t> utf16(utf8_to_utf16_converter::max_output(utf8.size()));
+		{
+			utf8_to_utf16_converter converter{};
+			utf16.resize(converter.convert(utf8, utf16.data()));
+		}
+		const std::span<const char> utf16_bytes(reinterpret_cast<const char*>(utf16.data()), utf16.size() * sizeof(char16_t));
+
+		std::vector<char16_t> wide(utf8_to_utf16_converter::max_output(chunk));
+		std::vector<char> narrow(utf16_to_utf8_converter::max_output(chunk));
+
+		auto widen = [&] {
+			utf8_to_utf16_converter converter{};
+			std::size_t output{ 0 };
+			for (std::size_t offset = 0; offset < utf8.size(); offset += chunk)
+				output += converter.convert(std::span<const char>(utf8).subspan(offset, std::min(chunk, utf8.size() - offset)), wide.data());
+			return output;
+		};
+		auto narrow_all = [&] {
+			utf16_to_utf8_converter converter{};
+			std::size_t output{ 0 };
+			for (std::size_t offset = 0; offset < utf16_bytes.size(); offset += chunk)
+				output += converter.convert_bytes(utf16_bytes.subspan(offset, std::min(chunk, utf16_bytes.size() - offset)), narrow.data());
+			return output;
+		};
+
+		double results[6]{};
+		for (bool scalar : { false, true }) {
+			utf_force_scalar(scalar);
+			results[scalar ? 1 : 0] = MeasureConversion(utf8.size(), widen);
+			results[scalar ? 4 : 3] = MeasureConversion(utf16_bytes.size(), narrow_all);
+		}
+		utf_force_scalar(false);
+
+#if defined(RELAY_BENCH_HAS_NOWIDE)
+		// nowide converts whole strings. The chunks are split at character boundaries of the sample.
+		const std::size_t aligned_chunk = std::max<std::size_t>(chunk / current.sample.size(), 1) * current.sample.size();
+		results[2] = MeasureConversion(utf8.size(), [&] {
+			std::size_t output{ 0 };
+			for (std::size_t offset = 0; offset < utf8.size(); offset += aligned_chunk) {
+				const char* begin = utf8.data() + offset;
+				output += nowide::utf::convert_string<char16_t>(begin, begin + std::min(aligned_chunk, utf8.size() - offset)).size();
+			}
+			return output;
+		});
+		const std::size_t aligned_units = std::max<std::size_t>(chunk / 2 / 64, 1) * 64;
+		results[5] = MeasureConversion(utf16_bytes.size(), [&] {
+			std::size_t output{ 0 };
+			for (std::size_t offset = 0; offset < utf16.size(); offset += aligned_units) {
+				std::size_t count = std::min(aligned_units, utf16.size() - offset);
+				// Do not split a surrogate pair.
+				if (offset + count < utf16.size() && utf16[offset + count - 1] >= 0xD800 && utf16[offset + count - 1] <= 0xDBFF)
+					++count;
+				output += nowide::utf::convert_string<char>(utf16.data() + offset, utf16.data() + offset + count).size();
+				offset += count - std::min(aligned_units, utf16.size() - offset);
+			}
+			return output;
+		});
+#endif
+
+		auto cell = [](double value) { return value > 0.0 ? fmt::format("{:.1f}", value) : std::string{ "-" }; };
+		fmt::print("{:>8}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", current.name,
+			cell(results[0]), cell(results[1]), cell(results[2]), cell(results[3]), cell(results[4]), cell(results[5]));
+	}
+	return true;
+}
+
+#if !defined(_WIN32)
+// Writes `text` into the terminal side of a pty, like a user, who types very fast.
+std::thread StartTypist(byte_stream& master, std::string_view text, std::size_t chunk_size) {
+	return std::thread([&master, text, chunk_size]() {
+		std::size_t offset = 0;
+		while (offset < text.size()) {
+			io_result result = master.write(std::span<const char>(text.data() + offset, std::min(chunk_size, text.size() - offset)));
+			if (!result.ok() || result.count == 0)
+				return;
+			offset += result.count;
+		}
+	});
+}
+
+// Malformed UTF-8, typed into a pty, reaches read_utf16() as U+FFFD, without taking
+// the valid characters around it along. A sequence, that the end cuts off, is U+FFFD, too.
+bool CheckInvalidTypedText() {
+	struct invalid_case {
+		std::string_view name;
+		std::string_view typed;
+		std::u16string_view expected;
+		// The pty is closed after the last complete character.
+		bool at_end{ false };
+	};
+	const invalid_case cases[]{
+		{ "continuation byte", "a\x80" "b", u"a\xFFFD" "b" },
+		{ "lead without continuation", "a\xC3" "b", u"a\xFFFD" "b" },
+		{ "overlong", "\xC0\xAF" "b", u"\xFFFD\xFFFD" "b" },
+		{ "surrogate", "\xED\xA0\x80" "b", u"\xFFFD\xFFFD\xFFFD" "b" },
+		{ "above U+10FFFF", "\xF5\x80\x80\x80" "b", u"\xFFFD\xFFFD\xFFFD\xFFFD" "b" },
+		{ "truncated before ASCII", "\xE4\xB8" "xyz", u"\xFFFD" "xyz" },
+		{ "truncated at the end", "b\xF0\x9F\x98", u"b\xFFFD", true },
+	};
+
+	bool all_ok{ true };
+	fmt::print("\n");
+	for (const invalid_case& test : cases) {
+		auto pty = open_pty();
+		if (!pty)
+			return false;
+		auto con_in = open_console(*pty->slave->handle(), console_in_or_out::in);
+		if (!con_in || !con_in->set_mode(0))
+			return false;
+		bool ok = pty->master->write(std::span<const char>(test.typed.data(), test.typed.size())).count == test.typed.size();
+
+		std::u16string received{};
+		char16_t buffer[64]{};
+		while (ok && received.size() < test.expected.size()) {
+			if (test.at_end && received.size() + 1 == test.expected.size())
+				pty->master.reset();
+			io_result result = con_in->read_utf16(buffer);
+			if (!result.ok())
+				break;
+			received.append(buffer, result.count);
+		}
+		ok = ok && received == test.expected;
+		all_ok = all_ok && ok;
+		fmt::print("Invalid typed text, {}: {}\n", test.name, ok ? "ok" : "FAILED");
+	}
+	return all_ok;
+}
+
+bool BenchEcho(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	// ASCII with umlauts and emoji, so that surrogate pairs are split between reads.
+	const std::string text = MakeText("Echo \xC3\xA4\xC3\xB6\xC3\xBC \xF0\x9F\x98\x80 0123456789 abcdefghijklmnopqrstuvwxyz\n", total);
+	std::size_t expected_units{ 0 };
+	{
+		std::vector<char16_t> utf16(utf8_to_utf16_converter::max_output(text.size()));
+		utf8_to_utf16_converter converter{};
+		expected_units = converter.convert(text, utf16.data());
+	}
+
+	fmt::print("stdin-echo loop, {} MiB of UTF-8 typed into a pty in chunks of {} bytes, echoed into a pipe\n\n", args.megabytes, args.chunk_size);
+	fmt::print("{:>10}  {:>10}  {:>10}  {:>12}  {:>10}  {:>12}\n", "writer", "MB/s", "allocs", "allocs/MB", "writes", "writes/MB");
+
+	for (bool batched : { false, true }) {
+		auto pty = open_pty();
+		auto out_pipe = create_pipe();
+		if (!pty || !out_pipe) {
+			fmt::print(stderr, "Failed to create pty or pipe\n");
+			return false;
+		}
+		// Raw mode, like stdin-echo: no line editing, no echo, no signals.
+		auto con_in = open_console(*pty->slave->handle(), console_in_or_out::in);
+		if (!con_in || !con_in->set_mode(0)) {
+			fmt::print(stderr, "Failed to switch the pty to raw mode\n");
+			return false;
+		}
+
+		std::size_t drained{ 0 };
+		std::size_t writes{ 0 };
+		std::size_t units{ 0 };
+		bool success{ true };
+		auto start = std::chrono::steady_clock::now();
+		std::thread typist = StartTypist(*pty->master, text, args.chunk_size);
+		std::thread drain = StartDrain(std::move(out_pipe->read_end), drained);
+		const std::size_t allocations_before = g_allocations.load();
+		{
+			auto out = std::move(out_pipe->write_end);
+			utf8_writer writer{ *out };
+			utf16_to_utf8_converter encoder{};
+			char16_t buffer[512]{};
+			while (success && units < expected_units) {
+				io_result read_result = con_in->read_utf16(buffer);
+				if (!read_result.ok()) {
+					success = false;
+					break;
+				}
+				units += read_result.count;
+				std::u16string_view read(buffer, read_result.count);
+				if (batched) {
+					success = writer.write(read) && (con_in->has_pending_input() || writer.flush());
+				}
+				else {
+					// The previous shape of stdin-echo: a new string and a write per read.
+					std::string str(utf16_to_utf8_converter::max_output(read.size() * sizeof(char16_t)), '\0');
+					str.resize(encoder.convert(std::span<const char16_t>(read.data(), read.size()), str.data()));
+					success = out->write(str).ok();
+					++writes;
+				}
+			}
+			success = success && writer.finish();
+			if (batched)
+				writes = writer.writes();
+		}
+		const std::size_t allocations = g_allocations.load() - allocations_before;
+		typist.join();
+		drain.join();
+		auto stop = std::chrono::steady_clock::now();
+
+		if (!success || drained != text.size()) {
+			fmt::print(stderr, "Echo failed after {} of {} bytes\n", drained, text.size());
+			return false;
+		}
+
+		const double seconds = std::chrono::duration<double>(stop - start).count();
+		const double megabytes = static_cast<double>(total) / 1e6;
+		fmt::print("{:>10}  {:>10.1f}  {:>10}  {:>12.1f}  {:>10}  {:>12.1f}\n", batched ? "batched" : "per-read",
+			megabytes / seconds, allocations, static_cast<double>(allocations) / megabytes,
+			writes, static_cast<double>(writes) / megabytes);
+	}
+	return CheckInvalidTypedText();
+}
+#endif
+
+// The benchmark "suite": every relay loop of the tools with every kind of text.
+// Prints JSON, so that the numbers of two builds can be compared by a script.
+
+struct suite_scenario {
+	std::string_view name;
+	std::string_view sample; // UTF-8, repeated up to the size of the run
+};
+
+constexpr suite_scenario SUITE_SCENARIOS[]{
+	{ "ascii", "The quick brown fox jumps over the lazy dog, 0123456789.\r\n" },
+	{ "bmp", "Gr\xC3\xBC\xC3\x9F" "e aus K\xC3\xB6ln, \xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, "
+		"\xE3\x81\x93\xE3\x82\x93\xE3\x81\xAB\xE3\x81\xA1\xE3\x81\xAF \xE2\x86\x92 \xE2\x9C\x93\r\n" },
+	// UTF_8_thumbs_up_with_skin_tone of stty.cpp, two surrogate pairs per character.
+	{ "emoji", "ok \xF0\x9F\x91\x8D\xF0\x9F\x8F\xBB thanks \xF0\x9F\x91\x8D\xF0\x9F\x8F\xBB\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBB\r\n" },
+	// Colors, cursor movement and line erasing, like the output of a build.
+	{ "vt", "\x1B[1;32m OK \x1B[0m \x1B[38;5;208mbuild\x1B[39m \x1B[2K\x1B[1G[ 42%] \x1B[7mlink\x1B[27m \x1B[10;20H\x1B[?25l\r\n" },
+};
+
+// Time of the clock of the benchmark in nanoseconds.
+int64_t NowNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Notes, when the output of every chunk of the producer has arrived. `boundaries`
+// holds the number of output bytes, that complete each chunk.
+class arrival_log {
+public:
+	arrival_log(const std::vector<std::size_t>& boundaries, const std::vector<std::atomic<int64_t>>& sent)
+		: m_boundaries{ boundaries }, m_sent{ sent }
+	{
+		latencies.reserve(boundaries.size());
+	}
+
+	void record(std::size_t bytes) {
+		++writes;
+		this->bytes += bytes;
+		if (m_next == m_boundaries.size() || this->bytes < m_boundaries[m_next])
+			return;
+		const int64_t now = NowNanoseconds();
+		for (; m_next < m_boundaries.size() && this->bytes >= m_boundaries[m_next]; ++m_next)
+			latencies.push_back(now - m_sent[m_next].load(std::memory_order_acquire));
+	}
+
+	std::size_t writes{ 0 };
+	std::size_t bytes{ 0 };
+	std::vector<int64_t> latencies{};
+
+private:
+	const std::vector<std::size_t>& m_boundaries;
+	const std::vector<std::atomic<int64_t>>& m_sent;
+	std::size_t m_next{ 0 };
+};
+
+class recording_sink final : public byte_sink {
+public:
+	explicit recording_sink(arrival_log& log) : m_log{ log } {}
+
+	io_result write(std::span<const char> buffer) override {
+		m_log.record(buffer.size());
+		return io_result{ .count{buffer.size()} };
+	}
+
+private:
+	arrival_log& m_log;
+};
+
+class recording_console final : public console_sink {
+public:
+	explicit recording_console(arrival_log& log) : m_log{ log } {}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override {
+		m_log.record(buffer.size_bytes());
+		return io_result{ .count{buffer.size()} };
+	}
+
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+
+private:
+	arrival_log& m_log;
+};
+
+// Stands in for the console, that stdin-echo reads from: UTF-16LE from a pipe.
+class pipe_console_source final : public console_source {
+public:
+	explicit pipe_console_source(byte_source& in) : m_in{ in } {}
+
+	io_result read_utf16(std::span<char16_t> buffer) override {
+		char* const bytes = reinterpret_cast<char*>(buffer.data());
+		std::size_t count{ 0 };
+		if (m_has_odd_byte) {
+			bytes[count++] = m_odd_byte;
+			m_has_odd_byte = false;
+		}
+		while (count < sizeof(char16_t)) {
+			io_result result = m_in.read(std::span<char>(bytes + count, buffer.size_bytes() - count));
+			if (!result.ok())
+				return result;
+			count += result.count;
+		}
+		if (count % 2 != 0) {
+			m_odd_byte = bytes[count - 1];
+			m_has_odd_byte = true;
+		}
+		return io_result{ .count{count / 2} };
+	}
+
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+
+private:
+	byte_source& m_in;
+	bool m_has_odd_byte{ false };
+	char m_odd_byte{ 0 };
+};
+
+// The loop of stdin-echo with its default options.
+bool EchoLoop(console_source& in, byte_sink& out) {
+	utf8_writer writer{ out };
+	char16_t buffer[512]{};
+	while (true) {
+		io_result result = in.read_utf16(buffer);
+		if (!result.ok())
+			break;
+		const std::u16string_view text(buffer, result.count);
+		if (find_any_of(text, u"\x3\x4") != text.size())
+			return false; // the scenarios have no Ctrl-C or Ctrl-D
+		if (!writer.write(text) || (!in.has_pending_input() && !writer.flush()))
+			return false;
+	}
+	return writer.finish();
+}
+
+struct suite_relay {
+	std::string_view name;
+	text_encoding input;
+	text_encoding output;
+	bool (*run)(byte_source& in, arrival_log& log, buffer_size_option buffer_size);
+};
+
+const suite_relay SUITE_RELAYS[]{
+	{ "pipe_to_con", text_encoding::utf16le, text_encoding::utf16le, [](byte_source& in, arrival_log& log, buffer_size_option buffer_size) {
+		recording_console console{ log };
+		return ReadPipeWriteConsole(in, console, buffer_size);
+	} },
+	{ "pipe_to_con-transcoded", text_encoding::utf8, text_encoding::utf16le, [](byte_source& in, arrival_log& log, buffer_size_option buffer_size) {
+		recording_sink sink{ log };
+		return ReadHandleWriteFileTranscoded(in, sink, text_encoding::utf8, text_encoding::utf16le, buffer_size);
+	} },
+	{ "stty", text_encoding::utf8, text_encoding::utf8, [](byte_source& in, arrival_log& log, buffer_size_option buffer_size) {
+		recording_sink sink{ log };
+		return ReadHandleWriteFileByteWise(in, sink, buffer_size);
+	} },
+	{ "stdin-echo", text_encoding::utf16le, text_encoding::utf8, [](byte_source& in, arrival_log& log, buffer_size_option) {
+		pipe_console_source console{ in };
+		recording_sink sink{ log };
+		return EchoLoop(console, sink);
+	} },
+};
+
+// Converts `text` from UTF-8 and returns the bytes.
+std::string EncodeText(std::string_view text, text_encoding encoding) {
+	if (encoding == text_encoding::utf8)
+		return std::string{ text };
+	std::string utf16(utf8_to_utf16_converter::max_output(text.size()) * sizeof(char16_t), '\0');
+	utf8_to_utf16_converter converter{};
+	utf16.resize(converter.convert(text, reinterpret_cast<char16_t*>(utf16.data())) * sizeof(char16_t));
+	return utf16;
+}
+
+// Number of output bytes, once the relay has seen each chunk of `input`.
+std::vector<std::size_t> OutputBoundaries(std::string_view input, std::size_t chunk_size, text_encoding from, text_encoding to) {
+	std::vector<std::size_t> boundaries{};
+	boundaries.reserve(input.size() / chunk_size + 1);
+	utf8_to_utf16_converter decoder{};
+	utf16_to_utf8_converter encoder{};
+	std::vector<char> scratch(std::max(utf8_to_utf16_converter::max_output(chunk_size) * sizeof(char16_t), utf16_to_utf8_converter::max_output(chunk_size)));
+	std::size_t output{ 0 };
+	for (std::size_t offset = 0; offset < input.size(); offset += chunk_size) {
+		const std::span<const char> chunk(input.data() + offset, std::min(chunk_size, input.size() - offset));
+		if (from == to)
+			output += chunk.size();
+		else if (from == text_encoding::utf8)
+			output += decoder.convert(chunk, reinterpret_cast<char16_t*>(scratch.data())) * sizeof(char16_t);
+		else
+			output += encoder.convert_bytes(chunk, scratch.data());
+		boundaries.push_back(output);
+	}
+	return boundaries;
+}
+
+// Writes `input` in chunks into `sink`, with `rate` MB/s (0: as fast as possible),
+// and notes the time before each chunk in `sent`.
+std::thread StartChunkProducer(std::unique_ptr<byte_stream> sink, std::string_view input, std::size_t chunk_size,
+	std::size_t rate, std::vector<std::atomic<int64_t>>& sent)
+{
+	return std::thread([sink = std::move(sink), input, chunk_size, rate, &sent]() mutable {
+		pacer producer_pacer{ rate };
+		for (std::size_t k = 0, offset = 0; offset < input.size(); ++k, offset += chunk_size) {
+			const std::size_t to_write = std::min(chunk_size, input.size() - offset);
+			producer_pacer.consume(to_write);
+			sent[k].store(NowNanoseconds(), std::memory_order_release);
+			std::size_t written = 0;
+			while (written < to_write) {
+				io_result result = sink->write(std::span<const char>(input.data() + offset + written, to_write - written));
+				if (!result.ok() || result.count == 0)
+					return;
+				written += result.count;
+			}
+		}
+		sink.reset(); // EOF for the reader
+	});
+}
+
+struct suite_run {
+	bool success{ false };
+	double seconds{ 0.0 };
+	std::size_t reads{ 0 };
+	std::size_t writes{ 0 };
+	std::size_t output_bytes{ 0 };
+	std::vector<int64_t> latencies{};
+};
+
+suite_run RunSuiteRelay(const suite_relay& relay, std::string_view input, const std::vector<std::size_t>& boundaries,
+	std::size_t chunk_size, std::size_t rate, buffer_size_option buffer_size)
+{
+	suite_run run{};
+	auto pipe = create_pipe();
+	if (!pipe)
+		return run;
+
+	std::vector<std::atomic<int64_t>> sent(boundaries.size());
+	arrival_log log{ boundaries, sent };
+	counting_source source{ *pipe->read_end };
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer = StartChunkProducer(std::move(pipe->write_end), input, chunk_size, rate, sent);
+	run.success = relay.run(source, log, buffer_size);
+	producer.join();
+	auto stop = std::chrono::steady_clock::now();
+
+	run.seconds = std::chrono::duration<double>(stop - start).count();
+	run.reads = source.reads;
+	run.writes = log.writes;
+	run.output_bytes = log.bytes;
+	run.latencies = std::move(log.latencies);
+	run.success = run.success && run.output_bytes == (boundaries.empty() ? 0 : boundaries.back());
+	return run;
+}
+
+bool BenchSuite(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const buffer_size_option buffer_size = args.buffer_size.value_or(buffer_size_option{});
+
+	fmt::print("{{\n");
+	fmt::print("  \"benchmark\": \"suite\",\n");
+	fmt::print("  \"megabytes\": {},\n", args.megabytes);
+	fmt::print("  \"chunk_size\": {},\n", args.chunk_size);
+	fmt::print("  \"buffer_size\": \"{}\",\n", buffer_size_option_to_string(buffer_size));
+	fmt::print("  \"latency_rate_mb_per_s\": {},\n", args.read_rate);
+	fmt::print("  \"utf_kernel\": \"{}\",\n", utf_kernel_name());
+	fmt::print("  \"results\": [");
+
+	bool first{ true };
+	for (const suite_relay& relay : SUITE_RELAYS) {
+		for (const suite_scenario& scenario : SUITE_SCENARIOS) {
+			const std::string input = EncodeText(MakeText(scenario.sample, total), relay.input);
+			const std::vector<std::size_t> boundaries = OutputBoundaries(input, args.chunk_size, relay.input, relay.output);
+
+			// Throughput with a producer, that is always ahead. Its latencies are only the
+			// time in the full pipe, so they come from a second run with a paced producer.
+			suite_run throughput = RunSuiteRelay(relay, input, boundaries, args.chunk_size, 0, buffer_size);
+			suite_run latency = RunSuiteRelay(relay, input, boundaries, args.chunk_size, args.read_rate, buffer_size);
+			if (!throughput.success || !latency.success) {
+				fmt::print(stderr, "Relay {} failed for {} after {} bytes\n", relay.name, scenario.name, throughput.output_bytes);
+				return false;
+			}
+
+			std::sort(latency.latencies.begin(), latency.latencies.end());
+			auto percentile = [&](double fraction) -> double {
+				if (latency.latencies.empty())
+					return 0.0;
+				const std::size_t index = std::min(latency.latencies.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(latency.latencies.size())));
+				return static_cast<double>(latency.latencies[index]) / 1e3;
+			};
+
+			const double megabytes = static_cast<double>(input.size()) / 1e6;
+			fmt::print("{}\n    {{ \"relay\": \"{}\", \"scenario\": \"{}\", \"input_bytes\": {}, \"output_bytes\": {},\n",
+				first ? "" : ",", relay.name, scenario.name, input.size(), throughput.output_bytes);
+			fmt::print("      \"seconds\": {:.4f}, \"mb_per_s\": {:.1f}, \"reads\": {}, \"writes\": {}, \"syscalls_per_mb\": {:.1f},\n",
+				throughput.seconds, megabytes / throughput.seconds, throughput.reads, throughput.writes,
+				static_cast<double>(throughput.reads + throughput.writes) / megabytes);
+			fmt::print("      \"latency_us\": {{ \"chunks\": {}, \"p50\": {:.1f}, \"p90\": {:.1f}, \"p99\": {:.1f}, \"p999\": {:.1f}, \"max\": {:.1f} }} }}",
+				latency.latencies.size(), percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+			first = false;
+		}
+	}
+	fmt::print("\n  ]\n}}\n");
+	return true;
+}
+
+// The benchmark "duplex": both directions of "pipe-to-con --duplex" through pipes, at
+// once in one session (relay_duplex()) versus one after the other, as with two
+// invocations. The console renders with --write-rate and its input comes with
+// --read-rate. Then the end of a session, whose console input never ends.
+
+// A console, that needs time to render, and counts the code units.
+class counting_console final : public console_sink {
+public:
+	explicit counting_console(std::size_t rate = 0) : m_pacer{ rate } {}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override {
+		code_units += buffer.size();
+		m_pacer.consume(buffer.size_bytes());
+		return io_result{ .count{buffer.size()} };
+	}
+
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+
+	std::size_t code_units{ 0 };
+
+private:
+	pacer m_pacer;
+};
+
+// The input of a console, that comes with `rate` MB/s.
+class generated_console_input final : public console_source {
+public:
+	generated_console_input(std::size_t code_units, std::size_t rate) : m_remaining{ code_units }, m_pacer{ rate } {}
+
+	io_result read_utf16(std::span<char16_t> buffer) override {
+		if (m_remaining == 0)
+			return io_result{ .status{io_status::eof} };
+		const std::size_t count = std::min(buffer.size(), m_remaining);
+		std::fill_n(buffer.begin(), count, u'a');
+		m_remaining -= count;
+		m_pacer.consume(count * sizeof(char16_t));
+		return io_result{ .count{count} };
+	}
+
+	std::optional<uint32_t> get_mode() const override { return 0; }
+	bool set_mode(uint32_t) override { return true; }
+
+private:
+	std::size_t m_remaining;
+	pacer m_pacer;
+};
+
+struct duplex_run {
+	bool success{ false };
+	double seconds{ 0.0 };
+	double to_console_seconds{ 0.0 };
+	double from_console_seconds{ 0.0 };
+};
+
+duplex_run RunDuplex(const bench_args& args, buffer_size_option buffer_size, bool at_once) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	duplex_run run{};
+	auto to_console = create_pipe();
+	auto from_console = create_pipe();
+	if (!to_console || !from_console)
+		return run;
+
+	counting_console console{ args.write_rate };
+	generated_console_input input{ total / sizeof(char16_t), args.read_rate };
+	std::size_t drained{ 0 };
+	const auto start = std::chrono::steady_clock::now();
+	auto stop_to_console = start;
+	auto stop_from_console = start;
+	// The relays of the secondary process: the console input goes out, the pipe comes in.
+	const duplex_relay write_outgoing = [&](std::unique_ptr<byte_stream>& pipe) {
+		const bool success = ReadConsoleWritePipe(input, *pipe, buffer_size);
+		pipe.reset();
+		stop_from_console = std::chrono::steady_clock::now();
+		return success;
+	};
+	const duplex_relay read_incoming = [&](std::unique_ptr<byte_stream>& pipe) {
+		const bool success = ReadPipeWriteConsole(*pipe, console, buffer_size);
+		stop_to_console = std::chrono::steady_clock::now();
+		return success;
+	};
+
+	std::thread producer = StartProducer(std::move(to_console->write_end), total, args.chunk_size);
+	std::thread drain = StartDrain(std::move(from_console->read_end), drained);
+	if (at_once) {
+		run.success = relay_duplex(std::move(from_console->write_end), write_outgoing,
+			std::move(to_console->read_end), read_incoming, duplex_end::both);
+	}
+	else {
+		run.success = read_incoming(to_console->read_end);
+		run.success = write_outgoing(from_console->write_end) && run.success;
+	}
+	producer.join();
+	drain.join();
+	const auto stop = std::chrono::steady_clock::now();
+
+	run.success = run.success && console.code_units == total / sizeof(char16_t) && drained == total;
+	run.seconds = std::chrono::duration<double>(stop - start).count();
+	// One after the other, the second direction starts, when the first has ended.
+	run.to_console_seconds = std::chrono::duration<double>(stop_to_console - start).count();
+	run.from_console_seconds = std::chrono::duration<double>(stop_from_console - (at_once ? start : stop_to_console)).count();
+	return run;
+}
+
+// The session ends with the relay to the console, although nobody types: the relay of
+// the console input is left behind in its read, until its pipe closes.
+bool CheckDuplexEnd(std::size_t total, std::size_t chunk_size, buffer_size_option buffer_size) {
+	auto to_console = create_pipe();
+	auto keyboard = create_pipe();
+	auto from_console = create_pipe();
+	if (!to_console || !keyboard || !from_console)
+		return false;
+
+	counting_console console{};
+	std::shared_ptr<byte_stream> keys{ std::move(keyboard->read_end) };
+	std::thread producer = StartProducer(std::move(to_console->write_end), total, chunk_size);
+	const auto start = std::chrono::steady_clock::now();
+	const bool success = relay_duplex(
+		std::move(from_console->write_end), [keys, buffer_size](std::unique_ptr<byte_stream>& pipe) {
+			pipe_console_source input{ *keys };
+			return ReadConsoleWritePipe(input, *pipe, buffer_size);
+		},
+		std::move(to_console->read_end), [&console, buffer_size](std::unique_ptr<byte_stream>& pipe) {
+			return ReadPipeWriteConsole(*pipe, console, buffer_size);
+		},
+		duplex_end::either);
+	const auto stop = std::chrono::steady_clock::now();
+	producer.join();
+	// Releases the relay, that was left behind.
+	keyboard->write_end.reset();
+
+	const bool ended = success && console.code_units == total / sizeof(char16_t);
+	fmt::print("\nEnd of a session without console input: {} after {:.1f} ms\n",
+		ended ? "ok" : "FAILED", std::chrono::duration<double>(stop - start).count() * 1e3);
+	return ended;
+}
+
+bool BenchDuplex(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const buffer_size_option buffer_size = args.buffer_size.value_or(buffer_size_option{});
+
+	fmt::print("pipe-to-con --duplex, {} MiB each way through pipes in chunks of {} bytes, console {} MB/s, input {} MB/s, buffer-size {}\n\n",
+		args.megabytes, args.chunk_size, args.write_rate, args.read_rate, buffer_size_option_to_string(buffer_size));
+	fmt::print("{:>12}  {:>10}  {:>16}  {:>18}  {:>12}\n", "mode", "seconds", "MB/s to console", "MB/s from console", "MB/s total");
+	for (bool at_once : { false, true }) {
+		duplex_run run = RunDuplex(args, buffer_size, at_once);
+		if (!run.success) {
+			fmt::print(stderr, "The relay failed\n");
+			return false;
+		}
+		const double megabytes = static_cast<double>(total) / 1e6;
+		fmt::print("{:>12}  {:>10.3f}  {:>16.1f}  {:>18.1f}  {:>12.1f}\n", at_once ? "duplex" : "sequential", run.seconds,
+			megabytes / run.to_console_seconds, megabytes / run.from_console_seconds, 2.0 * megabytes / run.seconds);
+	}
+	return CheckDuplexEnd(total, args.chunk_size, buffer_size);
+}
+
+// The reference for the SPSC ring: a deque of bytes behind a mutex.
+class locked_byte_queue {
+public:
+	explicit locked_byte_queue(std::size_t capacity) : m_capacity{ capacity } {}
+
+	void push(std::span<const char> bytes) {
+		std::unique_lock lock{ m_mutex };
+		m_not_full.wait(lock, [&] { return m_queue.size() + bytes.size() <= m_capacity; });
+		m_queue.insert(m_queue.end(), bytes.begin(), bytes.end());
+		m_not_empty.notify_one();
+	}
+
+	void close() {
+		std::lock_guard lock{ m_mutex };
+		m_closed = true;
+		m_not_empty.notify_one();
+	}
+
+	// Returns 0 at the end.
+	std::size_t pop(std::span<char> bytes) {
+		std::unique_lock lock{ m_mutex };
+		m_not_empty.wait(lock, [&] { return !m_queue.empty() || m_closed; });
+		std::size_t count = std::min(bytes.size(), m_queue.size());
+		std::copy_n(m_queue.begin(), count, bytes.begin());
+		m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+		m_not_full.notify_one();
+		return count;
+	}
+
+private:
+	std::size_t m_capacity;
+	std::mutex m_mutex;
+	std::condition_variable m_not_full;
+	std::condition_variable m_not_empty;
+	std::deque<char> m_queue;
+	bool m_closed{ false };
+};
+
+// Moves `total` bytes in batches of `batch` bytes from a producer to a consumer thread
+// and returns the duration and the sum of all bytes seen by the consumer.
+std::pair<double, uint64_t> RunSpscRing(std::size_t total, std::size_t batch, std::size_t capacity) {
+	spsc_byte_ring_buffer ring{ capacity };
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&] {
+		std::size_t remaining = total;
+		while (remaining > 0) {
+			std::span<char> span = ring.write_span();
+			if (span.empty()) {
+				ring.wait_for_space();
+				continue;
+			}
+			std::size_t count = std::min({ span.size(), batch, remaining });
+			std::memset(span.data(), 1, count);
+			ring.commit(count);
+			remaining -= count;
+		}
+		ring.close_producer();
+	});
+
+	uint64_t sum{ 0 };
+	while (true) {
+		std::span<const char> span = ring.read_span();
+		if (span.empty()) {
+			if (ring.producer_closed() && ring.read_span().empty())
+				break;
+			ring.wait_for_data();
+			continue;
+		}
+		span = span.first(std::min(span.size(), batch));
+		for (char c : span)
+			sum += static_cast<unsigned char>(c);
+		ring.release(span.size());
+	}
+	producer.join();
+	auto stop = std::chrono::steady_clock::now();
+	return { std::chrono::duration<double>(stop - start).count(), sum };
+}
+
+std::pair<double, uint64_t> RunLockedQueue(std::size_t total, std::size_t batch, std::size_t capacity) {
+	locked_byte_queue queue{ capacity };
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&] {
+		std::vector<char> chunk(batch, 1);
+		std::size_t remaining = total;
+		while (remaining > 0) {
+			std::size_t count = std::min(batch, remaining);
+			queue.push(std::span<const char>(chunk.data(), count));
+			remaining -= count;
+		}
+		queue.close();
+	});
+
+	uint64_t sum{ 0 };
+	std::vector<char> chunk(batch);
+	while (std::size_t count = queue.pop(chunk)) {
+		for (std::size_t i = 0; i < count; ++i)
+			sum += static_cast<unsigned char>(chunk[i]);
+	}
+	producer.join();
+	auto stop = std::chrono::steady_clock::now();
+	return { std::chrono::duration<double>(stop - start).count(), sum };
+}
+
+bool BenchSpsc(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	const std::size_t capacity = std::bit_ceil(std::max<std::size_t>(args.chunk_size, 4096));
+
+	fmt::print("{} MiB from one thread to another, ring capacity {} bytes\n\n", args.megabytes, capacity);
+	fmt::print("{:>8}  {:>12}  {:>12}  {:>12}  {:>12}\n", "batch", "ring GB/s", "ring ns/op", "mutex GB/s", "mutex ns/op");
+
+	for (std::size_t batch : { 16u, 64u, 512u, 4096u }) {
+		if (batch > capacity)
+			break;
+		auto [ring_seconds, ring_sum] = RunSpscRing(total, batch, capacity);
+		auto [locked_seconds, locked_sum] = RunLockedQueue(total, batch, capacity);
+		if (ring_sum != total || locked_sum != total) {
+			fmt::print(stderr, "Lost bytes: ring {}, mutex {} of {}\n", ring_sum, locked_sum, total);
+			return false;
+		}
+		const double operations = static_cast<double>(total) / static_cast<double>(batch);
+		fmt::print("{:>8}  {:>12.2f}  {:>12.1f}  {:>12.2f}  {:>12.1f}\n", batch,
+			static_cast<double>(total) / 1e9 / ring_seconds, ring_seconds * 1e9 / operations,
+			static_cast<double>(total) / 1e9 / locked_seconds, locked_seconds * 1e9 / operations);
+	}
+	return true;
+}
+
+#if !defined(_WIN32)
+// The benchmark "ttfb": time from the start of an invocation to the first byte on the
+// console, with a secondary process per invocation, with a broker, and on the direct
+// path, that opens the terminal of the target itself. A pty stands in for the console.
+// The start of the invoking process itself is the same in all modes and not part of
+// the numbers.
+
+constexpr std::size_t TTFB_RUNS{ 200 };
+// One character in UTF-16LE, the encoding of the pipe of pipe-to-con.
+constexpr std::string_view TTFB_PAYLOAD{ "x\0", 2 };
+
+// The hidden benchmark "ttfb-secondary <pipe fd> <console fd>": what the secondary
+// process of pipe-to-con does after AttachConsole().
+int RunTtfbSecondary(std::string_view pipe_fd, std::string_view console_fd) {
+	auto pipe_handle = string_to_uint<uint32_t>(pipe_fd);
+	auto console_handle = string_to_uint<uint32_t>(console_fd);
+	if (!pipe_handle || !console_handle)
+		return 1;
+	auto pipe = open_byte_stream(static_cast<int>(*pipe_handle), true);
+	auto con = open_console(static_cast<int>(*console_handle), console_in_or_out::out, true);
+	if (!con)
+		return 1;
+	return ReadPipeWriteConsole(*pipe, *con) ? 0 : 1;
+}
+
+// Reads the terminal side, until the payload has arrived.
+bool WaitForPayload(byte_stream& master) {
+	char buffer[64];
+	for (;;) {
+		io_result result = master.read(buffer);
+		if (!result.ok())
+			return false;
+		if (std::string_view(buffer, result.count).find('x') != std::string_view::npos)
+			return true;
+	}
+}
+
+bool WriteAll(byte_sink& out, std::string_view bytes) {
+	while (!bytes.empty()) {
+		io_result result = out.write(bytes);
+		if (!result.ok() || result.count == 0)
+			return false;
+		bytes.remove_prefix(result.count);
+	}
+	return true;
+}
+
+// One invocation the old way: a pipe and a new process, that relays it to the console.
+std::optional<int64_t> InvokeWithSecondary(byte_stream& master, int console_fd) {
+	const int64_t start = NowNanoseconds();
+	auto pipe = create_pipe();
+	if (!pipe)
+		return std::nullopt;
+	const int pipe_fd = *pipe->read_end->handle();
+	// Only the two descriptors are inherited, like the handles of the secondary process.
+	::fcntl(pipe_fd, F_SETFD, 0);
+	::fcntl(console_fd, F_SETFD, 0);
+	const std::string pipe_arg = std::to_string(pipe_fd);
+	const std::string console_arg = std::to_string(console_fd);
+	char* const argv[]{ const_cast<char*>("relay-bench"), const_cast<char*>("ttfb-secondary"),
+		const_cast<char*>(pipe_arg.c_str()), const_cast<char*>(console_arg.c_str()), nullptr };
+	pid_t child{};
+	const bool spawned = ::posix_spawn(&child, "/proc/self/exe", nullptr, nullptr, argv, environ) == 0;
+	::fcntl(console_fd, F_SETFD, FD_CLOEXEC);
+	pipe->read_end.reset();
+	if (!spawned)
+		return std::nullopt;
+
+	const bool arrived = WriteAll(*pipe->write_end, TTFB_PAYLOAD) && WaitForPayload(master);
+	const int64_t first_byte = NowNanoseconds();
+	pipe->write_end.reset();
+	int status{};
+	::waitpid(child, &status, 0);
+	if (!arrived || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return std::nullopt;
+	return first_byte - start;
+}
+
+// One invocation with a broker: connect, send the arguments, stream.
+std::optional<int64_t> InvokeWithBroker(byte_stream& master, std::string_view endpoint) {
+	const int64_t start = NowNanoseconds();
+	broker_connection connection = connect_to_broker(endpoint, "--to-secondary --buffer-size 512");
+	if (connection.status != broker_status::accepted)
+		return std::nullopt;
+	const bool arrived = WriteAll(*connection.stream, TTFB_PAYLOAD) && WaitForPayload(master);
+	const int64_t first_byte = NowNanoseconds();
+	if (!arrived)
+		return std::nullopt;
+	return first_byte - start;
+}
+
+// Runs the broker in a process of its own, like "pipe-to-con --broker". Returns its
+// PID, once it listens on `endpoint`.
+std::optional<pid_t> StartBrokerProcess(std::string_view endpoint, int console_fd) {
+	int ready[2];
+	if (::pipe(ready) != 0)
+		return std::nullopt;
+	pid_t child = ::fork();
+	if (child == 0) {
+		::close(ready[0]);
+		auto listener = listen_local(endpoint);
+		auto con = open_console(console_fd, console_in_or_out::out);
+		if (!listener || !con)
+			::_exit(1);
+		(void)!::write(ready[1], "", 1);
+		::close(ready[1]);
+		serve_broker_sessions(*listener, [&con](broker_session& session) {
+			if (session.accept())
+				(void)ReadPipeWriteConsole(*session.connection(), *con);
+		});
+		::_exit(0);
+	}
+	::close(ready[1]);
+	char byte{};
+	const bool listening = child > 0 && ::read(ready[0], &byte, 1) == 1;
+	::close(ready[0]);
+	if (!listening) {
+		if (child > 0)
+			::waitpid(child, nullptr, 0);
+		return std::nullopt;
+	}
+	return child;
+}
+
+// A process with the pty as its stdin: the target of "pipe-to-con --pid". Returns its
+// PID, once the pty is in place.
+std::optional<pid_t> StartTargetProcess(int console_fd) {
+	int ready[2];
+	if (::pipe(ready) != 0)
+		return std::nullopt;
+	pid_t child = ::fork();
+	if (child == 0) {
+		::close(ready[0]);
+		if (::dup2(console_fd, STDIN_FILENO) < 0)
+			::_exit(1);
+		(void)!::write(ready[1], "", 1);
+		::close(ready[1]);
+		::pause();
+		::_exit(0);
+	}
+	::close(ready[1]);
+	char byte{};
+	const bool started = child > 0 && ::read(ready[0], &byte, 1) == 1;
+	::close(ready[0]);
+	if (!started) {
+		if (child > 0)
+			::waitpid(child, nullptr, 0);
+		return std::nullopt;
+	}
+	return child;
+}
+
+// One invocation on the direct path: the terminal of the target, opened in this process.
+std::optional<int64_t> InvokeDirect(byte_stream& master, pid_t target) {
+	const int64_t start = NowNanoseconds();
+	auto con = open_process_console(static_cast<uint32_t>(target), console_in_or_out::out);
+	if (!con)
+		return std::nullopt;
+	const char16_t payload[]{ u'x' };
+	const bool arrived = con->write_utf16(payload).ok() && WaitForPayload(master);
+	const int64_t first_byte = NowNanoseconds();
+	if (!arrived)
+		return std::nullopt;
+	return first_byte - start;
+}
+
+bool BenchTtfb(const bench_args& /*args*/) {
+	auto pty = open_pty();
+	if (!pty) {
+		fmt::print(stderr, "Failed to create a pty\n");
+		return false;
+	}
+	const int console_fd = *pty->slave->handle();
+	const std::string endpoint = fmt::format("relay-bench-ttfb-{}", ::getpid());
+	std::optional<pid_t> broker = StartBrokerProcess(endpoint, console_fd);
+	if (!broker) {
+		fmt::print(stderr, "Failed to start the broker\n");
+		return false;
+	}
+	std::optional<pid_t> target = StartTargetProcess(console_fd);
+	if (!target) {
+		fmt::print(stderr, "Failed to start the target process\n");
+		::kill(*broker, SIGTERM);
+		::waitpid(*broker, nullptr, 0);
+		return false;
+	}
+
+	fmt::print("Time to first byte of pipe-to-con --to-secondary, {} invocations each, in microseconds\n\n", TTFB_RUNS);
+	fmt::print("{:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "mode", "mean", "p50", "p99", "max");
+	bool success{ true };
+	for (std::string_view mode : { "spawn", "broker", "direct" }) {
+		std::vector<int64_t> samples{};
+		for (std::size_t run = 0; run < TTFB_RUNS && success; ++run) {
+			std::optional<int64_t> sample = (mode == "broker") ? InvokeWithBroker(*pty->master, endpoint)
+				: (mode == "direct") ? InvokeDirect(*pty->master, *target)
+				: InvokeWithSecondary(*pty->master, console_fd);
+			success = sample.has_value();
+			if (sample)
+				samples.push_back(*sample);
+		}
+		if (!success) {
+			fmt::print(stderr, "An invocation in the mode {}{}{} failed\n", quote_open, mode, quote_close);
+			break;
+		}
+		std::sort(samples.begin(), samples.end());
+		double sum{ 0.0 };
+		for (int64_t sample : samples)
+			sum += static_cast<double>(sample);
+		auto microseconds = [&](double fraction) {
+			const std::size_t index = std::min(samples.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(samples.size())));
+			return static_cast<double>(samples[index]) / 1e3;
+		};
+		fmt::print("{:>10}  {:>10.1f}  {:>10.1f}  {:>10.1f}  {:>10.1f}\n", mode,
+			sum / static_cast<double>(samples.size()) / 1e3, microseconds(0.5), microseconds(0.99), microseconds(1.0));
+	}
+
+	::kill(*target, SIGTERM);
+	::waitpid(*target, nullptr, 0);
+	::kill(*broker, SIGTERM);
+	::waitpid(*broker, nullptr, 0);
+	// The killed broker left its socket file behind. Taking the endpoint over removes it.
+	(void)listen_local(endpoint);
+	return success;
+}
+#endif
+
+#if !defined(_WIN32)
+// The benchmark "sessions": many pipe -> pipe relays at once, a thread per session
+// versus one relay_loop. Both copy through a buffer of the same size; the threads do
+// not get splice(), because the handles are hidden from them. A producer thread writes
+// a chunk into every session per round, a consumer thread reads it back.
+
+constexpr std::size_t SESSIONS_CHUNK_SIZE{ 4096 };
+constexpr std::size_t SESSIONS_BUFFER_SIZE{ 16u * 1024u };
+
+struct sessions_pipes {
+	std::vector<std::unique_ptr<byte_stream>> inputs{};  // written by the producer
+	std::vector<std::unique_ptr<byte_stream>> outputs{}; // read by the consumer
+	// The ends of the relays.
+	std::vector<std::unique_ptr<byte_stream>> sources{};
+	std::vector<std::unique_ptr<byte_stream>> sinks{};
+};
+
+std::optional<sessions_pipes> CreateSessionPipes(std::size_t count) {
+	sessions_pipes pipes{};
+	for (std::size_t i = 0; i < count; ++i) {
+		auto in = create_pipe();
+		auto out = create_pipe();
+		if (!in || !out)
+			return std::nullopt;
+		pipes.inputs.push_back(std::move(in->write_end));
+		pipes.sources.push_back(std::move(in->read_end));
+		pipes.sinks.push_back(std::move(out->write_end));
+		pipes.outputs.push_back(std::move(out->read_end));
+	}
+	return pipes;
+}
+
+// Resident memory of the process in KiB.
+std::size_t ResidentKilobytes() {
+	FILE* statm = std::fopen("/proc/self/statm", "r");
+	if (!statm)
+		return 0;
+	unsigned long size{}, resident{};
+	const bool parsed = std::fscanf(statm, "%lu %lu", &size, &resident) == 2;
+	std::fclose(statm);
+	return parsed ? resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)) / 1024u : 0;
+}
+
+int64_t ThreadCpuNanoseconds() {
+	timespec time{};
+	::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return static_cast<int64_t>(time.tv_sec) * 1'000'000'000 + time.tv_nsec;
+}
+
+struct sessions_run {
+	double seconds{ 0.0 };
+	// CPU time of the relays, without the producer and the consumer.
+	int64_t cpu_nanoseconds{ 0 };
+	// Growth of the resident memory from before the sessions to after the first round.
+	std::size_t resident_kilobytes{ 0 };
+	bool success{ false };
+};
+
+// Feeds `rounds` chunks into every session and reads them back. `after_first_round`
+// is called, while all sessions are busy.
+bool RunSessionTraffic(sessions_pipes& pipes, std::size_t rounds, const std::function<void()>& after_first_round) {
+	const std::vector<char> chunk(SESSIONS_CHUNK_SIZE, 'x');
+	std::thread producer([&pipes, &chunk, rounds] {
+		for (std::size_t round = 0; round < rounds; ++round)
+			for (auto& input : pipes.inputs)
+				if (!WriteAll(*input, std::string_view(chunk.data(), chunk.size())))
+					return;
+		pipes.inputs.clear(); // EOF for every session
+	});
+
+	bool success{ true };
+	std::vector<char> buffer(SESSIONS_CHUNK_SIZE);
+	for (std::size_t round = 0; round < rounds && success; ++round) {
+		for (auto& output : pipes.outputs) {
+			std::size_t received = 0;
+			while (received < buffer.size() && success) {
+				io_result result = output->read(std::span<char>(buffer.data() + received, buffer.size() - received));
+				success = result.ok();
+				received += result.count;
+			}
+		}
+		if (round == 0)
+			after_first_round();
+	}
+	producer.join();
+	return success;
+}
+
+sessions_run RunSessionThreads(std::size_t count, std::size_t rounds) {
+	sessions_run run{};
+	const std::size_t resident_before = ResidentKilobytes();
+	std::optional<sessions_pipes> pipes = CreateSessionPipes(count);
+	if (!pipes)
+		return run;
+
+	std::vector<int64_t> cpu(count, 0);
+	std::vector<char> results(count, 0);
+	std::vector<std::thread> threads{};
+	const auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < count; ++i) {
+		threads.emplace_back([&pipes, &cpu, &results, i] {
+			counting_source source{ *pipes->sources[i] };
+			counting_sink sink{ *pipes->sinks[i] };
+			results[i] = ReadHandleWriteFileByteWise(source, sink, buffer_size_option{ .size{SESSIONS_BUFFER_SIZE} });
+			pipes->sinks[i].reset();
+			cpu[i] = ThreadCpuNanoseconds();
+		});
+	}
+	run.success = RunSessionTraffic(*pipes, rounds, [&] { run.resident_kilobytes = ResidentKilobytes() - resident_before; });
+	for (auto& thread : threads)
+		thread.join();
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (std::size_t i = 0; i < count; ++i) {
+		run.cpu_nanoseconds += cpu[i];
+		run.success = run.success && results[i];
+	}
+	return run;
+}
+
+sessions_run RunSessionLoop(std::size_t count, std::size_t rounds, relay_loop_counters& counters) {
+	sessions_run run{};
+	const std::size_t resident_before = ResidentKilobytes();
+	std::unique_ptr<relay_loop> loop = create_relay_loop(relay_loop_option{ .buffer_size{SESSIONS_BUFFER_SIZE} });
+	std::optional<sessions_pipes> pipes = CreateSessionPipes(count);
+	if (!loop || !pipes)
+		return run;
+
+	std::size_t ended = 0;
+	bool all_succeeded{ true };
+	for (std::size_t i = 0; i < count; ++i) {
+		const bool added = loop->add(std::move(pipes->sources[i]), std::move(pipes->sinks[i]), [&, count](bool success) {
+			all_succeeded = all_succeeded && success;
+			if (++ended == count)
+				loop->stop();
+		});
+		if (!added)
+			return run;
+	}
+
+	int64_t cpu{ 0 };
+	const auto start = std::chrono::steady_clock::now();
+	std::thread relay([&] {
+		loop->run();
+		cpu = ThreadCpuNanoseconds();
+	});
+	run.success = RunSessionTraffic(*pipes, rounds, [&] { run.resident_kilobytes = ResidentKilobytes() - resident_before; });
+	relay.join();
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	run.cpu_nanoseconds = cpu;
+	run.success = run.success && all_succeeded && ended == count;
+	counters = loop->counters();
+	return run;
+}
+
+// Runs one measurement in a child process, so that the memory, that the previous one
+// left to the allocator, does not hide the growth of this one.
+sessions_run RunSessionsIsolated(std::size_t count, std::size_t rounds, bool with_loop, relay_loop_counters& counters) {
+	struct report {
+		sessions_run run;
+		relay_loop_counters counters;
+	};
+	int channel[2];
+	if (::pipe(channel) != 0)
+		return sessions_run{};
+	pid_t child = ::fork();
+	if (child == 0) {
+		::close(channel[0]);
+		report result{};
+		result.run = with_loop ? RunSessionLoop(count, rounds, result.counters) : RunSessionThreads(count, rounds);
+		(void)!::write(channel[1], &result, sizeof(result));
+		::_exit(0);
+	}
+	::close(channel[1]);
+	report result{};
+	const bool received = child > 0 && ::read(channel[0], &result, sizeof(result)) == static_cast<ssize_t>(sizeof(result));
+	::close(channel[0]);
+	if (child > 0)
+		::waitpid(child, nullptr, 0);
+	if (!received)
+		return sessions_run{};
+	counters = result.counters;
+	return result.run;
+}
+
+// 1000 sessions need 4000 descriptors.
+void RaiseDescriptorLimit() {
+	rlimit limit{};
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		(void)::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+bool BenchSessions(const bench_args& args) {
+	RaiseDescriptorLimit();
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+
+	fmt::print("{} MiB through N pipe -> pipe sessions in chunks of {} bytes, buffers of {} bytes\n\n",
+		args.megabytes, SESSIONS_CHUNK_SIZE, SESSIONS_BUFFER_SIZE);
+	fmt::print("{:>8}  {:>8}  {:>10}  {:>10}  {:>12}  {:>12}  {:>10}  {:>10}\n",
+		"sessions", "relay", "MB/s", "CPU ms", "CPU us/MB", "KiB/session", "buffers", "wakeups");
+	for (std::size_t count : { 10u, 100u, 1000u }) {
+		const std::size_t rounds = std::max<std::size_t>(1, total / (count * SESSIONS_CHUNK_SIZE));
+		const double megabytes = static_cast<double>(rounds * count * SESSIONS_CHUNK_SIZE) / 1e6;
+		for (bool with_loop : { false, true }) {
+			relay_loop_counters counters{};
+			sessions_run run = RunSessionsIsolated(count, rounds, with_loop, counters);
+			if (!run.success) {
+				fmt::print(stderr, "{} sessions {} failed\n", count, with_loop ? "in the relay loop" : "in threads");
+				return false;
+			}
+			const double cpu_milliseconds = static_cast<double>(run.cpu_nanoseconds) / 1e6;
+			fmt::print("{:>8}  {:>8}  {:>10.1f}  {:>10.1f}  {:>12.1f}  {:>12.1f}  {:>10}  {:>10}\n",
+				count, with_loop ? "loop" : "threads", megabytes / run.seconds, cpu_milliseconds,
+				cpu_milliseconds * 1e3 / megabytes, static_cast<double>(run.resident_kilobytes) / static_cast<double>(count),
+				with_loop ? std::to_string(counters.buffers_allocated) : std::to_string(count),
+				with_loop ? std::to_string(counters.wakeups) : std::string{ "-" });
+		}
+	}
+	return true;
+}
+#endif
+
+#if !defined(_WIN32)
+// The benchmark "async": 1 to 100 relays at once, each in a thread of its own with
+// blocking calls (ReadPipeWriteConsole() and the others, through run_relay()), versus
+// all of them as tasks of one io_scheduler (relay_async.h). "pipe" copies bytes from pipe to pipe, the threads without splice(),
+// because the handles are hidden from them; "console" writes UTF-16 from a pipe to a
+// pty. A producer thread writes a chunk into every relay per round, the consumer
+// reads the output back.
+
+constexpr std::size_t ASYNC_CHUNK_SIZE{ 4096 };
+constexpr std::size_t ASYNC_BUFFER_SIZE{ 16u * 1024u };
+
+struct async_relays {
+	std::vector<std::unique_ptr<byte_stream>> inputs{};  // written by the producer
+	std::vector<std::unique_ptr<byte_stream>> outputs{}; // read by the consumer
+	// The ends of the relays: `sinks` for "pipe", `consoles` for "console".
+	std::vector<std::unique_ptr<byte_stream>> sources{};
+	std::vector<std::unique_ptr<byte_stream>> sinks{};
+	std::vector<std::unique_ptr<console>> consoles{};
+};
+
+std::optional<async_relays> CreateAsyncRelays(std::size_t count, bool to_console) {
+	async_relays relays{};
+	for (std::size_t i = 0; i < count; ++i) {
+		auto in = create_pipe();
+		if (!in)
+			return std::nullopt;
+		relays.inputs.push_back(std::move(in->write_end));
+		relays.sources.push_back(std::move(in->read_end));
+		if (to_console) {
+			auto pty = open_pty();
+			if (!pty)
+				return std::nullopt;
+			relays.outputs.push_back(std::move(pty->master));
+			relays.consoles.push_back(std::move(pty->slave));
+		}
+		else {
+			auto out = create_pipe();
+			if (!out)
+				return std::nullopt;
+			relays.sinks.push_back(std::move(out->write_end));
+			relays.outputs.push_back(std::move(out->read_end));
+		}
+	}
+	return relays;
+}
+
+// Feeds `rounds` chunks into every relay and reads `output_size` bytes per chunk back.
+bool RunAsyncTraffic(async_relays& relays, std::size_t rounds, std::string_view chunk, std::size_t output_size) {
+	std::thread producer([&relays, chunk, rounds] {
+		for (std::size_t round = 0; round < rounds; ++round)
+			for (auto& input : relays.inputs)
+				if (!WriteAll(*input, chunk))
+					return;
+		relays.inputs.clear(); // EOF for every relay
+	});
+
+	bool success{ true };
+	std::vector<char> buffer(output_size);
+	for (std::size_t round = 0; round < rounds && success; ++round) {
+		for (auto& output : relays.outputs) {
+			std::size_t received = 0;
+			while (received < buffer.size() && success) {
+				io_result result = output->read(std::span<char>(buffer.data() + received, buffer.size() - received));
+				success = result.ok();
+				received += result.count;
+			}
+		}
+	}
+	producer.join();
+	return success;
+}
+
+struct async_run {
+	double seconds{ 0.0 };
+	// CPU time of the relays, without the producer and the consumer.
+	int64_t cpu_nanoseconds{ 0 };
+	io_scheduler_counters counters{};
+	bool success{ false };
+};
+
+async_run RunAsyncThreads(std::size_t count, std::size_t rounds, bool to_console, std::string_view chunk, std::size_t output_size) {
+	async_run run{};
+	std::optional<async_relays> relays = CreateAsyncRelays(count, to_console);
+	if (!relays)
+		return run;
+
+	const buffer_size_option buffer_size{ .size{ASYNC_BUFFER_SIZE} };
+	std::vector<int64_t> cpu(count, 0);
+	std::vector<char> results(count, 0);
+	std::vector<std::thread> threads{};
+	const auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < count; ++i) {
+		threads.emplace_back([&relays, &cpu, &results, i, to_console, buffer_size] {
+			if (to_console) {
+				results[i] = ReadPipeWriteConsole(*relays->sources[i], *relays->consoles[i], buffer_size);
+			}
+			else {
+				counting_source source{ *relays->sources[i] };
+				counting_sink sink{ *relays->sinks[i] };
+				results[i] = ReadHandleWriteFileByteWise(source, sink, buffer_size);
+			}
+			cpu[i] = ThreadCpuNanoseconds();
+		});
+	}
+	run.success = RunAsyncTraffic(*relays, rounds, chunk, output_size);
+	for (auto& thread : threads)
+		thread.join();
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (std::size_t i = 0; i < count; ++i) {
+		run.cpu_nanoseconds += cpu[i];
+		run.success = run.success && results[i];
+	}
+	return run;
+}
+
+async_run RunAsyncTasks(std::size_t count, std::size_t rounds, bool to_console, std::string_view chunk, std::size_t output_size) {
+	async_run run{};
+	std::optional<async_relays> relays = CreateAsyncRelays(count, to_console);
+	if (!relays)
+		return run;
+
+	const buffer_size_option buffer_size{ .size{ASYNC_BUFFER_SIZE} };
+	std::unique_ptr<io_scheduler> scheduler = create_io_scheduler();
+	for (std::size_t i = 0; i < count; ++i) {
+		if (to_console)
+			scheduler->spawn(ReadPipeWriteConsoleAsync(*relays->sources[i], *relays->consoles[i], buffer_size));
+		else
+			scheduler->spawn(ReadHandleWriteFileByteWiseAsync(*relays->sources[i], *relays->sinks[i], buffer_size));
+	}
+
+	bool relayed{ false };
+	const auto start = std::chrono::steady_clock::now();
+	std::thread relay([&] {
+		relayed = scheduler->run();
+		run.cpu_nanoseconds = ThreadCpuNanoseconds();
+	});
+	run.success = RunAsyncTraffic(*relays, rounds, chunk, output_size);
+	relay.join();
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	run.success = run.success && relayed;
+	run.counters = scheduler->counters();
+	return run;
+}
+
+bool BenchAsync(const bench_args& args) {
+	RaiseDescriptorLimit();
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	// "console" gets UTF-16 "x", that reaches the pty as one byte per code unit.
+	std::u16string text(ASYNC_CHUNK_SIZE / sizeof(char16_t), u'x');
+	const std::string_view console_chunk(reinterpret_cast<const char*>(text.data()), ASYNC_CHUNK_SIZE);
+	const std::string pipe_chunk(ASYNC_CHUNK_SIZE, 'x');
+
+	fmt::print("{} MiB through N relays in chunks of {} bytes, buffers of {} bytes\n\n",
+		args.megabytes, ASYNC_CHUNK_SIZE, ASYNC_BUFFER_SIZE);
+	fmt::print("{:>8}  {:>8}  {:>8}  {:>10}  {:>10}  {:>12}  {:>12}  {:>10}\n",
+		"relay", "relays", "core", "MB/s", "CPU ms", "CPU us/MB", "suspensions", "wakeups");
+	for (bool to_console : { false, true }) {
+		const std::string_view chunk = to_console ? console_chunk : std::string_view(pipe_chunk);
+		const std::size_t output_size = to_console ? ASYNC_CHUNK_SIZE / sizeof(char16_t) : ASYNC_CHUNK_SIZE;
+		for (std::size_t count : { 1u, 10u, 100u }) {
+			const std::size_t rounds = std::max<std::size_t>(1, total / (count * ASYNC_CHUNK_SIZE));
+			const double megabytes = static_cast<double>(rounds * count * ASYNC_CHUNK_SIZE) / 1e6;
+			for (bool with_tasks : { false, true }) {
+				async_run run = with_tasks ? RunAsyncTasks(count, rounds, to_console, chunk, output_size)
+					: RunAsyncThreads(count, rounds, to_console, chunk, output_size);
+				if (!run.success) {
+					fmt::print(stderr, "{} {} relays {} failed\n", count, to_console ? "console" : "pipe", with_tasks ? "as tasks" : "in threads");
+					return false;
+				}
+				const double cpu_milliseconds = static_cast<double>(run.cpu_nanoseconds) / 1e6;
+				fmt::print("{:>8}  {:>8}  {:>8}  {:>10.1f}  {:>10.1f}  {:>12.1f}  {:>12}  {:>10}\n",
+					to_console ? "console" : "pipe", count, with_tasks ? "tasks" : "threads", megabytes / run.seconds,
+					cpu_milliseconds, cpu_milliseconds * 1e3 / megabytes,
+					with_tasks ? std::to_string(run.counters.suspensions) : std::string{ "-" },
+					with_tasks ? std::to_string(run.counters.wakeups) : std::string{ "-" });
+			}
+		}
+	}
+	return true;
+}
+#endif
+
+#if !defined(_WIN32)
+// The benchmark "ctrl-event": the time from generate_ctrl_event() to the end of the wait
+// for the handler, in a process group of 1 to 16 processes, like "stty --generate-event".
+// Each process confirms with the waitable object of ctrl_event_handler, or with the loop
+// of 10 ms sleeps on a flag, that stty.exe used before. The confirmation runs in a thread
+// of its own, also in the process, that generates the events: kill() runs the handler of
+// the caller before it returns, and on Windows the handler runs in a new thread anyway.
+
+constexpr std::size_t CTRL_EVENT_ROUNDS{ 200 };
+constexpr std::chrono::milliseconds CTRL_EVENT_POLL_INTERVAL{ 10 };
+// Generous, so that a loaded machine with a single CPU does not fail a round.
+constexpr std::chrono::milliseconds CTRL_EVENT_TIMEOUT{ 5000 };
+
+bool WaitForCtrlEvent(const ctrl_event_handler& handler, uint64_t seen, bool polling) {
+	if (!polling)
+		return handler.wait(seen, CTRL_EVENT_TIMEOUT);
+	for (auto waited = std::chrono::milliseconds{ 0 }; waited < CTRL_EVENT_TIMEOUT && handler.handled() <= seen; waited += CTRL_EVENT_POLL_INTERVAL)
+		std::this_thread::sleep_for(CTRL_EVENT_POLL_INTERVAL);
+	return handler.handled() > seen;
+}
+
+// Reports the time, at which each of `rounds` events was seen after `seen`.
+bool ConfirmCtrlEvents(const ctrl_event_handler& handler, uint64_t seen, int report_fd, std::size_t rounds, bool polling) {
+	for (std::size_t round = 0; round < rounds; ++round, ++seen) {
+		if (!WaitForCtrlEvent(handler, seen, polling))
+			return false;
+		const int64_t now = NowNanoseconds();
+		(void)!::write(report_fd, &now, sizeof(now));
+	}
+	return true;
+}
+
+// A member of the group, but not the one, that generates the events. Reports 0 (ready)
+// or -1 (no handler), and then the time, at which it saw each event.
+[[noreturn]] void RunCtrlEventMember(int report_fd, std::size_t rounds, bool polling) {
+	ctrl_event_handler handler{};
+	const int64_t ready = handler.installed() ? 0 : -1;
+	(void)!::write(report_fd, &ready, sizeof(ready));
+	const uint64_t seen = handler.handled();
+	::_exit(handler.installed() && ConfirmCtrlEvents(handler, seen, report_fd, rounds, polling) ? 0 : 1);
+}
+
+// Runs in a process of its own, that leads a new process group, so that the events do
+// not reach the benchmark or its shell. Returns the latencies in nanoseconds.
+std::vector<int64_t> RunCtrlEventGroup(std::size_t members, std::size_t rounds, bool polling) {
+	std::vector<int64_t> latencies{};
+	if (::setpgid(0, 0) != 0)
+		return latencies;
+	int reports[2];
+	if (::pipe(reports) != 0)
+		return latencies;
+	// The others are forked first, so that each gets a handler and a pipe of its own.
+	std::vector<pid_t> others{};
+	for (std::size_t m = 1; m < members; ++m) {
+		pid_t member = ::fork();
+		if (member == 0) {
+			::close(reports[0]);
+			RunCtrlEventMember(reports[1], rounds, polling);
+		}
+		if (member > 0)
+			others.push_back(member);
+	}
+	auto read_report = [&](int64_t& value) {
+		return ::read(reports[0], &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value));
+	};
+
+	// This process confirms in a thread, like the others. It has its own descriptor, so
+	// that the pipe ends, once it and all members have stopped.
+	ctrl_event_handler handler{};
+	bool success = handler.installed() && others.size() + 1 == members;
+	std::thread confirmer{};
+	if (success) {
+		const uint64_t seen = handler.handled();
+		confirmer = std::thread([&handler, seen, report_fd = reports[1], rounds, polling] {
+			(void)ConfirmCtrlEvents(handler, seen, report_fd, rounds, polling);
+			::close(report_fd);
+		});
+	}
+	else {
+		::close(reports[1]);
+	}
+	for (std::size_t m = 0; m < others.size() && success; ++m) {
+		int64_t ready{ -1 };
+		success = read_report(ready) && ready == 0;
+	}
+	for (std::size_t round = 0; round < rounds && success; ++round) {
+		const int64_t generated = NowNanoseconds();
+		success = generate_ctrl_event(ConsoleCtrlEvent::ctrl_c_event, 0);
+		// Every process has seen this event, before the next one is generated, because
+		// signals, that are pending at the same time, are delivered once.
+		for (std::size_t m = 0; m < members && success; ++m) {
+			int64_t seen_at{};
+			success = read_report(seen_at);
+			latencies.push_back(seen_at - generated);
+		}
+	}
+	if (!success) {
+		for (pid_t member : others)
+			::kill(member, SIGKILL);
+	}
+	// After a failure, the thread gives up after CTRL_EVENT_TIMEOUT.
+	if (confirmer.joinable())
+		confirmer.join();
+	::close(reports[0]);
+	for (pid_t member : others)
+		::waitpid(member, nullptr, 0);
+	if (!success)
+		latencies.clear();
+	return latencies;
+}
+
+std::vector<int64_t> RunCtrlEventIsolated(std::size_t members, std::size_t rounds, bool polling) {
+	std::vector<int64_t> latencies{};
+	int channel[2];
+	if (::pipe(channel) != 0)
+		return latencies;
+	pid_t child = ::fork();
+	if (child == 0) {
+		::close(channel[0]);
+		const std::vector<int64_t> result = RunCtrlEventGroup(members, rounds, polling);
+		std::span<const char> bytes{ reinterpret_cast<const char*>(result.data()), result.size() * sizeof(int64_t) };
+		while (!bytes.empty()) {
+			const ssize_t written = ::write(channel[1], bytes.data(), bytes.size());
+			if (written <= 0)
+				break;
+			bytes = bytes.subspan(static_cast<std::size_t>(written));
+		}
+		::_exit(result.empty() ? 1 : 0);
+	}
+	::close(channel[1]);
+	int64_t latency{};
+	while (child > 0 && ::read(channel[0], &latency, sizeof(latency)) == static_cast<ssize_t>(sizeof(latency)))
+		latencies.push_back(latency);
+	::close(channel[0]);
+	if (child > 0)
+		::waitpid(child, nullptr, 0);
+	return latencies;
+}
+
+bool BenchCtrlEvent(const bench_args& /*args*/) {
+	fmt::print("SIGINT to a process group, {} events, from the generate call until each process confirmed, in microseconds\n\n", CTRL_EVENT_ROUNDS);
+	fmt::print("{:>8}  {:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "members", "confirm", "mean", "p50", "p99", "max");
+	for (std::size_t members : { 1u, 4u, 16u }) {
+		for (bool polling : { true, false }) {
+			std::vector<int64_t> samples = RunCtrlEventIsolated(members, CTRL_EVENT_ROUNDS, polling);
+			// One configuration, that failed, does not hide the others.
+			if (samples.size() != members * CTRL_EVENT_ROUNDS) {
+				fmt::print("{:>8}  {:>10}  {:>10}\n", members, polling ? "poll 10ms" : "event", "failed");
+				continue;
+			}
+			std::sort(samples.begin(), samples.end());
+			double sum{ 0.0 };
+			for (int64_t sample : samples)
+				sum += static_cast<double>(sample);
+			auto microseconds = [&](double fraction) {
+				const std::size_t index = std::min(samples.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(samples.size())));
+				return static_cast<double>(samples[index]) / 1e3;
+			};
+			fmt::print("{:>8}  {:>10}  {:>10.1f}  {:>10.1f}  {:>10.1f}  {:>10.1f}\n", members, polling ? "poll 10ms" : "event",
+				sum / static_cast<double>(samples.size()) / 1e3, microseconds(0.5), microseconds(0.99), microseconds(1.0));
+		}
+	}
+	return true;
+}
+
+// The benchmark "shm-ring": the transports of "pipe-to-con --transport" between two
+// processes, a pipe and a ring in shared memory. Throughput in chunks of 64 bytes to
+// 64 KiB, and the round trip of a single byte, which includes a wakeup each way.
+
+constexpr std::size_t SHM_RING_ROUNDS{ 10000 };
+
+enum class bench_transport {
+	pipe,
+	shm
+};
+
+// One direction between the benchmark and a child, that is forked afterwards.
+struct transport_channel {
+	std::unique_ptr<byte_stream> parent_end{};
+	// Pipe: the end of the child. Ring: the descriptor of the mapping, owned by parent_end.
+	std::unique_ptr<byte_stream> child_pipe_end{};
+	int mapping_fd{ -1 };
+	// The ring behind parent_end, if any.
+	shm_ring_stream* ring{ nullptr };
+};
+
+std::optional<transport_channel> CreateChannel(bench_transport transport, bool parent_writes) {
+	transport_channel channel{};
+	if (transport == bench_transport::shm) {
+		auto ring = create_shm_ring(DEFAULT_SHM_RING_CAPACITY, parent_writes ? shm_ring_side::producer : shm_ring_side::consumer);
+		if (!ring)
+			return std::nullopt;
+		channel.mapping_fd = ring->shared_handle();
+		channel.ring = ring.get();
+		channel.parent_end = std::move(ring);
+		return channel;
+	}
+	auto pipe = create_pipe();
+	if (!pipe)
+		return std::nullopt;
+	channel.parent_end = std::move(parent_writes ? pipe->write_end : pipe->read_end);
+	channel.child_pipe_end = std::move(parent_writes ? pipe->read_end : pipe->write_end);
+	return channel;
+}
+
+// In the child after fork().
+std::unique_ptr<byte_stream> TakeChildEnd(transport_channel& channel, bool parent_writes) {
+	// Not the destructor of the parent's end: for a ring, it would close the side of the parent.
+	if (auto fd = channel.parent_end->handle())
+		::close(*fd);
+	(void)channel.parent_end.release();
+	if (channel.mapping_fd < 0)
+		return std::move(channel.child_pipe_end);
+	return open_shm_ring(::dup(channel.mapping_fd), parent_writes ? shm_ring_side::consumer : shm_ring_side::producer);
+}
+
+// In the parent after fork(). The ring learns the child at once: if the child died, before
+// it opened the ring, the parent would wait for it forever otherwise.
+void KeepParentEnd(transport_channel& channel, pid_t child) {
+	channel.child_pipe_end.reset();
+	if (channel.ring && child > 0)
+		channel.ring->set_peer(static_cast<uint32_t>(child));
+}
+
+// MB/s of `total` bytes from a child in chunks of `chunk_size`.
+std::optional<double> RunTransportThroughput(bench_transport transport, std::size_t total, std::size_t chunk_size) {
+	auto channel = CreateChannel(transport, false);
+	if (!channel)
+		return std::nullopt;
+	const int64_t start = NowNanoseconds();
+	pid_t child = ::fork();
+	if (child == 0) {
+		auto out = TakeChildEnd(*channel, false);
+		std::vector<char> chunk(chunk_size, 'x');
+		for (std::size_t remaining = total; out && remaining > 0;) {
+			const std::size_t size = std::min(remaining, chunk.size());
+			if (!WriteAll(*out, std::string_view(chunk.data(), size)))
+				::_exit(1);
+			remaining -= size;
+		}
+		out.reset(); // EOF for the reader
+		::_exit(0);
+	}
+	KeepParentEnd(*channel, child);
+	std::size_t received{ 0 };
+	std::vector<char> buffer(chunk_size);
+	for (;;) {
+		io_result result = channel->parent_end->read(buffer);
+		if (!result.ok())
+			break;
+		received += result.count;
+	}
+	const int64_t elapsed = NowNanoseconds() - start;
+	int status{};
+	if (child < 0 || ::waitpid(child, &status, 0) != child || status != 0 || received != total)
+		return std::nullopt;
+	return static_cast<double>(total) / 1e6 / (static_cast<double>(elapsed) / 1e9);
+}
+
+// Round trips of one byte to a child, that echoes it, in nanoseconds.
+std::vector<int64_t> RunTransportPingPong(bench_transport transport, std::size_t rounds) {
+	std::vector<int64_t> samples{};
+	auto to_child = CreateChannel(transport, true);
+	auto from_child = CreateChannel(transport, false);
+	if (!to_child || !from_child)
+		return samples;
+	pid_t child = ::fork();
+	if (child == 0) {
+		auto in = TakeChildEnd(*to_child, true);
+		auto out = TakeChildEnd(*from_child, false);
+		char byte{};
+		while (in && out) {
+			io_result result = in->read(std::span<char>(&byte, 1));
+			if (!result.ok())
+				break;
+			if (!WriteAll(*out, std::string_view(&byte, 1)))
+				::_exit(1);
+		}
+		::_exit(0);
+	}
+	KeepParentEnd(*to_child, child);
+	KeepParentEnd(*from_child, child);
+	char byte{ 'x' };
+	for (std::size_t round = 0; round < rounds && child > 0; ++round) {
+		const int64_t start = NowNanoseconds();
+		if (!WriteAll(*to_child->parent_end, std::string_view(&byte, 1)))
+			break;
+		io_result result = from_child->parent_end->read(std::span<char>(&byte, 1));
+		if (!result.ok() || result.count != 1)
+			break;
+		samples.push_back(NowNanoseconds() - start);
+	}
+	to_child->parent_end.reset(); // EOF for the child
+	int status{};
+	if (child < 0 || ::waitpid(child, &status, 0) != child || status != 0 || samples.size() != rounds)
+		samples.clear();
+	return samples;
+}
+
+// A child, that dies before it opens the ring: the read of the parent has to end.
+bool CheckRingChildDied() {
+	auto channel = CreateChannel(bench_transport::shm, false);
+	if (!channel)
+		return false;
+	pid_t child = ::fork();
+	if (child == 0)
+		::_exit(0);
+	KeepParentEnd(*channel, child);
+
+	struct outcome {
+		std::atomic<bool> ended{ false };
+		io_result read{};
+	};
+	auto result = std::make_shared<outcome>();
+	std::shared_ptr<byte_stream> ring{ std::move(channel->parent_end) };
+	const auto start = std::chrono::steady_clock::now();
+	std::thread reader([result, ring] {
+		char byte{};
+		result->read = ring->read(std::span<char>(&byte, 1));
+		result->ended.store(true, std::memory_order_release);
+	});
+	while (!result->ended.load(std::memory_order_acquire) && std::chrono::steady_clock::now() - start < std::chrono::seconds{ 5 })
+		std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+	const auto stop = std::chrono::steady_clock::now();
+
+	const bool ended = result->ended.load(std::memory_order_acquire);
+	if (ended)
+		reader.join();
+	else
+		reader.detach(); // waits for the child forever; it ends with the process
+	int status{};
+	if (child > 0)
+		(void)::waitpid(child, &status, 0);
+	const bool ok = ended && !result->read.ok();
+	fmt::print("\nChild died before it opened the ring: {} after {:.1f} ms\n",
+		ok ? "ok" : "FAILED", std::chrono::duration<double>(stop - start).count() * 1e3);
+	return ok;
+}
+
+bool BenchShmRing(const bench_args& args) {
+	const std::size_t total = args.megabytes * 1024u * 1024u;
+	fmt::print("{} MiB from a child process, ring of {} KiB\n\n", args.megabytes, DEFAULT_SHM_RING_CAPACITY / 1024u);
+	fmt::print("{:>10}  {:>12}  {:>12}\n", "chunk", "pipe MB/s", "shm MB/s");
+	for (std::size_t chunk_size : { 64u, 512u, 4096u, 65536u }) {
+		const auto through_pipe = RunTransportThroughput(bench_transport::pipe, total, chunk_size);
+		const auto through_ring = RunTransportThroughput(bench_transport::shm, total, chunk_size);
+		if (!through_pipe || !through_ring) {
+			fmt::print(stderr, "The transfer in chunks of {} bytes failed through the {}\n", chunk_size, through_pipe ? "ring" : "pipe");
+			return false;
+		}
+		fmt::print("{:>10}  {:>12.1f}  {:>12.1f}\n", chunk_size, *through_pipe, *through_ring);
+	}
+
+	fmt::print("\nRound trip of one byte, {} rounds, in microseconds\n\n", SHM_RING_ROUNDS);
+	fmt::print("{:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "transport", "mean", "p50", "p99", "max");
+	for (bench_transport transport : { bench_transport::pipe, bench_transport::shm }) {
+		std::vector<int64_t> samples = RunTransportPingPong(transport, SHM_RING_ROUNDS);
+		const std::string_view name = (transport == bench_transport::shm) ? "shm" : "pipe";
+		if (samples.empty()) {
+			fmt::print(stderr, "The round trips through the {} failed\n", name);
+			return false;
+		}
+		std::sort(samples.begin(), samples.end());
+		double sum{ 0.0 };
+		for (int64_t sample : samples)
+			sum += static_cast<double>(sample);
+		auto microseconds = [&](double fraction) {
+			const std::size_t index = std::min(samples.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(samples.size())));
+			return static_cast<double>(samples[index]) / 1e3;
+		};
+		fmt::print("{:>10}  {:>10.1f}  {:>10.1f}  {:>10.1f}  {:>10.1f}\n", name,
+			sum / static_cast<double>(samples.size()) / 1e3, microseconds(0.5), microseconds(0.99), microseconds(1.0));
+	}
+	return CheckRingChildDied();
+}
+#endif
+
+#if !defined(_WIN32)
+// The benchmark "c-api": the library console-relay on a pty, that stands in for the
+// console of a target process. First the sessions are checked in both directions and
+// encodings, then a message is timed from the call until it arrives: a secondary
+// process per message, a session per message, and one session for all messages.
+
+constexpr std::size_t C_API_MESSAGES{ 200 };
+
+std::optional<console_relay_session*> OpenRelaySession(pid_t target, uint32_t direction, uint32_t encoding) {
+	const console_relay_options options{ .size = sizeof(console_relay_options), .direction = direction,
+		.encoding = encoding, .flags = CONSOLE_RELAY_NO_BROKER };
+	console_relay_session* session{ nullptr };
+	const int32_t result = console_relay_open(static_cast<uint32_t>(target), &options, &session);
+	if (result != CONSOLE_RELAY_OK) {
+		fmt::print(stderr, "console_relay_open() failed with {}\n", result);
+		return std::nullopt;
+	}
+	return session;
+}
+
+// Reads from the session, until `expected` has arrived.
+bool ReadRelaySession(console_relay_session* session, std::string_view expected) {
+	std::string received{};
+	char buffer[64];
+	while (received.size() < expected.size()) {
+		std::size_t count{};
+		if (console_relay_read(session, buffer, sizeof(buffer), &count) != CONSOLE_RELAY_OK)
+			return false;
+		received.append(buffer, count);
+	}
+	return received == expected;
+}
+
+// Drains the terminal side, until `expected` was seen.
+bool WaitForText(byte_stream& master, std::string_view expected) {
+	std::string received{};
+	char buffer[256];
+	while (received.find(expected) == std::string::npos) {
+		io_result result = master.read(buffer);
+		if (!result.ok())
+			return false;
+		received.append(buffer, result.count);
+	}
+	return true;
+}
+
+bool CheckRelaySessions(byte_stream& master, pid_t target) {
+	for (uint32_t encoding : { CONSOLE_RELAY_UTF8, CONSOLE_RELAY_UTF16LE }) {
+		const bool utf8 = (encoding == CONSOLE_RELAY_UTF8);
+		const std::string_view name = utf8 ? "UTF-8" : "UTF-16LE";
+		const std::string text = EncodeText("caf\xC3\xA9 \xF0\x9F\x98\x80\n", utf8 ? text_encoding::utf8 : text_encoding::utf16le);
+
+		std::optional<console_relay_session*> out = OpenRelaySession(target, CONSOLE_RELAY_TO_CONSOLE, encoding);
+		if (!out)
+			return false;
+		// An odd split of the UTF-16LE bytes must not break the text.
+		const bool written = console_relay_write(*out, text.data(), 3) == CONSOLE_RELAY_OK
+			&& console_relay_write(*out, text.data() + 3, text.size() - 3) == CONSOLE_RELAY_OK;
+		console_relay_close(*out);
+		if (!written || !WaitForText(master, "caf\xC3\xA9 \xF0\x9F\x98\x80")) {
+			fmt::print(stderr, "Writing {} to the console failed\n", name);
+			return false;
+		}
+
+		std::optional<console_relay_session*> in = OpenRelaySession(target, CONSOLE_RELAY_FROM_CONSOLE, encoding);
+		if (!in)
+			return false;
+		const bool read = WriteAll(master, "caf\xC3\xA9 \xF0\x9F\x98\x80\n") && ReadRelaySession(*in, text);
+		console_relay_close(*in);
+		// The terminal echoes the line back.
+		if (!read || !WaitForText(master, "\n")) {
+			fmt::print(stderr, "Reading {} from the console failed\n", name);
+			return false;
+		}
+		fmt::print("{:>10}  to and from the console: ok\n", name);
+	}
+	return true;
+}
+
+// One message through a session, that stays open.
+std::optional<int64_t> SendWithSession(byte_stream& master, console_relay_session* session) {
+	const int64_t start = NowNanoseconds();
+	const bool arrived = console_relay_write(session, TTFB_PAYLOAD.data(), TTFB_PAYLOAD.size()) == CONSOLE_RELAY_OK
+		&& WaitForPayload(master);
+	const int64_t first_byte = NowNanoseconds();
+	if (!arrived)
+		return std::nullopt;
+	return first_byte - start;
+}
+
+std::optional<int64_t> SendWithNewSession(byte_stream& master, pid_t target) {
+	const int64_t start = NowNanoseconds();
+	std::optional<console_relay_session*> session = OpenRelaySession(target, CONSOLE_RELAY_TO_CONSOLE, CONSOLE_RELAY_UTF16LE);
+	if (!session)
+		return std::nullopt;
+	const bool arrived = console_relay_write(*session, TTFB_PAYLOAD.data(), TTFB_PAYLOAD.size()) == CONSOLE_RELAY_OK
+		&& WaitForPayload(master);
+	const int64_t first_byte = NowNanoseconds();
+	console_relay_close(*session);
+	if (!arrived)
+		return std::nullopt;
+	return first_byte - start;
+}
+
+bool BenchCApi(const bench_args& /*args*/) {
+	auto pty = open_pty();
+	if (!pty) {
+		fmt::print(stderr, "Failed to create a pty\n");
+		return false;
+	}
+	const int console_fd = *pty->slave->handle();
+	std::optional<pid_t> target = StartTargetProcess(console_fd);
+	if (!target) {
+		fmt::print(stderr, "Failed to start the target process\n");
+		return false;
+	}
+
+	fmt::print("console-relay, API version {}\n\n", console_relay_api_version());
+	bool success = CheckRelaySessions(*pty->master, *target);
+	std::optional<console_relay_session*> session{};
+	if (success) {
+		session = OpenRelaySession(*target, CONSOLE_RELAY_TO_CONSOLE, CONSOLE_RELAY_UTF16LE);
+		success = session.has_value();
+	}
+	if (success) {
+		fmt::print("\nLatency of one message of {} until it is on the console, in microseconds\n\n", C_API_MESSAGES);
+		fmt::print("{:>10}  {:>10}  {:>10}  {:>10}  {:>10}\n", "mode", "mean", "p50", "p99", "max");
+	}
+	for (std::string_view mode : { "spawn", "open", "session" }) {
+		if (!success)
+			break;
+		std::vector<int64_t> samples{};
+		for (std::size_t run = 0; run < C_API_MESSAGES && success; ++run) {
+			std::optional<int64_t> sample = (mode == "session") ? SendWithSession(*pty->master, *session)
+				: (mode == "open") ? SendWithNewSession(*pty->master, *target)
+				: InvokeWithSecondary(*pty->master, console_fd);
+			success = sample.has_value();
+			if (sample)
+				samples.push_back(*sample);
+		}
+		if (!success) {
+			fmt::print(stderr, "A message in the mode {}{}{} failed\n", quote_open, mode, quote_close);
+			break;
+		}
+		std::sort(samples.begin(), samples.end());
+		double sum{ 0.0 };
+		for (int64_t sample : samples)
+			sum += static_cast<double>(sample);
+		auto microseconds = [&](double fraction) {
+			const std::size_t index = std::min(samples.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(samples.size())));
+			return static_cast<double>(samples[index]) / 1e3;
+		};
+		fmt::print("{:>10}  {:>10.1f}  {:>10.1f}  {:>10.1f}  {:>10.1f}\n", mode,
+			sum / static_cast<double>(samples.size()) / 1e3, microseconds(0.5), microseconds(0.99), microseconds(1.0));
+	}
+
+	if (session)
+		console_relay_close(*session);
+	::kill(*target, SIGTERM);
+	::waitpid(*target, nullptr, 0);
+	return success;
+}
+#endif
+
+void PrintUsage(FILE* stream) {
+	fmt::print(stream,
+		"Usage:\n"
+		"\n"
+		"  relay-bench <benchmark> [--megabytes <n>] [--chunk-size <bytes>] [--read-rate <MB/s>] [--write-rate <MB/s>] [--buffer-size <size>]\n"
+		"\n"
+		"<benchmark>   One of these:\n"
+		"              - \"buffer-size\"   throughput versus size of the relay buffer\n"
+		"              - \"pipeline\"      read-ahead pipeline versus read-then-write, with a\n"
+		"                                producer and a console of the given speeds\n"
+		"              - \"zero-copy\"     copy loop versus transfer_in_kernel() (splice on Linux)\n"
+		"                                between two pipes\n"
+		"              - \"io-uring\"      blocking read/write loop versus io_uring with 2 to 16\n"
+		"                                buffers, between two pipes\n"
+		"              - \"utf\"           UTF-8 <-> UTF-16 conversion: SIMD kernel, scalar code\n"
+		"                                and nowide, for ASCII, Latin, CJK and emoji text\n"
+		"              - \"echo\"          the read/write loop of stdin-echo on a pty (POSIX):\n"
+		"                                a string and a write per read, versus utf8_writer\n"
+		"              - \"spsc\"          lock-free SPSC byte ring versus a deque behind a\n"
+		"                                mutex, in batches of 16 to 4096 bytes\n"
+		"              - \"suite\"         the relays of pipe-to-con, stty and stdin-echo with\n"
+		"                                ASCII, BMP, emoji and VT text, as JSON: MB/s,\n"
+		"                                syscalls/MB and the latency of the chunks at\n"
+		"                                --read-rate\n"
+		"              - \"duplex\"        both directions of pipe-to-con --duplex through pipes:\n"
+		"                                at once versus one after the other, with a console\n"
+		"                                and its input of the given speeds, and the end of a\n"
+		"                                session without console input\n"
+		"              - \"ttfb\"          time to the first byte on a pty (POSIX): a secondary\n"
+		"                                process per invocation, versus a broker process,\n"
+		"                                versus the direct path through /proc/<pid>/fd/0\n"
+		"              - \"sessions\"      10, 100 and 1000 pipe relays at once (POSIX): a thread\n"
+		"                                per session versus one relay_loop, with CPU time\n"
+		"                                and memory per session\n"
+		"              - \"async\"         1, 10 and 100 pipe -> pipe and pipe -> pty relays at\n"
+		"                                once (POSIX): a thread per relay with blocking calls\n"
+		"                                versus tasks of one io_scheduler, with CPU time\n"
+		"              - \"ctrl-event\"    SIGINT to a process group of 1, 4 and 16 processes\n"
+		"                                (POSIX): the latency until each handler confirmed,\n"
+		"                                with a waitable object versus 10 ms polling\n"
+		"              - \"shm-ring\"      a pipe versus a ring in shared memory between two\n"
+		"                                processes (Linux): MB/s in chunks of 64 bytes to\n"
+		"                                64 KiB and the round trip of one byte\n"
+		"              - \"c-api\"         the library console-relay on a pty (POSIX): text to\n"
+		"                                and from the console, and the latency of a message\n"
+		"                                with a secondary process, a new session, or one\n"
+		"                                session for all\n"
+		"\n"
+		"<size>        Size of the relay buffer for \"suite\" and \"duplex\", like --buffer-size of\n"
+		"              pipe-to-con.\n"
+	);
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2) {
+		PrintUsage(stderr);
+		return 1;
+	}
+
+	std::string_view benchmark{ argv[1] };
+	bench_args args{};
+
+#if !defined(_WIN32)
+	if (benchmark == "ttfb-secondary" && argc == 4)
+		return RunTtfbSecondary(argv[2], argv[3]);
+#endif
+
+	for (int i = 2; i < argc; ++i) {
+		std::string_view current_arg{ argv[i] };
+		std::optional<std::string_view> next_arg{ std::nullopt };
+		if (i + 1 < argc)
+			next_arg = argv[i + 1];
+
+		auto parse_size = [&](std::string_view option_name, std::size_t& value) -> bool {
+			if (!next_arg) {
+				fmt::print(stderr, "Value for option '{}' is missing.\n", option_name);
+				return false;
+			}
+			i += 1;
+			auto number = string_to_uint<uint32_t>(*next_arg);
+			if (!number || *number == 0) {
+				fmt::print(stderr, "value for option \"{}\" is not a positive number.\n", option_name);
+				return false;
+			}
+			value = *number;
+			return true;
+		};
+
+		if (current_arg == "--megabytes") {
+			if (!parse_size("--megabytes", args.megabytes))
+				return 1;
+		}
+		else if (current_arg == "--chunk-size") {
+			if (!parse_size("--chunk-size", args.chunk_size))
+				return 1;
+		}
+		else if (current_arg == "--read-rate") {
+			if (!parse_size("--read-rate", args.read_rate))
+				return 1;
+		}
+		else if (current_arg == "--write-rate") {
+			if (!parse_size("--write-rate", args.write_rate))
+				return 1;
+		}
+		else if (current_arg == "--buffer-size") {
+			if (!next_arg) {
+				fmt::print(stderr, "Value for option '{}' is missing.\n", current_arg);
+				return 1;
+			}
+			i += 1;
+			args.buffer_size = parse_buffer_size_option(*next_arg);
+			if (!args.buffer_size) {
+				fmt::print(stderr, "value for option \"--buffer-size\" is not an even number between {} and {}, or \"auto\".\n", MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+				return 1;
+			}
+		}
+		else {
+			fmt::print(stderr, "Argument {}{}{} could not be interpreted\n", quote_open, current_arg, quote_close);
+			PrintUsage(stderr);
+			return 1;
+		}
+	}
+
+	bool success{ false };
+	if (benchmark == "buffer-size") {
+		success = BenchBufferSize(args);
+	}
+	else if (benchmark == "pipeline") {
+		success = BenchPipeline(args);
+	}
+	else if (benchmark == "zero-copy") {
+		success = BenchZeroCopy(args);
+	}
+	else if (benchmark == "io-uring") {
+		success = BenchIoUring(args);
+	}
+	else if (benchmark == "utf") {
+		success = BenchUtf(args);
+	}
+#if !defined(_WIN32)
+	else if (benchmark == "echo") {
+		success = BenchEcho(args);
+	}
+	else if (benchmark == "ttfb") {
+		success = BenchTtfb(args);
+	}
+	else if (benchmark == "sessions") {
+		success = BenchSessions(args);
+	}
+	else if (benchmark == "async") {
+		success = BenchAsync(args);
+	}
+	else if (benchmark == "ctrl-event") {
+		success = BenchCtrlEvent(args);
+	}
+	else if (benchmark == "shm-ring") {
+		success = BenchShmRing(args);
+	}
+	else if (benchmark == "c-api") {
+		success = BenchCApi(args);
+	}
+#endif
+	else if (benchmark == "suite") {
+		success = BenchSuite(args);
+	}
+	else if (benchmark == "duplex") {
+		success = BenchDuplex(args);
+	}
+	else if (benchmark == "spsc") {
+		success = BenchSpsc(args);
+	}
+	else {
+		fmt::print(stderr, "Unknown benchmark {}{}{}\n", quote_open, benchmark, quote_close);
+		PrintUsage(stderr);
+		return 1;
+	}
+	return success ? 0 : 1;
+}
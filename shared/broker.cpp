@@ -0,0 +1,164 @@
+#include "console-tools/broker.h"
+#include "console-tools/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <fmt/core.h>
+
+namespace {
+
+// Arguments of a secondary process fit into a few hundred bytes.
+constexpr std::size_t MAX_ARGUMENTS_SIZE{ 4096 };
+constexpr std::size_t MAX_REASON_SIZE{ 4096 };
+
+bool write_all(byte_sink& out, std::span<const char> bytes) {
+	while (!bytes.empty()) {
+		io_result result = out.write(bytes);
+		if (!result.ok() || result.count == 0)
+			return false;
+		bytes = bytes.subspan(result.count);
+	}
+	return true;
+}
+
+bool read_exactly(byte_source& in, std::span<char> bytes) {
+	while (!bytes.empty()) {
+		io_result result = in.read(bytes);
+		if (!result.ok())
+			return false;
+		bytes = bytes.subspan(result.count);
+	}
+	return true;
+}
+
+std::vector<std::string_view> split_arguments(std::string_view text) {
+	std::vector<std::string_view> arguments{};
+	while (!text.empty()) {
+		const std::size_t end = std::min(text.find(' '), text.size());
+		if (end > 0)
+			arguments.push_back(text.substr(0, end));
+		text.remove_prefix(std::min(end + 1, text.size()));
+	}
+	return arguments;
+}
+
+struct session_thread {
+	std::thread thread{};
+	std::atomic<bool> done{ false };
+};
+
+} // namespace
+
+std::string broker_endpoint(std::string_view tool, uint32_t pid) {
+	return fmt::format("{}-broker-{}", tool, pid);
+}
+
+bool write_frame(byte_sink& out, std::string_view payload) {
+	const auto size = static_cast<uint32_t>(payload.size());
+	const char header[4]{
+		static_cast<char>(size & 0xFFu), static_cast<char>((size >> 8) & 0xFFu),
+		static_cast<char>((size >> 16) & 0xFFu), static_cast<char>((size >> 24) & 0xFFu),
+	};
+	// One write for small frames, so that the peer does not wake up twice.
+	if (payload.size() <= MAX_REASON_SIZE) {
+		char frame[sizeof(header) + MAX_REASON_SIZE];
+		std::memcpy(frame, header, sizeof(header));
+		std::memcpy(frame + sizeof(header), payload.data(), payload.size());
+		return write_all(out, std::span<const char>(frame, sizeof(header) + payload.size())) && out.flush();
+	}
+	return write_all(out, header) && write_all(out, payload) && out.flush();
+}
+
+std::optional<std::string> read_frame(byte_source& in, std::size_t max_size) {
+	unsigned char header[4]{};
+	if (!read_exactly(in, std::span<char>(reinterpret_cast<char*>(header), sizeof(header))))
+		return std::nullopt;
+	const std::size_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (std::size_t{ header[3] } << 24);
+	if (size > max_size)
+		return std::nullopt;
+	std::string payload(size, '\0');
+	if (!read_exactly(in, payload))
+		return std::nullopt;
+	return payload;
+}
+
+broker_session::broker_session(std::unique_ptr<byte_stream> connection, std::string arguments)
+	: m_connection{ std::move(connection) }
+	, m_argument_text{ std::move(arguments) }
+{
+	m_arguments = split_arguments(m_argument_text);
+}
+
+broker_session::~broker_session() {
+	if (!m_answered)
+		reject("The session ended before it started.");
+}
+
+bool broker_session::accept() {
+	m_answered = true;
+	return m_connection && write_frame(*m_connection, "");
+}
+
+void broker_session::reject(std::string_view reason) {
+	m_answered = true;
+	if (m_connection)
+		(void)write_frame(*m_connection, reason.substr(0, MAX_REASON_SIZE));
+}
+
+void serve_broker_sessions(local_listener& listener, const broker_session_handler& handler) {
+	std::list<session_thread> sessions{};
+	for (;;) {
+		std::unique_ptr<byte_stream> connection = listener.accept();
+		if (!connection)
+			break;
+
+		sessions.remove_if([](session_thread& session) {
+			if (!session.done.load(std::memory_order_acquire))
+				return false;
+			session.thread.join();
+			return true;
+		});
+
+		session_thread& session = sessions.emplace_back();
+		session.thread = std::thread([&handler, &done = session.done, connection = std::move(connection)]() mutable {
+			trace_thread_name("session");
+			// The arguments are read here, not in the accepting thread, so that a slow
+			// client does not hold up the others.
+			if (std::optional<std::string> arguments = read_frame(*connection, MAX_ARGUMENTS_SIZE)) {
+				broker_session session{ std::move(connection), std::move(*arguments) };
+				handler(session);
+			}
+			done.store(true, std::memory_order_release);
+		});
+	}
+	for (session_thread& session : sessions)
+		session.thread.join();
+}
+
+broker_connection connect_to_broker(std::string_view endpoint, std::string_view arguments) {
+	broker_connection connection{};
+	connection.stream = trace_call("connect to broker", "process", [&] { return connect_local(endpoint); });
+	if (!connection.stream)
+		return connection;
+
+	std::optional<std::string> answer{};
+	if (write_frame(*connection.stream, arguments))
+		answer = read_frame(*connection.stream, MAX_REASON_SIZE);
+	if (!answer) {
+		connection.status = broker_status::rejected;
+		connection.reason = "The broker closed the connection.";
+		connection.stream.reset();
+	}
+	else if (!answer->empty()) {
+		connection.status = broker_status::rejected;
+		connection.reason = std::move(*answer);
+		connection.stream.reset();
+	}
+	else {
+		connection.status = broker_status::accepted;
+	}
+	return connection;
+}
@@ -0,0 +1,121 @@
+#include "console-tools/ctrl_event.h"
+#include "console-tools/trace.h"
+
+#include <atomic>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<uint64_t> g_handled{ 0 };
+
+#if defined(_WIN32)
+// Created once and never closed, because a handler, that runs late, may still set it.
+HANDLE g_wakeup{ nullptr };
+
+BOOL WINAPI on_ctrl_event(_In_ DWORD dwCtrlType) {
+	switch (dwCtrlType) {
+	case CTRL_C_EVENT:
+	case CTRL_BREAK_EVENT:
+		g_handled.fetch_add(1, std::memory_order_release);
+		(void)SetEvent(g_wakeup);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+bool wait_for_wakeup(std::chrono::milliseconds timeout) {
+	return WaitForSingleObject(g_wakeup, static_cast<DWORD>(timeout.count())) != WAIT_FAILED;
+}
+#else
+// Like the event on Windows, the pipe lives as long as the process.
+int g_wakeup[2]{ -1, -1 };
+struct sigaction g_previous_int {};
+struct sigaction g_previous_quit {};
+
+void on_signal(int) {
+	const int saved_errno = errno;
+	g_handled.fetch_add(1, std::memory_order_release);
+	(void)!::write(g_wakeup[1], "", 1);
+	errno = saved_errno;
+}
+
+bool wait_for_wakeup(std::chrono::milliseconds timeout) {
+	pollfd wakeup{ .fd{g_wakeup[0]}, .events{POLLIN}, .revents{0} };
+	if (::poll(&wakeup, 1, static_cast<int>(timeout.count())) < 0 && errno != EINTR)
+		return false;
+	// The counter is the truth, the bytes are only the doorbell.
+	char drain[64];
+	while (::read(g_wakeup[0], drain, sizeof(drain)) > 0) {
+	}
+	return true;
+}
+#endif
+
+} // namespace
+
+ctrl_event_handler::ctrl_event_handler() {
+#if defined(_WIN32)
+	if (g_wakeup == nullptr)
+		g_wakeup = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+	m_installed = g_wakeup != nullptr && SetConsoleCtrlHandler(&on_ctrl_event, TRUE);
+#else
+	if (g_wakeup[0] < 0 && ::pipe2(g_wakeup, O_CLOEXEC | O_NONBLOCK) != 0)
+		return;
+	struct sigaction action {};
+	action.sa_handler = &on_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	m_installed = ::sigaction(SIGINT, &action, &g_previous_int) == 0;
+	if (m_installed && ::sigaction(SIGQUIT, &action, &g_previous_quit) != 0) {
+		(void)::sigaction(SIGINT, &g_previous_int, nullptr);
+		m_installed = false;
+	}
+#endif
+}
+
+ctrl_event_handler::~ctrl_event_handler() {
+	if (!m_installed)
+		return;
+#if defined(_WIN32)
+	(void)SetConsoleCtrlHandler(&on_ctrl_event, FALSE);
+#else
+	(void)::sigaction(SIGINT, &g_previous_int, nullptr);
+	(void)::sigaction(SIGQUIT, &g_previous_quit, nullptr);
+#endif
+}
+
+uint64_t ctrl_event_handler::handled() const {
+	return g_handled.load(std::memory_order_acquire);
+}
+
+bool ctrl_event_handler::wait(uint64_t seen, std::chrono::milliseconds timeout) const {
+	if (!m_installed)
+		return false;
+	trace_scope trace{ "wait for ctrl event", "process" };
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (handled() <= seen) {
+		const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+		if (remaining.count() <= 0 || !wait_for_wakeup(remaining))
+			return false;
+	}
+	return true;
+}
+
+bool generate_ctrl_event(ConsoleCtrlEvent event, uint32_t group) {
+	trace_scope trace{ "generate ctrl event", "process" };
+	trace.set_arg("group", group);
+#if defined(_WIN32)
+	return GenerateConsoleCtrlEvent(static_cast<DWORD>(event), group) != FALSE;
+#else
+	const int signal = (event == ConsoleCtrlEvent::ctrl_break_event) ? SIGQUIT : SIGINT;
+	return ::kill(group == 0 ? 0 : -static_cast<pid_t>(group), signal) == 0;
+#endif
+}
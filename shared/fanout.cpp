@@ -0,0 +1,205 @@
+#include "console-tools/fanout.h"
+#include "console-tools/trace.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+using fanout_chunk = std::shared_ptr<const std::vector<char>>;
+
+bool write_all(byte_sink& out, std::span<const char> bytes) {
+	while (!bytes.empty()) {
+		io_result result = out.write(bytes);
+		if (!result.ok() || result.count == 0)
+			return false;
+		bytes = bytes.subspan(result.count);
+	}
+	return true;
+}
+
+} // namespace
+
+std::optional<lag_policy> parse_lag_policy(std::string_view str) {
+	if (str == "block")
+		return lag_policy::block;
+	if (str == "drop")
+		return lag_policy::drop;
+	if (str == "disconnect")
+		return lag_policy::disconnect;
+	return std::nullopt;
+}
+
+std::string_view lag_policy_to_string(lag_policy policy) {
+	switch (policy) {
+	case lag_policy::block:
+		return "block";
+	case lag_policy::drop:
+		return "drop";
+	case lag_policy::disconnect:
+		return "disconnect";
+	}
+	return "block";
+}
+
+struct fanout_sink::target_state {
+	std::unique_ptr<byte_sink> sink{};
+	std::mutex mutex{};
+	std::condition_variable changed{};
+	// The front chunk stays in the queue, while the writer writes it, so that
+	// `queued_bytes` is the lag of the target.
+	std::deque<fanout_chunk> queue{};
+	std::size_t queued_bytes{ 0 };
+	bool input_ended{ false };
+	// No more chunks for this target: it failed or was disconnected.
+	bool closed{ false };
+	fanout_result result{};
+	std::thread writer{};
+
+	void run() {
+		trace_thread_name("fanout");
+		for (;;) {
+			fanout_chunk chunk{};
+			{
+				std::unique_lock lock{ mutex };
+				changed.wait(lock, [this] { return closed || input_ended || !queue.empty(); });
+				if (closed || queue.empty())
+					break;
+				chunk = queue.front();
+			}
+			// A disconnect only takes effect after this write. The chunk stays alive,
+			// even if the queue is cleared meanwhile.
+			const bool written = write_all(*sink, *chunk) && sink->flush();
+			std::lock_guard lock{ mutex };
+			if (!written) {
+				result.failed = !closed;
+				closed = true;
+				queue.clear();
+				queued_bytes = 0;
+				changed.notify_all();
+				break;
+			}
+			result.bytes_written += chunk->size();
+			if (closed)
+				break;
+			queue.pop_front();
+			queued_bytes -= chunk->size();
+			changed.notify_all();
+		}
+		// The end of the stream for the reader.
+		sink.reset();
+	}
+};
+
+fanout_sink::fanout_sink(std::vector<fanout_target> targets, fanout_option option)
+	: m_option{ option }
+{
+	m_option.unit_size = std::max<std::size_t>(m_option.unit_size, 1);
+	for (fanout_target& target : targets) {
+		auto state = std::make_unique<target_state>();
+		state->sink = std::move(target.sink);
+		state->result.name = std::move(target.name);
+		m_targets.push_back(std::move(state));
+	}
+	for (auto& state : m_targets)
+		state->writer = std::thread([target = state.get()] { target->run(); });
+}
+
+fanout_sink::~fanout_sink() {
+	if (!m_finished)
+		(void)finish();
+}
+
+io_result fanout_sink::write(std::span<const char> buffer) {
+	std::span<const char> bytes = buffer;
+	if (!m_carry.empty()) {
+		// Completes the code unit of the last write.
+		const std::size_t missing = std::min(m_option.unit_size - m_carry.size(), bytes.size());
+		m_carry.insert(m_carry.end(), bytes.begin(), bytes.begin() + missing);
+		bytes = bytes.subspan(missing);
+		if (m_carry.size() == m_option.unit_size) {
+			publish(m_carry);
+			m_carry.clear();
+		}
+	}
+	const std::size_t whole = bytes.size() - bytes.size() % m_option.unit_size;
+	publish(bytes.first(whole));
+	m_carry.insert(m_carry.end(), bytes.begin() + whole, bytes.end());
+
+	const bool any_open = std::any_of(m_targets.begin(), m_targets.end(), [](const auto& state) {
+		std::lock_guard lock{ state->mutex };
+		return !state->closed;
+	});
+	if (!any_open)
+		return io_result{ .status{io_status::error} };
+	return io_result{ .count{buffer.size()} };
+}
+
+void fanout_sink::publish(std::span<const char> bytes) {
+	if (bytes.empty())
+		return;
+	trace_scope trace{ "fanout", "relay" };
+	trace.set_arg("bytes", static_cast<int64_t>(bytes.size()));
+	// The only copy of the bytes. Every queue gets a reference to it.
+	const fanout_chunk chunk = std::make_shared<const std::vector<char>>(bytes.begin(), bytes.end());
+
+	for (auto& state : m_targets) {
+		std::unique_lock lock{ state->mutex };
+		if (state->closed) {
+			state->result.bytes_dropped += chunk->size();
+			continue;
+		}
+		// A target with an empty queue always takes the chunk, however large it is.
+		auto has_room = [&] { return state->queued_bytes == 0 || state->queued_bytes + chunk->size() <= m_option.max_lag; };
+		if (!has_room()) {
+			switch (m_option.policy) {
+			case lag_policy::block:
+				state->changed.wait(lock, [&] { return state->closed || has_room(); });
+				if (state->closed) {
+					state->result.bytes_dropped += chunk->size();
+					continue;
+				}
+				break;
+			case lag_policy::drop:
+				state->result.bytes_dropped += chunk->size();
+				continue;
+			case lag_policy::disconnect:
+				// The chunk in flight is written, the rest of the queue is not.
+				state->result.disconnected = true;
+				state->result.bytes_dropped += chunk->size() + state->queued_bytes - state->queue.front()->size();
+				state->closed = true;
+				state->queue.clear();
+				state->queued_bytes = 0;
+				state->changed.notify_all();
+				continue;
+			}
+		}
+		state->queue.push_back(chunk);
+		state->queued_bytes += chunk->size();
+		state->changed.notify_all();
+	}
+}
+
+std::vector<fanout_result> fanout_sink::finish() {
+	if (!m_carry.empty()) {
+		// An incomplete code unit at the end of the input goes out, as it is.
+		publish(m_carry);
+		m_carry.clear();
+	}
+	for (auto& state : m_targets) {
+		std::lock_guard lock{ state->mutex };
+		state->input_ended = true;
+		state->changed.notify_all();
+	}
+	std::vector<fanout_result> results{};
+	for (auto& state : m_targets) {
+		if (state->writer.joinable())
+			state->writer.join();
+		results.push_back(state->result);
+	}
+	m_finished = true;
+	return results;
+}
@@ -0,0 +1,610 @@
+#if !defined(_WIN32)
+#include "console-tools/io.h"
+#include "console-tools/trace.h"
+#include "console-tools/utf.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+io_result errno_result() {
+	int error = errno;
+	// EIO is what the master side of a pty returns, after the slave side is closed.
+	if (error == EPIPE || error == EIO)
+		return io_result{ .status{io_status::eof}, .error_code{static_cast<uint32_t>(error)} };
+	return io_result{ .status{io_status::error}, .error_code{static_cast<uint32_t>(error)} };
+}
+
+ssize_t read_retry(int fd, void* buffer, std::size_t size) {
+	trace_scope trace{ "read", "io" };
+	ssize_t result;
+	do {
+		result = ::read(fd, buffer, size);
+	} while (result < 0 && errno == EINTR);
+	trace.set_arg("bytes", result);
+	return result;
+}
+
+ssize_t write_retry(int fd, const void* buffer, std::size_t size) {
+	trace_scope trace{ "write", "io" };
+	ssize_t result;
+	do {
+		result = ::write(fd, buffer, size);
+	} while (result < 0 && errno == EINTR);
+	trace.set_arg("bytes", result);
+	return result;
+}
+
+class posix_byte_stream final : public byte_stream {
+public:
+	posix_byte_stream(int fd, bool take_ownership) : m_fd{ fd }, m_owned{ take_ownership } {}
+	~posix_byte_stream() override {
+		if (m_owned && m_fd >= 0)
+			::close(m_fd);
+	}
+
+	io_result read(std::span<char> buffer) override {
+		ssize_t bytes_read = read_retry(m_fd, buffer.data(), buffer.size());
+		if (bytes_read < 0)
+			return errno_result();
+		if (bytes_read == 0)
+			return io_result{ .status{io_status::eof} };
+		return io_result{ .count{static_cast<std::size_t>(bytes_read)} };
+	}
+
+	io_result write(std::span<const char> buffer) override {
+		ssize_t bytes_written = write_retry(m_fd, buffer.data(), buffer.size());
+		if (bytes_written < 0)
+			return errno_result();
+		return io_result{ .count{static_cast<std::size_t>(bytes_written)} };
+	}
+
+	std::optional<native_handle_t> handle() const override { return m_fd; }
+	std::optional<native_handle_t> pollable_handle() const override { return m_fd; }
+
+private:
+	int m_fd;
+	bool m_owned;
+};
+
+// A connection of a unix domain socket. Writes use send() with MSG_NOSIGNAL, so a
+// client, that has gone, ends the stream with EPIPE instead of killing the process.
+class posix_socket_stream final : public byte_stream {
+public:
+	explicit posix_socket_stream(int fd) : m_fd{ fd } {}
+	~posix_socket_stream() override { ::close(m_fd); }
+
+	io_result read(std::span<char> buffer) override {
+		ssize_t bytes_read = read_retry(m_fd, buffer.data(), buffer.size());
+		if (bytes_read < 0)
+			return errno_result();
+		if (bytes_read == 0)
+			return io_result{ .status{io_status::eof} };
+		return io_result{ .count{static_cast<std::size_t>(bytes_read)} };
+	}
+
+	io_result write(std::span<const char> buffer) override {
+		trace_scope trace{ "send", "io" };
+		ssize_t bytes_written;
+		do {
+			bytes_written = ::send(m_fd, buffer.data(), buffer.size(), MSG_NOSIGNAL);
+		} while (bytes_written < 0 && errno == EINTR);
+		trace.set_arg("bytes", bytes_written);
+		if (bytes_written < 0)
+			return errno_result();
+		return io_result{ .count{static_cast<std::size_t>(bytes_written)} };
+	}
+
+	std::optional<native_handle_t> handle() const override { return m_fd; }
+	std::optional<native_handle_t> pollable_handle() const override { return m_fd; }
+
+private:
+	int m_fd;
+};
+
+std::optional<sockaddr_un> local_socket_address(std::string_view name) {
+	std::string path{};
+	const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir != nullptr && *runtime_dir != '\0')
+		path = std::string{ runtime_dir } + "/console-tools-" + std::string{ name } + ".sock";
+	else
+		path = "/tmp/console-tools-" + std::to_string(::getuid()) + "-" + std::string{ name } + ".sock";
+
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return std::nullopt;
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+
+int connect_socket(const sockaddr_un& address) {
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	int result;
+	do {
+		result = ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+	} while (result < 0 && errno == EINTR);
+	if (result < 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// The process at the other end of the socket `fd` runs as the same user as this process.
+// The name in /tmp can be taken by another user first, to read what we send.
+bool peer_is_current_user(int fd) {
+#if defined(__linux__)
+	ucred peer{};
+	socklen_t size = sizeof(peer);
+	if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0 || size != sizeof(peer))
+		return false;
+	return peer.uid == ::getuid();
+#else
+	uid_t uid{};
+	gid_t gid{};
+	return ::getpeereid(fd, &uid, &gid) == 0 && uid == ::getuid();
+#endif
+}
+
+class posix_socket_listener final : public local_listener {
+public:
+	posix_socket_listener(int fd, sockaddr_un address) : m_fd{ fd }, m_address{ address } {}
+	~posix_socket_listener() override {
+		::close(m_fd);
+		::unlink(m_address.sun_path);
+	}
+
+	std::unique_ptr<byte_stream> accept() override {
+		int fd;
+		do {
+			fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		} while (fd < 0 && (errno == EINTR || errno == ECONNABORTED));
+		if (fd < 0)
+			return nullptr;
+		return std::make_unique<posix_socket_stream>(fd);
+	}
+
+private:
+	int m_fd;
+	sockaddr_un m_address;
+};
+
+// A terminal speaks UTF-8. This class converts from and to the UTF-16 code
+// units, that the console interface uses on every platform.
+class posix_console final : public console {
+public:
+	posix_console(int fd, console_in_or_out type, bool take_ownership) : m_fd{ fd }, m_type{ type }, m_owned{ take_ownership } {}
+	~posix_console() override {
+		if (m_owned && m_fd >= 0)
+			::close(m_fd);
+	}
+
+	io_result read_utf16(std::span<char16_t> buffer) override {
+		if (buffer.empty())
+			return io_result{};
+
+		// Invalid input becomes U+FFFD (utf.h), like on the Windows console. An
+		// incomplete sequence waits in the decoder for the rest.
+		while (m_decoded_begin == m_decoded.size()) {
+			char bytes[512];
+			ssize_t bytes_read = read_retry(m_fd, bytes, std::min(sizeof(bytes), buffer.size()));
+			if (bytes_read < 0) {
+				io_result result = errno_result();
+				if (result.status != io_status::eof)
+					return result;
+				bytes_read = 0;
+			}
+			const std::size_t bytes_in = static_cast<std::size_t>(bytes_read);
+			m_decoded.resize(utf8_to_utf16_converter::max_output(bytes_in));
+			m_decoded_begin = 0;
+			if (bytes_read == 0) {
+				// A sequence, that the end cut off, is the last code unit.
+				m_decoded.resize(m_decoder.finish(m_decoded.data()));
+				if (m_decoded.empty())
+					return io_result{ .status{io_status::eof} };
+			}
+			else {
+				m_decoded.resize(m_decoder.convert(std::span<const char>(bytes, bytes_in), m_decoded.data()));
+			}
+		}
+
+		// Up to 3 code units more than bytes read may come out, the rest waits for the next call.
+		const std::size_t count = std::min(buffer.size(), m_decoded.size() - m_decoded_begin);
+		std::copy_n(m_decoded.begin() + m_decoded_begin, count, buffer.begin());
+		m_decoded_begin += count;
+		return io_result{ .count{count} };
+	}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override {
+		// Bytes, that a non-blocking terminal did not take in an earlier call, go first.
+		if (io_result flushed = write_pending_out(); !flushed.ok())
+			return flushed;
+
+		// A high surrogate at the end stays in the converter, until the next call.
+		if (m_pending_out.size() < utf16_to_utf8_converter::max_output(buffer.size_bytes()))
+			m_pending_out.resize(utf16_to_utf8_converter::max_output(buffer.size_bytes()));
+		m_out_begin = 0;
+		m_out_end = m_encoder.convert(buffer, m_pending_out.data());
+
+		// Code units are only reported as written, after all of their bytes are written,
+		// or wait in m_pending_out for the next call, if the terminal is non-blocking.
+		if (io_result written = write_pending_out(); !written.ok() && !io_would_block(written))
+			return written;
+		return io_result{ .count{buffer.size()} };
+	}
+
+	bool has_pending_input() const override {
+		if (m_decoded_begin < m_decoded.size())
+			return true;
+		pollfd fd{ .fd = m_fd, .events = POLLIN, .revents = 0 };
+		return ::poll(&fd, 1, 0) > 0 && (fd.revents & POLLIN);
+	}
+
+	std::optional<uint32_t> get_mode() const override {
+		termios tio{};
+		if (tcgetattr(m_fd, &tio) != 0)
+			return std::nullopt;
+
+		uint32_t mode{ 0 };
+		if (m_type == console_in_or_out::out) {
+			mode |= ENABLE_WRAP_AT_EOL_OUTPUT | ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+			if (tio.c_oflag & OPOST)  mode |= ENABLE_PROCESSED_OUTPUT;
+			if (!(tio.c_oflag & ONLCR)) mode |= DISABLE_NEWLINE_AUTO_RETURN;
+		}
+		else {
+			mode |= ENABLE_VIRTUAL_TERMINAL_INPUT;
+			if (tio.c_lflag & ISIG)   mode |= ENABLE_PROCESSED_INPUT;
+			if (tio.c_lflag & ICANON) mode |= ENABLE_LINE_INPUT;
+			if (tio.c_lflag & ECHO)   mode |= ENABLE_ECHO_INPUT;
+		}
+		return mode;
+	}
+
+	bool set_mode(uint32_t mode) override {
+		termios tio{};
+		if (tcgetattr(m_fd, &tio) != 0)
+			return false;
+
+		auto set_flag = [](tcflag_t& flags, tcflag_t flag, bool set) {
+			if (set) flags |= flag;
+			else     flags &= ~flag;
+		};
+		if (m_type == console_in_or_out::out) {
+			set_flag(tio.c_oflag, OPOST, mode & ENABLE_PROCESSED_OUTPUT);
+			set_flag(tio.c_oflag, ONLCR, !(mode & DISABLE_NEWLINE_AUTO_RETURN));
+		}
+		else {
+			set_flag(tio.c_lflag, ISIG, mode & ENABLE_PROCESSED_INPUT);
+			set_flag(tio.c_lflag, ICANON, mode & ENABLE_LINE_INPUT);
+			set_flag(tio.c_lflag, ECHO, mode & ENABLE_ECHO_INPUT);
+		}
+		return tcsetattr(m_fd, TCSANOW, &tio) == 0;
+	}
+
+	std::optional<native_handle_t> handle() const override { return m_fd; }
+	std::optional<native_handle_t> pollable_handle() const override { return m_fd; }
+
+private:
+	io_result write_pending_out() {
+		while (m_out_begin < m_out_end) {
+			ssize_t bytes_written = write_retry(m_fd, m_pending_out.data() + m_out_begin, m_out_end - m_out_begin);
+			if (bytes_written < 0) {
+				io_result result = errno_result();
+				// After an error, a later call does not repeat them.
+				if (!io_would_block(result))
+					m_out_begin = m_out_end;
+				return result;
+			}
+			m_out_begin += static_cast<std::size_t>(bytes_written);
+		}
+		return io_result{};
+	}
+
+	int m_fd;
+	console_in_or_out m_type;
+	bool m_owned;
+	utf8_to_utf16_converter m_decoder{};
+	utf16_to_utf8_converter m_encoder{};
+	// Code units of the last read, that did not fit into the buffer of read_utf16().
+	std::u16string m_decoded{};
+	std::size_t m_decoded_begin{ 0 };
+	std::string m_pending_out{};
+	// The bytes of m_pending_out, that are not written yet.
+	std::size_t m_out_begin{ 0 };
+	std::size_t m_out_end{ 0 };
+};
+
+#if defined(__linux__)
+// Bytes per splice() call. Through a pipe, one call moves at most the capacity of the pipe.
+constexpr std::size_t SPLICE_CHUNK_SIZE{ 1024u * 1024u };
+
+bool is_pipe(int fd) {
+	struct stat st {};
+	return ::fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// The kernel cannot splice between these descriptors. Nothing was moved by the failed call.
+bool splice_unsupported(int error) {
+	return error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == EXDEV;
+}
+
+ssize_t splice_retry(int fd_in, int fd_out, std::size_t size) {
+	trace_scope trace{ "splice", "io" };
+	ssize_t result;
+	do {
+		result = ::splice(fd_in, nullptr, fd_out, nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+	} while (result < 0 && errno == EINTR);
+	trace.set_arg("bytes", result);
+	return result;
+}
+
+// splice() needs a pipe on one side at least.
+std::optional<bool> splice_direct(int fd_in, int fd_out) {
+	while (true) {
+		ssize_t moved = splice_retry(fd_in, fd_out, SPLICE_CHUNK_SIZE);
+		if (moved == 0)
+			return true;
+		if (moved < 0)
+			return splice_unsupported(errno) ? std::nullopt : std::optional<bool>{ false };
+	}
+}
+
+// Copies `size` bytes out of the pipe `fd_pipe` with read() and write().
+bool drain_pipe(int fd_pipe, int fd_out, std::size_t size) {
+	char buffer[4096];
+	while (size > 0) {
+		ssize_t bytes_read = read_retry(fd_pipe, buffer, std::min(size, sizeof(buffer)));
+		if (bytes_read <= 0)
+			return false;
+		for (ssize_t offset = 0; offset < bytes_read;) {
+			ssize_t bytes_written = write_retry(fd_out, buffer + offset, static_cast<std::size_t>(bytes_read - offset));
+			if (bytes_written <= 0)
+				return false;
+			offset += bytes_written;
+		}
+		size -= static_cast<std::size_t>(bytes_read);
+	}
+	return true;
+}
+
+// Neither side is a pipe: splice into a pipe of our own and from there into `fd_out`.
+std::optional<bool> splice_through_pipe(int fd_in, int fd_out, int fd_pipe_read, int fd_pipe_write) {
+	while (true) {
+		ssize_t moved = splice_retry(fd_in, fd_pipe_write, SPLICE_CHUNK_SIZE);
+		if (moved == 0)
+			return true;
+		if (moved < 0)
+			return splice_unsupported(errno) ? std::nullopt : std::optional<bool>{ false };
+
+		std::size_t remaining = static_cast<std::size_t>(moved);
+		while (remaining > 0) {
+			ssize_t moved_out = splice_retry(fd_pipe_read, fd_out, remaining);
+			if (moved_out < 0 && splice_unsupported(errno)) {
+				// `fd_out` does not take spliced pages. The bytes in our pipe are already
+				// consumed from `fd_in`, so they are written here, and the caller copies the rest.
+				if (!drain_pipe(fd_pipe_read, fd_out, remaining))
+					return false;
+				return std::nullopt;
+			}
+			if (moved_out <= 0)
+				return false;
+			remaining -= static_cast<std::size_t>(moved_out);
+		}
+	}
+}
+#endif
+
+} // namespace
+
+std::optional<native_handle_t> get_std_handle(std_stream which) {
+	switch (which) {
+	case std_stream::in:  return STDIN_FILENO;
+	case std_stream::out: return STDOUT_FILENO;
+	case std_stream::err: return STDERR_FILENO;
+	}
+	return std::nullopt;
+}
+
+std::unique_ptr<byte_stream> open_byte_stream(native_handle_t handle, bool take_ownership) {
+	return std::make_unique<posix_byte_stream>(handle, take_ownership);
+}
+
+std::unique_ptr<console> open_console(native_handle_t handle, console_in_or_out type, bool take_ownership) {
+	if (!::isatty(handle))
+		return nullptr;
+	return std::make_unique<posix_console>(handle, type, take_ownership);
+}
+
+std::unique_ptr<console> open_process_console(uint32_t pid, console_in_or_out type) {
+#if defined(__linux__)
+	// A new open file description of the terminal, not the one of the process, so that
+	// O_NONBLOCK and the like of either side stay apart. Needs the permission to ptrace
+	// the process, like any look into /proc/<pid>/fd.
+	const std::string path = "/proc/" + std::to_string(pid) + "/fd/0";
+	int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+	std::unique_ptr<console> opened = open_console(fd, type, true);
+	if (!opened)
+		::close(fd);
+	return opened;
+#else
+	(void)pid;
+	(void)type;
+	return nullptr;
+#endif
+}
+
+bool shares_console_with(uint32_t pid) {
+	const std::string path = "/proc/" + std::to_string(pid) + "/fd/0";
+	struct stat theirs {};
+	struct stat ours {};
+	return ::isatty(STDIN_FILENO) && ::stat(path.c_str(), &theirs) == 0 && ::fstat(STDIN_FILENO, &ours) == 0
+		&& S_ISCHR(theirs.st_mode) && theirs.st_rdev == ours.st_rdev;
+}
+
+std::optional<pipe_pair> create_pipe() {
+	int fds[2];
+	if (::pipe2(fds, O_CLOEXEC) != 0)
+		return std::nullopt;
+	return pipe_pair{
+		.read_end{ open_byte_stream(fds[0], true) },
+		.write_end{ open_byte_stream(fds[1], true) },
+	};
+}
+
+std::optional<bool> transfer_in_kernel(byte_source& in, byte_sink& out) {
+#if defined(__linux__)
+	std::optional<native_handle_t> fd_in = in.handle();
+	std::optional<native_handle_t> fd_out = out.handle();
+	if (!fd_in || !fd_out)
+		return std::nullopt;
+	// Bytes, that are still buffered in `out`, come first.
+	if (!out.flush())
+		return false;
+
+	if (is_pipe(*fd_in) || is_pipe(*fd_out))
+		return splice_direct(*fd_in, *fd_out);
+
+	int fds[2];
+	if (::pipe2(fds, O_CLOEXEC) != 0)
+		return std::nullopt;
+	// A larger pipe means fewer round trips. Without the permission, the default size works as well.
+	::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(SPLICE_CHUNK_SIZE));
+	std::optional<bool> result = splice_through_pipe(*fd_in, *fd_out, fds[0], fds[1]);
+	::close(fds[0]);
+	::close(fds[1]);
+	return result;
+#else
+	(void)in;
+	(void)out;
+	return std::nullopt;
+#endif
+}
+
+bool io_would_block(const io_result& result) {
+	return result.status == io_status::error && (result.error_code == EAGAIN || result.error_code == EWOULDBLOCK);
+}
+
+std::string io_error_message(uint32_t error_code) {
+	return std::strerror(static_cast<int>(error_code));
+}
+
+struct read_interrupter::state {
+	// interrupt() writes a byte into it, that nobody reads, so it stays readable.
+	int wakeup[2]{ -1, -1 };
+	std::atomic<bool> interrupted{ false };
+};
+
+read_interrupter::read_interrupter() : m_state{ std::make_unique<state>() } {
+	if (::pipe2(m_state->wakeup, O_CLOEXEC) != 0)
+		m_state->wakeup[0] = m_state->wakeup[1] = -1;
+}
+
+read_interrupter::~read_interrupter() {
+	for (int fd : m_state->wakeup) {
+		if (fd >= 0)
+			::close(fd);
+	}
+}
+
+io_result read_interrupter::read(byte_source& in, std::span<char> buffer) {
+	const io_result interrupted{ .status{io_status::error}, .error_code{ECANCELED} };
+	if (m_state->interrupted.load(std::memory_order_acquire))
+		return interrupted;
+	if (std::optional<native_handle_t> handle = in.pollable_handle(); handle && m_state->wakeup[0] >= 0) {
+		pollfd fds[2]{
+			{ .fd = *handle, .events = POLLIN, .revents = 0 },
+			{ .fd = m_state->wakeup[0], .events = POLLIN, .revents = 0 },
+		};
+		int ready;
+		do {
+			ready = ::poll(fds, 2, -1);
+		} while (ready < 0 && errno == EINTR);
+		if (ready < 0)
+			return errno_result();
+		if (fds[1].revents != 0)
+			return interrupted;
+	}
+	return in.read(buffer);
+}
+
+void read_interrupter::interrupt() {
+	m_state->interrupted.store(true, std::memory_order_release);
+	const char wakeup{ 0 };
+	if (m_state->wakeup[1] >= 0)
+		(void)!::write(m_state->wakeup[1], &wakeup, 1);
+}
+
+std::unique_ptr<local_listener> listen_local(std::string_view name) {
+	std::optional<sockaddr_un> address = local_socket_address(name);
+	if (!address)
+		return nullptr;
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return nullptr;
+	auto bind_address = [&] {
+		return ::bind(fd, reinterpret_cast<const sockaddr*>(&*address), sizeof(*address)) == 0;
+	};
+	bool bound = bind_address();
+	if (!bound && errno == EADDRINUSE) {
+		// A socket file without a listener is left over from a process, that was killed.
+		int other = connect_socket(*address);
+		if (other >= 0)
+			::close(other);
+		else if (::unlink(address->sun_path) == 0)
+			bound = bind_address();
+	}
+	// Only the current user may connect, also in /tmp.
+	if (!bound || ::chmod(address->sun_path, S_IRUSR | S_IWUSR) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+		if (bound)
+			::unlink(address->sun_path);
+		::close(fd);
+		return nullptr;
+	}
+	return std::make_unique<posix_socket_listener>(fd, *address);
+}
+
+std::unique_ptr<byte_stream> connect_local(std::string_view name) {
+	std::optional<sockaddr_un> address = local_socket_address(name);
+	if (!address)
+		return nullptr;
+	int fd = connect_socket(*address);
+	if (fd < 0)
+		return nullptr;
+	if (!peer_is_current_user(fd)) {
+		::close(fd);
+		return nullptr;
+	}
+	return std::make_unique<posix_socket_stream>(fd);
+}
+
+std::optional<pty_pair> open_pty() {
+	int master{ -1 };
+	int slave{ -1 };
+	if (::openpty(&master, &slave, nullptr, nullptr, nullptr) != 0)
+		return std::nullopt;
+	::fcntl(master, F_SETFD, FD_CLOEXEC);
+	::fcntl(slave, F_SETFD, FD_CLOEXEC);
+	return pty_pair{
+		.master{ open_byte_stream(master, true) },
+		.slave{ open_console(slave, console_in_or_out::out, true) },
+	};
+}
+#endif
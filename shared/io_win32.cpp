@@ -0,0 +1,418 @@
+#if defined(_WIN32)
+#include "console-tools/io.h"
+#include "console-tools/helper.h"
+#include "console-tools/trace.h"
+
+#include <limits>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static_assert(sizeof(wchar_t) == sizeof(char16_t));
+
+namespace {
+
+DWORD clamp_to_DWORD(std::size_t size) {
+	return static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max()));
+}
+
+io_result last_error_result() {
+	auto error = GetLastError();
+	// The write end of the pipe was closed. For us this is the regular end of the stream.
+	if (error == ERROR_BROKEN_PIPE)
+		return io_result{ .status{io_status::eof}, .error_code{error} };
+	return io_result{ .status{io_status::error}, .error_code{error} };
+}
+
+class win32_byte_stream final : public byte_stream {
+public:
+	win32_byte_stream(HANDLE handle, bool take_ownership) : m_handle{ handle }, m_owned{ take_ownership } {}
+	~win32_byte_stream() override {
+		if (m_owned && m_handle != nullptr && m_handle != INVALID_HANDLE_VALUE)
+			CloseHandle(m_handle);
+	}
+
+	io_result read(std::span<char> buffer) override {
+		DWORD dwBytesRead{};
+		trace_scope trace{ "ReadFile", "io" };
+		if (!ReadFile(m_handle, buffer.data(), clamp_to_DWORD(buffer.size()), &dwBytesRead, nullptr))
+			return last_error_result();
+		trace.set_arg("bytes", dwBytesRead);
+		if (dwBytesRead == 0)
+			return io_result{ .status{io_status::eof} };
+		return io_result{ .count{dwBytesRead} };
+	}
+
+	io_result write(std::span<const char> buffer) override {
+		DWORD dwBytesWritten{};
+		trace_scope trace{ "WriteFile", "io" };
+		if (!WriteFile(m_handle, buffer.data(), clamp_to_DWORD(buffer.size()), &dwBytesWritten, nullptr))
+			return last_error_result();
+		trace.set_arg("bytes", dwBytesWritten);
+		return io_result{ .count{dwBytesWritten} };
+	}
+
+	std::optional<native_handle_t> handle() const override { return m_handle; }
+
+private:
+	HANDLE m_handle;
+	bool m_owned;
+};
+
+// The server end of a named pipe. The bytes, that the client did not read yet, are
+// lost, when the handle is closed. So the destructor waits for the client first.
+class win32_pipe_connection final : public byte_stream {
+public:
+	explicit win32_pipe_connection(HANDLE handle) : m_stream{ handle, true } {}
+	~win32_pipe_connection() override {
+		HANDLE handle = *m_stream.handle();
+		(void)FlushFileBuffers(handle);
+		(void)DisconnectNamedPipe(handle);
+	}
+
+	io_result read(std::span<char> buffer) override { return m_stream.read(buffer); }
+	io_result write(std::span<const char> buffer) override { return m_stream.write(buffer); }
+	std::optional<native_handle_t> handle() const override { return m_stream.handle(); }
+
+private:
+	win32_byte_stream m_stream;
+};
+
+std::string local_pipe_path(std::string_view name) {
+	return std::string{ "\\\\.\\pipe\\console-tools-" }.append(name);
+}
+
+constexpr DWORD LOCAL_PIPE_BUFFER_SIZE{ 64u * 1024u };
+
+// The TOKEN_USER of `process`, with the SID behind it. Empty, if it cannot be queried.
+std::vector<char> token_user(HANDLE process) {
+	HANDLE token{ nullptr };
+	if (!OpenProcessToken(process, TOKEN_QUERY, &token))
+		return {};
+	DWORD size{ 0 };
+	(void)GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+	std::vector<char> user(size);
+	const bool got_user = size != 0 && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+	CloseHandle(token);
+	if (!got_user)
+		return {};
+	return user;
+}
+
+PSID sid_of(std::vector<char>& user) {
+	return reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid;
+}
+
+// The server end of `pipe` runs as the same user as this process. The name of a pipe is
+// machine-wide, so another user might have created it first, to read what we send.
+bool pipe_server_is_current_user(HANDLE pipe) {
+	ULONG server_pid{ 0 };
+	if (!GetNamedPipeServerProcessId(pipe, &server_pid))
+		return false;
+	HANDLE server = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, server_pid);
+	if (server == nullptr)
+		return false;
+	std::vector<char> server_user = token_user(server);
+	CloseHandle(server);
+	std::vector<char> own_user = token_user(GetCurrentProcess());
+	return !server_user.empty() && !own_user.empty() && EqualSid(sid_of(server_user), sid_of(own_user));
+}
+
+// A security descriptor, whose DACL grants access to the user of this process only, like
+// the mode 0600 of the socket on POSIX. The default DACL of the token may let in others.
+class current_user_only {
+public:
+	current_user_only(const current_user_only&) = delete;
+	current_user_only& operator=(const current_user_only&) = delete;
+
+	// Returns nullptr, if the user or the descriptor cannot be determined.
+	static std::unique_ptr<current_user_only> create() {
+		std::unique_ptr<current_user_only> created{ new current_user_only{} };
+		return created->init() ? std::move(created) : nullptr;
+	}
+
+	SECURITY_ATTRIBUTES* attributes() { return &m_attributes; }
+
+private:
+	current_user_only() = default;
+
+	bool init() {
+		m_user = token_user(GetCurrentProcess());
+		if (m_user.empty())
+			return false;
+		PSID sid = sid_of(m_user);
+
+		m_acl.resize(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid));
+		PACL acl = reinterpret_cast<PACL>(m_acl.data());
+		if (!InitializeAcl(acl, static_cast<DWORD>(m_acl.size()), ACL_REVISION)
+			|| !AddAccessAllowedAce(acl, ACL_REVISION, GENERIC_ALL, sid))
+			return false;
+		if (!InitializeSecurityDescriptor(&m_descriptor, SECURITY_DESCRIPTOR_REVISION)
+			|| !SetSecurityDescriptorDacl(&m_descriptor, TRUE, acl, FALSE))
+			return false;
+		m_attributes = SECURITY_ATTRIBUTES{ .nLength{sizeof(m_attributes)}, .lpSecurityDescriptor{&m_descriptor}, .bInheritHandle{false} };
+		return true;
+	}
+
+	// TOKEN_USER and the SID behind it.
+	std::vector<char> m_user{};
+	std::vector<char> m_acl{};
+	SECURITY_DESCRIPTOR m_descriptor{};
+	SECURITY_ATTRIBUTES m_attributes{};
+};
+
+HANDLE create_pipe_instance(const std::string& path, bool first, current_user_only& security) {
+	// The first instance fails, if another process owns the name already.
+	// Clients on other machines are rejected.
+	return CreateNamedPipeA(path.c_str(),
+		PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+		PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+		PIPE_UNLIMITED_INSTANCES, LOCAL_PIPE_BUFFER_SIZE, LOCAL_PIPE_BUFFER_SIZE, 0, security.attributes());
+}
+
+class win32_pipe_listener final : public local_listener {
+public:
+	win32_pipe_listener(std::string path, std::unique_ptr<current_user_only> security, HANDLE first_instance)
+		: m_path{ std::move(path) }, m_security{ std::move(security) }, m_next{ first_instance } {}
+	~win32_pipe_listener() override {
+		if (m_next != INVALID_HANDLE_VALUE)
+			CloseHandle(m_next);
+	}
+
+	std::unique_ptr<byte_stream> accept() override {
+		while (m_next != INVALID_HANDLE_VALUE) {
+			HANDLE instance = m_next;
+			const bool connected = ConnectNamedPipe(instance, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED;
+			// The next instance exists before this one is handed out. Until then,
+			// clients see ERROR_PIPE_BUSY and wait, instead of ERROR_FILE_NOT_FOUND.
+			m_next = create_pipe_instance(m_path, false, *m_security);
+			if (connected)
+				return std::make_unique<win32_pipe_connection>(instance);
+			// ERROR_NO_DATA: the client has gone again.
+			CloseHandle(instance);
+		}
+		return nullptr;
+	}
+
+private:
+	std::string m_path;
+	std::unique_ptr<current_user_only> m_security;
+	HANDLE m_next;
+};
+
+class win32_console final : public console {
+public:
+	win32_console(HANDLE handle, bool take_ownership) : m_handle{ handle }, m_owned{ take_ownership } {}
+	~win32_console() override {
+		if (m_owned && m_handle != nullptr && m_handle != INVALID_HANDLE_VALUE)
+			CloseHandle(m_handle);
+	}
+
+	io_result read_utf16(std::span<char16_t> buffer) override {
+		DWORD dwWideCharsRead{};
+		trace_scope trace{ "ReadConsoleW", "io" };
+		if (!ReadConsoleW(m_handle, buffer.data(), clamp_to_DWORD(buffer.size()), &dwWideCharsRead, nullptr))
+			return last_error_result();
+		trace.set_arg("code_units", dwWideCharsRead);
+		if (dwWideCharsRead == 0)
+			return io_result{ .status{io_status::eof} };
+		return io_result{ .count{dwWideCharsRead} };
+	}
+
+	bool has_pending_input() const override {
+		// Only a key press with a character makes ReadConsoleW() return. Key releases,
+		// mouse and focus events do not.
+		INPUT_RECORD records[64];
+		DWORD dwRecordsRead{};
+		if (!PeekConsoleInputW(m_handle, records, static_cast<DWORD>(std::size(records)), &dwRecordsRead))
+			return false;
+		for (DWORD i = 0; i < dwRecordsRead; ++i) {
+			const INPUT_RECORD& record = records[i];
+			if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown && record.Event.KeyEvent.uChar.UnicodeChar != 0)
+				return true;
+		}
+		return false;
+	}
+
+	io_result write_utf16(std::span<const char16_t> buffer) override {
+		DWORD dwWideCharsWritten{};
+		trace_scope trace{ "WriteConsoleW", "io" };
+		if (!WriteConsoleW(m_handle, buffer.data(), clamp_to_DWORD(buffer.size()), &dwWideCharsWritten, nullptr))
+			return last_error_result();
+		trace.set_arg("code_units", dwWideCharsWritten);
+		return io_result{ .count{dwWideCharsWritten} };
+	}
+
+	std::optional<uint32_t> get_mode() const override {
+		DWORD mode{};
+		if (!GetConsoleMode(m_handle, &mode))
+			return std::nullopt;
+		return mode;
+	}
+
+	bool set_mode(uint32_t mode) override {
+		return SetConsoleMode(m_handle, mode);
+	}
+
+	std::optional<native_handle_t> handle() const override { return m_handle; }
+
+private:
+	HANDLE m_handle;
+	bool m_owned;
+};
+
+} // namespace
+
+std::optional<native_handle_t> get_std_handle(std_stream which) {
+	DWORD std_handle = STD_INPUT_HANDLE;
+	switch (which) {
+	case std_stream::in:  std_handle = STD_INPUT_HANDLE; break;
+	case std_stream::out: std_handle = STD_OUTPUT_HANDLE; break;
+	case std_stream::err: std_handle = STD_ERROR_HANDLE; break;
+	}
+	HANDLE handle = GetStdHandle(std_handle);
+	if (handle == INVALID_HANDLE_VALUE || handle == nullptr)
+		return std::nullopt;
+	return handle;
+}
+
+std::unique_ptr<byte_stream> open_byte_stream(native_handle_t handle, bool take_ownership) {
+	return std::make_unique<win32_byte_stream>(handle, take_ownership);
+}
+
+std::unique_ptr<console> open_console(native_handle_t handle, console_in_or_out /*type*/, bool take_ownership) {
+	DWORD dummy;
+	if (!GetConsoleMode(handle, &dummy))
+		return nullptr;
+	return std::make_unique<win32_console>(handle, take_ownership);
+}
+
+bool shares_console_with(uint32_t pid) {
+	// Enough for the usual console. The call tells, if the list has to be longer.
+	std::vector<DWORD> PIDs(64);
+	for (;;) {
+		const DWORD count = GetConsoleProcessList(PIDs.data(), static_cast<DWORD>(PIDs.size()));
+		if (count == 0)
+			return false;
+		if (count <= PIDs.size())
+			return std::find(PIDs.begin(), PIDs.begin() + count, DWORD{ pid }) != PIDs.begin() + count;
+		PIDs.resize(count);
+	}
+}
+
+std::unique_ptr<console> open_process_console(uint32_t pid, console_in_or_out type) {
+	if (!shares_console_with(pid))
+		return nullptr;
+	const bool input = (type == console_in_or_out::in);
+	HANDLE handle = CreateFileA(input ? "CONIN$" : "CONOUT$", GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return nullptr;
+	std::unique_ptr<console> opened = open_console(handle, type, true);
+	if (!opened)
+		CloseHandle(handle);
+	return opened;
+}
+
+std::optional<pipe_pair> create_pipe() {
+	HANDLE h_read{ nullptr };
+	HANDLE h_write{ nullptr };
+	if (!CreatePipe(&h_read, &h_write, nullptr, 0))
+		return std::nullopt;
+	return pipe_pair{
+		.read_end{ open_byte_stream(h_read, true) },
+		.write_end{ open_byte_stream(h_write, true) },
+	};
+}
+
+std::optional<bool> transfer_in_kernel(byte_source& /*in*/, byte_sink& /*out*/) {
+	// Windows has no general way to connect two handles. TransmitFile only sends to sockets.
+	return std::nullopt;
+}
+
+bool io_would_block(const io_result& /*result*/) {
+	// No handle of this backend is non-blocking.
+	return false;
+}
+
+std::string io_error_message(uint32_t error_code) {
+	return get_error_message(error_code).value_or("");
+}
+
+struct read_interrupter::state {
+	std::mutex mutex{};
+	std::condition_variable read_ended{};
+	bool interrupted{ false };
+	bool reading{ false };
+	// The reading thread, with THREAD_TERMINATE for CancelSynchronousIo().
+	HANDLE thread{ nullptr };
+};
+
+read_interrupter::read_interrupter() : m_state{ std::make_unique<state>() } {}
+
+read_interrupter::~read_interrupter() {
+	if (m_state->thread != nullptr)
+		CloseHandle(m_state->thread);
+}
+
+io_result read_interrupter::read(byte_source& in, std::span<char> buffer) {
+	{
+		std::lock_guard lock{ m_state->mutex };
+		if (m_state->interrupted)
+			return io_result{ .status{io_status::error}, .error_code{ERROR_OPERATION_ABORTED} };
+		if (m_state->thread == nullptr)
+			m_state->thread = OpenThread(THREAD_TERMINATE, FALSE, GetCurrentThreadId());
+		m_state->reading = true;
+	}
+	io_result result = in.read(buffer);
+	{
+		std::lock_guard lock{ m_state->mutex };
+		m_state->reading = false;
+	}
+	m_state->read_ended.notify_all();
+	return result;
+}
+
+void read_interrupter::interrupt() {
+	std::unique_lock lock{ m_state->mutex };
+	m_state->interrupted = true;
+	// The read may not have reached ReadFile() yet, so the cancel is repeated, until it ends.
+	while (m_state->reading && m_state->thread != nullptr) {
+		(void)CancelSynchronousIo(m_state->thread);
+		m_state->read_ended.wait_for(lock, std::chrono::milliseconds{ 10 });
+	}
+}
+
+std::unique_ptr<local_listener> listen_local(std::string_view name) {
+	std::string path = local_pipe_path(name);
+	std::unique_ptr<current_user_only> security = current_user_only::create();
+	if (!security)
+		return nullptr;
+	HANDLE first_instance = create_pipe_instance(path, true, *security);
+	if (first_instance == INVALID_HANDLE_VALUE)
+		return nullptr;
+	return std::make_unique<win32_pipe_listener>(std::move(path), std::move(security), first_instance);
+}
+
+std::unique_ptr<byte_stream> connect_local(std::string_view name) {
+	const std::string path = local_pipe_path(name);
+	for (;;) {
+		// The server may only identify us, not act as us.
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+			SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr);
+		if (handle != INVALID_HANDLE_VALUE) {
+			if (pipe_server_is_current_user(handle))
+				return open_byte_stream(handle, true);
+			CloseHandle(handle);
+			return nullptr;
+		}
+		// All instances are connected. The listener creates the next one right away.
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(path.c_str(), 5000))
+			return nullptr;
+	}
+}
+#endif
@@ -0,0 +1,484 @@
+#include "console-tools/relay.h"
+#include "console-tools/relay_async.h"
+#include "console-tools/helper.h"
+#include "console-tools/spsc_ring.h"
+#include "console-tools/trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <fmt/core.h>
+
+std::optional<buffer_size_option> parse_buffer_size_option(std::string_view str) {
+	if (str == "auto")
+		return buffer_size_option{ .size{DEFAULT_BUFFER_SIZE}, .adaptive{true} };
+
+	std::size_t factor{ 1 };
+	if (!str.empty() && (str.back() == 'k' || str.back() == 'K')) {
+		factor = 1024u;
+		str.remove_suffix(1);
+	}
+	else if (!str.empty() && str.back() == 'M') {
+		factor = 1024u * 1024u;
+		str.remove_suffix(1);
+	}
+
+	auto number = string_to_uint<uint32_t>(str);
+	if (!number)
+		return std::nullopt;
+
+	std::size_t size = std::size_t{ *number } * factor;
+	// The UTF-16 loops need whole code units.
+	if (size < MIN_BUFFER_SIZE || size > MAX_BUFFER_SIZE || size % sizeof(char16_t) != 0)
+		return std::nullopt;
+	return buffer_size_option{ .size{size}, .adaptive{false} };
+}
+
+std::string buffer_size_option_to_string(buffer_size_option option) {
+	if (option.adaptive)
+		return "auto";
+	return fmt::format("{}", option.size);
+}
+
+relay_buffer::relay_buffer(buffer_size_option option)
+	: m_storage(option.size), m_adaptive{ option.adaptive }
+{
+}
+
+void relay_buffer::update(std::size_t bytes_read, std::size_t bytes_requested) {
+	if (!m_adaptive)
+		return;
+
+	// Two full reads in a row: there is more waiting in the pipe.
+	constexpr unsigned full_reads_before_growing{ 2 };
+	// Many small reads in a row: the traffic is interactive.
+	constexpr unsigned small_reads_before_shrinking{ 16 };
+
+	if (bytes_read >= bytes_requested) {
+		m_small_reads = 0;
+		if (++m_full_reads >= full_reads_before_growing && m_storage.size() < MAX_ADAPTIVE_BUFFER_SIZE) {
+			m_storage.resize(std::min(m_storage.size() * 2, MAX_ADAPTIVE_BUFFER_SIZE));
+			m_full_reads = 0;
+		}
+	}
+	else if (bytes_read < m_storage.size() / 8) {
+		m_full_reads = 0;
+		if (++m_small_reads >= small_reads_before_shrinking && m_storage.size() > DEFAULT_BUFFER_SIZE) {
+			m_storage.resize(std::max(m_storage.size() / 2, DEFAULT_BUFFER_SIZE));
+			m_storage.shrink_to_fit();
+			m_small_reads = 0;
+		}
+	}
+	else {
+		m_full_reads = 0;
+		m_small_reads = 0;
+	}
+}
+
+// The loops are the tasks of relay_async.cpp. Without other relays to interleave with,
+// run_relay() makes blocking calls, like a loop of its own.
+
+bool ReadPipeWriteConsole(byte_source& pipe, console_sink& console, buffer_size_option buffer_size)
+{
+	return run_relay(ReadPipeWriteConsoleAsync(pipe, console, buffer_size));
+}
+
+bool ReadConsoleWritePipe(console_source& console, byte_sink& pipe, buffer_size_option buffer_size)
+{
+	return run_relay(ReadConsoleWritePipeAsync(console, pipe, buffer_size));
+}
+
+bool ReadHandleWriteFileByteWise(byte_source& in, byte_sink& out, buffer_size_option buffer_size) {
+	return run_relay(ReadHandleWriteFileByteWiseAsync(in, out, buffer_size));
+}
+
+namespace {
+
+bool write_all(byte_sink& out, std::span<const char> bytes) {
+	std::size_t absolute_number_of_bytes_written = 0;
+	io_result write_result{};
+	while
+	(
+		absolute_number_of_bytes_written < bytes.size()
+		&&
+		(
+			write_result = out.write(bytes.subspan(absolute_number_of_bytes_written))
+		).ok()
+		&&
+		write_result.count > 0
+	){
+		absolute_number_of_bytes_written += write_result.count;
+	}
+	return absolute_number_of_bytes_written == bytes.size();
+}
+
+} // namespace
+
+bool ReadHandleWriteFileTranscoded(byte_source& in, byte_sink& out, text_encoding from, text_encoding to, buffer_size_option buffer_size) {
+	if (from == to)
+		return ReadHandleWriteFileByteWise(in, out, buffer_size);
+
+	relay_buffer buffer{ buffer_size };
+	utf8_to_utf16_converter decoder{};
+	utf16_to_utf8_converter encoder{};
+	// Grows to the largest output of a read and stays there.
+	std::vector<char> converted{};
+	auto reserve = [&](std::size_t bytes) -> char* {
+		if (converted.size() < bytes)
+			converted.resize(bytes);
+		return converted.data();
+	};
+
+	do {
+		char* const szBuffer = buffer.data();
+		const std::size_t BUFF_SIZE = buffer.size();
+
+		io_result read_result = in.read(std::span<char>(szBuffer, BUFF_SIZE));
+		if (!read_result.ok())
+			break;
+		const std::span<const char> bytes_read(szBuffer, read_result.count);
+
+		std::size_t bytes_to_write{ 0 };
+		{
+			trace_scope trace{ "convert", "relay" };
+			if (from == text_encoding::utf8) {
+				char16_t* const wptr = reinterpret_cast<char16_t*>(reserve(utf8_to_utf16_converter::max_output(bytes_read.size()) * sizeof(char16_t)));
+				bytes_to_write = decoder.convert(bytes_read, wptr) * sizeof(char16_t);
+			}
+			else {
+				bytes_to_write = encoder.convert_bytes(bytes_read, reserve(utf16_to_utf8_converter::max_output(bytes_read.size())));
+			}
+			trace.set_arg("bytes", static_cast<int64_t>(bytes_read.size()));
+		}
+		if (!write_all(out, std::span<const char>(converted.data(), bytes_to_write)))
+			return false;
+
+		buffer.update(read_result.count, BUFF_SIZE);
+	} while (true);
+
+	// A sequence, that the input did not complete, becomes U+FFFD.
+	std::size_t bytes_to_write{ 0 };
+	if (from == text_encoding::utf8)
+		bytes_to_write = decoder.finish(reinterpret_cast<char16_t*>(reserve(2 * sizeof(char16_t)))) * sizeof(char16_t);
+	else
+		bytes_to_write = encoder.finish(reserve(6));
+	if (!write_all(out, std::span<const char>(converted.data(), bytes_to_write)))
+		return false;
+	return out.flush();
+}
+
+utf8_writer::utf8_writer(byte_sink& out, std::size_t flush_threshold)
+	: m_out{ out }
+	, m_flush_threshold{ flush_threshold }
+{
+}
+
+bool utf8_writer::write(std::u16string_view text) {
+	const std::size_t required = m_used + utf16_to_utf8_converter::max_output(text.size() * sizeof(char16_t));
+	if (m_buffer.size() < required)
+		m_buffer.resize(required);
+	m_used += m_encoder.convert(std::span<const char16_t>(text.data(), text.size()), m_buffer.data() + m_used);
+
+	if (m_used >= m_flush_threshold)
+		return flush();
+	return true;
+}
+
+bool utf8_writer::flush() {
+	if (m_used == 0)
+		return true;
+	++m_writes;
+	const bool ok = write_all(m_out, std::span<const char>(m_buffer.data(), m_used));
+	m_used = 0;
+	return ok;
+}
+
+bool utf8_writer::finish() {
+	if (m_buffer.size() < m_used + 6)
+		m_buffer.resize(m_used + 6);
+	m_used += m_encoder.finish(m_buffer.data() + m_used);
+	return flush() && m_out.flush();
+}
+
+std::optional<pipeline_option> parse_pipeline_option(std::string_view str) {
+	auto size = parse_buffer_size_option(str);
+	if (!size || size->adaptive)
+		return std::nullopt;
+	return pipeline_option{ .memory_cap{size->size} };
+}
+
+std::string pipeline_option_to_string(pipeline_option option) {
+	return fmt::format("{}", option.memory_cap);
+}
+
+namespace {
+
+// Runs a reader thread, that reads from `in` directly into the ring, while the
+// calling thread passes the committed bytes to `consume`. `consume` returns the
+// number of bytes it used, or std::nullopt on failure. Bytes it does not use stay
+// in the ring and are passed again together with the next bytes. `consume` is only
+// called with at least `min_chunk` bytes.
+template<class consume_function>
+bool RunReadAhead(byte_source& in, buffer_size_option buffer_size, pipeline_option pipeline,
+	std::size_t min_chunk, consume_function consume)
+{
+	const std::size_t read_size = buffer_size.size;
+	// Room for two reads at least, otherwise reading and writing could not overlap.
+	spsc_byte_ring_buffer ring{ std::max(std::bit_floor(pipeline.memory_cap), std::bit_ceil(2 * read_size)) };
+	// A read of an idle source would keep the reader, after the consumer has failed.
+	read_interrupter interrupter{};
+
+	std::thread reader([&] {
+		trace_thread_name("read-ahead");
+		while (!ring.consumer_closed()) {
+			std::span<char> span = ring.write_span();
+			if (span.empty()) {
+				// The console is behind: a stall of the pipeline.
+				trace_scope trace{ "wait for space", "pipeline" };
+				ring.wait_for_space();
+				continue;
+			}
+			io_result read_result = interrupter.read(in, span.first(std::min(span.size(), read_size)));
+			if (!read_result.ok())
+				break;
+			ring.commit(read_result.count);
+		}
+		ring.close_producer();
+	});
+
+	bool success{ true };
+	while (true) {
+		std::span<const char> span = ring.read_span();
+		if (span.size() < min_chunk) {
+			const bool closed = ring.producer_closed();
+			trace_scope trace{ "wait for data", "pipeline" };
+			ring.wait_for_data(span.size());
+			span = ring.read_span();
+			if (span.size() < min_chunk) {
+				if (closed)
+					break; // A single odd byte at the end is dropped, like in ReadPipeWriteConsole.
+				continue;
+			}
+		}
+
+		std::optional<std::size_t> used = consume(span);
+		if (!used) {
+			success = false;
+			break;
+		}
+		ring.release(*used);
+	}
+	ring.close_consumer();
+	if (!success)
+		interrupter.interrupt();
+	reader.join();
+	return success;
+}
+
+} // namespace
+
+bool ReadPipeWriteConsolePipelined(byte_source& pipe, console_sink& console, buffer_size_option buffer_size, pipeline_option pipeline)
+{
+	static_assert(sizeof(char16_t) == 2);
+
+	// The consumer always releases whole code units. So every span starts at an even
+	// offset of the ring, and an odd byte at the end just stays in the ring, until the
+	// reader delivers the other half. The odd-byte carry of ReadPipeWriteConsole is not needed.
+	auto consume = [&](std::span<const char> span) -> std::optional<std::size_t> {
+		assert(std::bit_cast<uintptr_t>(span.data()) % alignof(char16_t) == 0);
+		const char16_t* const write_start_wptr = reinterpret_cast<const char16_t*>(span.data());
+		const std::size_t absolute_number_of_wchars_to_write = span.size() / sizeof(char16_t);
+
+		std::size_t absolute_number_of_wchars_written = 0;
+		io_result write_result{};
+		while
+			(
+				absolute_number_of_wchars_written < absolute_number_of_wchars_to_write
+				&&
+				(
+					write_result = console.write_utf16(std::span<const char16_t>(
+						write_start_wptr + absolute_number_of_wchars_written,
+						absolute_number_of_wchars_to_write - absolute_number_of_wchars_written))
+					).ok()
+				&&
+				write_result.count > 0
+				) {
+			absolute_number_of_wchars_written += write_result.count;
+		}
+		if (!write_result.ok() || absolute_number_of_wchars_written != absolute_number_of_wchars_to_write)
+			return std::nullopt;
+		return absolute_number_of_wchars_written * sizeof(char16_t);
+	};
+
+	return RunReadAhead(pipe, buffer_size, pipeline, sizeof(char16_t), consume);
+}
+
+bool ReadHandleWriteFileByteWisePipelined(byte_source& in, byte_sink& out, buffer_size_option buffer_size, pipeline_option pipeline)
+{
+	auto consume = [&](std::span<const char> span) -> std::optional<std::size_t> {
+		std::size_t absolute_number_of_bytes_written = 0;
+		io_result write_result{};
+		while
+		(
+			absolute_number_of_bytes_written < span.size()
+			&&
+			(
+				write_result = out.write(span.subspan(absolute_number_of_bytes_written))
+			).ok()
+			&&
+			write_result.count > 0
+		){
+			absolute_number_of_bytes_written += write_result.count;
+		}
+		if (absolute_number_of_bytes_written != span.size())
+			return std::nullopt;
+		return absolute_number_of_bytes_written;
+	};
+
+	// Without user space copies, there is nothing left to overlap.
+	if (std::optional<bool> transferred = transfer_in_kernel(in, out))
+		return *transferred && out.flush();
+
+	if (!RunReadAhead(in, buffer_size, pipeline, 1, consume))
+		return false;
+	return out.flush();
+}
+
+namespace {
+
+// Shared by relay_duplex() and its threads, so that a thread, that is left behind,
+// does not refer to the stack of relay_duplex().
+struct duplex_state {
+	std::mutex mutex{};
+	std::condition_variable ended{};
+	std::optional<bool> outgoing{ std::nullopt };
+	std::optional<bool> incoming{ std::nullopt };
+};
+
+std::thread StartDuplexDirection(std::shared_ptr<duplex_state> state, std::optional<bool> duplex_state::* result,
+	std::unique_ptr<byte_stream> stream, duplex_relay relay, const char* name)
+{
+	return std::thread([state = std::move(state), result, stream = std::move(stream), relay = std::move(relay), name]() mutable {
+		trace_thread_name(name);
+		const bool success = relay(stream);
+		// The end of the stream for the other side.
+		stream.reset();
+		std::lock_guard lock{ state->mutex };
+		(*state).*result = success;
+		state->ended.notify_all();
+	});
+}
+
+} // namespace
+
+bool relay_duplex(std::unique_ptr<byte_stream> outgoing, const duplex_relay& write_outgoing,
+	std::unique_ptr<byte_stream> incoming, const duplex_relay& read_incoming, duplex_end end)
+{
+	auto state = std::make_shared<duplex_state>();
+	std::thread outgoing_thread = StartDuplexDirection(state, &duplex_state::outgoing, std::move(outgoing), write_outgoing, "duplex outgoing");
+	std::thread incoming_thread = StartDuplexDirection(state, &duplex_state::incoming, std::move(incoming), read_incoming, "duplex incoming");
+
+	std::unique_lock lock{ state->mutex };
+	state->ended.wait(lock, [&] {
+		switch (end) {
+		case duplex_end::both:
+			return state->outgoing && state->incoming;
+		case duplex_end::either:
+			return state->outgoing || state->incoming;
+		case duplex_end::incoming:
+			break;
+		}
+		return state->incoming.has_value();
+	});
+	const bool success = state->outgoing.value_or(true) && state->incoming.value_or(true);
+	// A thread with a result only has to unlock the mutex, before it returns.
+	const bool outgoing_ended = state->outgoing.has_value();
+	const bool incoming_ended = state->incoming.has_value();
+	lock.unlock();
+	if (outgoing_ended)
+		outgoing_thread.join();
+	else
+		outgoing_thread.detach();
+	if (incoming_ended)
+		incoming_thread.join();
+	else
+		incoming_thread.detach();
+	return success;
+}
+
+namespace {
+
+class console_stream final : public byte_stream {
+public:
+	console_stream(std::unique_ptr<console> target, text_encoding encoding)
+		: m_console{ std::move(target) },
+		m_bytes{ (encoding == text_encoding::utf8) ? open_byte_stream(*m_console->handle()) : nullptr } {}
+
+	io_result read(std::span<char> buffer) override {
+		if (m_bytes)
+			return m_bytes->read(buffer);
+		// Only whole code units. An odd last byte of `buffer` stays unused.
+		m_units.resize(buffer.size() / sizeof(char16_t));
+		if (m_units.empty())
+			return io_result{ .status{io_status::error} };
+		io_result result = m_console->read_utf16(m_units);
+		if (!result.ok())
+			return result;
+		std::memcpy(buffer.data(), m_units.data(), result.count * sizeof(char16_t));
+		return io_result{ .count{result.count * sizeof(char16_t)} };
+	}
+
+	io_result write(std::span<const char> buffer) override {
+		if (m_bytes)
+			return m_bytes->write(buffer);
+		m_units.clear();
+		std::span<const char> bytes = buffer;
+		if (m_carry && !bytes.empty()) {
+			const char pair[2]{ *m_carry, bytes.front() };
+			m_units.push_back(std::bit_cast<char16_t>(pair));
+			m_carry.reset();
+			bytes = bytes.subspan(1);
+		}
+		const std::size_t whole = bytes.size() / sizeof(char16_t);
+		m_units.resize(m_units.size() + whole);
+		std::memcpy(m_units.data() + m_units.size() - whole, bytes.data(), whole * sizeof(char16_t));
+		if (bytes.size() % sizeof(char16_t) != 0)
+			m_carry = bytes.back();
+
+		std::span<const char16_t> units = m_units;
+		while (!units.empty()) {
+			io_result result = m_console->write_utf16(units);
+			if (!result.ok())
+				return result;
+			// A console, that takes nothing, would keep this loop spinning.
+			if (result.count == 0)
+				return io_result{ .status{io_status::error} };
+			units = units.subspan(result.count);
+		}
+		return io_result{ .count{buffer.size()} };
+	}
+
+	bool flush() override { return !m_bytes || m_bytes->flush(); }
+
+	std::optional<native_handle_t> handle() const override { return std::nullopt; }
+
+private:
+	std::unique_ptr<console> m_console;
+	std::unique_ptr<byte_stream> m_bytes;
+	std::vector<char16_t> m_units{};
+	// The first byte of a code unit, that the last write did not complete.
+	std::optional<char> m_carry{ std::nullopt };
+};
+
+} // namespace
+
+std::unique_ptr<byte_stream> open_console_stream(std::unique_ptr<console> target, text_encoding encoding) {
+	return std::make_unique<console_stream>(std::move(target), encoding);
+}
@@ -0,0 +1,407 @@
+#include "console-tools/relay_async.h"
+#include "console-tools/trace.h"
+
+#include <bit>
+#include <cassert>
+#include <list>
+#include <vector>
+
+#include <fmt/core.h>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct scheduled_task {
+	// The task, that spawn() was given, wrapped in run_task().
+	relay_task root{};
+	io_scheduler::done_function done{};
+	bool started{ false };
+	bool ended{ false };
+};
+
+// The book-keeping of the tasks. The backends decide, how to wait.
+class task_scheduler : public io_scheduler {
+public:
+	void spawn(relay_task task, done_function done) override {
+		scheduled_task& entry = m_tasks.emplace_back();
+		entry.done = std::move(done);
+		entry.root = run_task(std::move(task), entry);
+		entry.root.handle().promise().scheduler = this;
+	}
+
+	bool run() override {
+		while (true) {
+			start_tasks();
+			// Tasks are freed after the round, because they end within it.
+			m_tasks.remove_if([](const scheduled_task& task) { return task.ended; });
+			if (m_tasks.empty())
+				break;
+			if (!poll()) {
+				fmt::print(stderr, "Error: {} relays wait, but the scheduler cannot wait for them.\n", m_tasks.size());
+				break;
+			}
+		}
+
+		// Only after a failure of poll(): the tasks, that still wait, give up.
+		const bool all_ended = m_tasks.empty();
+		while (!m_tasks.empty()) {
+			scheduled_task task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+			task.root = {};
+			++m_counters.tasks_ended;
+			if (task.done)
+				task.done(false);
+		}
+		restore();
+		const bool all_succeeded = all_ended && m_all_succeeded;
+		m_all_succeeded = true;
+		return all_succeeded;
+	}
+
+	io_scheduler_counters counters() const override { return m_counters; }
+
+protected:
+	// Waits, until at least one handle is ready, and calls its waiters.
+	virtual bool poll() = 0;
+
+	// Switches the handles of prepare() back and forgets the waiters.
+	virtual void restore() = 0;
+
+	io_scheduler_counters m_counters{};
+
+private:
+	relay_task run_task(relay_task task, scheduled_task& entry) {
+		const bool success = co_await std::move(task);
+		entry.ended = true;
+		m_all_succeeded = m_all_succeeded && success;
+		++m_counters.tasks_ended;
+		if (entry.done)
+			entry.done(success);
+		co_return success;
+	}
+
+	void start_tasks() {
+		// A task may spawn() others, while it runs. They are appended, so the loop sees them.
+		for (scheduled_task& task : m_tasks) {
+			if (task.started)
+				continue;
+			task.started = true;
+			++m_counters.tasks_started;
+			task.root.handle().resume();
+		}
+	}
+
+	std::list<scheduled_task> m_tasks{};
+	bool m_all_succeeded{ true };
+};
+
+// Every call blocks, so a task runs to its end, before the next one starts.
+class blocking_scheduler final : public task_scheduler {
+public:
+	bool prepare(native_handle_t /*handle*/) override { return false; }
+	bool wait(native_handle_t /*handle*/, bool /*for_writing*/, io_waiter& /*waiter*/) override { return false; }
+
+private:
+	bool poll() override { return false; }
+	void restore() override {}
+};
+
+#if defined(__linux__)
+constexpr int MAX_EVENTS{ 256 };
+
+class epoll_scheduler final : public task_scheduler {
+public:
+	static std::unique_ptr<epoll_scheduler> create() {
+		int epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			return nullptr;
+		return std::unique_ptr<epoll_scheduler>(new epoll_scheduler(epoll_fd));
+	}
+
+	~epoll_scheduler() override {
+		restore();
+		::close(m_epoll_fd);
+	}
+
+	bool prepare(native_handle_t handle) override {
+		if (m_original_flags.contains(handle))
+			return true;
+		int flags = ::fcntl(handle, F_GETFL);
+		if (flags < 0 || ::fcntl(handle, F_SETFL, flags | O_NONBLOCK) != 0)
+			return false;
+		m_original_flags.emplace(handle, flags);
+		return true;
+	}
+
+	bool wait(native_handle_t handle, bool for_writing, io_waiter& waiter) override {
+		handle_watch& watch = m_watches[handle];
+		io_waiter*& slot = for_writing ? watch.writer : watch.reader;
+		if (slot != nullptr && slot != &waiter)
+			return false;
+		slot = &waiter;
+		if (!update(handle, watch)) {
+			slot = nullptr;
+			return false;
+		}
+		++m_counters.suspensions;
+		return true;
+	}
+
+private:
+	// The waiters of a handle. It is in the epoll set with EPOLLONESHOT: after an event,
+	// it reports nothing more, not even a hang-up, until update() arms it again.
+	struct handle_watch {
+		io_waiter* reader{ nullptr };
+		io_waiter* writer{ nullptr };
+		bool in_set{ false };
+		// The events, that it is armed for.
+		uint32_t events{ 0 };
+	};
+
+	explicit epoll_scheduler(int epoll_fd) : m_epoll_fd{ epoll_fd } {}
+
+	bool update(int fd, handle_watch& watch) {
+		const uint32_t events = (watch.reader ? EPOLLIN : 0u) | (watch.writer ? EPOLLOUT : 0u);
+		if (events == 0 || events == watch.events)
+			return true;
+		epoll_event event{ .events{events | EPOLLONESHOT}, .data{.fd{fd}} };
+		int result = ::epoll_ctl(m_epoll_fd, watch.in_set ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+		// A handle, that was closed, leaves the set on its own, and its number may come back.
+		if (result != 0 && watch.in_set && errno == ENOENT)
+			result = ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+		if (result != 0)
+			return false;
+		watch.in_set = true;
+		watch.events = events;
+		return true;
+	}
+
+	bool poll() override {
+		epoll_event events[MAX_EVENTS];
+		int count;
+		do {
+			trace_scope trace{ "epoll_wait", "io" };
+			count = ::epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+			trace.set_arg("events", count);
+		} while (count < 0 && errno == EINTR);
+		if (count < 0)
+			return false;
+		++m_counters.wakeups;
+
+		for (int i = 0; i < count; ++i) {
+			const int fd = events[i].data.fd;
+			auto found = m_watches.find(fd);
+			if (found == m_watches.end())
+				continue;
+			handle_watch& watch = found->second;
+			// An error or a hang-up ends the wait in both directions; the calls report it.
+			const bool failed = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+			io_waiter* reader = ((events[i].events & EPOLLIN) || failed) ? std::exchange(watch.reader, nullptr) : nullptr;
+			io_waiter* writer = ((events[i].events & EPOLLOUT) || failed) ? std::exchange(watch.writer, nullptr) : nullptr;
+			// The other direction may still wait. If it cannot, its call reports the failure.
+			watch.events = 0;
+			if (!update(fd, watch)) {
+				if (!reader)
+					reader = std::exchange(watch.reader, nullptr);
+				if (!writer)
+					writer = std::exchange(watch.writer, nullptr);
+			}
+			// The waiters resume their tasks, which may wait again, also for this handle.
+			if (reader)
+				reader->ready();
+			if (writer)
+				writer->ready();
+		}
+		return true;
+	}
+
+	void restore() override {
+		for (auto& [fd, watch] : m_watches) {
+			if (watch.in_set)
+				(void)::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+		}
+		m_watches.clear();
+		for (auto [fd, flags] : m_original_flags)
+			(void)::fcntl(fd, F_SETFL, flags);
+		m_original_flags.clear();
+	}
+
+	int m_epoll_fd;
+	std::unordered_map<int, handle_watch> m_watches{};
+	std::unordered_map<int, int> m_original_flags{};
+};
+#endif
+
+// The scheduler of the awaiting task, without suspending it.
+struct current_scheduler {
+	io_scheduler* scheduler{ nullptr };
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(relay_task::handle_type task) noexcept {
+		scheduler = task.promise().scheduler;
+		return false;
+	}
+	io_scheduler* await_resume() const noexcept { return scheduler; }
+};
+
+// Whether `scheduler` suspends the task on `handle`, instead of letting the calls block.
+bool waits_for(io_scheduler* scheduler, std::optional<native_handle_t> handle) {
+	return handle && scheduler != nullptr && scheduler->prepare(*handle);
+}
+
+} // namespace
+
+std::unique_ptr<io_scheduler> create_io_scheduler() {
+#if defined(__linux__)
+	if (std::unique_ptr<epoll_scheduler> scheduler = epoll_scheduler::create())
+		return scheduler;
+#endif
+	return std::make_unique<blocking_scheduler>();
+}
+
+bool run_relay(relay_task task) {
+	// With nothing to interleave, blocking calls cost the least, and the handles keep their mode.
+	blocking_scheduler scheduler{};
+	scheduler.spawn(std::move(task), {});
+	return scheduler.run();
+}
+
+relay_task ReadPipeWriteConsoleAsync(byte_source& pipe, console_sink& console, buffer_size_option buffer_size)
+{
+	relay_buffer buffer{ buffer_size };
+	static_assert(sizeof(char16_t) == 2);
+	// The storage of std::vector is aligned for any fundamental type, so for char16_t, too.
+	assert(std::bit_cast<uintptr_t>(buffer.data()) % alignof(char16_t) == 0);
+
+	// A read starts either odd, at `szBuffer[1]`, or even, at `szBuffer[2]`. If it starts
+	// odd, we have one byte more from the last round in `szBuffer[0]`. We begin with even,
+	// because in the beginning we don't have a byte from the last round.
+	std::size_t read_start_index = sizeof(char16_t);
+
+	while (true) {
+		char* const szBuffer = buffer.data();
+		char* const read_start_ptr = szBuffer + read_start_index;
+		const std::size_t bytes_requested = buffer.size() - read_start_index;
+
+		io_result read_result = co_await async_read(pipe, std::span<char>(read_start_ptr, bytes_requested));
+		if (!read_result.ok())
+			break;
+		const std::size_t bytes_read = read_result.count;
+		if (bytes_read > bytes_requested) {
+			fmt::print(stderr, "Unexpected error when reading from the pipe: More bytes read than requested.\n");
+			co_return false;
+		}
+
+		// Add +1, if we have an additional byte from the last round. The code units start
+		// even, so one before an odd start.
+		const bool carried = (read_start_index % 2) != 0;
+		const std::size_t bytes_available = bytes_read + (carried ? 1 : 0);
+		const char16_t* const units = reinterpret_cast<const char16_t*>(carried ? read_start_ptr - 1 : read_start_ptr);
+		const std::size_t units_to_write = bytes_available / sizeof(char16_t); // round down
+
+		std::size_t units_written = 0;
+		while (units_written < units_to_write) {
+			io_result write_result = co_await async_write_utf16(console,
+				std::span<const char16_t>(units + units_written, units_to_write - units_written));
+			if (!write_result.ok() || write_result.count == 0)
+				co_return false;
+			units_written += write_result.count;
+		}
+
+		// If the number of available bytes is odd, one byte could not be written, because
+		// a UTF-16 code unit has 2 bytes. It starts the next round.
+		if (bytes_available % 2 != 0) {
+			trace_instant("odd byte carried", "relay");
+			szBuffer[0] = read_start_ptr[bytes_read - 1];
+			read_start_index = 1;
+		}
+		else {
+			read_start_index = sizeof(char16_t);
+		}
+
+		// This may move the buffer. `szBuffer[0]` is kept.
+		buffer.update(bytes_read, bytes_requested);
+	}
+
+	// Code units, that a non-blocking console holds back, reach it before the end.
+	if (console.pollable_handle())
+		co_return (co_await async_write_utf16(console, {})).ok();
+	co_return true;
+}
+
+relay_task ReadConsoleWritePipeAsync(console_source& console, byte_sink& pipe, buffer_size_option buffer_size)
+{
+	relay_buffer buffer{ buffer_size };
+
+	while (true) {
+		char* const szBuffer = buffer.data();
+		const std::size_t units_requested = buffer.size() / sizeof(char16_t);
+
+		io_result read_result = co_await async_read_utf16(console, std::span<char16_t>(reinterpret_cast<char16_t*>(szBuffer), units_requested));
+		if (!read_result.ok())
+			break;
+		if (read_result.count > units_requested) {
+			fmt::print(stderr, "Unexpected error when reading from the console.\n");
+			co_return false;
+		}
+
+		const std::size_t bytes_to_write = read_result.count * sizeof(char16_t);
+		std::size_t bytes_written = 0;
+		while (bytes_written < bytes_to_write) {
+			io_result write_result = co_await async_write(pipe, std::span<const char>(szBuffer + bytes_written, bytes_to_write - bytes_written));
+			if (!write_result.ok() || write_result.count == 0)
+				co_return false;
+			bytes_written += write_result.count;
+		}
+
+		buffer.update(bytes_to_write, units_requested * sizeof(char16_t));
+	}
+
+	co_return true;
+}
+
+relay_task ReadHandleWriteFileByteWiseAsync(byte_source& in, byte_sink& out, buffer_size_option buffer_size)
+{
+	// The bytes are not looked at, so the kernel can move them on its own. But it blocks
+	// the thread, so only, where the calls of the task would block anyway (run_relay()).
+	io_scheduler* scheduler = co_await current_scheduler{};
+	if (!waits_for(scheduler, in.pollable_handle()) && !waits_for(scheduler, out.pollable_handle())) {
+		if (std::optional<bool> transferred = transfer_in_kernel(in, out))
+			co_return *transferred && out.flush();
+	}
+
+	relay_buffer buffer{ buffer_size };
+
+	while (true) {
+		char* const szBuffer = buffer.data();
+		const std::size_t bytes_requested = buffer.size();
+
+		io_result read_result = co_await async_read(in, std::span<char>(szBuffer, bytes_requested));
+		if (!read_result.ok())
+			break;
+		if (read_result.count > bytes_requested) {
+			fmt::print(stderr, "Unexpected error when reading.\n");
+			co_return false;
+		}
+
+		std::size_t bytes_written = 0;
+		while (bytes_written < read_result.count) {
+			io_result write_result = co_await async_write(out, std::span<const char>(szBuffer + bytes_written, read_result.count - bytes_written));
+			if (!write_result.ok() || write_result.count == 0)
+				co_return false;
+			bytes_written += write_result.count;
+		}
+
+		buffer.update(read_result.count, bytes_requested);
+	}
+
+	co_return out.flush();
+}
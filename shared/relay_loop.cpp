@@ -0,0 +1,323 @@
+#include "console-tools/relay_loop.h"
+#include "console-tools/trace.h"
+
+#if defined(__linux__)
+#include <atomic>
+#include <cerrno>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int MAX_EVENTS{ 256 };
+// Buffers, that the loop keeps for the next busy session. Beyond that, they are freed.
+constexpr std::size_t MAX_POOLED_BUFFERS{ 64 };
+
+struct loop_session;
+
+// The epoll_event of a handle points here.
+struct loop_endpoint {
+	loop_session* session{ nullptr };
+	bool is_sink{ false };
+};
+
+struct loop_session {
+	std::unique_ptr<byte_source> source{};
+	std::unique_ptr<byte_sink> sink{};
+	relay_loop::done_function done{};
+	int in_fd{ -1 };
+	int out_fd{ -1 };
+	// Sockets are written with send(MSG_NOSIGNAL), so a peer, that has gone, is no SIGPIPE.
+	bool out_is_socket{ false };
+	loop_endpoint in_endpoint{};
+	loop_endpoint out_endpoint{};
+	// Only one of the handles is in the epoll set at a time: the source while the
+	// buffer is empty, the sink while it holds bytes.
+	bool waiting_for_sink{ false };
+	bool closed{ false };
+	std::unique_ptr<char[]> buffer{};
+	std::size_t begin{ 0 };
+	std::size_t end{ 0 };
+};
+
+bool set_non_blocking(int fd) {
+	int flags = ::fcntl(fd, F_GETFL);
+	return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool is_socket(int fd) {
+	struct stat info {};
+	return ::fstat(fd, &info) == 0 && S_ISSOCK(info.st_mode);
+}
+
+class epoll_relay_loop final : public relay_loop {
+public:
+	static std::unique_ptr<epoll_relay_loop> create(relay_loop_option option) {
+		int epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			return nullptr;
+		int wakeup_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (wakeup_fd < 0) {
+			::close(epoll_fd);
+			return nullptr;
+		}
+		// data.ptr == nullptr stands for the wakeup.
+		epoll_event event{ .events{EPOLLIN}, .data{.ptr{nullptr}} };
+		if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) != 0) {
+			::close(wakeup_fd);
+			::close(epoll_fd);
+			return nullptr;
+		}
+		return std::unique_ptr<epoll_relay_loop>(new epoll_relay_loop(option, epoll_fd, wakeup_fd));
+	}
+
+	~epoll_relay_loop() override {
+		close_all();
+		::close(m_wakeup_fd);
+		::close(m_epoll_fd);
+	}
+
+	bool add(std::unique_ptr<byte_source> in, std::unique_ptr<byte_sink> out, done_function done) override {
+		std::optional<native_handle_t> in_fd = in->handle();
+		std::optional<native_handle_t> out_fd = out->handle();
+		if (!in_fd || !out_fd || *in_fd == *out_fd || !out->flush())
+			return false;
+		if (!set_non_blocking(*in_fd) || !set_non_blocking(*out_fd))
+			return false;
+
+		auto session = std::make_unique<loop_session>();
+		session->source = std::move(in);
+		session->sink = std::move(out);
+		session->done = std::move(done);
+		session->in_fd = *in_fd;
+		session->out_fd = *out_fd;
+		session->out_is_socket = is_socket(*out_fd);
+		{
+			std::lock_guard lock{ m_pending_mutex };
+			m_pending.push_back(std::move(session));
+		}
+		wake_up();
+		return true;
+	}
+
+	void run() override {
+		epoll_event events[MAX_EVENTS];
+		while (!m_stop_requested.load(std::memory_order_acquire)) {
+			int count;
+			{
+				trace_scope trace{ "epoll_wait", "io" };
+				count = ::epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+				trace.set_arg("events", count);
+			}
+			if (count < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			++m_counters.wakeups;
+			for (int i = 0; i < count; ++i) {
+				if (events[i].data.ptr == nullptr) {
+					take_pending();
+					continue;
+				}
+				loop_endpoint& endpoint = *static_cast<loop_endpoint*>(events[i].data.ptr);
+				if (endpoint.session->closed)
+					continue;
+				if (endpoint.is_sink)
+					drain(*endpoint.session);
+				else
+					fill(*endpoint.session);
+			}
+			// Sessions are freed after the round, because a later event of the same
+			// round may point to them.
+			m_sessions.remove_if([](const std::unique_ptr<loop_session>& session) { return session->closed; });
+		}
+		close_all();
+	}
+
+	void stop() override {
+		m_stop_requested.store(true, std::memory_order_release);
+		wake_up();
+	}
+
+	relay_loop_counters counters() const override { return m_counters; }
+
+private:
+	epoll_relay_loop(relay_loop_option option, int epoll_fd, int wakeup_fd)
+		: m_option{ option }, m_epoll_fd{ epoll_fd }, m_wakeup_fd{ wakeup_fd } {}
+
+	void wake_up() {
+		const uint64_t one{ 1 };
+		(void)!::write(m_wakeup_fd, &one, sizeof(one));
+	}
+
+	void take_pending() {
+		uint64_t value{};
+		(void)!::read(m_wakeup_fd, &value, sizeof(value));
+		std::vector<std::unique_ptr<loop_session>> pending{};
+		{
+			std::lock_guard lock{ m_pending_mutex };
+			pending.swap(m_pending);
+		}
+		for (auto& session : pending) {
+			session->in_endpoint = loop_endpoint{ .session{session.get()}, .is_sink{false} };
+			session->out_endpoint = loop_endpoint{ .session{session.get()}, .is_sink{true} };
+			++m_counters.sessions_started;
+			loop_session& added = *m_sessions.emplace_back(std::move(session));
+			if (!watch(added.in_fd, added.in_endpoint, EPOLLIN))
+				close(added, false);
+		}
+	}
+
+	bool watch(int fd, loop_endpoint& endpoint, uint32_t events) {
+		epoll_event event{ .events{events}, .data{.ptr{&endpoint}} };
+		return ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+	}
+
+	void unwatch(int fd) {
+		(void)::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+
+	// One read, then as much of it to the sink, as it takes right now.
+	void fill(loop_session& session) {
+		if (!session.buffer)
+			session.buffer = take_buffer();
+		ssize_t bytes_read;
+		do {
+			bytes_read = ::read(session.in_fd, session.buffer.get(), m_option.buffer_size);
+		} while (bytes_read < 0 && errno == EINTR);
+
+		if (bytes_read > 0) {
+			session.begin = 0;
+			session.end = static_cast<std::size_t>(bytes_read);
+			drain(session);
+		}
+		else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			release_buffer(session);
+		}
+		else {
+			// EIO is the end of the master side of a pty, like in io_posix.cpp.
+			close(session, bytes_read == 0 || errno == EIO);
+		}
+	}
+
+	void drain(loop_session& session) {
+		while (session.begin < session.end) {
+			const char* data = session.buffer.get() + session.begin;
+			const std::size_t size = session.end - session.begin;
+			ssize_t written;
+			do {
+				written = session.out_is_socket
+					? ::send(session.out_fd, data, size, MSG_NOSIGNAL)
+					: ::write(session.out_fd, data, size);
+			} while (written < 0 && errno == EINTR);
+
+			if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				// The sink is full. The source waits, until the buffer is empty again.
+				if (!session.waiting_for_sink) {
+					unwatch(session.in_fd);
+					if (!watch(session.out_fd, session.out_endpoint, EPOLLOUT)) {
+						close(session, false);
+						return;
+					}
+					session.waiting_for_sink = true;
+				}
+				return;
+			}
+			if (written < 0) {
+				close(session, false);
+				return;
+			}
+			session.begin += static_cast<std::size_t>(written);
+			m_counters.bytes += static_cast<uint64_t>(written);
+		}
+
+		release_buffer(session);
+		if (session.waiting_for_sink) {
+			unwatch(session.out_fd);
+			session.waiting_for_sink = false;
+			if (!watch(session.in_fd, session.in_endpoint, EPOLLIN))
+				close(session, false);
+		}
+	}
+
+	void close(loop_session& session, bool success) {
+		if (session.closed)
+			return;
+		session.closed = true;
+		unwatch(session.waiting_for_sink ? session.out_fd : session.in_fd);
+		session.begin = session.end = 0;
+		release_buffer(session);
+		session.source.reset();
+		session.sink.reset();
+		++m_counters.sessions_ended;
+		if (session.done)
+			session.done(success);
+	}
+
+	void close_all() {
+		for (auto& session : m_sessions)
+			close(*session, false);
+		m_sessions.clear();
+		std::vector<std::unique_ptr<loop_session>> pending{};
+		{
+			std::lock_guard lock{ m_pending_mutex };
+			pending.swap(m_pending);
+		}
+		for (auto& session : pending) {
+			if (session->done)
+				session->done(false);
+		}
+	}
+
+	std::unique_ptr<char[]> take_buffer() {
+		if (!m_free_buffers.empty()) {
+			std::unique_ptr<char[]> buffer = std::move(m_free_buffers.back());
+			m_free_buffers.pop_back();
+			return buffer;
+		}
+		++m_counters.buffers_allocated;
+		return std::make_unique_for_overwrite<char[]>(m_option.buffer_size);
+	}
+
+	void release_buffer(loop_session& session) {
+		if (!session.buffer || session.begin < session.end)
+			return;
+		if (m_free_buffers.size() < MAX_POOLED_BUFFERS) {
+			m_free_buffers.push_back(std::move(session.buffer));
+		}
+		else {
+			session.buffer.reset();
+			--m_counters.buffers_allocated;
+		}
+	}
+
+	relay_loop_option m_option;
+	int m_epoll_fd;
+	int m_wakeup_fd;
+	std::atomic<bool> m_stop_requested{ false };
+	std::mutex m_pending_mutex{};
+	std::vector<std::unique_ptr<loop_session>> m_pending{};
+	std::list<std::unique_ptr<loop_session>> m_sessions{};
+	std::vector<std::unique_ptr<char[]>> m_free_buffers{};
+	relay_loop_counters m_counters{};
+};
+
+} // namespace
+
+std::unique_ptr<relay_loop> create_relay_loop(relay_loop_option option) {
+	return epoll_relay_loop::create(option);
+}
+#else
+std::unique_ptr<relay_loop> create_relay_loop(relay_loop_option /*option*/) {
+	return nullptr;
+}
+#endif
@@ -0,0 +1,212 @@
+#include "console-tools/relay_stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fmt/core.h>
+
+namespace {
+
+std::size_t bucket_index(uint64_t value, std::size_t linear_buckets, std::size_t sub_buckets) {
+	if (value < linear_buckets)
+		return static_cast<std::size_t>(value);
+	// `value` has at least 5 bits. The 3 bits below the highest one pick the sub-bucket.
+	const std::size_t exponent = static_cast<std::size_t>(std::bit_width(value)) - 1;
+	const std::size_t sub = static_cast<std::size_t>(value >> (exponent - 3)) & (sub_buckets - 1);
+	return linear_buckets + (exponent - 4) * sub_buckets + sub;
+}
+
+uint64_t bucket_upper_end(std::size_t index, std::size_t linear_buckets, std::size_t sub_buckets) {
+	if (index < linear_buckets)
+		return index;
+	const std::size_t exponent = (index - linear_buckets) / sub_buckets + 4;
+	const uint64_t sub = (index - linear_buckets) % sub_buckets;
+	const uint64_t width = uint64_t{ 1 } << (exponent - 3);
+	return (sub_buckets + sub) * width + (width - 1);
+}
+
+// The names of the calls, that the counters stand for.
+#if defined(_WIN32)
+constexpr std::string_view READ_FILE_NAME{ "ReadFile" };
+constexpr std::string_view READ_CONSOLE_NAME{ "ReadConsoleW" };
+constexpr std::string_view WRITE_FILE_NAME{ "WriteFile" };
+constexpr std::string_view WRITE_CONSOLE_NAME{ "WriteConsoleW" };
+#else
+constexpr std::string_view READ_FILE_NAME{ "read" };
+constexpr std::string_view READ_CONSOLE_NAME{ "read (tty)" };
+constexpr std::string_view WRITE_FILE_NAME{ "write" };
+constexpr std::string_view WRITE_CONSOLE_NAME{ "write (tty)" };
+#endif
+
+double to_milliseconds(uint64_t nanoseconds) {
+	return static_cast<double>(nanoseconds) / 1e6;
+}
+
+double to_microseconds(uint64_t nanoseconds) {
+	return static_cast<double>(nanoseconds) / 1e3;
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+}
+
+std::string counters_to_json(const relay_io_counters& counters, std::string_view units_name) {
+	return fmt::format("{{\"calls\":{},\"{}\":{},\"partial_writes\":{},\"blocked_ms\":{:.3f}}}",
+		counters.calls.load(std::memory_order_relaxed), units_name, counters.units.load(std::memory_order_relaxed),
+		counters.partial_writes.load(std::memory_order_relaxed), to_milliseconds(counters.blocked_ns.load(std::memory_order_relaxed)));
+}
+
+void print_counters(FILE* stream, const relay_io_counters& counters, std::string_view call_name, std::string_view units_name) {
+	const uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+	if (calls == 0)
+		return;
+	fmt::print(stream, "  {:<14} {:>10} calls  {:>14} {:<10}  blocked {:>10.3f} ms",
+		call_name, calls, counters.units.load(std::memory_order_relaxed), units_name,
+		to_milliseconds(counters.blocked_ns.load(std::memory_order_relaxed)));
+	if (const uint64_t partial = counters.partial_writes.load(std::memory_order_relaxed); partial > 0)
+		fmt::print(stream, ", {} partial writes", partial);
+	fmt::print(stream, "\n");
+}
+
+} // namespace
+
+void latency_histogram::record(uint64_t nanoseconds) {
+	m_buckets[bucket_index(nanoseconds, LINEAR_BUCKETS, SUB_BUCKETS)].fetch_add(1, std::memory_order_relaxed);
+	uint64_t current = m_max.load(std::memory_order_relaxed);
+	while (current < nanoseconds && !m_max.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed)) {
+	}
+}
+
+uint64_t latency_histogram::count() const {
+	uint64_t total{ 0 };
+	for (const auto& bucket : m_buckets)
+		total += bucket.load(std::memory_order_relaxed);
+	return total;
+}
+
+uint64_t latency_histogram::percentile(double fraction) const {
+	const uint64_t total = count();
+	if (total == 0)
+		return 0;
+	const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(total))));
+	uint64_t seen{ 0 };
+	for (std::size_t i = 0; i < m_buckets.size(); ++i) {
+		seen += m_buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(bucket_upper_end(i, LINEAR_BUCKETS, SUB_BUCKETS), max());
+	}
+	return max();
+}
+
+std::string relay_stats_to_json(const relay_stats& stats, std::string_view relay) {
+	const latency_histogram& latency = stats.chunk_latency;
+	return fmt::format("{{\"relay\":\"{}\",\"elapsed_ms\":{:.3f},\"read_file\":{},\"read_console\":{},\"write_file\":{},\"write_console\":{},"
+		"\"chunk_latency_us\":{{\"count\":{},\"p50\":{:.1f},\"p99\":{:.1f},\"max\":{:.1f}}}}}",
+		relay, to_milliseconds(elapsed_ns(stats.start)),
+		counters_to_json(stats.file_reads, "bytes"), counters_to_json(stats.console_reads, "code_units"),
+		counters_to_json(stats.file_writes, "bytes"), counters_to_json(stats.console_writes, "code_units"),
+		latency.count(), to_microseconds(latency.percentile(0.5)), to_microseconds(latency.percentile(0.99)), to_microseconds(latency.max()));
+}
+
+void print_relay_stats(FILE* stream, const relay_stats& stats, std::string_view relay) {
+	const latency_histogram& latency = stats.chunk_latency;
+	fmt::print(stream, "Statistics of the relay {} after {:.3f} s:\n", relay, to_milliseconds(elapsed_ns(stats.start)) / 1e3);
+	print_counters(stream, stats.file_reads, READ_FILE_NAME, "bytes");
+	print_counters(stream, stats.console_reads, READ_CONSOLE_NAME, "code units");
+	print_counters(stream, stats.file_writes, WRITE_FILE_NAME, "bytes");
+	print_counters(stream, stats.console_writes, WRITE_CONSOLE_NAME, "code units");
+	if (latency.count() > 0) {
+		fmt::print(stream, "  chunk latency  p50 {:.1f} us, p99 {:.1f} us, max {:.1f} us ({} chunks)\n",
+			to_microseconds(latency.percentile(0.5)), to_microseconds(latency.percentile(0.99)), to_microseconds(latency.max()), latency.count());
+	}
+}
+
+std::chrono::steady_clock::time_point stats_read_clock::start() {
+	const auto now = std::chrono::steady_clock::now();
+	if (m_last_read_done)
+		m_stats.chunk_latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - *m_last_read_done).count()));
+	return now;
+}
+
+void stats_read_clock::stop(std::chrono::steady_clock::time_point started, relay_io_counters& counters, const io_result& result) {
+	const auto now = std::chrono::steady_clock::now();
+	counters.calls.fetch_add(1, std::memory_order_relaxed);
+	counters.blocked_ns.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - started).count()), std::memory_order_relaxed);
+	if (result.ok())
+		counters.units.fetch_add(result.count, std::memory_order_relaxed);
+	m_last_read_done = now;
+}
+
+io_result stats_byte_source::read(std::span<char> buffer) {
+	const auto started = m_clock.start();
+	io_result result = m_inner.read(buffer);
+	m_clock.stop(started, m_stats.file_reads, result);
+	return result;
+}
+
+io_result stats_console_source::read_utf16(std::span<char16_t> buffer) {
+	const auto started = m_clock.start();
+	io_result result = m_inner.read_utf16(buffer);
+	m_clock.stop(started, m_stats.console_reads, result);
+	return result;
+}
+
+namespace {
+
+void count_write(relay_io_counters& counters, std::chrono::steady_clock::time_point started, std::size_t offered, const io_result& result) {
+	counters.calls.fetch_add(1, std::memory_order_relaxed);
+	counters.blocked_ns.fetch_add(elapsed_ns(started), std::memory_order_relaxed);
+	if (!result.ok())
+		return;
+	counters.units.fetch_add(result.count, std::memory_order_relaxed);
+	if (result.count < offered)
+		counters.partial_writes.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+io_result stats_byte_sink::write(std::span<const char> buffer) {
+	const auto started = std::chrono::steady_clock::now();
+	io_result result = m_inner.write(buffer);
+	count_write(m_stats.file_writes, started, buffer.size(), result);
+	return result;
+}
+
+io_result stats_console_sink::write_utf16(std::span<const char16_t> buffer) {
+	const auto started = std::chrono::steady_clock::now();
+	io_result result = m_inner.write_utf16(buffer);
+	count_write(m_stats.console_writes, started, buffer.size(), result);
+	return result;
+}
+
+stats_reporter::stats_reporter(const relay_stats& stats, std::string_view relay, stats_option option, FILE* stream)
+	: m_stats{ stats }
+	, m_relay{ relay }
+	, m_option{ option }
+	, m_stream{ stream }
+{
+	if (m_option.interval.count() <= 0)
+		return;
+	m_thread = std::thread([this]() {
+		std::unique_lock lock{ m_mutex };
+		while (!m_stop_requested.wait_for(lock, m_option.interval, [this] { return m_stop; })) {
+			fmt::print(m_stream, "{}\n", relay_stats_to_json(m_stats, m_relay));
+			std::fflush(m_stream);
+		}
+	});
+}
+
+stats_reporter::~stats_reporter() {
+	if (m_thread.joinable()) {
+		{
+			std::lock_guard lock{ m_mutex };
+			m_stop = true;
+		}
+		m_stop_requested.notify_one();
+		m_thread.join();
+		// The last line has the final numbers.
+		fmt::print(m_stream, "{}\n", relay_stats_to_json(m_stats, m_relay));
+	}
+	print_relay_stats(m_stream, m_stats, m_relay);
+	std::fflush(m_stream);
+}
@@ -0,0 +1,361 @@
+#include "console-tools/relay.h"
+#include "console-tools/helper.h"
+#include "console-tools/trace.h"
+
+#include <fmt/core.h>
+
+std::optional<io_uring_option> parse_io_uring_option(std::string_view str) {
+	auto number = string_to_uint<uint32_t>(str);
+	if (!number || *number < MIN_IO_URING_QUEUE_DEPTH || *number > MAX_IO_URING_QUEUE_DEPTH)
+		return std::nullopt;
+	return io_uring_option{ .queue_depth{*number} };
+}
+
+std::string io_uring_option_to_string(io_uring_option option) {
+	return fmt::format("{}", option.queue_depth);
+}
+
+#if defined(__linux__)
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// The parts of io_uring, that the relay needs, on top of the raw system calls.
+// liburing is not required.
+class uring {
+public:
+	// Returns nullptr, if the kernel has no io_uring, it is disabled, or it lacks
+	// one of the operations used below.
+	static std::unique_ptr<uring> create(unsigned entries) {
+		io_uring_params params{};
+		int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0)
+			return nullptr;
+		auto ring = std::unique_ptr<uring>(new uring(fd));
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !ring->map(params) || !ring->supports_operations())
+			return nullptr;
+		return ring;
+	}
+
+	~uring() {
+		if (m_sqes != nullptr)
+			::munmap(m_sqes, m_sqes_size);
+		if (m_ring != nullptr)
+			::munmap(m_ring, m_ring_size);
+		::close(m_fd);
+	}
+
+	uring(const uring&) = delete;
+	uring& operator=(const uring&) = delete;
+
+	bool register_buffers(std::span<const iovec> buffers) {
+		return ::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) == 0;
+	}
+
+	// A cleared entry. The ring has room for all operations of the relay, so it is never full.
+	io_uring_sqe& next_sqe() {
+		io_uring_sqe& sqe = m_sqes[m_sq_tail & *m_sq_mask];
+		std::memset(&sqe, 0, sizeof(sqe));
+		m_sq_array[m_sq_tail & *m_sq_mask] = m_sq_tail & *m_sq_mask;
+		++m_sq_tail;
+		++m_pending;
+		return sqe;
+	}
+
+	// Submits the new entries and waits for `wait_count` completions.
+	bool submit_and_wait(unsigned wait_count) {
+		std::atomic_ref<unsigned>(*m_sq_tail_shared).store(m_sq_tail, std::memory_order_release);
+		trace_scope trace{ "io_uring_enter", "io" };
+		trace.set_arg("submitted", m_pending);
+		while (true) {
+			++enter_calls;
+			long submitted = ::syscall(__NR_io_uring_enter, m_fd, m_pending, wait_count, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (submitted >= 0) {
+				m_pending -= static_cast<unsigned>(submitted);
+				return true;
+			}
+			if (errno != EINTR)
+				return false;
+		}
+	}
+
+	struct completion {
+		uint64_t user_data;
+		int32_t res;
+	};
+
+	std::optional<completion> pop_completion() {
+		const unsigned tail = std::atomic_ref<unsigned>(*m_cq_tail).load(std::memory_order_acquire);
+		if (m_cq_head_local == tail)
+			return std::nullopt;
+		const io_uring_cqe& cqe = m_cqes[m_cq_head_local & *m_cq_mask];
+		completion result{ .user_data{cqe.user_data}, .res{cqe.res} };
+		++m_cq_head_local;
+		std::atomic_ref<unsigned>(*m_cq_head).store(m_cq_head_local, std::memory_order_release);
+		return result;
+	}
+
+	std::size_t enter_calls{ 0 };
+
+private:
+	explicit uring(int fd) : m_fd{ fd } {}
+
+	bool map(const io_uring_params& params) {
+		m_ring_size = std::max(
+			params.sq_off.array + params.sq_entries * sizeof(unsigned),
+			params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		void* ring = ::mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (ring == MAP_FAILED)
+			return false;
+		m_ring = static_cast<char*>(ring);
+
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+		m_sq_tail_shared = reinterpret_cast<unsigned*>(m_ring + params.sq_off.tail);
+		m_sq_mask = reinterpret_cast<unsigned*>(m_ring + params.sq_off.ring_mask);
+		m_sq_array = reinterpret_cast<unsigned*>(m_ring + params.sq_off.array);
+		m_sq_tail = *m_sq_tail_shared;
+
+		m_cq_head = reinterpret_cast<unsigned*>(m_ring + params.cq_off.head);
+		m_cq_tail = reinterpret_cast<unsigned*>(m_ring + params.cq_off.tail);
+		m_cq_mask = reinterpret_cast<unsigned*>(m_ring + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(m_ring + params.cq_off.cqes);
+		m_cq_head_local = *m_cq_head;
+		return true;
+	}
+
+	// IORING_OP_READ and IORING_OP_WRITE came with Linux 5.6, later than io_uring itself.
+	bool supports_operations() {
+		constexpr unsigned OPERATION_COUNT{ IORING_OP_LAST };
+		std::vector<char> storage(sizeof(io_uring_probe) + OPERATION_COUNT * sizeof(io_uring_probe_op));
+		auto probe = reinterpret_cast<io_uring_probe*>(storage.data());
+		if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, OPERATION_COUNT) != 0)
+			return false;
+		for (unsigned op : { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_ASYNC_CANCEL }) {
+			if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		}
+		return true;
+	}
+
+	int m_fd;
+	char* m_ring{ nullptr };
+	std::size_t m_ring_size{ 0 };
+	io_uring_sqe* m_sqes{ nullptr };
+	std::size_t m_sqes_size{ 0 };
+
+	unsigned* m_sq_tail_shared{ nullptr };
+	unsigned* m_sq_mask{ nullptr };
+	unsigned* m_sq_array{ nullptr };
+	unsigned m_sq_tail{ 0 };
+	unsigned m_pending{ 0 };
+
+	unsigned* m_cq_head{ nullptr };
+	unsigned* m_cq_tail{ nullptr };
+	unsigned* m_cq_mask{ nullptr };
+	io_uring_cqe* m_cqes{ nullptr };
+	unsigned m_cq_head_local{ 0 };
+};
+
+// The file position for pipes and for files opened without O_APPEND alike.
+constexpr uint64_t CURRENT_POSITION{ ~uint64_t{ 0 } };
+
+// user_data of the entries: index of the buffer and kind of operation.
+enum class uring_operation : uint64_t {
+	read = 0,
+	write = 1,
+	cancel = 2
+};
+
+uint64_t make_user_data(unsigned slot, uring_operation operation) {
+	return (static_cast<uint64_t>(slot) << 2) | static_cast<uint64_t>(operation);
+}
+
+} // namespace
+
+std::optional<bool> ReadHandleWriteFileByteWiseUring(byte_source& in, byte_sink& out, buffer_size_option buffer_size,
+	io_uring_option uring_option, std::size_t* syscalls)
+{
+	std::optional<native_handle_t> fd_in = in.handle();
+	std::optional<native_handle_t> fd_out = out.handle();
+	if (!fd_in || !fd_out)
+		return std::nullopt;
+
+	const unsigned depth = uring_option.queue_depth;
+	// Per buffer a read and a write, plus one cancel.
+	auto ring = uring::create(std::bit_ceil(2 * depth + 1));
+	if (!ring)
+		return std::nullopt;
+
+	// Bytes, that are still buffered in `out`, come first.
+	if (!out.flush())
+		return false;
+
+	struct slot_state {
+		char* data{ nullptr };
+		std::size_t count{ 0 };   // bytes read into the buffer
+		std::size_t written{ 0 }; // of them already written
+	};
+
+	const std::size_t size = buffer_size.size;
+	auto storage = std::make_unique<char[]>(depth * size);
+	std::vector<slot_state> slots(depth);
+	std::vector<iovec> iovecs(depth);
+	for (unsigned i = 0; i < depth; ++i) {
+		slots[i].data = storage.get() + i * size;
+		iovecs[i] = iovec{ .iov_base = slots[i].data, .iov_len = size };
+	}
+	// Registered buffers save the kernel the page pinning on every operation.
+	// Without them (e.g. RLIMIT_MEMLOCK too low), the plain operations work as well.
+	const bool fixed = ring->register_buffers(iovecs);
+
+	auto prepare = [&](io_uring_sqe& sqe, bool write, unsigned slot, const char* data, std::size_t count) {
+		sqe.opcode = static_cast<uint8_t>(write
+			? (fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE)
+			: (fixed ? IORING_OP_READ_FIXED : IORING_OP_READ));
+		sqe.fd = write ? *fd_out : *fd_in;
+		sqe.off = CURRENT_POSITION;
+		sqe.addr = reinterpret_cast<uint64_t>(data);
+		sqe.len = static_cast<uint32_t>(count);
+		if (fixed)
+			sqe.buf_index = static_cast<uint16_t>(slot);
+		sqe.user_data = make_user_data(slot, write ? uring_operation::write : uring_operation::read);
+	};
+
+	// Reads run one after the other, and so do writes; a pipe does not keep the order
+	// of concurrent operations. But while the kernel writes one buffer, it already
+	// reads into the next.
+	std::deque<unsigned> free_slots{};
+	for (unsigned i = 0; i < depth; ++i)
+		free_slots.push_back(i);
+	std::deque<unsigned> filled_slots{};
+	// The buffers of the read and of the write in flight.
+	constexpr unsigned NO_SLOT{ ~0u };
+	unsigned reading{ NO_SLOT };
+	unsigned writing{ NO_SLOT };
+	bool end_of_input{ false };
+	bool failed{ false };
+	bool cancel_sent{ false };
+
+	while (true) {
+		if (!end_of_input && !failed && reading == NO_SLOT && !free_slots.empty()) {
+			const unsigned slot = free_slots.front();
+			free_slots.pop_front();
+			io_uring_sqe& read_sqe = ring->next_sqe();
+			prepare(read_sqe, false, slot, slots[slot].data, size);
+			reading = slot;
+			if (writing == NO_SLOT && filled_slots.empty()) {
+				// The write follows in the same submission. The kernel starts it as soon as
+				// the read is done. A short read cancels it, and the rest of the buffer is
+				// written below.
+				read_sqe.flags |= IOSQE_IO_LINK;
+				prepare(ring->next_sqe(), true, slot, slots[slot].data, size);
+				writing = slot;
+			}
+		}
+		if (writing == NO_SLOT && !filled_slots.empty()) {
+			const unsigned slot = filled_slots.front();
+			filled_slots.pop_front();
+			const slot_state& state = slots[slot];
+			prepare(ring->next_sqe(), true, slot, state.data + state.written, state.count - state.written);
+			writing = slot;
+		}
+		if (failed && reading != NO_SLOT && !cancel_sent) {
+			// The input may never deliver again.
+			io_uring_sqe& sqe = ring->next_sqe();
+			sqe.opcode = IORING_OP_ASYNC_CANCEL;
+			sqe.addr = make_user_data(reading, uring_operation::read);
+			sqe.user_data = make_user_data(0, uring_operation::cancel);
+			cancel_sent = true;
+		}
+		if (reading == NO_SLOT && writing == NO_SLOT)
+			break;
+
+		if (!ring->submit_and_wait(1)) {
+			// Entries, that are in flight, still point into `storage`. Without a way
+			// to wait for them, it must not be freed.
+			(void)storage.release();
+			return false;
+		}
+
+		while (std::optional<uring::completion> cqe = ring->pop_completion()) {
+			const unsigned slot = static_cast<unsigned>(cqe->user_data >> 2);
+			slot_state& state = slots[slot];
+			switch (static_cast<uring_operation>(cqe->user_data & 3)) {
+			case uring_operation::read:
+				reading = NO_SLOT;
+				if (cqe->res <= 0) {
+					// Like the blocking loop: a failing read ends the input.
+					end_of_input = true;
+					state.count = 0;
+					if (writing != slot)
+						free_slots.push_back(slot);
+					break;
+				}
+				state.count = static_cast<std::size_t>(cqe->res);
+				state.written = 0;
+				if (writing != slot)
+					filled_slots.push_back(slot);
+				break;
+
+			case uring_operation::write:
+				writing = NO_SLOT;
+				if (cqe->res == -ECANCELED) {
+					// The linked read came back short or empty. It was the oldest buffer.
+					if (state.count > 0)
+						filled_slots.push_front(slot);
+					else
+						free_slots.push_back(slot);
+					break;
+				}
+				if (cqe->res <= 0) {
+					failed = true;
+					free_slots.push_back(slot);
+					break;
+				}
+				state.written += static_cast<std::size_t>(cqe->res);
+				if (state.written < state.count)
+					filled_slots.push_front(slot);
+				else
+					free_slots.push_back(slot);
+				break;
+
+			case uring_operation::cancel:
+				break;
+			}
+		}
+		if (failed)
+			filled_slots.clear();
+	}
+
+	if (syscalls != nullptr)
+		*syscalls = ring->enter_calls;
+	return !failed;
+}
+
+#else
+
+std::optional<bool> ReadHandleWriteFileByteWiseUring(byte_source& /*in*/, byte_sink& /*out*/, buffer_size_option /*buffer_size*/,
+	io_uring_option /*uring*/, std::size_t* /*syscalls*/)
+{
+	return std::nullopt;
+}
+
+#endif
@@ -0,0 +1,383 @@
+#include "console-tools/shm_ring.h"
+#include "console-tools/spsc_ring.h"
+#include "console-tools/trace.h"
+
+#if defined(_WIN32) || defined(__linux__)
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char SHM_RING_MAGIC[8]{ 'C', 'T', 'R', 'I', 'N', 'G', '1', '\0' };
+constexpr std::size_t MIN_SHM_RING_CAPACITY{ 4096 };
+// While the other process is not known or cannot be waited for, a sleeping side looks
+// after it this often.
+constexpr int PEER_CHECK_INTERVAL_MS{ 100 };
+
+// The start of the mapping. The storage of the ring follows it.
+struct shm_ring_header {
+	char magic[8];
+	uint64_t capacity;
+	uint64_t mapping_size;
+	std::atomic<uint32_t> creator_pid;
+	std::atomic<uint32_t> opener_pid;
+	// Windows: the values of the events, that wake the consumer and the producer. They
+	// are inherited, so they have the same values in the other process.
+	uint64_t data_event;
+	uint64_t space_event;
+	spsc_ring_indices indices;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+	"the atomics in the mapping must not need a lock of one process");
+
+constexpr std::size_t STORAGE_OFFSET{ (sizeof(shm_ring_header) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE };
+
+uint32_t current_pid() {
+#if defined(_WIN32)
+	return GetCurrentProcessId();
+#else
+	return static_cast<uint32_t>(::getpid());
+#endif
+}
+
+#if defined(__linux__)
+long futex(std::atomic<uint32_t>& word, int op, uint32_t value, const timespec* timeout) {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+	// No FUTEX_PRIVATE_FLAG: the word is in memory, that another process maps.
+	return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+}
+#endif
+
+// The platform objects of one end: the mapping, and on Windows the events.
+struct shm_mapping {
+	native_handle_t handle{};
+	shm_ring_header* header{ nullptr };
+	// Copies of the header, that the other process cannot change any more.
+	std::size_t capacity{ 0 };
+	std::size_t size{ 0 };
+#if defined(_WIN32)
+	HANDLE data_event{ nullptr };
+	HANDLE space_event{ nullptr };
+#endif
+};
+
+void close_mapping(shm_mapping& mapping) {
+#if defined(_WIN32)
+	if (mapping.header != nullptr)
+		UnmapViewOfFile(mapping.header);
+	if (mapping.data_event != nullptr)
+		CloseHandle(mapping.data_event);
+	if (mapping.space_event != nullptr)
+		CloseHandle(mapping.space_event);
+	if (mapping.handle != nullptr)
+		CloseHandle(mapping.handle);
+#else
+	if (mapping.header != nullptr)
+		::munmap(mapping.header, mapping.size);
+	if (mapping.handle >= 0)
+		::close(mapping.handle);
+#endif
+}
+
+class shm_ring_stream_impl final : public shm_ring_stream, private spsc_ring_wakeup {
+public:
+	shm_ring_stream_impl(shm_mapping mapping, shm_ring_side side, bool creator)
+		: m_mapping{ mapping }, m_side{ side }, m_creator{ creator },
+		m_ring{ mapping.header->indices, std::span<char>(reinterpret_cast<char*>(mapping.header) + STORAGE_OFFSET, mapping.capacity), this }
+	{
+		if (!m_creator)
+			set_peer(m_mapping.header->creator_pid.load(std::memory_order_acquire));
+	}
+
+	~shm_ring_stream_impl() override {
+		if (m_side == shm_ring_side::producer)
+			m_ring.close_producer();
+		else
+			m_ring.close_consumer();
+		close_peer();
+		close_mapping(m_mapping);
+	}
+
+	io_result read(std::span<char> buffer) override {
+		if (m_side != shm_ring_side::consumer)
+			return io_result{ .status{io_status::error} };
+		trace_scope trace{ "shm read", "io" };
+		for (;;) {
+			std::size_t count{ 0 };
+			// Up to two spans, if the bytes wrap around the end of the storage.
+			for (int part = 0; part < 2 && count < buffer.size(); ++part) {
+				std::span<const char> available = m_ring.read_span();
+				if (available.empty())
+					break;
+				const std::size_t size = std::min(available.size(), buffer.size() - count);
+				std::memcpy(buffer.data() + count, available.data(), size);
+				m_ring.release(size);
+				count += size;
+			}
+			if (count > 0) {
+				trace.set_arg("bytes", static_cast<int64_t>(count));
+				return io_result{ .count{count} };
+			}
+			if (m_ring.producer_closed()) {
+				// Bytes, that were committed just before the close, come first.
+				if (!m_ring.read_span().empty())
+					continue;
+				return io_result{ .status{io_status::eof} };
+			}
+			if (!m_ring.wait_for_data())
+				return peer_gone();
+		}
+	}
+
+	io_result write(std::span<const char> buffer) override {
+		if (m_side != shm_ring_side::producer)
+			return io_result{ .status{io_status::error} };
+		trace_scope trace{ "shm write", "io" };
+		for (;;) {
+			if (m_ring.consumer_closed())
+				return io_result{ .status{io_status::eof} };
+			std::size_t count{ 0 };
+			for (int part = 0; part < 2 && count < buffer.size(); ++part) {
+				std::span<char> space = m_ring.write_span();
+				if (space.empty())
+					break;
+				const std::size_t size = std::min(space.size(), buffer.size() - count);
+				std::memcpy(space.data(), buffer.data() + count, size);
+				m_ring.commit(size);
+				count += size;
+			}
+			if (count > 0 || buffer.empty()) {
+				trace.set_arg("bytes", static_cast<int64_t>(count));
+				return io_result{ .count{count} };
+			}
+			if (!m_ring.wait_for_space())
+				return peer_gone();
+		}
+	}
+
+	void set_peer(uint32_t pid) override {
+		if (pid == 0 || pid == m_peer_pid)
+			return;
+		close_peer();
+		m_peer_pid = pid;
+#if defined(_WIN32)
+		m_peer = OpenProcess(SYNCHRONIZE, FALSE, pid);
+#else
+		// A pidfd becomes readable, when the process ends, even before it was reaped.
+		m_peer = static_cast<int>(::syscall(SYS_pidfd_open, static_cast<pid_t>(pid), 0));
+#endif
+	}
+
+	native_handle_t shared_handle() const override { return m_mapping.handle; }
+
+private:
+	bool wait(std::atomic<uint32_t>& flag) override {
+		trace_scope trace{ "shm wait", "io" };
+		if (m_peer_pid == 0)
+			set_peer(m_creator ? m_mapping.header->opener_pid.load(std::memory_order_acquire) : 0);
+#if defined(_WIN32)
+		// OpenProcess() failed: the process has ended already.
+		if (m_peer_pid != 0 && m_peer == nullptr)
+			return false;
+		HANDLE handles[2]{ event_of(flag), m_peer };
+		const DWORD count = (m_peer != nullptr) ? 2 : 1;
+		const DWORD result = WaitForMultipleObjects(count, handles, FALSE, (count == 2) ? INFINITE : PEER_CHECK_INTERVAL_MS);
+		if (result == WAIT_OBJECT_0 + 1)
+			return false;
+		return result != WAIT_FAILED;
+#else
+		const timespec timeout{ .tv_sec{0}, .tv_nsec{PEER_CHECK_INTERVAL_MS * 1000000L} };
+		if (futex(flag, FUTEX_WAIT, 1, &timeout) != 0 && errno == ETIMEDOUT)
+			return peer_alive();
+		return true;
+#endif
+	}
+
+	void wake(std::atomic<uint32_t>& flag) override {
+#if defined(_WIN32)
+		(void)SetEvent(event_of(flag));
+#else
+		(void)futex(flag, FUTEX_WAKE, 1, nullptr);
+#endif
+	}
+
+#if defined(_WIN32)
+	HANDLE event_of(const std::atomic<uint32_t>& flag) const {
+		return (&flag == &m_mapping.header->indices.consumer_waiting) ? m_mapping.data_event : m_mapping.space_event;
+	}
+#else
+	bool peer_alive() const {
+		if (m_peer >= 0) {
+			pollfd exited{ .fd{m_peer}, .events{POLLIN}, .revents{0} };
+			return ::poll(&exited, 1, 0) == 0;
+		}
+		return m_peer_pid == 0 || ::kill(static_cast<pid_t>(m_peer_pid), 0) == 0 || errno == EPERM;
+	}
+#endif
+
+	io_result peer_gone() const {
+#if defined(_WIN32)
+		return io_result{ .status{io_status::error}, .error_code{ERROR_BROKEN_PIPE} };
+#else
+		return io_result{ .status{io_status::error}, .error_code{EPIPE} };
+#endif
+	}
+
+	void close_peer() {
+#if defined(_WIN32)
+		if (m_peer != nullptr)
+			CloseHandle(m_peer);
+		m_peer = nullptr;
+#else
+		if (m_peer >= 0)
+			::close(m_peer);
+		m_peer = -1;
+#endif
+	}
+
+	shm_mapping m_mapping;
+	shm_ring_side m_side;
+	bool m_creator;
+	uint32_t m_peer_pid{ 0 };
+#if defined(_WIN32)
+	HANDLE m_peer{ nullptr };
+#else
+	int m_peer{ -1 };
+#endif
+	spsc_byte_ring m_ring;
+};
+
+// Takes the capacity and size of the ring from the header of another process, if the ring
+// lies within the `view_size` bytes, that are mapped here. Otherwise the storage of the
+// ring would reach beyond the view.
+bool take_header(shm_mapping& mapping, std::size_t view_size) {
+	if (view_size < STORAGE_OFFSET + MIN_SHM_RING_CAPACITY
+		|| std::memcmp(mapping.header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC)) != 0)
+		return false;
+	// Read once, the other process might change them meanwhile.
+	const uint64_t capacity = mapping.header->capacity;
+	const uint64_t mapping_size = mapping.header->mapping_size;
+	if (mapping_size > view_size || mapping_size < STORAGE_OFFSET
+		|| capacity < MIN_SHM_RING_CAPACITY || !std::has_single_bit(capacity)
+		|| capacity > mapping_size - STORAGE_OFFSET)
+		return false;
+	mapping.capacity = static_cast<std::size_t>(capacity);
+	mapping.size = static_cast<std::size_t>(mapping_size);
+	return true;
+}
+
+// Maps `handle` and checks, that it holds a ring. The header is not touched otherwise.
+std::optional<shm_mapping> map_existing(native_handle_t handle) {
+	shm_mapping mapping{ .handle{handle} };
+#if defined(_WIN32)
+	void* view = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (view == nullptr)
+		return std::nullopt;
+	mapping.header = static_cast<shm_ring_header*>(view);
+	// The whole mapping is mapped; the region of the view is its size, rounded up to pages.
+	MEMORY_BASIC_INFORMATION region{};
+	if (VirtualQuery(view, &region, sizeof(region)) != sizeof(region) || !take_header(mapping, region.RegionSize)) {
+		UnmapViewOfFile(view);
+		return std::nullopt;
+	}
+	mapping.data_event = std::bit_cast<HANDLE>(static_cast<uintptr_t>(mapping.header->data_event));
+	mapping.space_event = std::bit_cast<HANDLE>(static_cast<uintptr_t>(mapping.header->space_event));
+#else
+	struct stat info {};
+	if (::fstat(handle, &info) != 0 || static_cast<std::size_t>(info.st_size) < STORAGE_OFFSET + MIN_SHM_RING_CAPACITY)
+		return std::nullopt;
+	void* view = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (view == MAP_FAILED)
+		return std::nullopt;
+	mapping.header = static_cast<shm_ring_header*>(view);
+	if (!take_header(mapping, static_cast<std::size_t>(info.st_size)) || mapping.size != static_cast<std::size_t>(info.st_size)) {
+		::munmap(view, static_cast<std::size_t>(info.st_size));
+		return std::nullopt;
+	}
+#endif
+	return mapping;
+}
+
+} // namespace
+
+std::unique_ptr<shm_ring_stream> create_shm_ring(std::size_t capacity, shm_ring_side side) {
+	trace_scope trace{ "create shm ring", "io" };
+	capacity = std::bit_ceil(std::max(capacity, MIN_SHM_RING_CAPACITY));
+	const std::size_t mapping_size = STORAGE_OFFSET + capacity;
+	shm_mapping mapping{};
+#if defined(_WIN32)
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
+	mapping.handle = CreateFileMappingA(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE,
+		static_cast<DWORD>(uint64_t{ mapping_size } >> 32), static_cast<DWORD>(mapping_size & 0xFFFFFFFFu), nullptr);
+	mapping.data_event = CreateEventA(&sa, FALSE, FALSE, nullptr);
+	mapping.space_event = CreateEventA(&sa, FALSE, FALSE, nullptr);
+	void* view = (mapping.handle != nullptr) ? MapViewOfFile(mapping.handle, FILE_MAP_ALL_ACCESS, 0, 0, mapping_size) : nullptr;
+	if (view == nullptr || mapping.data_event == nullptr || mapping.space_event == nullptr) {
+		close_mapping(mapping);
+		return nullptr;
+	}
+#else
+	mapping.handle = static_cast<int>(::syscall(SYS_memfd_create, "console-tools-ring", MFD_CLOEXEC));
+	if (mapping.handle < 0)
+		return nullptr;
+	void* view = MAP_FAILED;
+	if (::ftruncate(mapping.handle, static_cast<off_t>(mapping_size)) == 0)
+		view = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.handle, 0);
+	if (view == MAP_FAILED) {
+		close_mapping(mapping);
+		return nullptr;
+	}
+#endif
+	// The pages are zero, so only the fields with other values are set.
+	mapping.header = new (view) shm_ring_header{};
+	std::memcpy(mapping.header->magic, SHM_RING_MAGIC, sizeof(SHM_RING_MAGIC));
+	mapping.header->capacity = capacity;
+	mapping.header->mapping_size = mapping_size;
+	mapping.capacity = capacity;
+	mapping.size = mapping_size;
+	mapping.header->creator_pid.store(current_pid(), std::memory_order_release);
+#if defined(_WIN32)
+	mapping.header->data_event = std::bit_cast<uintptr_t>(mapping.data_event);
+	mapping.header->space_event = std::bit_cast<uintptr_t>(mapping.space_event);
+#endif
+	return std::make_unique<shm_ring_stream_impl>(mapping, side, true);
+}
+
+std::unique_ptr<shm_ring_stream> open_shm_ring(native_handle_t handle, shm_ring_side side) {
+	std::optional<shm_mapping> mapping = map_existing(handle);
+	if (!mapping) {
+#if defined(_WIN32)
+		CloseHandle(handle);
+#else
+		::close(handle);
+#endif
+		return nullptr;
+	}
+	mapping->header->opener_pid.store(current_pid(), std::memory_order_release);
+	return std::make_unique<shm_ring_stream_impl>(*mapping, side, false);
+}
+#else
+std::unique_ptr<shm_ring_stream> create_shm_ring(std::size_t /*capacity*/, shm_ring_side /*side*/) {
+	return nullptr;
+}
+
+std::unique_ptr<shm_ring_stream> open_shm_ring(native_handle_t handle, shm_ring_side /*side*/) {
+	::close(handle);
+	return nullptr;
+}
+#endif
@@ -0,0 +1,130 @@
+#include "console-tools/trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fmt/core.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct trace_event {
+	const char* name;
+	const char* category;
+	char phase; // 'X' complete, 'i' instant
+	int64_t start_ns;
+	int64_t end_ns;
+	const char* arg_name;
+	int64_t arg;
+};
+
+// Enough for a few seconds of a busy relay, before the vector has to grow.
+constexpr std::size_t EVENTS_RESERVED{ 64u * 1024u };
+
+struct thread_buffer {
+	uint32_t thread_id{ 0 };
+	const char* thread_name{ nullptr };
+	std::vector<trace_event> events{};
+};
+
+// Every thread registers its buffer once. The registry keeps the buffers of threads,
+// that have ended, e.g. the reader thread of a pipeline.
+std::mutex g_registry_mutex{};
+std::vector<std::shared_ptr<thread_buffer>> g_registry{};
+
+std::shared_ptr<thread_buffer> register_thread() {
+	auto buffer = std::make_shared<thread_buffer>();
+	buffer->events.reserve(EVENTS_RESERVED);
+	std::lock_guard lock{ g_registry_mutex };
+	buffer->thread_id = static_cast<uint32_t>(g_registry.size()) + 1;
+	g_registry.push_back(buffer);
+	return buffer;
+}
+
+thread_buffer& this_thread_buffer() {
+	thread_local std::shared_ptr<thread_buffer> buffer = register_thread();
+	return *buffer;
+}
+
+unsigned long current_process_id() {
+#if defined(_WIN32)
+	return GetCurrentProcessId();
+#else
+	return static_cast<unsigned long>(::getpid());
+#endif
+}
+
+} // namespace
+
+namespace trace_detail {
+
+int64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record_complete(const char* name, const char* category, int64_t start_ns, int64_t end_ns, const char* arg_name, int64_t arg) {
+	this_thread_buffer().events.push_back(trace_event{ name, category, 'X', start_ns, end_ns, arg_name, arg });
+}
+
+void record_instant(const char* name, const char* category, const char* arg_name, int64_t arg) {
+	const int64_t now = now_ns();
+	this_thread_buffer().events.push_back(trace_event{ name, category, 'i', now, now, arg_name, arg });
+}
+
+void set_thread_name(const char* name) {
+	this_thread_buffer().thread_name = name;
+}
+
+void write_file(const char* program_name) {
+	const char* directory = std::getenv("CONSOLE_TOOLS_TRACE_DIR");
+	const unsigned long pid = current_process_id();
+	const std::string path = fmt::format("{}{}{}-{}.trace.json",
+		directory ? directory : "", directory ? "/" : "", program_name, pid);
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		fmt::print(stderr, "Could not write the trace to {}\n", path);
+		return;
+	}
+
+	std::lock_guard lock{ g_registry_mutex };
+	fmt::print(file, "{{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first{ true };
+	auto separator = [&first] {
+		const char* text = first ? "" : ",\n";
+		first = false;
+		return text;
+	};
+	for (const auto& buffer : g_registry) {
+		if (buffer->thread_name != nullptr) {
+			fmt::print(file, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+				separator(), pid, buffer->thread_id, buffer->thread_name);
+		}
+		for (const trace_event& event : buffer->events) {
+			// The timestamps are in microseconds.
+			fmt::print(file, "{}{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"{}\",\"ts\":{:.3f},",
+				separator(), event.name, event.category, event.phase, static_cast<double>(event.start_ns) / 1e3);
+			if (event.phase == 'X')
+				fmt::print(file, "\"dur\":{:.3f},", static_cast<double>(event.end_ns - event.start_ns) / 1e3);
+			else
+				fmt::print(file, "\"s\":\"t\",");
+			fmt::print(file, "\"pid\":{},\"tid\":{}", pid, buffer->thread_id);
+			if (event.arg_name != nullptr)
+				fmt::print(file, ",\"args\":{{\"{}\":{}}}", event.arg_name, event.arg);
+			fmt::print(file, "}}");
+		}
+	}
+	fmt::print(file, "\n]}}\n");
+	std::fclose(file);
+}
+
+} // namespace trace_detail
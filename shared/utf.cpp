@@ -0,0 +1,516 @@
+#include "console-tools/utf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || (defined(__i386__) && defined(__SSE2__))
+#define CONSOLE_TOOLS_UTF_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang only generate AVX2 instructions in functions, that ask for them.
+// The functions are only called, if the CPU has AVX2.
+#if defined(CONSOLE_TOOLS_UTF_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CONSOLE_TOOLS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CONSOLE_TOOLS_TARGET_AVX2
+#endif
+
+// The UTF-16LE bytes are read as code units in place.
+static_assert(std::endian::native == std::endian::little);
+
+std::optional<text_encoding> parse_text_encoding(std::string_view str) {
+	if (str == "utf8" || str == "utf-8")
+		return text_encoding::utf8;
+	if (str == "utf16" || str == "utf-16" || str == "utf16le" || str == "utf-16le")
+		return text_encoding::utf16le;
+	return std::nullopt;
+}
+
+std::string_view text_encoding_to_string(text_encoding encoding) {
+	switch (encoding) {
+	case text_encoding::utf8: return "utf8";
+	case text_encoding::utf16le: return "utf16le";
+	}
+	return "";
+}
+
+namespace {
+
+constexpr char32_t REPLACEMENT_CHARACTER{ 0xFFFD };
+
+// The kernels convert the leading ASCII of their input, a whole block at a time.
+// They stop before the first block with a non-ASCII character and return the
+// number of characters done. The rest is left to the scalar code.
+using widen_ascii_function = std::size_t(*)(const unsigned char* in, std::size_t count, char16_t* out);
+using narrow_ascii_function = std::size_t(*)(const char16_t* in, std::size_t count, char* out);
+// Unlike the others, this kernel does all of its input: it returns the index of
+// the first code unit, that equals one of `units`, or `count`.
+using find_any_of_function = std::size_t(*)(const char16_t* in, std::size_t count, const char16_t units[4]);
+
+struct utf_kernels {
+	widen_ascii_function widen_ascii;
+	narrow_ascii_function narrow_ascii;
+	find_any_of_function find_any_of;
+	std::string_view name;
+};
+
+std::size_t widen_ascii_scalar(const unsigned char* /*in*/, std::size_t /*count*/, char16_t* /*out*/) { return 0; }
+std::size_t narrow_ascii_scalar(const char16_t* /*in*/, std::size_t /*count*/, char* /*out*/) { return 0; }
+
+std::size_t find_any_of_scalar(const char16_t* in, std::size_t count, const char16_t units[4]) {
+	for (std::size_t i = 0; i < count; ++i) {
+		const char16_t unit = in[i];
+		if (unit == units[0] || unit == units[1] || unit == units[2] || unit == units[3])
+			return i;
+	}
+	return count;
+}
+
+#if defined(CONSOLE_TOOLS_UTF_X86)
+std::size_t widen_ascii_sse2(const unsigned char* in, std::size_t count, char16_t* out) {
+	const __m128i zero = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		if (_mm_movemask_epi8(bytes) != 0)
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(bytes, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(bytes, zero));
+	}
+	return i;
+}
+
+std::size_t narrow_ascii_sse2(const char16_t* in, std::size_t count, char* out) {
+	const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i zero = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+		const __m128i bits = _mm_and_si128(_mm_or_si128(low, high), non_ascii);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, zero)) != 0xFFFF)
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+	}
+	return i;
+}
+
+std::size_t find_any_of_sse2(const char16_t* in, std::size_t count, const char16_t units[4]) {
+	const __m128i unit0 = _mm_set1_epi16(static_cast<short>(units[0]));
+	const __m128i unit1 = _mm_set1_epi16(static_cast<short>(units[1]));
+	const __m128i unit2 = _mm_set1_epi16(static_cast<short>(units[2]));
+	const __m128i unit3 = _mm_set1_epi16(static_cast<short>(units[3]));
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const __m128i found = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi16(block, unit0), _mm_cmpeq_epi16(block, unit1)),
+			_mm_or_si128(_mm_cmpeq_epi16(block, unit2), _mm_cmpeq_epi16(block, unit3)));
+		if (const int mask = _mm_movemask_epi8(found); mask != 0)
+			return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(mask))) / 2;
+	}
+	return i + find_any_of_scalar(in + i, count - i, units);
+}
+
+CONSOLE_TOOLS_TARGET_AVX2
+std::size_t widen_ascii_avx2(const unsigned char* in, std::size_t count, char16_t* out) {
+	std::size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		if (_mm256_movemask_epi8(bytes) != 0)
+			break;
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+	}
+	// The tail with 128 bit registers. Calling the SSE2 kernel instead would mix
+	// legacy SSE and AVX instructions, which stalls on many CPUs.
+	if (i + 16 <= count) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		if (_mm_movemask_epi8(bytes) == 0) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(bytes));
+			i += 16;
+		}
+	}
+	return i;
+}
+
+CONSOLE_TOOLS_TARGET_AVX2
+std::size_t narrow_ascii_avx2(const char16_t* in, std::size_t count, char* out) {
+	const __m256i non_ascii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+	std::size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+		if (!_mm256_testz_si256(_mm256_or_si256(low, high), non_ascii))
+			break;
+		// packus works within the 128 bit lanes, the permutation restores the order.
+		const __m256i packed = _mm256_packus_epi16(low, high);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	if (i + 16 <= count) {
+		const __m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		if (_mm256_testz_si256(units, non_ascii)) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+				_mm_packus_epi16(_mm256_castsi256_si128(units), _mm256_extracti128_si256(units, 1)));
+			i += 16;
+		}
+	}
+	return i;
+}
+
+CONSOLE_TOOLS_TARGET_AVX2
+std::size_t find_any_of_avx2(const char16_t* in, std::size_t count, const char16_t units[4]) {
+	const __m256i unit0 = _mm256_set1_epi16(static_cast<short>(units[0]));
+	const __m256i unit1 = _mm256_set1_epi16(static_cast<short>(units[1]));
+	const __m256i unit2 = _mm256_set1_epi16(static_cast<short>(units[2]));
+	const __m256i unit3 = _mm256_set1_epi16(static_cast<short>(units[3]));
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i found = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi16(block, unit0), _mm256_cmpeq_epi16(block, unit1)),
+			_mm256_or_si256(_mm256_cmpeq_epi16(block, unit2), _mm256_cmpeq_epi16(block, unit3)));
+		if (const int mask = _mm256_movemask_epi8(found); mask != 0)
+			return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(mask))) / 2;
+	}
+	return i + find_any_of_scalar(in + i, count - i, units);
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4]{};
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	// The OS must save the YMM registers on a context switch.
+	if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+constexpr utf_kernels SCALAR_KERNELS{ widen_ascii_scalar, narrow_ascii_scalar, find_any_of_scalar, "scalar" };
+
+utf_kernels detect_kernels() {
+#if defined(CONSOLE_TOOLS_UTF_X86)
+	if (cpu_has_avx2())
+		return utf_kernels{ widen_ascii_avx2, narrow_ascii_avx2, find_any_of_avx2, "avx2" };
+	return utf_kernels{ widen_ascii_sse2, narrow_ascii_sse2, find_any_of_sse2, "sse2" };
+#else
+	return SCALAR_KERNELS;
+#endif
+}
+
+std::atomic<bool> g_force_scalar{ false };
+
+const utf_kernels& kernels() {
+	static const utf_kernels detected = detect_kernels();
+	return g_force_scalar.load(std::memory_order_relaxed) ? SCALAR_KERNELS : detected;
+}
+
+enum class decode_status {
+	complete,
+	invalid,   // `consumed` bytes are replaced by one U+FFFD
+	incomplete // the sequence is valid so far, but needs more bytes
+};
+
+struct decode_result {
+	decode_status status;
+	char32_t code_point;
+	std::size_t consumed;
+};
+
+// Decodes the sequence at the start of `in` (not empty). An invalid sequence
+// consumes its longest valid prefix, at least one byte.
+decode_result decode_utf8(const unsigned char* in, std::size_t count) {
+	const unsigned char lead = in[0];
+	if (lead < 0x80)
+		return { decode_status::complete, lead, 1 };
+
+	std::size_t length{ 0 };
+	char32_t code_point{ 0 };
+	unsigned char second_min{ 0x80 };
+	unsigned char second_max{ 0xBF };
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		length = 2;
+		code_point = lead & 0x1Fu;
+	}
+	else if (lead >= 0xE0 && lead <= 0xEF) {
+		length = 3;
+		code_point = lead & 0x0Fu;
+		if (lead == 0xE0) second_min = 0xA0; // overlong
+		if (lead == 0xED) second_max = 0x9F; // surrogates
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4) {
+		length = 4;
+		code_point = lead & 0x07u;
+		if (lead == 0xF0) second_min = 0x90; // overlong
+		if (lead == 0xF4) second_max = 0x8F; // above U+10FFFF
+	}
+	else {
+		return { decode_status::invalid, REPLACEMENT_CHARACTER, 1 };
+	}
+
+	for (std::size_t i = 1; i < length; ++i) {
+		if (i >= count)
+			return { decode_status::incomplete, 0, i };
+		const unsigned char byte = in[i];
+		const unsigned char min = (i == 1) ? second_min : 0x80;
+		const unsigned char max = (i == 1) ? second_max : 0xBF;
+		if (byte < min || byte > max)
+			return { decode_status::invalid, REPLACEMENT_CHARACTER, i };
+		code_point = (code_point << 6) | (byte & 0x3Fu);
+	}
+	return { decode_status::complete, code_point, length };
+}
+
+std::size_t put_utf16(char32_t code_point, char16_t* out) {
+	if (code_point < 0x10000) {
+		out[0] = static_cast<char16_t>(code_point);
+		return 1;
+	}
+	code_point -= 0x10000;
+	out[0] = static_cast<char16_t>(0xD800 + (code_point >> 10));
+	out[1] = static_cast<char16_t>(0xDC00 + (code_point & 0x3FF));
+	return 2;
+}
+
+std::size_t put_utf8(char32_t code_point, char* out) {
+	if (code_point < 0x80) {
+		out[0] = static_cast<char>(code_point);
+		return 1;
+	}
+	if (code_point < 0x800) {
+		out[0] = static_cast<char>(0xC0 | (code_point >> 6));
+		out[1] = static_cast<char>(0x80 | (code_point & 0x3F));
+		return 2;
+	}
+	if (code_point < 0x10000) {
+		out[0] = static_cast<char>(0xE0 | (code_point >> 12));
+		out[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		out[2] = static_cast<char>(0x80 | (code_point & 0x3F));
+		return 3;
+	}
+	out[0] = static_cast<char>(0xF0 | (code_point >> 18));
+	out[1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+	out[2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+	out[3] = static_cast<char>(0x80 | (code_point & 0x3F));
+	return 4;
+}
+
+// After this many ASCII characters in a row, the scalar code hands over to the
+// kernel again. For text with short ASCII runs (e.g. between umlauts), a failing
+// kernel call would cost more than it saves.
+constexpr std::size_t ASCII_RUN_FOR_KERNEL{ 16 };
+
+bool is_high_surrogate(char16_t unit) { return unit >= 0xD800 && unit <= 0xDBFF; }
+bool is_low_surrogate(char16_t unit) { return unit >= 0xDC00 && unit <= 0xDFFF; }
+
+char32_t combine_surrogates(char16_t high, char16_t low) {
+	return 0x10000 + ((static_cast<char32_t>(high) - 0xD800) << 10) + (static_cast<char32_t>(low) - 0xDC00);
+}
+
+} // namespace
+
+std::string_view utf_kernel_name() {
+	return kernels().name;
+}
+
+void utf_force_scalar(bool scalar) {
+	g_force_scalar.store(scalar, std::memory_order_relaxed);
+}
+
+std::size_t find_any_of(std::u16string_view text, std::u16string_view units) {
+	assert(!units.empty() && units.size() <= 4);
+	// Repeating the last unit fills the four compare registers of the kernels.
+	char16_t padded[4]{};
+	for (std::size_t k = 0; k < 4; ++k)
+		padded[k] = units[std::min(k, units.size() - 1)];
+	return kernels().find_any_of(text.data(), text.size(), padded);
+}
+
+std::size_t utf8_to_utf16_converter::convert(std::span<const char> in, char16_t* out) {
+	const auto* bytes = reinterpret_cast<const unsigned char*>(in.data());
+	const std::size_t count = in.size();
+	std::size_t i = 0;
+	std::size_t o = 0;
+
+	if (m_pending_count > 0) {
+		// Complete the sequence from the last call in a copy.
+		unsigned char sequence[8]{};
+		std::memcpy(sequence, m_pending, m_pending_count);
+		const std::size_t taken = std::min<std::size_t>(4 - m_pending_count, count);
+		std::memcpy(sequence + m_pending_count, bytes, taken);
+		decode_result result = decode_utf8(sequence, m_pending_count + taken);
+		if (result.status == decode_status::incomplete) {
+			// All of `in` went into the sequence, and it is still not complete.
+			std::memcpy(m_pending, sequence, m_pending_count + taken);
+			m_pending_count += taken;
+			return 0;
+		}
+		o += put_utf16(result.code_point, out);
+		// The pending bytes are a valid prefix, so the sequence ends in the new bytes.
+		i = result.consumed - m_pending_count;
+		m_pending_count = 0;
+	}
+
+	const widen_ascii_function widen_ascii = kernels().widen_ascii;
+	while (i < count) {
+		const std::size_t ascii = widen_ascii(bytes + i, count - i, out + o);
+		i += ascii;
+		o += ascii;
+
+		std::size_t ascii_run{ 0 };
+		while (i < count) {
+			if (bytes[i] < 0x80) {
+				out[o++] = bytes[i++];
+				if (++ascii_run == ASCII_RUN_FOR_KERNEL)
+					break;
+				continue;
+			}
+			ascii_run = 0;
+			decode_result result = decode_utf8(bytes + i, count - i);
+			if (result.status == decode_status::incomplete) {
+				std::memcpy(m_pending, bytes + i, count - i);
+				m_pending_count = count - i;
+				return o;
+			}
+			o += put_utf16(result.code_point, out + o);
+			i += result.consumed;
+		}
+	}
+	return o;
+}
+
+std::size_t utf8_to_utf16_converter::finish(char16_t* out) {
+	if (m_pending_count == 0)
+		return 0;
+	m_pending_count = 0;
+	return put_utf16(REPLACEMENT_CHARACTER, out);
+}
+
+std::size_t utf16_to_utf8_converter::convert(std::span<const char16_t> in, char* out) {
+	const char16_t* units = in.data();
+	const std::size_t count = in.size();
+	std::size_t i = 0;
+	std::size_t o = 0;
+
+	if (m_high_surrogate != 0 && count > 0) {
+		if (is_low_surrogate(units[0])) {
+			o += put_utf8(combine_surrogates(m_high_surrogate, units[0]), out);
+			i = 1;
+		}
+		else {
+			o += put_utf8(REPLACEMENT_CHARACTER, out);
+		}
+		m_high_surrogate = 0;
+	}
+
+	const narrow_ascii_function narrow_ascii = kernels().narrow_ascii;
+	while (i < count) {
+		const std::size_t ascii = narrow_ascii(units + i, count - i, out + o);
+		i += ascii;
+		o += ascii;
+
+		std::size_t ascii_run{ 0 };
+		while (i < count) {
+			const char16_t unit = units[i];
+			if (unit < 0x80) {
+				out[o++] = static_cast<char>(unit);
+				++i;
+				if (++ascii_run == ASCII_RUN_FOR_KERNEL)
+					break;
+				continue;
+			}
+			ascii_run = 0;
+			if (unit < 0x800) {
+				out[o++] = static_cast<char>(0xC0 | (unit >> 6));
+				out[o++] = static_cast<char>(0x80 | (unit & 0x3F));
+				++i;
+			}
+			else if (is_high_surrogate(unit)) {
+				if (i + 1 == count) {
+					// The low surrogate comes with the next call.
+					m_high_surrogate = unit;
+					return o;
+				}
+				if (is_low_surrogate(units[i + 1])) {
+					o += put_utf8(combine_surrogates(unit, units[i + 1]), out + o);
+					i += 2;
+				}
+				else {
+					o += put_utf8(REPLACEMENT_CHARACTER, out + o);
+					i += 1;
+				}
+			}
+			else if (is_low_surrogate(unit)) {
+				o += put_utf8(REPLACEMENT_CHARACTER, out + o);
+				i += 1;
+			}
+			else {
+				o += put_utf8(unit, out + o);
+				i += 1;
+			}
+		}
+	}
+	return o;
+}
+
+std::size_t utf16_to_utf8_converter::convert_bytes(std::span<const char> in, char* out) {
+	std::size_t o = 0;
+	if (m_has_odd_byte && !in.empty()) {
+		const char16_t unit = static_cast<char16_t>(m_odd_byte | (static_cast<unsigned char>(in[0]) << 8));
+		m_has_odd_byte = false;
+		o += convert(std::span<const char16_t>(&unit, 1), out);
+		in = in.subspan(1);
+	}
+
+	const std::size_t unit_count = in.size() / sizeof(char16_t);
+	if (reinterpret_cast<uintptr_t>(in.data()) % alignof(char16_t) == 0) {
+		o += convert(std::span<const char16_t>(reinterpret_cast<const char16_t*>(in.data()), unit_count), out + o);
+	}
+	else {
+		// After an odd byte, the code units are not aligned in the buffer of the caller.
+		char16_t aligned[512];
+		for (std::size_t done = 0; done < unit_count;) {
+			const std::size_t chunk = std::min(unit_count - done, std::size(aligned));
+			std::memcpy(aligned, in.data() + done * sizeof(char16_t), chunk * sizeof(char16_t));
+			o += convert(std::span<const char16_t>(aligned, chunk), out + o);
+			done += chunk;
+		}
+	}
+
+	if (in.size() % 2 != 0) {
+		m_odd_byte = static_cast<unsigned char>(in.back());
+		m_has_odd_byte = true;
+	}
+	return o;
+}
+
+std::size_t utf16_to_utf8_converter::finish(char* out) {
+	std::size_t o = 0;
+	if (m_high_surrogate != 0) {
+		o += put_utf8(REPLACEMENT_CHARACTER, out);
+		m_high_surrogate = 0;
+	}
+	if (m_has_odd_byte) {
+		o += put_utf8(REPLACEMENT_CHARACTER, out + o);
+		m_has_odd_byte = false;
+	}
+	return o;
+}
@@ -1,836 +1,2117 @@
-
-#include <Windows.h>
-
-#include <string>
-#include <optional>
-#include <cstdint>
-#include <thread>
-#include <chrono>
-#include <memory>
-#include <io.h>
-#include <fcntl.h>
-
-#include "console-tools/helper.h"
-
-#include <fmt/core.h>
-#include <nowide/args.hpp>
-
-
-//void print_bits(DWORD dw) {
-//	constexpr const int number_of_bits = sizeof(dw) * 8;
-//	for (int i = number_of_bits - 1; i >= 0; --i) {
-//		bool one = 0 != (dw & (1 << i));
-//
-//		fmt::print("{}", one ? "1" : ".");
-//
-//		// space separators
-//		if (i != 0 && (i % 4) == 0)
-//			fmt::print(" ");
-//	}
-//}
-
-#if !defined(UNICODE)
-#error macro UNICODE is not defined
-#endif
-
-#if !defined(_UNICODE)
-#error macro _UNICODE is not defined
-#endif
-
-constexpr const char8_t UTF_8_test_1[] = u8"ü";
-static_assert(sizeof(UTF_8_test_1) == 3);
-static_assert(UTF_8_test_1[0] == static_cast<char8_t>(0xC3u));
-static_assert(UTF_8_test_1[1] == static_cast<char8_t>(0xBCu));
-static_assert(UTF_8_test_1[2] == static_cast<char8_t>(0x0u));
-
-constexpr const char UTF_8_test_2[] = "ü";
-static_assert(sizeof(UTF_8_test_2) == 3);
-static_assert(UTF_8_test_2[0] == static_cast<char>(0xC3u));
-static_assert(UTF_8_test_2[1] == static_cast<char>(0xBCu));
-static_assert(UTF_8_test_2[2] == static_cast<char>(0x0u));
-
-constexpr const std::string_view UTF_8_thumbs_up_with_skin_tone = "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbb";
-
-void PrintFileType(FILE*stream, std::string_view leading, HANDLE handle) {
-	auto file_type = GetFileType(handle);
-	switch (file_type) {
-	case FILE_TYPE_CHAR:
-		fmt::print(stream, "{}Filetype: FILE_TYPE_CHAR\n", leading);
-		break;
-	case FILE_TYPE_DISK:
-		fmt::print(stream, "{}Filetype: FILE_TYPE_DISK\n", leading);
-		break;
-	case FILE_TYPE_PIPE:
-		fmt::print(stream, "{}Filetype: FILE_TYPE_PIPE\n", leading);
-		break;
-	case FILE_TYPE_REMOTE:
-		fmt::print(stream, "{}Filetype: FILE_TYPE_REMOTE\n", leading);
-		break;
-	case FILE_TYPE_UNKNOWN: {
-		auto error = GetLastError();
-		if (error == NO_ERROR) {
-			fmt::print(stream, "{}Filetype: FILE_TYPE_UNKNOWN\n",leading);
-		}
-		else {
-			auto error_message = get_error_message(error);
-			fmt::print(stream, "{0}Filetype: FILE_TYPE_UNKNOWN, error: {1:#x} {1:d} - {2}",leading, error, indent_message(std::string{leading}+"  ", error_message.value_or("")));
-		}
-		break;
-	}
-	default:
-		fmt::print(stream, "{}Filetype: {:#0x} - this is unexpected, undocumented and an error\n", leading, file_type);
-		break;
-	}
-}
-
-static bool is_handle_invalid(HANDLE h, bool strict = false) {
-	if (h == INVALID_HANDLE_VALUE || h == nullptr)
-		return true;
-	DWORD dummy;
-	return !GetHandleInformation(h, &dummy);
-}
-
-enum class console_in_or_out :uint32_t {
-	undefined,
-	in,
-	out
-};
-struct handle_with_name {
-	HANDLE handle{ nullptr };
-	std::string_view name{};
-	console_in_or_out type{ console_in_or_out::undefined };
-};
-
-
-void PrintConsoleMode(FILE* stream, std::string_view indent, DWORD mode, console_in_or_out type) {
-	constexpr std::size_t bits = sizeof(mode) * 8;
-
-	fmt::print(stream, "{0}console mode: {1:#0{2}b}  {1:#0{3}x}\n", indent, mode, sizeof(mode) * 8 + 2, sizeof(mode) * 2 + 2);
-	auto lambda = [&]<size_t size>(std::string_view const (&array)[size]) ->void {
-		static_assert(size <= bits);
-		for (int i = 0; i < size && i < bits; ++i) {
-			DWORD mask = DWORD(1u) << i;
-			bool set = mode & mask;
-			auto pre_space  = bits - 1 - i;
-			auto post_space = i;
-			fmt::print(stream, "{0}                {1}{2}{3}  {4:#0{5}x} {6}\n",
-				indent,
-				std::string(pre_space, ' '),
-				set ? '1' : '.',
-				std::string(post_space, ' '),
-				mask,
-				sizeof(mode) * 2 + 2,
-				array[i]);
-		}
-	};
-
-	constexpr const std::string_view input_flags[]{
-		"ENABLE_PROCESSED_INPUT",              // 0x0001
-		"ENABLE_LINE_INPUT",                   // 0x0002
-		"ENABLE_ECHO_INPUT",                   // 0x0004
-		"ENABLE_WINDOW_INPUT",                 // 0x0008
-		"ENABLE_MOUSE_INPUT",                  // 0x0010
-		"ENABLE_INSERT_MODE",                  // 0x0020
-		"ENABLE_QUICK_EDIT_MODE",              // 0x0040
-		"ENABLE_EXTENDED_FLAGS",               // 0x0080
-		"ENABLE_AUTO_POSITION",                // 0x0100
-		"ENABLE_VIRTUAL_TERMINAL_INPUT",       // 0x0200
-	};
-	constexpr const std::string_view output_flags[]{
-		"ENABLE_PROCESSED_OUTPUT",             //0x0001
-		"ENABLE_WRAP_AT_EOL_OUTPUT",           //0x0002
-		"ENABLE_VIRTUAL_TERMINAL_PROCESSING",  //0x0004
-		"DISABLE_NEWLINE_AUTO_RETURN",         //0x0008
-		"ENABLE_LVB_GRID_WORLDWIDE",           //0x0010
-	};
-
-	if (type == console_in_or_out::in || type == console_in_or_out::undefined)
-		return lambda(input_flags);
-
-	if (type == console_in_or_out::out || type == console_in_or_out::undefined)
-		return lambda(output_flags);
-}
-
-bool PrintMode(FILE* stream, handle_with_name h, set_and_reset<DWORD> s_n_r = set_and_reset<DWORD>{}) {
-	bool ret{ true };
-	if (is_handle_invalid(h.handle, true)) {
-		fmt::print("{}: {:#x} invalid\n", h.name, std::bit_cast<uintptr_t>(h.handle));
-	}
-	else {
-		static_assert(sizeof(HANDLE) == sizeof(uintptr_t));
-
-		fmt::print(stream, "{}: {:#x}\n", h.name, std::bit_cast<uintptr_t>(h.handle));
-		DWORD console_mode{};
-		if (GetConsoleMode(h.handle, &console_mode)) {
-			PrintConsoleMode(stream, "  ", console_mode, h.type);
-			auto new_mode = s_n_r.change(console_mode);
-			if (new_mode != console_mode) {
-				fmt::print(stream, "  new mode {:#x}\n", new_mode);
-				if (SetConsoleMode(h.handle, new_mode)) {
-					PrintConsoleMode(stream, "  ", new_mode, h.type);
-				}
-				else {
-					auto error = GetLastError();
-					auto message = get_error_message(error);
-					fmt::print(stream, "  SetConsoleMode(): error {:#x} - {}", error, indent_message("    ", message.value_or("")));
-					ret = false;
-				}
-			}
-		}
-		else {
-			auto error = GetLastError();
-			auto message = get_error_message(error);
-			fmt::print(stream, "  console mode: error {:#x} - {}", error, indent_message("    ", message.value_or("")));
-			//ret = false;
-		}
-
-		PrintFileType(stream, "  ", h.handle);
-	}
-	return ret;
-}
-
-void PrintComparison(FILE* stream, handle_with_name hn1, handle_with_name hn2) {
-	if (!is_handle_invalid(hn1.handle, true) && !is_handle_invalid(hn2.handle, true)) {
-		if (hn1.handle == hn2.handle)
-			fmt::print(stream, "The handles for {} and {} are equal.\n", hn1.name, hn2.name);
-		if (CompareObjectHandles(hn1.handle, hn2.handle))
-			fmt::print(stream, "The handles for {} and {} point to the same kernel object.\n",hn1.name,hn2.name);
-		else
-			fmt::print(stream, "The handles for {} and {} do not point to the same kernel object.{}\n",hn1.name, hn2.name,
-				hn1.handle == hn2.handle ? " It seems like, the object they are pointing to is not a kernel object, but some other kind of object." : "");
-	}
-}
-
-void CompareEveryThing(FILE* stream, std::vector<handle_with_name> handles) {
-
-	for (int i = 0; i < handles.size(); ++i) {
-		for (int j = i+1; j < handles.size(); ++j) {
-			PrintComparison(stream, handles[i], handles[j]);
-		}
-	}
-}
-
-void TestWriteConsole(FILE*stream, HANDLE conout) {
-	constexpr const std::wstring_view wsv = L"Moin Moin\n";
-	DWORD written;
-	bool success = WriteConsoleW(conout, wsv.data(), static_cast<DWORD>(wsv.size()), &written, nullptr);
-	fmt::print(stream, "  WriteConsoleW result: {}\n", success?"success":"fail");
-}
-
-
-struct change_con_mode{
-	set_and_reset<DWORD> conin{};
-	set_and_reset<DWORD> conout{};
-};
-
-bool PrintInfo(FILE*stream, change_con_mode change_mode, bool more_info = false) {
-	bool ret{ true };
-	fmt::print(stream, "DEBUG: äöü {}{}{}\n", quote_open, UTF_8_thumbs_up_with_skin_tone, quote_close);
-
-	UINT acp = GetACP();
-	UINT oem_cp = GetACP();
-	UINT console_input_cp = GetConsoleCP();
-	UINT console_output_cp = GetConsoleOutputCP();
-	fmt::print(stream, "ACP:               {}\n", acp);
-	fmt::print(stream, "OEM CP:            {}\n", oem_cp);
-	fmt::print(stream, "Console Input CP:  {}\n", console_input_cp);
-	fmt::print(stream, "Console Output CP: {}\n", console_output_cp);
-	fmt::print(stream, "\n");
-
-	// -----------------------
-	if (more_info)
-		fmt::print(stream, "\nIN:\n\n");
-
-	handle_with_name hC_stdin{
-		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdin)))},
-		.name{"stdin"},
-		.type{console_in_or_out::in},
-	};
-
-	if (more_info)
-		ret = PrintMode(stream, hC_stdin) && ret;
-
-	handle_with_name hStdIn{ .handle{ GetStdHandle(STD_INPUT_HANDLE)}, .name{"STD_INPUT_HANDLE"}, .type{console_in_or_out::in}, };
-
-	if (more_info)
-		ret = PrintMode(stream, hStdIn) && ret;
-
-	handle_with_name hConIn{ .handle{nullptr}, .name{"CONIN$"}, .type{console_in_or_out::in}, };
-	{
-		SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
-		hConIn.handle = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &sa, OPEN_EXISTING, 0, nullptr);
-		ret = PrintMode(stream, hConIn, change_mode.conin) && ret;
-	}
-
-
-	if (more_info) {
-		fmt::print(stream, "\n");
-		CompareEveryThing(stream, std::vector{ hC_stdin, hStdIn, hConIn });
-	}
-
-	fmt::print(stream, "\n");
-	// -----------------------
-	if (more_info)
-		fmt::print(stream, "\nOUT:\n\n");
-
-	handle_with_name hC_stdout{ 
-		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdout)))}, 
-		.name{"stdout"},
-		.type{console_in_or_out::out},
-	};
-	if (more_info)
-		ret = PrintMode(stream, hC_stdout) && ret;
-
-	handle_with_name hC_stderr{
-		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stderr)))},
-		.name{"stderr"},
-		.type{console_in_or_out::out},
-	};
-	if (more_info)
-		ret = PrintMode(stream, hC_stderr) && ret;
-
-	handle_with_name hStdOut{ 
-		.handle{ GetStdHandle(STD_OUTPUT_HANDLE)}, 
-		.name{"STD_OUTPUT_HANDLE"},
-		.type{console_in_or_out::out},
-	};
-	if (more_info)
-		ret = PrintMode(stream, hStdOut) && ret;
-
-	handle_with_name hStdErr{
-		.handle {GetStdHandle(STD_ERROR_HANDLE)},
-		.name{"STD_ERROR_HANDLE"},
-		.type{console_in_or_out::out},
-	};
-	if (more_info)
-		ret = PrintMode(stream,  hStdErr) && ret;
-
-	handle_with_name hConOut{ .handle{nullptr}, .name{"CONOUT$"}, .type{console_in_or_out::out}, };
-	{
-		SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
-		hConOut.handle = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
-		ret = PrintMode(stream, hConOut, change_mode.conout) && ret;
-		//TestWriteConsole(stream, hConOut.handle);
-	}
-
-	if (more_info) {
-		fmt::print(stream, "\n");
-		CompareEveryThing(stream, std::vector{ hC_stdout, hC_stderr, hStdOut, hStdErr, hConOut });
-	}
-
-	if (!is_handle_invalid(hConOut.handle)) {
-		CloseHandle(hConOut.handle);
-		hConOut.handle = nullptr;
-	}
-
-	if (!is_handle_invalid(hConIn.handle)) {
-		CloseHandle(hConIn.handle);
-		hConIn.handle = nullptr;
-	}
-	return ret;
-}
-
-void PrintUsage(FILE*stream) {
-	fmt::print(stream,
-		"Usage:\n"
-		"\n"
-		"  stty.exe [--pid <PID>] [--handle-out <handle-out>] [--no-self-spawn] [--set-in-mode <mode>] [--set-out-mode <mode>] [--generate-event <event> [--use-pid-as-gid]]\n"
-		"\n"
-		"<mode>    A string of dots (.), zeros (0), and ones (1).\n"
-		"          A dot means no change\n"
-		"          A zero sets the bit to zero\n"
-		"          A one sets the bit to one\n"
-		"\n"
-		"<event>   One of these (without quotes):\n"
-		"          - \"ctrl-c\"\n"
-		"          - \"ctrl-break\"\n"
-		"          - \"none\"\n"
-	);
-}
-
-struct generate_event_info {
-	ConsoleCtrlEvent event{};
-	bool use_pid_as_group_id{ false };
-};
-
-bool g_ctrl_event_handled{ false };
-
-BOOL WINAPI HandleCtrlEvent(
-	_In_ DWORD dwCtrlType
-) {
-	switch (dwCtrlType) {
-	case CTRL_C_EVENT:
-	case CTRL_BREAK_EVENT:
-		g_ctrl_event_handled = true;
-		return TRUE;
-	default:
-		return FALSE;
-	}
-}
-bool GenerateCtrlEvent(FILE* stream, generate_event_info event_info, std::optional<DWORD> PID) {
-	bool handler_set{ false };
-	bool ret{ true };
-	if (!(handler_set = SetConsoleCtrlHandler(&HandleCtrlEvent, TRUE)))
-	{
-		fmt::print(stream,"Warning: SetConsoleCtrlHandler() failed. This process might exit abnormaly.\n");
-	}
-
-	auto dw_event = static_cast<DWORD>(event_info.event);
-	static_assert(std::is_same_v <decltype(dw_event), std::underlying_type_t<decltype(event_info.event)>>);
-
-	constexpr DWORD default_pgid = 0;
-	DWORD pgid = default_pgid;
-	if (event_info.use_pid_as_group_id) {
-		if (PID.has_value())
-			pgid = *PID;
-		else {
-			fmt::print(stream, "Warning: Cannot use PID as process group ID (PGID), because no PID is specified\n");
-		}
-	}
-
-	fmt::print(stream, "generate event {}\n", dw_event);
-	if (!GenerateConsoleCtrlEvent(dw_event, pgid)) {
-		auto error = GetLastError();
-		auto message = get_error_message(error);
-		fmt::print(stream, "GenerateConsoleCtrlEvent({}) failed with error {} - {}", dw_event,  error, indent_message("  ", message.value_or("")));
-		ret = false;
-	}
-
-	if (handler_set) {
-		using namespace ::std::chrono_literals;
-		// FIXME: Add option, that specifies, if we should wait for the event, if we specify a specific group ID when generating the event.
-		for (int i = 0; i < 100 && !g_ctrl_event_handled && ret; ++i) 
-			std::this_thread::sleep_for(10ms);
-
-		(void)SetConsoleCtrlHandler(&HandleCtrlEvent, FALSE);
-	}
-	return ret;
-}
-
-bool AttachToConsole(FILE*stream, uint32_t PID, change_con_mode change_mode) {
-	if (!FreeConsole()) {
-		auto error = GetLastError();
-		auto message = get_error_message(error);
-		fmt::print(stream, "FreeConsole() failed, but we are ignoring that. The error is {:#x} with message is {}{}{}\n",
-			error, quote_open, message.value_or(""), quote_close);
-	}
-	static_assert(sizeof(PID) == sizeof(DWORD) && std::is_unsigned_v<decltype(PID)> == std::is_unsigned_v<DWORD>);
-	if (!AttachConsole(PID)) {
-		auto error = GetLastError();
-		auto message = get_error_message(error);
-		fmt::print(stream, "AttachConsole({}) failed with error {} - {}", PID, error, indent_message("  ", message.value_or("")));
-		return false;
-	}
-	fmt::print(stream, "Attached to console of process {}\n", PID);
-	//HWND hwnd = GetConsoleWindow();
-	//if (hwnd != NULL) {
-
-	//	if (!ShowWindow(hwnd, SW_SHOWNORMAL)) {
-	//		//auto error = GetLastError();
-	//		//auto message = get_error_message(error);
-	//		//fmt::print(stream, "ShowWindow() failed with error {} - {}", error, indent_message("  ", message.value_or("")));
-	//		//return false;
-	//	}
-	//}
-	////else {
-	////	fmt::print(stream, "GetConsoleWindow() returned NULL.\n");
-	////	return false;
-	////}
-	return true;
-}
-
-bool SpawnSelf(FILE* fOut, FILE* fErr, DWORD pid, change_con_mode change_mode, std::optional<generate_event_info> event_info) {
-
-	//HANDLE hOut = std::bit_cast<HANDLE>(_get_osfhandle(_fileno(fOut)));
-	//HANDLE hErr = std::bit_cast<HANDLE>(_get_osfhandle(_fileno(fErr)));
-	bool ret_value = false;
-	DWORD exitCode{};
-	std::string prog_path{};
-	STARTUPINFOA startupinfo{};
-	PROCESS_INFORMATION procinfo{};
-	std::string cmd_line{};
-	std::unique_ptr<char[]> mutable_cmd_line_buf{};
-
-	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
-
-	HANDLE hChildStdOut_read{ nullptr };
-	HANDLE hChildStdOut_write{ nullptr };
-	if (!CreatePipe(&hChildStdOut_read, &hChildStdOut_write, &sa, 0)) {
-		fmt::print(fErr, "Failed to create pipe\n");
-		goto cleanup;
-	}
-	{
-		auto prog_path_opt = GetProgPath(fErr);
-		if (!prog_path_opt.has_value()) {
-			goto cleanup;
-		}
-		prog_path = *prog_path_opt;
-	}
-
-	startupinfo.cb = sizeof(startupinfo);
-
-	// startupinfo.hStdError  = g_hChildStd_OUT_Wr;
-	// startupinfo.hStdOutput = g_hChildStd_OUT_Wr;
-	// startupinfo.hStdInput  = g_hChildStd_IN_Rd;
-	// startupinfo.dwFlags   |= STARTF_USESTDHANDLES;
-	{
-		auto set_conin_str = change_mode.conin.to_string();
-		auto set_conout_str = change_mode.conout.to_string();
-		if (!set_conin_str ||!set_conout_str) {
-			fmt::print(fErr, "internal error");
-			goto cleanup;
-		}
-		std::string generate_event_str{};
-		if (event_info.has_value()) {
-			generate_event_str = fmt::format(" --generate-event \"{}\"{}", event_to_string(event_info->event), (event_info->use_pid_as_group_id ? " --use-pid-as-gid" : ""));
-		}
-
-		cmd_line = fmt::format("\"{0}\" --pid {1} --handle-out {2} --handle-err {2} " 
-			"--no-self-spawn --set-in-mode \"{3}\" --set-out-mode \"{4}\"{5}",
-			prog_path, pid, reinterpret_cast<uintptr_t>(hChildStdOut_write),
-			*set_conin_str, *set_conout_str, generate_event_str
-			);
-	}
-
-	mutable_cmd_line_buf = std::make_unique<char[]>(cmd_line.length() + 1);
-	std::memcpy(mutable_cmd_line_buf.get(), cmd_line.c_str(), cmd_line.length() * sizeof(char));
-	mutable_cmd_line_buf.get()[cmd_line.length()] = '\0';
-
-
-	if (!CreateProcessA(prog_path.c_str(), mutable_cmd_line_buf.get(), nullptr, nullptr, true, 0, nullptr, nullptr, &startupinfo, &procinfo)) {
-		auto error = GetLastError();
-		fmt::print(fErr, "Couldn't create child process - {:#x} {}\n", error, get_error_message(error).value_or(""));
-		goto cleanup;
-	}
-	CloseHandle(procinfo.hThread);
-	procinfo.hThread = nullptr;
-
-	CloseHandle(hChildStdOut_write);
-	hChildStdOut_write = nullptr;
-
-	{
-		constexpr const DWORD BUFF_SIZE{ 512 };
-		char szBuffer[BUFF_SIZE]{};
-		constexpr const auto element_size{ sizeof(szBuffer[0]) };
-		static_assert(element_size == 1);
-
-		DWORD dwBytesRead{};
-		size_t bytesWritten{};
-		bool bRead{ false };
-
-		do {
-			bRead = ReadFile(hChildStdOut_read, szBuffer, BUFF_SIZE, &dwBytesRead, nullptr);
-			if (!bRead)
-				break;
-			if (dwBytesRead == 0)
-				break;
-			if (dwBytesRead > BUFF_SIZE) {
-				fmt::print(fErr, "Unexpected error when using ReadFile().\n");
-				goto cleanup;
-			}
-
-			std::string_view sv(szBuffer, dwBytesRead);
-			fmt::print(fOut, "{}", sv); // this can also print zero bytes ('\0' ASCII NUL)
-		} while (true);
-	}
-
-
-	WaitForSingleObject(procinfo.hProcess, INFINITE);
-
-	if (0 == GetExitCodeProcess(procinfo.hProcess, &exitCode)) {
-		fmt::print(fErr, "Failed to get Exit Code of Process.\n");
-		goto cleanup;
-	}
-
-	if (exitCode != 0) {
-		fmt::print(fErr, "Child process failed with exited code: {}", exitCode);
-		goto cleanup;
-	}
-
-	//hPipeListenerThread = reinterpret_cast<HANDLE>(_beginthread(PipeListener, 0, hPipeIn));
-	ret_value = true;
-cleanup:
-	if (procinfo.hProcess != nullptr) {
-		CloseHandle(procinfo.hProcess);
-		procinfo.hProcess = nullptr;
-	}
-	if (procinfo.hThread != nullptr) {
-		CloseHandle(procinfo.hThread);
-		procinfo.hThread = nullptr;
-	}
-
-	if (hChildStdOut_read) {
-		CloseHandle(hChildStdOut_read);
-		hChildStdOut_read = nullptr;
-	}
-	if (hChildStdOut_write) {
-		CloseHandle(hChildStdOut_write);
-		hChildStdOut_write = nullptr;
-	}
-		
-	return ret_value;
-}
-
-int main(int argc, const char **argv) {
-	_set_fmode(_O_BINARY);
-	_setmode(_fileno(stdout), _O_BINARY);
-	_setmode(_fileno(stdin), _O_BINARY);
-
-	if (argc <= 1) {
-		if (!PrintInfo(stdout, change_con_mode{}))
-			return 1;
-		return 0;
-	}
-	if (GetACP() != 65001) {
-		fmt::print(stderr, "The Active Code Page (ACP) for this process is not UTF-8 (65001).\n"
-			"Command line parsing is not supported.\n"
-			"Your version of Windows might be to old, so that the manifest embedded in the executable is not read. "
-			"The manifest specifies, that this executable wants UTF-8 as ACP.\n"
-			"As a workaround you can activate \"Beta: Use Unicode UTF-8 for worldwide language support\":\n"
-			"  - Press Win+R\n"
-			"  - Type \"intl.cpl\"\n"
-			"  - Goto Tab \"Administrative\"\n"
-			"  - Click on \"Change system locale\"\n"
-			"  - Set Checkbox \"Beta: Use Unicode UTF-8 for worldwide language support\"\n"
-			"\n");
-		PrintUsage(stderr);
-		return 1;
-	}
-
-
-	std::optional<uint32_t> PID{ std::nullopt };
-	std::optional<intptr_t> handle_out{ std::nullopt };
-	std::optional<intptr_t> handle_err{ std::nullopt };
-	bool no_self_spawn{ false };
-	change_con_mode change_mode{};
-	std::optional<generate_event_info> event_info{ std::nullopt };
-
-	for (int i = 1; i < argc; ++i) {
-		std::string_view current_arg{ argv[i] };
-		std::optional<std::string_view> next_arg{ std::nullopt };
-
-		{
-			int next_index = i + 1;
-			bool next_available = next_index < argc;
-			if (next_available)
-				next_arg = argv[next_index];
-		}
-
-
-		if (current_arg == "--pid") {
-			if (!next_arg) {
-				fmt::print(stderr, "No process identifier supplied for option \"--pid\".\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1;
-			PID = string_to_uint<uint32_t>(*next_arg);
-			if (!PID) {
-				fmt::print(stderr, "Process identifier supplied for option \"--pid\" is not a number in base ten.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-		}
-		else if (current_arg == "--no-self-spawn") {
-			no_self_spawn = true;
-		}
-		else if (current_arg == "--handle-out") {
-			if (!next_arg) {
-				fmt::print(stderr, "Missing value for option \"--handle-out\"\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1;
-			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
-			if (!opt_uint) {
-				fmt::print(stderr, "value for option \"--handle-out\" is not a number or not in range.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			handle_out = std::bit_cast<intptr_t>(opt_uint.value());
-		}
-		else if (current_arg == "--handle-err") {
-			if (!next_arg) {
-				fmt::print(stderr, "Missing value for option \"--handle-err\"\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1;
-			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
-			if (!opt_uint) {
-				fmt::print(stderr, "value for option \"--handle-err\" is not a number or not in range.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			handle_err = std::bit_cast<intptr_t>(opt_uint.value());
-		}
-		else if (current_arg == "--set-in-mode") {
-			if (!next_arg) {
-				fmt::print(stderr, "Missing value for option \"--set-in-mode\"\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1;
-			auto opt_in_mode = parse_set_and_reset_string<DWORD>(*next_arg);
-			if (!opt_in_mode) {
-				fmt::print(stderr, "value for option \"--set-in-mode\" is in the wrong format.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			change_mode.conin = *opt_in_mode;
-		}
-		else if (current_arg == "--set-out-mode") {
-			if (!next_arg) {
-				fmt::print(stderr, "Missing value for option \"--set-out-mode\"\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1;
-			auto opt_out_mode = parse_set_and_reset_string<DWORD>(*next_arg);
-			if (!opt_out_mode) {
-				fmt::print(stderr, "value for option \"--set-in-mode\" is in the wrong format.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			change_mode.conout = *opt_out_mode;
-		}
-		else if (current_arg == "--generate-event") {
-			if (!next_arg) {
-				fmt::print(stderr, "Missing value for option \"--generate-event\"\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			i += 1; // consume next arg
-
-			auto event_or_error = parse_event_string(*next_arg);
-			if (std::holds_alternative<error_t>(event_or_error)) {
-				fmt::print(stderr, "value for option \"--generate-event\" wrong.\n");
-				PrintUsage(stderr);
-				return 1;
-			}
-			bool previous_option__use_pid_as_gid__discarded =
-					event_info.has_value() && event_info->use_pid_as_group_id;
-
-			auto opt_event = std::get<std::optional<ConsoleCtrlEvent>>(event_or_error);
-			if (opt_event.has_value()) {
-				event_info = generate_event_info{ .event = *opt_event };
-			}
-			else {
-				event_info.reset();
-			}
-			
-			auto after_next_index = i + 1;
-			bool after_next_available = after_next_index < argc;
-			if (after_next_available && std::string_view{ argv[after_next_index] } == "--use-pid-as-gid") {
-				i += 1; // consume after next arg
-				if (event_info.has_value()) {
-					event_info->use_pid_as_group_id = true;
-				}
-				else {
-					fmt::print(stderr, "Warning: Option {}--use-pid-as-gid{} ignored, because there is no event to generate.\n", quote_open, quote_close);
-				}
-			}
-			else if (previous_option__use_pid_as_gid__discarded) {
-				fmt::print(stderr, "Warning: previous option {0}--use-pid-as-gid{1} ignored, because it's not specefied directly after the <event> {0}{2}{1}.\n", quote_open, quote_close, *next_arg);
-			}
-			
-		}
-		else {
-			fmt::print(stderr, "Argument {}{}{} could not be interpreted\n", quote_open, current_arg, quote_close);
-			PrintUsage(stderr);
-			return 1;
-		}
-	}
-
-	int fdOut{};
-	FILE* fOut = stdout;
-	FILE* fErr = stderr;
-
-	if (handle_out) {
-		fdOut = _open_osfhandle(handle_out.value(), 0);
-		if (fdOut == -1)
-			return 1;
-		fOut = _fdopen(fdOut, "w");
-		if (fOut == nullptr)
-			return 1;
-	}
-
-	if (handle_err) {
-		int fdErr{};
-		if (handle_out && *handle_out == *handle_err) {
-			fdErr = _dup(fdOut);
-			if (fdErr == -1)
-				return 1;
-		}
-		else {
-			fdErr = _open_osfhandle(handle_err.value(), 0);
-			if (fdErr == -1)
-				return 1;
-		}
-		fErr = _fdopen(fdErr, "w");
-		if (fOut == nullptr)
-			return 1;
-		
-	}
-
-	bool success = true;
-	auto update_success = [&] (bool new_success){
-		success = new_success && success;
-	};
-	if (PID.has_value()) {
-		if (no_self_spawn) {
-			update_success(AttachToConsole(fOut, *PID, change_mode));
-			if (!success)
-				return 1;
-		}
-		else {
-			update_success(SpawnSelf(fOut, fErr, *PID, change_mode, event_info));
-			return success ? 0 : 1;
-		}
-	}
-
-	update_success(PrintInfo(fOut, change_mode));
-
-	if (event_info.has_value()) {
-		fmt::print(fOut, "\n");
-
-		update_success(GenerateCtrlEvent(fOut, *event_info, PID));
-	}
-
-	return success ? 0 : 1;
-}
-
-int main_temp() {
-	if (false) {
-		fmt::print(stdout, "waiting for debugger.\n");
-		using namespace std::chrono_literals;
-		while (!IsDebuggerPresent()) std::this_thread::sleep_for(100ms);
-		DebugBreak();
-	}
-	fmt::print(stdout, "Tach ");
-	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
-	HANDLE conout = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
-	if (conout == nullptr || conout == INVALID_HANDLE_VALUE)
-		return 1;
-
-	SetStdHandle(STD_OUTPUT_HANDLE, conout);
-
-	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(conout),0);
-	if (fd == -1)
-		return 1;
-
-	bool use_new_FILE = false;
-	FILE* f_stream{ nullptr };
-	if (use_new_FILE) {
-		 f_stream = _fdopen(fd, "w+");
-		 if (f_stream == nullptr)
-			 return 1;
-	}
-	else {
-		if (0 != _dup2(fd, _fileno(stdout)))
-			return 1;
-		f_stream = stdout;
-	}
-	fmt::print(f_stream, "Moin!\n");
-	return 0;
+
+#include <Windows.h>
+
+#include <array>
+#include <string>
+#include <optional>
+#include <cstdint>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <io.h>
+#include <fcntl.h>
+
+#include "console-tools/broker.h"
+#include "console-tools/ctrl_event.h"
+#include "console-tools/helper.h"
+#include "console-tools/io.h"
+#include "console-tools/relay.h"
+#include "console-tools/relay_async.h"
+#include "console-tools/relay_stats.h"
+#include "console-tools/trace.h"
+
+#include <fmt/core.h>
+#include <nowide/args.hpp>
+
+
+//void print_bits(DWORD dw) {
+//	constexpr const int number_of_bits = sizeof(dw) * 8;
+//	for (int i = number_of_bits - 1; i >= 0; --i) {
+//		bool one = 0 != (dw & (1 << i));
+//
+//		fmt::print("{}", one ? "1" : ".");
+//
+//		// space separators
+//		if (i != 0 && (i % 4) == 0)
+//			fmt::print(" ");
+//	}
+//}
+
+#if !defined(UNICODE)
+#error macro UNICODE is not defined
+#endif
+
+#if !defined(_UNICODE)
+#error macro _UNICODE is not defined
+#endif
+
+constexpr const char8_t UTF_8_test_1[] = u8"ü";
+static_assert(sizeof(UTF_8_test_1) == 3);
+static_assert(UTF_8_test_1[0] == static_cast<char8_t>(0xC3u));
+static_assert(UTF_8_test_1[1] == static_cast<char8_t>(0xBCu));
+static_assert(UTF_8_test_1[2] == static_cast<char8_t>(0x0u));
+
+constexpr const char UTF_8_test_2[] = "ü";
+static_assert(sizeof(UTF_8_test_2) == 3);
+static_assert(UTF_8_test_2[0] == static_cast<char>(0xC3u));
+static_assert(UTF_8_test_2[1] == static_cast<char>(0xBCu));
+static_assert(UTF_8_test_2[2] == static_cast<char>(0x0u));
+
+constexpr const std::string_view UTF_8_thumbs_up_with_skin_tone = "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbb";
+
+void PrintFileType(FILE*stream, std::string_view leading, HANDLE handle) {
+	auto file_type = GetFileType(handle);
+	switch (file_type) {
+	case FILE_TYPE_CHAR:
+		fmt::print(stream, "{}Filetype: FILE_TYPE_CHAR\n", leading);
+		break;
+	case FILE_TYPE_DISK:
+		fmt::print(stream, "{}Filetype: FILE_TYPE_DISK\n", leading);
+		break;
+	case FILE_TYPE_PIPE:
+		fmt::print(stream, "{}Filetype: FILE_TYPE_PIPE\n", leading);
+		break;
+	case FILE_TYPE_REMOTE:
+		fmt::print(stream, "{}Filetype: FILE_TYPE_REMOTE\n", leading);
+		break;
+	case FILE_TYPE_UNKNOWN: {
+		auto error = GetLastError();
+		if (error == NO_ERROR) {
+			fmt::print(stream, "{}Filetype: FILE_TYPE_UNKNOWN\n",leading);
+		}
+		else {
+			auto error_message = get_error_message(error);
+			fmt::print(stream, "{0}Filetype: FILE_TYPE_UNKNOWN, error: {1:#x} {1:d} - {2}",leading, error, indent_message(std::string{leading}+"  ", error_message.value_or("")));
+		}
+		break;
+	}
+	default:
+		fmt::print(stream, "{}Filetype: {:#0x} - this is unexpected, undocumented and an error\n", leading, file_type);
+		break;
+	}
+}
+
+static bool is_handle_invalid(HANDLE h, bool strict = false) {
+	if (h == INVALID_HANDLE_VALUE || h == nullptr)
+		return true;
+	DWORD dummy;
+	return !GetHandleInformation(h, &dummy);
+}
+
+struct handle_with_name {
+	HANDLE handle{ nullptr };
+	std::string_view name{};
+	console_in_or_out type{ console_in_or_out::undefined };
+};
+
+
+constexpr const std::string_view INPUT_MODE_FLAGS[]{
+	"ENABLE_PROCESSED_INPUT",              // 0x0001
+	"ENABLE_LINE_INPUT",                   // 0x0002
+	"ENABLE_ECHO_INPUT",                   // 0x0004
+	"ENABLE_WINDOW_INPUT",                 // 0x0008
+	"ENABLE_MOUSE_INPUT",                  // 0x0010
+	"ENABLE_INSERT_MODE",                  // 0x0020
+	"ENABLE_QUICK_EDIT_MODE",              // 0x0040
+	"ENABLE_EXTENDED_FLAGS",               // 0x0080
+	"ENABLE_AUTO_POSITION",                // 0x0100
+	"ENABLE_VIRTUAL_TERMINAL_INPUT",       // 0x0200
+};
+constexpr const std::string_view OUTPUT_MODE_FLAGS[]{
+	"ENABLE_PROCESSED_OUTPUT",             //0x0001
+	"ENABLE_WRAP_AT_EOL_OUTPUT",           //0x0002
+	"ENABLE_VIRTUAL_TERMINAL_PROCESSING",  //0x0004
+	"DISABLE_NEWLINE_AUTO_RETURN",         //0x0008
+	"ENABLE_LVB_GRID_WORLDWIDE",           //0x0010
+};
+
+void PrintConsoleMode(FILE* stream, std::string_view indent, DWORD mode, console_in_or_out type) {
+	constexpr std::size_t bits = sizeof(mode) * 8;
+
+	fmt::print(stream, "{0}console mode: {1:#0{2}b}  {1:#0{3}x}\n", indent, mode, sizeof(mode) * 8 + 2, sizeof(mode) * 2 + 2);
+	auto lambda = [&]<size_t size>(std::string_view const (&array)[size]) ->void {
+		static_assert(size <= bits);
+		for (int i = 0; i < size && i < bits; ++i) {
+			DWORD mask = DWORD(1u) << i;
+			bool set = mode & mask;
+			auto pre_space  = bits - 1 - i;
+			auto post_space = i;
+			fmt::print(stream, "{0}                {1}{2}{3}  {4:#0{5}x} {6}\n",
+				indent,
+				std::string(pre_space, ' '),
+				set ? '1' : '.',
+				std::string(post_space, ' '),
+				mask,
+				sizeof(mode) * 2 + 2,
+				array[i]);
+		}
+	};
+
+	if (type == console_in_or_out::in || type == console_in_or_out::undefined)
+		return lambda(INPUT_MODE_FLAGS);
+
+	if (type == console_in_or_out::out || type == console_in_or_out::undefined)
+		return lambda(OUTPUT_MODE_FLAGS);
+}
+
+bool PrintMode(FILE* stream, handle_with_name h, set_and_reset<DWORD> s_n_r = set_and_reset<DWORD>{}) {
+	bool ret{ true };
+	if (is_handle_invalid(h.handle, true)) {
+		fmt::print("{}: {:#x} invalid\n", h.name, std::bit_cast<uintptr_t>(h.handle));
+	}
+	else {
+		static_assert(sizeof(HANDLE) == sizeof(uintptr_t));
+
+		fmt::print(stream, "{}: {:#x}\n", h.name, std::bit_cast<uintptr_t>(h.handle));
+		DWORD console_mode{};
+		if (GetConsoleMode(h.handle, &console_mode)) {
+			PrintConsoleMode(stream, "  ", console_mode, h.type);
+			auto new_mode = s_n_r.change(console_mode);
+			if (new_mode != console_mode) {
+				fmt::print(stream, "  new mode {:#x}\n", new_mode);
+				if (SetConsoleMode(h.handle, new_mode)) {
+					PrintConsoleMode(stream, "  ", new_mode, h.type);
+				}
+				else {
+					auto error = GetLastError();
+					auto message = get_error_message(error);
+					fmt::print(stream, "  SetConsoleMode(): error {:#x} - {}", error, indent_message("    ", message.value_or("")));
+					ret = false;
+				}
+			}
+		}
+		else {
+			auto error = GetLastError();
+			auto message = get_error_message(error);
+			fmt::print(stream, "  console mode: error {:#x} - {}", error, indent_message("    ", message.value_or("")));
+			//ret = false;
+		}
+
+		PrintFileType(stream, "  ", h.handle);
+	}
+	return ret;
+}
+
+void PrintComparison(FILE* stream, handle_with_name hn1, handle_with_name hn2) {
+	if (!is_handle_invalid(hn1.handle, true) && !is_handle_invalid(hn2.handle, true)) {
+		if (hn1.handle == hn2.handle)
+			fmt::print(stream, "The handles for {} and {} are equal.\n", hn1.name, hn2.name);
+		if (CompareObjectHandles(hn1.handle, hn2.handle))
+			fmt::print(stream, "The handles for {} and {} point to the same kernel object.\n",hn1.name,hn2.name);
+		else
+			fmt::print(stream, "The handles for {} and {} do not point to the same kernel object.{}\n",hn1.name, hn2.name,
+				hn1.handle == hn2.handle ? " It seems like, the object they are pointing to is not a kernel object, but some other kind of object." : "");
+	}
+}
+
+void CompareEveryThing(FILE* stream, std::vector<handle_with_name> handles) {
+
+	for (int i = 0; i < handles.size(); ++i) {
+		for (int j = i+1; j < handles.size(); ++j) {
+			PrintComparison(stream, handles[i], handles[j]);
+		}
+	}
+}
+
+void TestWriteConsole(FILE*stream, HANDLE conout) {
+	constexpr const std::wstring_view wsv = L"Moin Moin\n";
+	DWORD written;
+	bool success = WriteConsoleW(conout, wsv.data(), static_cast<DWORD>(wsv.size()), &written, nullptr);
+	fmt::print(stream, "  WriteConsoleW result: {}\n", success?"success":"fail");
+}
+
+
+struct change_con_mode{
+	set_and_reset<DWORD> conin{};
+	set_and_reset<DWORD> conout{};
+};
+
+bool PrintInfo(FILE*stream, change_con_mode change_mode, bool more_info = false) {
+	bool ret{ true };
+	fmt::print(stream, "DEBUG: äöü {}{}{}\n", quote_open, UTF_8_thumbs_up_with_skin_tone, quote_close);
+
+	UINT acp = GetACP();
+	UINT oem_cp = GetACP();
+	UINT console_input_cp = GetConsoleCP();
+	UINT console_output_cp = GetConsoleOutputCP();
+	fmt::print(stream, "ACP:               {}\n", acp);
+	fmt::print(stream, "OEM CP:            {}\n", oem_cp);
+	fmt::print(stream, "Console Input CP:  {}\n", console_input_cp);
+	fmt::print(stream, "Console Output CP: {}\n", console_output_cp);
+	fmt::print(stream, "\n");
+
+	// -----------------------
+	if (more_info)
+		fmt::print(stream, "\nIN:\n\n");
+
+	handle_with_name hC_stdin{
+		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdin)))},
+		.name{"stdin"},
+		.type{console_in_or_out::in},
+	};
+
+	if (more_info)
+		ret = PrintMode(stream, hC_stdin) && ret;
+
+	handle_with_name hStdIn{ .handle{ GetStdHandle(STD_INPUT_HANDLE)}, .name{"STD_INPUT_HANDLE"}, .type{console_in_or_out::in}, };
+
+	if (more_info)
+		ret = PrintMode(stream, hStdIn) && ret;
+
+	handle_with_name hConIn{ .handle{nullptr}, .name{"CONIN$"}, .type{console_in_or_out::in}, };
+	{
+		SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
+		hConIn.handle = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &sa, OPEN_EXISTING, 0, nullptr);
+		ret = PrintMode(stream, hConIn, change_mode.conin) && ret;
+	}
+
+
+	if (more_info) {
+		fmt::print(stream, "\n");
+		CompareEveryThing(stream, std::vector{ hC_stdin, hStdIn, hConIn });
+	}
+
+	fmt::print(stream, "\n");
+	// -----------------------
+	if (more_info)
+		fmt::print(stream, "\nOUT:\n\n");
+
+	handle_with_name hC_stdout{ 
+		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdout)))}, 
+		.name{"stdout"},
+		.type{console_in_or_out::out},
+	};
+	if (more_info)
+		ret = PrintMode(stream, hC_stdout) && ret;
+
+	handle_with_name hC_stderr{
+		.handle{reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stderr)))},
+		.name{"stderr"},
+		.type{console_in_or_out::out},
+	};
+	if (more_info)
+		ret = PrintMode(stream, hC_stderr) && ret;
+
+	handle_with_name hStdOut{ 
+		.handle{ GetStdHandle(STD_OUTPUT_HANDLE)}, 
+		.name{"STD_OUTPUT_HANDLE"},
+		.type{console_in_or_out::out},
+	};
+	if (more_info)
+		ret = PrintMode(stream, hStdOut) && ret;
+
+	handle_with_name hStdErr{
+		.handle {GetStdHandle(STD_ERROR_HANDLE)},
+		.name{"STD_ERROR_HANDLE"},
+		.type{console_in_or_out::out},
+	};
+	if (more_info)
+		ret = PrintMode(stream,  hStdErr) && ret;
+
+	handle_with_name hConOut{ .handle{nullptr}, .name{"CONOUT$"}, .type{console_in_or_out::out}, };
+	{
+		SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
+		hConOut.handle = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+		ret = PrintMode(stream, hConOut, change_mode.conout) && ret;
+		//TestWriteConsole(stream, hConOut.handle);
+	}
+
+	if (more_info) {
+		fmt::print(stream, "\n");
+		CompareEveryThing(stream, std::vector{ hC_stdout, hC_stderr, hStdOut, hStdErr, hConOut });
+	}
+
+	if (!is_handle_invalid(hConOut.handle)) {
+		CloseHandle(hConOut.handle);
+		hConOut.handle = nullptr;
+	}
+
+	if (!is_handle_invalid(hConIn.handle)) {
+		CloseHandle(hConIn.handle);
+		hConIn.handle = nullptr;
+	}
+	return ret;
+}
+
+// Children, that inspect consoles at the same time, with more than one PID.
+constexpr unsigned DEFAULT_SURVEY_JOBS{ 16 };
+constexpr unsigned MAX_SURVEY_JOBS{ 256 };
+
+// The properties of a console, that PrintInfo shows, as data for "--format json" and
+// "--format binary". Unlike the text, both are built in memory and leave with one write.
+enum class output_format : uint32_t {
+	text,
+	json,
+	binary
+};
+
+std::optional<output_format> parse_output_format(std::string_view str) {
+	if (str == "text")
+		return output_format::text;
+	if (str == "json")
+		return output_format::json;
+	if (str == "binary")
+		return output_format::binary;
+	return std::nullopt;
+}
+
+std::string_view output_format_to_string(output_format format) {
+	switch (format) {
+	case output_format::json:
+		return "json";
+	case output_format::binary:
+		return "binary";
+	default:
+		return "text";
+	}
+}
+
+// The handles of PrintInfo with more_info, in the order of the binary record.
+constexpr std::string_view INFO_HANDLE_NAMES[]{
+	"stdin", "STD_INPUT_HANDLE", "CONIN$",
+	"stdout", "stderr", "STD_OUTPUT_HANDLE", "STD_ERROR_HANDLE", "CONOUT$",
+};
+constexpr std::size_t INFO_HANDLE_COUNT{ std::size(INFO_HANDLE_NAMES) };
+constexpr std::size_t CONIN_INDEX{ 2 };
+constexpr std::size_t CONOUT_INDEX{ 7 };
+
+struct handle_info {
+	bool valid{ false };
+	// The value of the HANDLE, so that collectors can tell, which handles are the same.
+	uint64_t value{ 0 };
+	std::optional<DWORD> mode{ std::nullopt };
+	DWORD file_type{ FILE_TYPE_UNKNOWN };
+	// Points to the same kernel object as CONIN$ (input) or CONOUT$ (output).
+	bool same_as_console{ false };
+};
+
+struct console_info {
+	uint32_t pid{ 0 };
+	// Zero, if the console was inspected. Otherwise the error of AttachConsole(), and
+	// the fields below are empty.
+	uint32_t error_code{ 0 };
+	std::string error{};
+	UINT acp{ 0 };
+	UINT oem_cp{ 0 };
+	UINT input_cp{ 0 };
+	UINT output_cp{ 0 };
+	std::array<handle_info, INFO_HANDLE_COUNT> handles{};
+};
+
+// error_code of a console, whose child ended without an answer.
+constexpr uint32_t NO_ANSWER_ERROR_CODE{ 0xFFFFFFFFu };
+
+std::string_view FileTypeName(DWORD file_type) {
+	switch (file_type) {
+	case FILE_TYPE_CHAR:
+		return "FILE_TYPE_CHAR";
+	case FILE_TYPE_DISK:
+		return "FILE_TYPE_DISK";
+	case FILE_TYPE_PIPE:
+		return "FILE_TYPE_PIPE";
+	case FILE_TYPE_REMOTE:
+		return "FILE_TYPE_REMOTE";
+	default:
+		return "FILE_TYPE_UNKNOWN";
+	}
+}
+
+handle_info InspectHandle(HANDLE handle) {
+	handle_info info{};
+	if (is_handle_invalid(handle, true))
+		return info;
+	info.valid = true;
+	info.value = std::bit_cast<uintptr_t>(handle);
+	DWORD mode{};
+	if (GetConsoleMode(handle, &mode))
+		info.mode = mode;
+	info.file_type = GetFileType(handle);
+	return info;
+}
+
+// Looks at the same handles as PrintInfo with more_info, but changes nothing.
+console_info CollectConsoleInfo(uint32_t PID) {
+	console_info info{
+		.pid{PID},
+		.acp{GetACP()},
+		.oem_cp{GetOEMCP()},
+		.input_cp{GetConsoleCP()},
+		.output_cp{GetConsoleOutputCP()},
+	};
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
+	HANDLE conin = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &sa, OPEN_EXISTING, 0, nullptr);
+	HANDLE conout = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+	const HANDLE handles[INFO_HANDLE_COUNT]{
+		reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdin))), GetStdHandle(STD_INPUT_HANDLE), conin,
+		reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdout))), reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stderr))),
+		GetStdHandle(STD_OUTPUT_HANDLE), GetStdHandle(STD_ERROR_HANDLE), conout,
+	};
+	for (std::size_t i = 0; i < INFO_HANDLE_COUNT; ++i) {
+		info.handles[i] = InspectHandle(handles[i]);
+		const HANDLE console = (i <= CONIN_INDEX) ? conin : conout;
+		info.handles[i].same_as_console = info.handles[i].valid && !is_handle_invalid(console, true) && CompareObjectHandles(handles[i], console);
+	}
+	if (!is_handle_invalid(conin))
+		CloseHandle(conin);
+	if (!is_handle_invalid(conout))
+		CloseHandle(conout);
+	return info;
+}
+
+// Attaches to the console of `PID` like AttachToConsole, but keeps the error for the
+// record, instead of printing it.
+console_info AttachAndCollectConsoleInfo(uint32_t PID) {
+	(void)FreeConsole();
+	if (!trace_call("AttachConsole", "process", [&] { return AttachConsole(PID); })) {
+		const DWORD error = GetLastError();
+		return console_info{
+			.pid{PID},
+			.error_code{error},
+			.error{fmt::format("AttachConsole({}) failed with error {} - {}", PID, error, get_error_message(error).value_or(""))},
+		};
+	}
+	return CollectConsoleInfo(PID);
+}
+
+// One line of "--format json".
+std::string ConsoleInfoToJson(const console_info& info) {
+	std::string json{};
+	auto out = std::back_inserter(json);
+	if (info.error_code != 0) {
+		std::string_view message{ info.error };
+		while (!message.empty() && (message.back() == '\n' || message.back() == '\r'))
+			message.remove_suffix(1);
+		fmt::format_to(out, "{{\"pid\":{},\"ok\":false,\"error_code\":{},\"error\":{}}}\n", info.pid, info.error_code, json_string(message));
+		return json;
+	}
+	fmt::format_to(out, "{{\"pid\":{},\"ok\":true,\"acp\":{},\"oem_cp\":{},\"input_cp\":{},\"output_cp\":{},\"handles\":{{",
+		info.pid, info.acp, info.oem_cp, info.input_cp, info.output_cp);
+	for (std::size_t i = 0; i < INFO_HANDLE_COUNT; ++i) {
+		const handle_info& handle = info.handles[i];
+		fmt::format_to(out, "{}\"{}\":", (i == 0 ? "" : ","), INFO_HANDLE_NAMES[i]);
+		if (!handle.valid) {
+			json += "null";
+			continue;
+		}
+		fmt::format_to(out, "{{\"handle\":{},\"mode\":{},\"file_type\":\"{}\",\"same_as_console\":{}}}",
+			handle.value, handle.mode ? std::to_string(*handle.mode) : std::string{ "null" },
+			FileTypeName(handle.file_type), handle.same_as_console);
+	}
+	json += "}}\n";
+	return json;
+}
+
+// The record of "--format binary", little-endian:
+//    0  4 bytes "STTY"
+//    4  u16 version (1)         6  u16 size of the record (160)
+//    8  u32 PID                12  u32 error code, 0 if the console was inspected
+//   16  u32 ACP                20  u32 OEM code page
+//   24  u32 input code page    28  u32 output code page
+//   32  8 handles of 16 bytes, in the order of INFO_HANDLE_NAMES:
+//        0  u64 value of the HANDLE
+//        8  u32 console mode
+//       12  u16 file type
+//       14  u16 flags: 1 valid, 2 mode is set, 4 same object as CONIN$/CONOUT$
+constexpr uint16_t CONSOLE_RECORD_VERSION{ 1 };
+constexpr std::size_t CONSOLE_RECORD_HEADER_SIZE{ 32 };
+constexpr std::size_t CONSOLE_RECORD_HANDLE_SIZE{ 16 };
+constexpr std::size_t CONSOLE_RECORD_SIZE{ CONSOLE_RECORD_HEADER_SIZE + INFO_HANDLE_COUNT * CONSOLE_RECORD_HANDLE_SIZE };
+constexpr std::string_view CONSOLE_RECORD_MAGIC{ "STTY" };
+
+using console_record = std::array<char, CONSOLE_RECORD_SIZE>;
+
+console_record ConsoleInfoToRecord(const console_info& info) {
+	console_record record{};
+	auto put = [&record](std::size_t offset, uint64_t value, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+			record[offset + i] = static_cast<char>((value >> (8 * i)) & 0xFFu);
+	};
+	std::copy(CONSOLE_RECORD_MAGIC.begin(), CONSOLE_RECORD_MAGIC.end(), record.begin());
+	put(4, CONSOLE_RECORD_VERSION, 2);
+	put(6, CONSOLE_RECORD_SIZE, 2);
+	put(8, info.pid, 4);
+	put(12, info.error_code, 4);
+	put(16, info.acp, 4);
+	put(20, info.oem_cp, 4);
+	put(24, info.input_cp, 4);
+	put(28, info.output_cp, 4);
+	for (std::size_t i = 0; i < INFO_HANDLE_COUNT; ++i) {
+		const handle_info& handle = info.handles[i];
+		const std::size_t offset = CONSOLE_RECORD_HEADER_SIZE + i * CONSOLE_RECORD_HANDLE_SIZE;
+		const uint16_t flags = (handle.valid ? 1u : 0u) | (handle.mode ? 2u : 0u) | (handle.same_as_console ? 4u : 0u);
+		put(offset, handle.value, 8);
+		put(offset + 8, handle.mode.value_or(0), 4);
+		put(offset + 12, handle.file_type, 2);
+		put(offset + 14, flags, 2);
+	}
+	return record;
+}
+
+bool IsConsoleRecord(std::string_view bytes) {
+	return bytes.size() == CONSOLE_RECORD_SIZE && bytes.starts_with(CONSOLE_RECORD_MAGIC);
+}
+
+// The whole output in one write, so that a collector never sees half a record.
+bool WriteAtOnce(FILE* stream, std::string_view bytes) {
+	return std::fwrite(bytes.data(), 1, bytes.size(), stream) == bytes.size() && std::fflush(stream) == 0;
+}
+
+bool WriteConsoleInfo(FILE* stream, output_format format, const console_info& info) {
+	if (format == output_format::binary) {
+		const console_record record = ConsoleInfoToRecord(info);
+		return WriteAtOnce(stream, std::string_view(record.data(), record.size()));
+	}
+	return WriteAtOnce(stream, ConsoleInfoToJson(info));
+}
+
+// "--watch": the modes and code pages of one console, polled every interval. CONIN$ and
+// CONOUT$ stay open, so a poll is four calls, and only the changes are written.
+constexpr uint32_t DEFAULT_WATCH_INTERVAL_MS{ 100 };
+constexpr uint32_t MIN_WATCH_INTERVAL_MS{ 10 };
+constexpr uint32_t MAX_WATCH_INTERVAL_MS{ 60000 };
+
+struct watched_state {
+	// Empty, while the handle is no console (any more).
+	std::optional<DWORD> in_mode{ std::nullopt };
+	std::optional<DWORD> out_mode{ std::nullopt };
+	UINT input_cp{ 0 };
+	UINT output_cp{ 0 };
+
+	bool operator==(const watched_state&) const = default;
+};
+
+watched_state PollConsole(HANDLE conin, HANDLE conout) {
+	trace_scope trace{ "poll console", "watch" };
+	watched_state state{ .input_cp{GetConsoleCP()}, .output_cp{GetConsoleOutputCP()} };
+	DWORD mode{};
+	if (GetConsoleMode(conin, &mode))
+		state.in_mode = mode;
+	if (GetConsoleMode(conout, &mode))
+		state.out_mode = mode;
+	return state;
+}
+
+// " +NAME -NAME" for the bits, that `before` and `now` do not share.
+void AppendModeBits(std::string& text, DWORD before, DWORD now, std::span<const std::string_view> names) {
+	for (std::size_t bit = 0; bit < sizeof(DWORD) * 8; ++bit) {
+		const DWORD mask = DWORD(1u) << bit;
+		if ((before & mask) == (now & mask))
+			continue;
+		const char sign = (now & mask) ? '+' : '-';
+		if (bit < names.size())
+			fmt::format_to(std::back_inserter(text), " {}{}", sign, names[bit]);
+		else
+			fmt::format_to(std::back_inserter(text), " {}{:#x}", sign, mask);
+	}
+}
+
+// One record for everything, that changed between `before` and `now`, or for all of
+// `now` at the start. Text: "<seconds> CONIN$ 0x1f7 -> 0x1f1 -ENABLE_LINE_INPUT ...".
+// JSON: {"t_ms":..,"CONIN$":{"mode":..,"set":..,"cleared":..},"input_cp":..}.
+std::string FormatWatchRecord(output_format format, int64_t t_ms, const std::optional<watched_state>& before, const watched_state& now) {
+	const bool json = (format == output_format::json);
+	std::string record{};
+	auto out = std::back_inserter(record);
+	if (json)
+		fmt::format_to(out, "{{\"t_ms\":{}", t_ms);
+	else
+		fmt::format_to(out, "{}.{:03}", t_ms / 1000, t_ms % 1000);
+
+	bool first{ true };
+	auto separate = [&] {
+		if (!json && !first)
+			record += ";";
+		first = false;
+	};
+	auto mode = [&](std::string_view name, std::optional<DWORD> old_mode, std::optional<DWORD> new_mode, std::span<const std::string_view> names) {
+		if (before && old_mode == new_mode)
+			return;
+		separate();
+		if (json) {
+			fmt::format_to(out, ",\"{}\":{{\"mode\":{}", name, new_mode ? std::to_string(*new_mode) : std::string{ "null" });
+			if (before && old_mode && new_mode)
+				fmt::format_to(out, ",\"set\":{},\"cleared\":{}", *new_mode & ~*old_mode, *old_mode & ~*new_mode);
+			record += "}";
+			return;
+		}
+		auto hex = [](std::optional<DWORD> value) { return value ? fmt::format("{:#x}", *value) : std::string{ "none" }; };
+		if (before)
+			fmt::format_to(out, " {} {} -> {}", name, hex(old_mode), hex(new_mode));
+		else
+			fmt::format_to(out, " {} {}", name, hex(new_mode));
+		if (before && old_mode && new_mode)
+			AppendModeBits(record, *old_mode, *new_mode, names);
+	};
+	auto code_page = [&](std::string_view json_name, std::string_view text_name, UINT old_cp, UINT new_cp) {
+		if (before && old_cp == new_cp)
+			return;
+		separate();
+		if (json)
+			fmt::format_to(out, ",\"{}\":{}", json_name, new_cp);
+		else if (before)
+			fmt::format_to(out, " {} {} -> {}", text_name, old_cp, new_cp);
+		else
+			fmt::format_to(out, " {} {}", text_name, new_cp);
+	};
+	mode("CONIN$", before ? before->in_mode : std::nullopt, now.in_mode, INPUT_MODE_FLAGS);
+	mode("CONOUT$", before ? before->out_mode : std::nullopt, now.out_mode, OUTPUT_MODE_FLAGS);
+	code_page("input_cp", "input CP", before ? before->input_cp : 0, now.input_cp);
+	code_page("output_cp", "output CP", before ? before->output_cp : 0, now.output_cp);
+	record += json ? "}\n" : "\n";
+	return record;
+}
+
+// Watches the console of this process, until `process` ends, or forever without one.
+// A change is seen at most one interval late. Between the polls, the thread sleeps.
+bool WatchConsole(FILE* fOut, FILE* fErr, output_format format, std::chrono::milliseconds interval, HANDLE process) {
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{false} };
+	HANDLE conin = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &sa, OPEN_EXISTING, 0, nullptr);
+	HANDLE conout = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+	if (is_handle_invalid(conin) && is_handle_invalid(conout)) {
+		auto error = GetLastError();
+		fmt::print(fErr, "Error: \"--watch\" could not open CONIN$ and CONOUT$ - {:#x} {}\n", error, get_error_message(error).value_or(""));
+		return false;
+	}
+	const DWORD interval_ms = static_cast<DWORD>(interval.count());
+	const auto start = std::chrono::steady_clock::now();
+	std::optional<watched_state> last{ std::nullopt };
+	bool success{ true };
+	for (;;) {
+		const watched_state now = PollConsole(conin, conout);
+		if (!last || now != *last) {
+			const auto t_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			if (!WriteAtOnce(fOut, FormatWatchRecord(format, t_ms, last, now))) {
+				// Nobody reads the records any more.
+				success = false;
+				break;
+			}
+			last = now;
+		}
+		if (process == nullptr)
+			Sleep(interval_ms);
+		else if (WaitForSingleObject(process, interval_ms) != WAIT_TIMEOUT)
+			break;
+	}
+	if (!is_handle_invalid(conin))
+		CloseHandle(conin);
+	if (!is_handle_invalid(conout))
+		CloseHandle(conout);
+	return success;
+}
+
+// The child of "--pid <PID> --watch": attaches to the console of `PID`, and watches it,
+// until `PID` ends. Without a child, if stty.exe shares that console.
+bool WatchAttached(FILE* fOut, FILE* fErr, uint32_t PID, output_format format, std::chrono::milliseconds interval) {
+	// Opened before the attach, so that a process, that ends meanwhile, is no race.
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, PID);
+	if (process == nullptr) {
+		auto error = GetLastError();
+		fmt::print(fErr, "OpenProcess({}) failed with error {} - {}", PID, error, indent_message("  ", get_error_message(error).value_or("")));
+		return false;
+	}
+	// Attached already, if this process shares the console of `PID`.
+	bool attached = shares_console_with(PID);
+	if (!attached) {
+		(void)FreeConsole();
+		attached = trace_call("AttachConsole", "process", [&] { return AttachConsole(PID); });
+		if (!attached) {
+			auto error = GetLastError();
+			fmt::print(fErr, "AttachConsole({}) failed with error {} - {}", PID, error, indent_message("  ", get_error_message(error).value_or("")));
+		}
+	}
+	const bool success = attached && WatchConsole(fOut, fErr, format, interval, process);
+	CloseHandle(process);
+	return success;
+}
+
+void PrintUsage(FILE*stream) {
+	fmt::print(stream,
+		"Usage:\n"
+		"\n"
+		"  stty.exe [--pid <PID>] [--handle-out <handle-out>] [--no-self-spawn] [--set-in-mode <mode>] [--set-out-mode <mode>] [--generate-event <event> [--use-pid-as-gid] [--wait-timeout <ms>]] [--buffer-size <size>]\n"
+		"           [--stats] [--stats-interval <ms>] [--no-broker] [--no-direct]\n"
+		"  stty.exe --pid <PID> --broker\n"
+		"  stty.exe [--pid <PID> ...] [--pid-file <file>] [--jobs <n>] [--format <format>]\n"
+		"  stty.exe --pid <PID> ... [--pid-file <file>] --generate-event <event> --use-pid-as-gid [--wait-timeout <ms>] [--format json]\n"
+		"  stty.exe [--pid <PID>] --watch [--watch-interval <ms>] [--format json]\n"
+		"\n"
+		"<mode>    A string of dots (.), zeros (0), and ones (1).\n"
+		"          A dot means no change\n"
+		"          A zero sets the bit to zero\n"
+		"          A one sets the bit to one\n"
+		"\n"
+		"<event>   One of these (without quotes):\n"
+		"          - \"ctrl-c\"\n"
+		"          - \"ctrl-break\"\n"
+		"          - \"none\"\n"
+		"\n"
+		"--wait-timeout  How long to wait for the event to reach the own handler of stty.exe,\n"
+		"          in milliseconds (default: {}, 0 does not wait). Only an event to the\n"
+		"          whole console reaches it, so there is no wait with \"--use-pid-as-gid\".\n"
+		"          With more than one PID and \"--use-pid-as-gid\", one process delivers the\n"
+		"          event to each group in turn. Then it waits up to <ms> for the end of each\n"
+		"          group leader, for all groups at the same time, and prints a line per\n"
+		"          group and the p50, p99 and slowest time from the event to the end.\n"
+		"          A leader, that still runs then, is unconfirmed, not an error. Windows\n"
+		"          delivers only \"ctrl-break\" to a group, so \"ctrl-c\" needs a single PID.\n"
+		"\n"
+		"<size>    Size of the buffer, that relays the output of the spawned process,\n"
+		"          in bytes, optionally with the suffix \"k\" or \"M\". Or \"auto\".\n"
+		"\n"
+		"--stats   With \"--pid\", print statistics of the relay of the child output to\n"
+		"          stderr at the end: calls, bytes, partial writes, time blocked in reads\n"
+		"          and writes, and the latency of the chunks (p50/p99/max).\n"
+		"\n"
+		"<ms>      Like \"--stats\", and every <ms> milliseconds a JSON line with the\n"
+		"          numbers so far.\n"
+		"\n"
+		"--broker  Attaches to the console of <PID> once and stays, until <PID> ends. Meanwhile\n"
+		"          it answers every \"stty.exe --pid <PID>\", that connects to its named pipe,\n"
+		"          instead of a new process. Run it in the background, e.g. with \"start /b\".\n"
+		"          Without a broker, a process is spawned as before. An answer of the broker\n"
+		"          has no child output to relay, so \"--stats\" prints nothing then.\n"
+		"\n"
+		"--no-broker  Spawns a process, even if a broker serves the console.\n"
+		"\n"
+		"--no-direct  Spawns a process (or asks a broker), even if stty.exe is attached to\n"
+		"          the console of <PID> already. Otherwise the console is inspected, changed\n"
+		"          or watched in this process then, without a child and without a pipe.\n"
+		"\n"
+		"<format>  \"text\" (default), \"json\" or \"binary\". \"--json\" is short for \"--format json\".\n"
+		"          JSON and binary hold the code pages, and the value, mode and file type of\n"
+		"          the handles, that the text shows. Each console is written at once, as one\n"
+		"          JSON object per line, or as one record of {} bytes, little-endian:\n"
+		"            0 \"STTY\", 4 u16 version (1), 6 u16 size, 8 u32 PID, 12 u32 error\n"
+		"            (0: ok), 16 u32 ACP, 20 u32 OEM CP, 24 u32 input CP, 28 u32 output CP,\n"
+		"            32 eight handles of 16 bytes: stdin, STD_INPUT_HANDLE, CONIN$, stdout,\n"
+		"            stderr, STD_OUTPUT_HANDLE, STD_ERROR_HANDLE, CONOUT$. Each is u64 value,\n"
+		"            u32 mode, u16 file type, u16 flags (1 valid, 2 has a mode, 4 same\n"
+		"            object as CONIN$/CONOUT$).\n"
+		"\n"
+		"--watch   Keeps CONIN$ and CONOUT$ open, polls their modes and the code pages\n"
+		"          every <ms> milliseconds (default: {}, {} to {}), and prints a line,\n"
+		"          whenever something changed: the time since the start, the old and\n"
+		"          the new value, and the bits, that were set (+) or cleared (-). The\n"
+		"          first line has all values. With \"--pid\", it ends with <PID>.\n"
+		"          As JSON: {{\"t_ms\":..,\"CONIN$\":{{\"mode\":..,\"set\":..,\"cleared\":..}},\n"
+		"          \"CONOUT$\":{{..}},\"input_cp\":..,\"output_cp\":..}}, with only the changed keys.\n"
+		"\n"
+		"<file>    More PIDs, in base ten, separated by white space or commas. A \"#\"\n"
+		"          starts a comment, that runs to the end of the line.\n"
+		"\n"
+		"<n>       With more than one PID, up to <n> processes inspect the consoles at the\n"
+		"          same time (default: {}, at most {}). Each console is one line of JSON\n"
+		"          or one binary record, in the order they are done; \"ok\" is false and\n"
+		"          \"error\" tells why (or the error code is not 0), if it could not be\n"
+		"          inspected. The survey spawns, except for consoles, that stty.exe shares;\n"
+		"          brokers are not asked.\n",
+		DEFAULT_CTRL_EVENT_WAIT_TIMEOUT.count(), CONSOLE_RECORD_SIZE, DEFAULT_WATCH_INTERVAL_MS, MIN_WATCH_INTERVAL_MS, MAX_WATCH_INTERVAL_MS,
+		DEFAULT_SURVEY_JOBS, MAX_SURVEY_JOBS
+	);
+}
+
+struct generate_event_info {
+	ConsoleCtrlEvent event{};
+	bool use_pid_as_group_id{ false };
+	// How long to wait for the own handler. Zero does not wait.
+	std::chrono::milliseconds wait_timeout{ DEFAULT_CTRL_EVENT_WAIT_TIMEOUT };
+};
+
+bool GenerateCtrlEvent(FILE* stream, generate_event_info event_info, std::optional<DWORD> PID) {
+	bool ret{ true };
+	const ctrl_event_handler handler{};
+	if (!handler.installed())
+	{
+		fmt::print(stream,"Warning: SetConsoleCtrlHandler() failed. This process might exit abnormaly.\n");
+	}
+
+	auto dw_event = static_cast<DWORD>(event_info.event);
+	static_assert(std::is_same_v <decltype(dw_event), std::underlying_type_t<decltype(event_info.event)>>);
+
+	constexpr DWORD default_pgid = 0;
+	DWORD pgid = default_pgid;
+	if (event_info.use_pid_as_group_id) {
+		if (PID.has_value())
+			pgid = *PID;
+		else {
+			fmt::print(stream, "Warning: Cannot use PID as process group ID (PGID), because no PID is specified\n");
+		}
+	}
+
+	fmt::print(stream, "generate event {}\n", dw_event);
+	const uint64_t seen = handler.handled();
+	const auto generated = std::chrono::steady_clock::now();
+	if (!generate_ctrl_event(event_info.event, pgid)) {
+		auto error = GetLastError();
+		auto message = get_error_message(error);
+		fmt::print(stream, "GenerateConsoleCtrlEvent({}) failed with error {} - {}", dw_event,  error, indent_message("  ", message.value_or("")));
+		ret = false;
+	}
+
+	// Only the whole console (group 0) includes this process. The event of another group
+	// never reaches the own handler, so there is nothing to wait for.
+	if (handler.installed() && ret && pgid == default_pgid && event_info.wait_timeout.count() > 0) {
+		if (handler.wait(seen, event_info.wait_timeout)) {
+			const auto latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - generated);
+			fmt::print(stream, "event handled after {:.3f} ms\n", latency.count());
+		}
+		else {
+			fmt::print(stream, "Warning: The event was not handled within {} ms.\n", event_info.wait_timeout.count());
+		}
+	}
+	return ret;
+}
+
+// "--generate-event <event> --use-pid-as-gid" with many PIDs: one event for each process
+// group, all from this process. The group leader (the process with the PID) counts as
+// confirmation, when it has ended. A leader, that still runs after "--wait-timeout",
+// is reported as unconfirmed: it may handle the event and go on. The time of each group
+// counts from its own event. The waits overlap, so all groups together take about one
+// "--wait-timeout" after the last event, not one each.
+struct group_delivery {
+	uint32_t group{ 0 };
+	HANDLE process{ nullptr };
+	// Time of the event, as a FILETIME, to compare with the exit time of the process.
+	uint64_t generated_at{ 0 };
+	// The same moment on the clock of the deadline: the wait of each group starts here.
+	std::chrono::steady_clock::time_point sent_at{};
+	std::string error{};
+	std::optional<double> latency_ms{ std::nullopt };
+	bool unconfirmed{ false };
+};
+
+uint64_t FileTimeToUInt64(FILETIME time) {
+	return (uint64_t{ time.dwHighDateTime } << 32) | time.dwLowDateTime;
+}
+
+void DeliverCtrlEvent(group_delivery& delivery, ConsoleCtrlEvent event) {
+	// The event of a group only reaches processes of the same console.
+	(void)FreeConsole();
+	if (!trace_call("AttachConsole", "process", [&] { return AttachConsole(delivery.group); })) {
+		auto error = GetLastError();
+		delivery.error = fmt::format("AttachConsole() failed with error {} - {}", error, get_error_message(error).value_or(""));
+		return;
+	}
+	FILETIME now{};
+	GetSystemTimePreciseAsFileTime(&now);
+	delivery.generated_at = FileTimeToUInt64(now);
+	delivery.sent_at = std::chrono::steady_clock::now();
+	if (!generate_ctrl_event(event, delivery.group)) {
+		auto error = GetLastError();
+		delivery.error = fmt::format("GenerateConsoleCtrlEvent() failed with error {} - {}", error, get_error_message(error).value_or(""));
+		delivery.generated_at = 0;
+	}
+}
+
+// Waits for the end of the group leader until `deadline`, and takes the latency from its
+// exit time, so that a leader, that ended while another one was waited for, is exact.
+void ConfirmCtrlEvent(group_delivery& delivery, std::chrono::steady_clock::time_point deadline) {
+	const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+	const DWORD timeout = static_cast<DWORD>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+	const DWORD waited = WaitForSingleObject(delivery.process, timeout);
+	if (waited == WAIT_TIMEOUT) {
+		delivery.unconfirmed = true;
+		return;
+	}
+	if (waited != WAIT_OBJECT_0) {
+		auto error = GetLastError();
+		delivery.error = fmt::format("WaitForSingleObject() failed with error {} - {}", error, get_error_message(error).value_or(""));
+		return;
+	}
+	FILETIME creation{}, exit{}, kernel{}, user{};
+	if (!GetProcessTimes(delivery.process, &creation, &exit, &kernel, &user)) {
+		delivery.error = "the exit time is unknown";
+		return;
+	}
+	const uint64_t exited_at = FileTimeToUInt64(exit);
+	// FILETIME counts 100 ns.
+	delivery.latency_ms = exited_at > delivery.generated_at ? static_cast<double>(exited_at - delivery.generated_at) / 1e4 : 0.0;
+}
+
+// Another process of the console, that this process is attached to. It stays there, while
+// this process attaches to the consoles of the groups, and leads back to the console then.
+std::optional<DWORD> ConsoleCompanion() {
+	std::vector<DWORD> PIDs(64);
+	for (;;) {
+		const DWORD count = GetConsoleProcessList(PIDs.data(), static_cast<DWORD>(PIDs.size()));
+		if (count == 0)
+			return std::nullopt;
+		if (count <= PIDs.size()) {
+			auto other = std::find_if(PIDs.begin(), PIDs.begin() + count, [](DWORD PID) { return PID != GetCurrentProcessId(); });
+			if (other == PIDs.begin() + count)
+				return std::nullopt;
+			return *other;
+		}
+		PIDs.resize(count);
+	}
+}
+
+bool IsConsoleStream(FILE* stream) {
+	DWORD mode{};
+	return GetConsoleMode(std::bit_cast<HANDLE>(_get_osfhandle(_fileno(stream))), &mode) != 0;
+}
+
+// After AttachConsole() to another console, the handles of the own console are invalid.
+// Attaches back to it (through `companion`, or else through the parent process), and
+// points `console_streams` to a new CONOUT$. Streams on a pipe or file keep their handle.
+void ReattachOwnConsole(std::optional<DWORD> companion, std::span<FILE* const> console_streams) {
+	(void)FreeConsole();
+	const bool attached = (companion.has_value() && trace_call("AttachConsole", "process", [&] { return AttachConsole(*companion); }))
+		|| trace_call("AttachConsole", "process", [&] { return AttachConsole(ATTACH_PARENT_PROCESS); });
+	if (!attached)
+		return;
+	for (FILE* stream : console_streams) {
+		HANDLE conout = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (conout == INVALID_HANDLE_VALUE)
+			return;
+		int fd = _open_osfhandle(std::bit_cast<intptr_t>(conout), 0);
+		if (fd == -1) {
+			CloseHandle(conout);
+			return;
+		}
+		(void)_dup2(fd, _fileno(stream));
+		_close(fd);
+	}
+}
+
+bool GenerateCtrlEventBatch(FILE* fOut, FILE* fErr, const std::vector<uint32_t>& PIDs, generate_event_info event_info, output_format format) {
+	// An event for the whole console must not end the batch halfway.
+	const ctrl_event_handler handler{};
+	if (!handler.installed())
+		fmt::print(fErr, "Warning: SetConsoleCtrlHandler() failed. This process might exit abnormaly.\n");
+
+	// Noted before the first AttachConsole(), for the report.
+	const std::optional<DWORD> companion = ConsoleCompanion();
+	std::vector<FILE*> console_streams{};
+	for (FILE* stream : { fOut, fErr }) {
+		if (IsConsoleStream(stream))
+			console_streams.push_back(stream);
+	}
+
+	std::vector<group_delivery> deliveries{};
+	for (uint32_t PID : PIDs) {
+		if (std::any_of(deliveries.begin(), deliveries.end(), [&](const group_delivery& delivery) { return delivery.group == PID; }))
+			continue;
+		group_delivery& delivery = deliveries.emplace_back(group_delivery{ .group{PID} });
+		// Opened before the event, so that the end of the leader cannot be missed.
+		delivery.process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, delivery.group);
+		if (delivery.process == nullptr) {
+			auto error = GetLastError();
+			delivery.error = fmt::format("OpenProcess() failed with error {} - {}", error, get_error_message(error).value_or(""));
+		}
+	}
+	{
+		trace_scope trace{ "deliver ctrl events", "process" };
+		trace.set_arg("groups", static_cast<int64_t>(deliveries.size()));
+		for (group_delivery& delivery : deliveries) {
+			if (delivery.error.empty())
+				DeliverCtrlEvent(delivery, event_info.event);
+		}
+	}
+	ReattachOwnConsole(companion, console_streams);
+	if (event_info.wait_timeout.count() > 0) {
+		trace_scope trace{ "confirm ctrl events", "process" };
+		for (group_delivery& delivery : deliveries) {
+			if (delivery.error.empty())
+				ConfirmCtrlEvent(delivery, delivery.sent_at + event_info.wait_timeout);
+		}
+	}
+
+	std::string report{};
+	auto out = std::back_inserter(report);
+	std::vector<double> latencies{};
+	uint32_t slowest_group{ 0 };
+	for (group_delivery& delivery : deliveries) {
+		if (delivery.latency_ms) {
+			if (latencies.empty() || *delivery.latency_ms > *std::max_element(latencies.begin(), latencies.end()))
+				slowest_group = delivery.group;
+			latencies.push_back(*delivery.latency_ms);
+		}
+		const bool ok = delivery.error.empty();
+		if (format == output_format::json) {
+			fmt::format_to(out, "{{\"group\":{},\"ok\":{},\"confirmed\":{}", delivery.group, ok, delivery.latency_ms.has_value());
+			if (delivery.latency_ms)
+				fmt::format_to(out, ",\"latency_ms\":{:.3f}", *delivery.latency_ms);
+			if (!ok)
+				fmt::format_to(out, ",\"error\":{}", json_string(delivery.error));
+			report += "}\n";
+		}
+		else if (delivery.latency_ms) {
+			fmt::format_to(out, "group {}: confirmed after {:.3f} ms\n", delivery.group, *delivery.latency_ms);
+		}
+		else if (delivery.unconfirmed) {
+			fmt::format_to(out, "group {}: event generated, the leader still runs after {} ms\n", delivery.group, event_info.wait_timeout.count());
+		}
+		else {
+			fmt::format_to(out, "group {}: {}\n", delivery.group, ok ? std::string{ "event generated" } : delivery.error);
+		}
+		if (delivery.process != nullptr)
+			CloseHandle(delivery.process);
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double fraction) {
+		if (latencies.empty())
+			return 0.0;
+		return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(latencies.size())))];
+	};
+	// Only a failed delivery fails the batch, not a leader, that is still running.
+	const bool all_ok = std::all_of(deliveries.begin(), deliveries.end(), [](const group_delivery& delivery) { return delivery.error.empty(); });
+	const auto unconfirmed = std::count_if(deliveries.begin(), deliveries.end(), [](const group_delivery& delivery) { return delivery.unconfirmed; });
+	if (format == output_format::json) {
+		fmt::format_to(out, "{{\"groups\":{},\"confirmed\":{},\"unconfirmed\":{},\"p50_ms\":{:.3f},\"p99_ms\":{:.3f},\"max_ms\":{:.3f},\"slowest_group\":{}}}\n",
+			deliveries.size(), latencies.size(), unconfirmed, percentile(0.5), percentile(0.99), percentile(1.0), slowest_group);
+	}
+	else {
+		fmt::format_to(out, "{} of {} groups confirmed ({} unconfirmed), p50 {:.3f} ms, p99 {:.3f} ms, slowest {:.3f} ms (group {})\n",
+			latencies.size(), deliveries.size(), unconfirmed, percentile(0.5), percentile(0.99), percentile(1.0), slowest_group);
+	}
+	return WriteAtOnce(fOut, report) && all_ok;
+}
+
+bool AttachToConsole(FILE*stream, uint32_t PID, change_con_mode change_mode) {
+	if (!FreeConsole()) {
+		auto error = GetLastError();
+		auto message = get_error_message(error);
+		fmt::print(stream, "FreeConsole() failed, but we are ignoring that. The error is {:#x} with message is {}{}{}\n",
+			error, quote_open, message.value_or(""), quote_close);
+	}
+	static_assert(sizeof(PID) == sizeof(DWORD) && std::is_unsigned_v<decltype(PID)> == std::is_unsigned_v<DWORD>);
+	if (!trace_call("AttachConsole", "process", [&] { return AttachConsole(PID); })) {
+		auto error = GetLastError();
+		auto message = get_error_message(error);
+		fmt::print(stream, "AttachConsole({}) failed with error {} - {}", PID, error, indent_message("  ", message.value_or("")));
+		return false;
+	}
+	fmt::print(stream, "Attached to console of process {}\n", PID);
+	//HWND hwnd = GetConsoleWindow();
+	//if (hwnd != NULL) {
+
+	//	if (!ShowWindow(hwnd, SW_SHOWNORMAL)) {
+	//		//auto error = GetLastError();
+	//		//auto message = get_error_message(error);
+	//		//fmt::print(stream, "ShowWindow() failed with error {} - {}", error, indent_message("  ", message.value_or("")));
+	//		//return false;
+	//	}
+	//}
+	////else {
+	////	fmt::print(stream, "GetConsoleWindow() returned NULL.\n");
+	////	return false;
+	////}
+	return true;
+}
+
+// A process of stty.exe, that was started with "--no-self-spawn" for the console of a PID.
+struct child_process {
+	HANDLE process{ nullptr };
+	// The read end of the pipe behind "--handle-out" and "--handle-err".
+	std::unique_ptr<byte_stream> out{};
+};
+
+// Starts "stty.exe --pid <pid> --no-self-spawn <arguments>". The child inherits only
+// its end of the pipe. Many children can be started from parallel threads this way,
+// without one of them keeping the pipe of another one open.
+std::optional<child_process> StartSelf(FILE* fErr, DWORD pid, std::string_view arguments) {
+
+	std::optional<child_process> started{ std::nullopt };
+	std::string prog_path{};
+	STARTUPINFOEXA startupinfo{};
+	PROCESS_INFORMATION procinfo{};
+	std::string cmd_line{};
+	std::unique_ptr<char[]> mutable_cmd_line_buf{};
+	std::unique_ptr<char[]> attribute_list_buf{};
+	SIZE_T attribute_list_size{ 0 };
+
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
+
+	HANDLE hChildStdOut_read{ nullptr };
+	HANDLE hChildStdOut_write{ nullptr };
+	if (!CreatePipe(&hChildStdOut_read, &hChildStdOut_write, &sa, 0)) {
+		fmt::print(fErr, "Failed to create pipe\n");
+		goto cleanup;
+	}
+	if (!SetHandleInformation(hChildStdOut_read, HANDLE_FLAG_INHERIT, 0)) {
+		fmt::print(fErr, "Failed to disable inheritance of a Handle\n");
+		goto cleanup;
+	}
+	{
+		auto prog_path_opt = GetProgPath(fErr);
+		if (!prog_path_opt.has_value()) {
+			goto cleanup;
+		}
+		prog_path = *prog_path_opt;
+	}
+
+	startupinfo.StartupInfo.cb = sizeof(startupinfo);
+
+	// startupinfo.hStdError  = g_hChildStd_OUT_Wr;
+	// startupinfo.hStdOutput = g_hChildStd_OUT_Wr;
+	// startupinfo.hStdInput  = g_hChildStd_IN_Rd;
+	// startupinfo.dwFlags   |= STARTF_USESTDHANDLES;
+
+	(void)InitializeProcThreadAttributeList(nullptr, 1, 0, &attribute_list_size);
+	attribute_list_buf = std::make_unique<char[]>(attribute_list_size);
+	startupinfo.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attribute_list_buf.get());
+	if (!InitializeProcThreadAttributeList(startupinfo.lpAttributeList, 1, 0, &attribute_list_size)) {
+		startupinfo.lpAttributeList = nullptr;
+		fmt::print(fErr, "InitializeProcThreadAttributeList() failed with {:#x}\n", GetLastError());
+		goto cleanup;
+	}
+	if (!UpdateProcThreadAttribute(startupinfo.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+		&hChildStdOut_write, sizeof(hChildStdOut_write), nullptr, nullptr)) {
+		fmt::print(fErr, "UpdateProcThreadAttribute() failed with {:#x}\n", GetLastError());
+		goto cleanup;
+	}
+
+	cmd_line = fmt::format("\"{0}\" --pid {1} --handle-out {2} --handle-err {2} --no-self-spawn {3}",
+		prog_path, pid, reinterpret_cast<uintptr_t>(hChildStdOut_write), arguments);
+
+	mutable_cmd_line_buf = std::make_unique<char[]>(cmd_line.length() + 1);
+	std::memcpy(mutable_cmd_line_buf.get(), cmd_line.c_str(), cmd_line.length() * sizeof(char));
+	mutable_cmd_line_buf.get()[cmd_line.length()] = '\0';
+
+
+	if (!trace_call("CreateProcess", "process", [&] { return CreateProcessA(prog_path.c_str(), mutable_cmd_line_buf.get(), nullptr, nullptr, true,
+		EXTENDED_STARTUPINFO_PRESENT, nullptr, nullptr, &startupinfo.StartupInfo, &procinfo); })) {
+		auto error = GetLastError();
+		fmt::print(fErr, "Couldn't create child process - {:#x} {}\n", error, get_error_message(error).value_or(""));
+		goto cleanup;
+	}
+	CloseHandle(procinfo.hThread);
+	procinfo.hThread = nullptr;
+
+	CloseHandle(hChildStdOut_write);
+	hChildStdOut_write = nullptr;
+
+	started = child_process{ .process{procinfo.hProcess}, .out{open_byte_stream(hChildStdOut_read, true)} };
+	procinfo.hProcess = nullptr;
+	hChildStdOut_read = nullptr;
+
+cleanup:
+	if (startupinfo.lpAttributeList != nullptr) {
+		DeleteProcThreadAttributeList(startupinfo.lpAttributeList);
+		startupinfo.lpAttributeList = nullptr;
+	}
+	if (procinfo.hProcess != nullptr) {
+		CloseHandle(procinfo.hProcess);
+		procinfo.hProcess = nullptr;
+	}
+	if (procinfo.hThread != nullptr) {
+		CloseHandle(procinfo.hThread);
+		procinfo.hThread = nullptr;
+	}
+
+	if (hChildStdOut_read) {
+		CloseHandle(hChildStdOut_read);
+		hChildStdOut_read = nullptr;
+	}
+	if (hChildStdOut_write) {
+		CloseHandle(hChildStdOut_write);
+		hChildStdOut_write = nullptr;
+	}
+
+	return started;
+}
+
+// Waits for the end of the child and closes its handle. Returns its exit code.
+std::optional<DWORD> WaitForChild(FILE* fErr, child_process& child) {
+	DWORD exitCode{};
+	trace_call("wait for child", "process", [&] { return WaitForSingleObject(child.process, INFINITE); });
+
+	const bool got_exit_code = 0 != GetExitCodeProcess(child.process, &exitCode);
+	if (!got_exit_code)
+		fmt::print(fErr, "Failed to get Exit Code of Process.\n");
+	CloseHandle(child.process);
+	child.process = nullptr;
+	if (!got_exit_code)
+		return std::nullopt;
+	return exitCode;
+}
+
+bool SpawnSelf(FILE* fOut, FILE* fErr, DWORD pid, change_con_mode change_mode, std::optional<generate_event_info> event_info, buffer_size_option buffer_size, std::optional<stats_option> stats) {
+
+	//HANDLE hOut = std::bit_cast<HANDLE>(_get_osfhandle(_fileno(fOut)));
+	//HANDLE hErr = std::bit_cast<HANDLE>(_get_osfhandle(_fileno(fErr)));
+	std::string arguments{};
+	{
+		auto set_conin_str = change_mode.conin.to_string();
+		auto set_conout_str = change_mode.conout.to_string();
+		if (!set_conin_str ||!set_conout_str) {
+			fmt::print(fErr, "internal error");
+			return false;
+		}
+		std::string generate_event_str{};
+		if (event_info.has_value()) {
+			generate_event_str = fmt::format(" --generate-event \"{}\"{} --wait-timeout {}", event_to_string(event_info->event),
+				(event_info->use_pid_as_group_id ? " --use-pid-as-gid" : ""), event_info->wait_timeout.count());
+		}
+
+		arguments = fmt::format("--set-in-mode \"{}\" --set-out-mode \"{}\"{}",
+			*set_conin_str, *set_conout_str, generate_event_str);
+	}
+
+	std::optional<child_process> child = StartSelf(fErr, pid, arguments);
+	if (!child)
+		return false;
+
+	bool relayed{ false };
+	{
+		file_sink out{ fOut };
+		relayed = relay_with_stats<byte_source, byte_sink>(stats, "child output", fErr, *child->out, out, [&](byte_source& in, byte_sink& to) {
+			return run_relay(ReadHandleWriteFileByteWiseAsync(in, to, buffer_size));
+		});
+		child->out.reset();
+	}
+	if (!relayed)
+		fmt::print(fErr, "Failed to relay the output of the child process.\n");
+
+	std::optional<DWORD> exitCode = WaitForChild(fErr, *child);
+	if (!exitCode)
+		return false;
+
+	if (*exitCode != 0) {
+		fmt::print(fErr, "Child process failed with exited code: {}", *exitCode);
+		return false;
+	}
+
+	//hPipeListenerThread = reinterpret_cast<HANDLE>(_beginthread(PipeListener, 0, hPipeIn));
+	return relayed;
+}
+
+// Every read of `in` is passed on with a flush of its own, so it is not held back in the
+// buffer of `fOut`.
+relay_task RelayRecords(byte_source& in, FILE* fOut) {
+	char buffer[4096];
+	for (io_result result = co_await async_read(in, buffer); result.ok(); result = co_await async_read(in, buffer)) {
+		if (!WriteAtOnce(fOut, std::string_view(buffer, result.count)))
+			co_return false;
+	}
+	co_return true;
+}
+
+// Runs a child, that writes records as it goes, e.g. of "--watch".
+bool RelayThroughChild(FILE* fOut, FILE* fErr, uint32_t PID, std::string_view arguments) {
+	std::optional<child_process> child = StartSelf(fErr, PID, arguments);
+	if (!child)
+		return false;
+
+	const bool relayed = run_relay(RelayRecords(*child->out, fOut));
+	// Without a reader, the child would only notice at the next change.
+	if (!relayed)
+		TerminateProcess(child->process, 1);
+	child->out.reset();
+
+	std::optional<DWORD> exitCode = WaitForChild(fErr, *child);
+	if (!exitCode || !relayed)
+		return false;
+	if (*exitCode != 0) {
+		fmt::print(fErr, "Child process failed with exited code: {}", *exitCode);
+		return false;
+	}
+	return true;
+}
+
+bool WatchThroughChild(FILE* fOut, FILE* fErr, uint32_t PID, output_format format, std::chrono::milliseconds interval) {
+	return RelayThroughChild(fOut, fErr, PID, fmt::format("--watch-interval {} --format {}",
+		interval.count(), output_format_to_string(format)));
+}
+
+// The batch leaves the console of stty.exe for the consoles of the groups, so a child
+// does it. The first `given` of `PIDs` are the ones of "--pid", the rest is from
+// `pid_file`, which the child reads itself, to keep its command line short.
+bool GenerateCtrlEventBatchThroughChild(FILE* fOut, FILE* fErr, const std::vector<uint32_t>& PIDs, std::size_t given,
+	const std::optional<std::string>& pid_file, generate_event_info event_info, output_format format) {
+	std::string arguments = fmt::format("--generate-event \"{}\" --use-pid-as-gid --wait-timeout {} --format {}",
+		event_to_string(event_info.event), event_info.wait_timeout.count(), output_format_to_string(format));
+	for (std::size_t i = 1; i < given; ++i)
+		fmt::format_to(std::back_inserter(arguments), " --pid {}", PIDs[i]);
+	if (pid_file)
+		fmt::format_to(std::back_inserter(arguments), " --pid-file \"{}\"", *pid_file);
+	// StartSelf() passes the first PID as "--pid". If it is from the file, the child sees it
+	// twice and drops one.
+	return RelayThroughChild(fOut, fErr, PIDs.front(), arguments);
+}
+
+constexpr std::string_view BROKER_TOOL_NAME{ "stty" };
+
+// What a session of the broker asks for: the part of a secondary process after AttachToConsole().
+struct query_request {
+	change_con_mode change_mode{};
+	std::optional<generate_event_info> event_info{ std::nullopt };
+};
+
+std::string QueryArguments(const query_request& request) {
+	std::string arguments = fmt::format("--set-in-mode {} --set-out-mode {}",
+		request.change_mode.conin.to_string().value_or(""), request.change_mode.conout.to_string().value_or(""));
+	if (request.event_info.has_value()) {
+		arguments += fmt::format(" --generate-event {}{} --wait-timeout {}", event_to_string(request.event_info->event),
+			(request.event_info->use_pid_as_group_id ? " --use-pid-as-gid" : ""), request.event_info->wait_timeout.count());
+	}
+	return arguments;
+}
+
+std::optional<query_request> ParseQueryArguments(const std::vector<std::string_view>& arguments) {
+	query_request request{};
+	for (std::size_t i = 0; i < arguments.size(); ++i) {
+		const bool next_available = i + 1 < arguments.size();
+		if (arguments[i] == "--set-in-mode" && next_available) {
+			auto mode = parse_set_and_reset_string<DWORD>(arguments[++i]);
+			if (!mode)
+				return std::nullopt;
+			request.change_mode.conin = *mode;
+		}
+		else if (arguments[i] == "--set-out-mode" && next_available) {
+			auto mode = parse_set_and_reset_string<DWORD>(arguments[++i]);
+			if (!mode)
+				return std::nullopt;
+			request.change_mode.conout = *mode;
+		}
+		else if (arguments[i] == "--generate-event" && next_available) {
+			auto event_or_error = parse_event_string(arguments[++i]);
+			if (std::holds_alternative<error_tag>(event_or_error))
+				return std::nullopt;
+			if (auto event = std::get<std::optional<ConsoleCtrlEvent>>(event_or_error))
+				request.event_info = generate_event_info{ .event = *event };
+		}
+		else if (arguments[i] == "--use-pid-as-gid" && request.event_info.has_value()) {
+			request.event_info->use_pid_as_group_id = true;
+		}
+		else if (arguments[i] == "--wait-timeout" && next_available && request.event_info.has_value()) {
+			auto milliseconds = string_to_uint<uint32_t>(arguments[++i]);
+			if (!milliseconds)
+				return std::nullopt;
+			request.event_info->wait_timeout = std::chrono::milliseconds{ *milliseconds };
+		}
+		else {
+			return std::nullopt;
+		}
+	}
+	return request;
+}
+
+struct captured_output {
+	bool success{ false };
+	std::string text{};
+};
+
+// Runs `query` with a CRT stream, like the one of "--handle-out", and collects, what it prints.
+std::optional<captured_output> CaptureOutput(const std::function<bool(FILE*)>& query) {
+	HANDLE h_read{ nullptr };
+	HANDLE h_write{ nullptr };
+	if (!CreatePipe(&h_read, &h_write, nullptr, 0))
+		return std::nullopt;
+
+	captured_output output{};
+	std::thread reader([&text = output.text, in = open_byte_stream(h_read, true)]() {
+		char buffer[4096];
+		for (io_result result = in->read(buffer); result.ok(); result = in->read(buffer))
+			text.append(buffer, result.count);
+	});
+
+	int fd = _open_osfhandle(std::bit_cast<intptr_t>(h_write), 0);
+	FILE* stream = (fd == -1) ? nullptr : _fdopen(fd, "w");
+	if (stream != nullptr) {
+		output.success = query(stream);
+		std::fclose(stream);
+	}
+	else if (fd != -1) {
+		_close(fd);
+	}
+	else {
+		CloseHandle(h_write);
+	}
+	reader.join();
+	if (stream == nullptr)
+		return std::nullopt;
+	return output;
+}
+
+// Answers the queries of other invocations for the console of `PID` (option "--broker"),
+// until `PID` ends. The answer of a session is one frame: '0' or '1' for the result,
+// then the output.
+bool RunBroker(FILE* fErr, uint32_t PID) {
+	auto listener = listen_local(broker_endpoint(BROKER_TOOL_NAME, PID));
+	if (!listener) {
+		fmt::print(fErr, "Could not create the endpoint of the broker. Does a broker for process {} run already?\n", PID);
+		return false;
+	}
+
+	// The handle keeps the PID from being reused, while we wait for the process.
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, PID);
+	if (hProcess == nullptr) {
+		auto error = GetLastError();
+		fmt::print(fErr, "OpenProcess({}) failed with error {} - {}", PID, error, indent_message("  ", get_error_message(error).value_or("")));
+		return false;
+	}
+	if (!AttachToConsole(fErr, PID, change_con_mode{})) {
+		CloseHandle(hProcess);
+		return false;
+	}
+	// The broker keeps the console alive, so it must not outlive the target process.
+	std::thread([hProcess] {
+		WaitForSingleObject(hProcess, INFINITE);
+		ExitProcess(0);
+	}).detach();
+
+	// The queries change console modes and install a ctrl handler for the whole
+	// process. They take turns.
+	std::mutex query_mutex{};
+	serve_broker_sessions(*listener, [PID, &query_mutex](broker_session& session) {
+		std::optional<query_request> request = ParseQueryArguments(session.arguments());
+		if (!request) {
+			session.reject("The arguments of the session are not valid.");
+			return;
+		}
+		if (!session.accept())
+			return;
+
+		std::optional<captured_output> output{};
+		{
+			std::lock_guard lock{ query_mutex };
+			output = CaptureOutput([&](FILE* stream) {
+				fmt::print(stream, "Attached to console of process {}\n", PID);
+				bool success = PrintInfo(stream, request->change_mode);
+				if (request->event_info.has_value()) {
+					fmt::print(stream, "\n");
+					success = GenerateCtrlEvent(stream, *request->event_info, PID) && success;
+				}
+				return success;
+			});
+		}
+		if (!output)
+			output = captured_output{ .success{false}, .text{"The broker could not capture the output of the query.\n"} };
+		(void)write_frame(*session.connection(), (output->success ? "0" : "1") + output->text);
+	});
+	fmt::print(fErr, "The broker stopped accepting sessions.\n");
+	return false;
+}
+
+// Asks the broker of the console of `PID`. Returns std::nullopt, if no broker serves
+// that console; the caller spawns a secondary process then.
+std::optional<bool> QueryThroughBroker(FILE* fOut, FILE* fErr, uint32_t PID, const query_request& request) {
+	broker_connection connection = connect_to_broker(broker_endpoint(BROKER_TOOL_NAME, PID), QueryArguments(request));
+	switch (connection.status) {
+	case broker_status::absent:
+		return std::nullopt;
+	case broker_status::rejected:
+		fmt::print(fErr, "The broker of the console of process {} rejected the query: {}\n", PID, connection.reason);
+		return false;
+	case broker_status::accepted:
+		break;
+	}
+	constexpr std::size_t MAX_ANSWER_SIZE{ 1024u * 1024u };
+	std::optional<std::string> answer = read_frame(*connection.stream, MAX_ANSWER_SIZE);
+	if (!answer || answer->empty()) {
+		fmt::print(fErr, "The broker of the console of process {} did not answer.\n", PID);
+		return false;
+	}
+	fmt::print(fOut, "{}", std::string_view{ *answer }.substr(1));
+	return answer->front() == '0';
+}
+
+// Reads the PIDs of "--pid-file": numbers in base ten, separated by white space or
+// commas. A '#' starts a comment, that runs to the end of the line.
+std::optional<std::vector<uint32_t>> ReadPidFile(FILE* fErr, const std::string& path) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		fmt::print(fErr, "Could not open the PID file {}{}{}.\n", quote_open, path, quote_close);
+		return std::nullopt;
+	}
+	std::string text{};
+	char buffer[4096];
+	for (std::size_t count = std::fread(buffer, 1, sizeof(buffer), file); count > 0; count = std::fread(buffer, 1, sizeof(buffer), file))
+		text.append(buffer, count);
+	std::fclose(file);
+
+	std::vector<uint32_t> PIDs{};
+	std::string_view rest{ text };
+	while (!rest.empty()) {
+		if (rest.front() == '#') {
+			rest.remove_prefix(std::min(rest.find('\n'), rest.size()));
+			continue;
+		}
+		if (rest.front() == ' ' || rest.front() == '\t' || rest.front() == '\r' || rest.front() == '\n' || rest.front() == ',') {
+			rest.remove_prefix(1);
+			continue;
+		}
+		const std::size_t end = std::min(rest.find_first_of(" \t\r\n,#"), rest.size());
+		auto PID = string_to_uint<uint32_t>(rest.substr(0, end));
+		if (!PID) {
+			fmt::print(fErr, "{}{}{} in the PID file is not a process identifier in base ten.\n", quote_open, rest.substr(0, end), quote_close);
+			return std::nullopt;
+		}
+		PIDs.push_back(*PID);
+		rest.remove_prefix(end);
+	}
+	return PIDs;
+}
+
+struct survey_line {
+	// One JSON line or one binary record, as the child wrote it.
+	std::string answer{};
+	bool ok{ false };
+};
+
+survey_line NoAnswer(uint32_t PID, output_format format, std::string error) {
+	const console_info info{ .pid{PID}, .error_code{NO_ANSWER_ERROR_CODE}, .error{std::move(error)} };
+	if (format == output_format::binary) {
+		const console_record record = ConsoleInfoToRecord(info);
+		return survey_line{ .answer{record.begin(), record.end()} };
+	}
+	return survey_line{ .answer{ConsoleInfoToJson(info)} };
+}
+
+// Asks a child with "--format json" or "--format binary" about the console of `PID`.
+survey_line InspectThroughChild(FILE* fErr, uint32_t PID, output_format format) {
+	std::optional<child_process> child = StartSelf(fErr, PID, fmt::format("--format {}", output_format_to_string(format)));
+	if (!child)
+		return NoAnswer(PID, format, "The child process could not be started.");
+
+	std::string answer{};
+	char buffer[4096];
+	for (io_result result = child->out->read(buffer); result.ok(); result = child->out->read(buffer))
+		answer.append(buffer, result.count);
+	child->out.reset();
+	std::optional<DWORD> exitCode = WaitForChild(fErr, *child);
+
+	const bool valid = (format == output_format::binary)
+		? IsConsoleRecord(answer)
+		: answer.starts_with('{') && answer.ends_with('\n') && answer.find('\n') == answer.size() - 1;
+	if (!valid) {
+		return NoAnswer(PID, format, fmt::format("The child process ended with exit code {} and without an answer.",
+			exitCode ? std::to_string(*exitCode) : std::string{ "unknown" }));
+	}
+	return survey_line{ .answer{std::move(answer)}, .ok{exitCode == DWORD{ 0 }} };
+}
+
+// A console, that this process shares: no child is needed.
+survey_line InspectDirectly(uint32_t PID, output_format format) {
+	const console_info info = CollectConsoleInfo(PID);
+	if (format == output_format::binary) {
+		const console_record record = ConsoleInfoToRecord(info);
+		return survey_line{ .answer{record.begin(), record.end()}, .ok{true} };
+	}
+	return survey_line{ .answer{ConsoleInfoToJson(info)}, .ok{true} };
+}
+
+// Inspects the consoles of `PIDs` with up to `jobs` children at a time. Every console
+// is one JSON line or binary record on `fOut`, in the order, in which the children finish.
+bool SurveyConsoles(FILE* fOut, FILE* fErr, const std::vector<uint32_t>& PIDs, unsigned jobs, output_format format, bool direct) {
+	std::atomic<std::size_t> next{ 0 };
+	std::atomic<bool> all_ok{ true };
+	std::mutex output_mutex{};
+	std::vector<std::thread> workers{};
+	const std::size_t worker_count = std::min<std::size_t>(jobs, PIDs.size());
+	for (std::size_t w = 0; w < worker_count; ++w) {
+		workers.emplace_back([&] {
+			trace_thread_name("survey");
+			for (std::size_t i = next++; i < PIDs.size(); i = next++) {
+				survey_line line = (direct && shares_console_with(PIDs[i]))
+					? InspectDirectly(PIDs[i], format)
+					: InspectThroughChild(fErr, PIDs[i], format);
+				std::lock_guard lock{ output_mutex };
+				if (!WriteAtOnce(fOut, line.answer) || !line.ok)
+					all_ok = false;
+			}
+		});
+	}
+	for (std::thread& worker : workers)
+		worker.join();
+	return all_ok;
+}
+
+int main(int argc, const char **argv) {
+	trace_session trace{ "stty" };
+	_set_fmode(_O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+	_setmode(_fileno(stdin), _O_BINARY);
+
+	if (argc <= 1) {
+		if (!PrintInfo(stdout, change_con_mode{}))
+			return 1;
+		return 0;
+	}
+	if (GetACP() != 65001) {
+		fmt::print(stderr, "The Active Code Page (ACP) for this process is not UTF-8 (65001).\n"
+			"Command line parsing is not supported.\n"
+			"Your version of Windows might be to old, so that the manifest embedded in the executable is not read. "
+			"The manifest specifies, that this executable wants UTF-8 as ACP.\n"
+			"As a workaround you can activate \"Beta: Use Unicode UTF-8 for worldwide language support\":\n"
+			"  - Press Win+R\n"
+			"  - Type \"intl.cpl\"\n"
+			"  - Goto Tab \"Administrative\"\n"
+			"  - Click on \"Change system locale\"\n"
+			"  - Set Checkbox \"Beta: Use Unicode UTF-8 for worldwide language support\"\n"
+			"\n");
+		PrintUsage(stderr);
+		return 1;
+	}
+
+
+	std::vector<uint32_t> PIDs{};
+	std::optional<std::string> pid_file{ std::nullopt };
+	unsigned jobs{ DEFAULT_SURVEY_JOBS };
+	output_format format{ output_format::text };
+	std::optional<std::chrono::milliseconds> watch{ std::nullopt };
+	std::optional<intptr_t> handle_out{ std::nullopt };
+	std::optional<intptr_t> handle_err{ std::nullopt };
+	bool no_self_spawn{ false };
+	change_con_mode change_mode{};
+	std::optional<generate_event_info> event_info{ std::nullopt };
+	std::optional<std::chrono::milliseconds> wait_timeout{ std::nullopt };
+	buffer_size_option buffer_size{};
+	std::optional<stats_option> stats{ std::nullopt };
+	bool broker{ false };
+	bool no_broker{ false };
+	// Spawn a process, even if this one is attached to the console of the PID already.
+	bool no_direct{ false };
+
+	for (int i = 1; i < argc; ++i) {
+		std::string_view current_arg{ argv[i] };
+		std::optional<std::string_view> next_arg{ std::nullopt };
+
+		{
+			int next_index = i + 1;
+			bool next_available = next_index < argc;
+			if (next_available)
+				next_arg = argv[next_index];
+		}
+
+
+		if (current_arg == "--pid") {
+			if (!next_arg) {
+				fmt::print(stderr, "No process identifier supplied for option \"--pid\".\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto PID = string_to_uint<uint32_t>(*next_arg);
+			if (!PID) {
+				fmt::print(stderr, "Process identifier supplied for option \"--pid\" is not a number in base ten.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			PIDs.push_back(*PID);
+		}
+		else if (current_arg == "--pid-file") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--pid-file\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			pid_file = std::string{ *next_arg };
+		}
+		else if (current_arg == "--jobs") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--jobs\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_jobs = string_to_uint<uint32_t>(*next_arg);
+			if (!opt_jobs || *opt_jobs == 0 || *opt_jobs > MAX_SURVEY_JOBS) {
+				fmt::print(stderr, "value for option \"--jobs\" is not a number between 1 and {}.\n", MAX_SURVEY_JOBS);
+				PrintUsage(stderr);
+				return 1;
+			}
+			jobs = *opt_jobs;
+		}
+		else if (current_arg == "--format") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--format\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_format = parse_output_format(*next_arg);
+			if (!opt_format) {
+				fmt::print(stderr, "value for option \"--format\" is not \"text\", \"json\" or \"binary\".\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			format = *opt_format;
+		}
+		else if (current_arg == "--json") {
+			format = output_format::json;
+		}
+		else if (current_arg == "--watch") {
+			watch = watch.value_or(std::chrono::milliseconds{ DEFAULT_WATCH_INTERVAL_MS });
+		}
+		else if (current_arg == "--watch-interval") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--watch-interval\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto milliseconds = string_to_uint<uint32_t>(*next_arg);
+			if (!milliseconds || *milliseconds < MIN_WATCH_INTERVAL_MS || *milliseconds > MAX_WATCH_INTERVAL_MS) {
+				fmt::print(stderr, "value for option \"--watch-interval\" is not a number of milliseconds between {} and {}.\n",
+					MIN_WATCH_INTERVAL_MS, MAX_WATCH_INTERVAL_MS);
+				PrintUsage(stderr);
+				return 1;
+			}
+			watch = std::chrono::milliseconds{ *milliseconds };
+		}
+		else if (current_arg == "--no-self-spawn") {
+			no_self_spawn = true;
+		}
+		else if (current_arg == "--broker") {
+			broker = true;
+		}
+		else if (current_arg == "--no-broker") {
+			no_broker = true;
+		}
+		else if (current_arg == "--no-direct") {
+			no_direct = true;
+		}
+		else if (current_arg == "--handle-out") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--handle-out\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
+			if (!opt_uint) {
+				fmt::print(stderr, "value for option \"--handle-out\" is not a number or not in range.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			handle_out = std::bit_cast<intptr_t>(opt_uint.value());
+		}
+		else if (current_arg == "--handle-err") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--handle-err\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_uint = string_to_uint<uintptr_t>(*next_arg);
+			if (!opt_uint) {
+				fmt::print(stderr, "value for option \"--handle-err\" is not a number or not in range.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			handle_err = std::bit_cast<intptr_t>(opt_uint.value());
+		}
+		else if (current_arg == "--set-in-mode") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--set-in-mode\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_in_mode = parse_set_and_reset_string<DWORD>(*next_arg);
+			if (!opt_in_mode) {
+				fmt::print(stderr, "value for option \"--set-in-mode\" is in the wrong format.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			change_mode.conin = *opt_in_mode;
+		}
+		else if (current_arg == "--set-out-mode") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--set-out-mode\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_out_mode = parse_set_and_reset_string<DWORD>(*next_arg);
+			if (!opt_out_mode) {
+				fmt::print(stderr, "value for option \"--set-in-mode\" is in the wrong format.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			change_mode.conout = *opt_out_mode;
+		}
+		else if (current_arg == "--buffer-size") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--buffer-size\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto opt_buffer_size = parse_buffer_size_option(*next_arg);
+			if (!opt_buffer_size) {
+				fmt::print(stderr, "value for option \"--buffer-size\" is not an even number between {} and {}, or \"auto\".\n", MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+				PrintUsage(stderr);
+				return 1;
+			}
+			buffer_size = *opt_buffer_size;
+		}
+		else if (current_arg == "--stats") {
+			stats = stats.value_or(stats_option{});
+		}
+		else if (current_arg == "--stats-interval") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--stats-interval\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto milliseconds = string_to_uint<uint32_t>(*next_arg);
+			if (!milliseconds || *milliseconds == 0) {
+				fmt::print(stderr, "value for option \"--stats-interval\" is not a positive number of milliseconds.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			stats = stats_option{ .interval{std::chrono::milliseconds{*milliseconds}} };
+		}
+		else if (current_arg == "--wait-timeout") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--wait-timeout\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1;
+			auto milliseconds = string_to_uint<uint32_t>(*next_arg);
+			if (!milliseconds) {
+				fmt::print(stderr, "value for option \"--wait-timeout\" is not a number of milliseconds.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			wait_timeout = std::chrono::milliseconds{ *milliseconds };
+		}
+		else if (current_arg == "--generate-event") {
+			if (!next_arg) {
+				fmt::print(stderr, "Missing value for option \"--generate-event\"\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			i += 1; // consume next arg
+
+			auto event_or_error = parse_event_string(*next_arg);
+			if (std::holds_alternative<error_tag>(event_or_error)) {
+				fmt::print(stderr, "value for option \"--generate-event\" wrong.\n");
+				PrintUsage(stderr);
+				return 1;
+			}
+			bool previous_option__use_pid_as_gid__discarded =
+					event_info.has_value() && event_info->use_pid_as_group_id;
+
+			auto opt_event = std::get<std::optional<ConsoleCtrlEvent>>(event_or_error);
+			if (opt_event.has_value()) {
+				event_info = generate_event_info{ .event = *opt_event };
+			}
+			else {
+				event_info.reset();
+			}
+			
+			auto after_next_index = i + 1;
+			bool after_next_available = after_next_index < argc;
+			if (after_next_available && std::string_view{ argv[after_next_index] } == "--use-pid-as-gid") {
+				i += 1; // consume after next arg
+				if (event_info.has_value()) {
+					event_info->use_pid_as_group_id = true;
+				}
+				else {
+					fmt::print(stderr, "Warning: Option {}--use-pid-as-gid{} ignored, because there is no event to generate.\n", quote_open, quote_close);
+				}
+			}
+			else if (previous_option__use_pid_as_gid__discarded) {
+				fmt::print(stderr, "Warning: previous option {0}--use-pid-as-gid{1} ignored, because it's not specefied directly after the <event> {0}{2}{1}.\n", quote_open, quote_close, *next_arg);
+			}
+			
+		}
+		else {
+			fmt::print(stderr, "Argument {}{}{} could not be interpreted\n", quote_open, current_arg, quote_close);
+			PrintUsage(stderr);
+			return 1;
+		}
+	}
+
+	int fdOut{};
+	FILE* fOut = stdout;
+	FILE* fErr = stderr;
+
+	if (handle_out) {
+		fdOut = _open_osfhandle(handle_out.value(), 0);
+		if (fdOut == -1)
+			return 1;
+		fOut = _fdopen(fdOut, "w");
+		if (fOut == nullptr)
+			return 1;
+	}
+
+	if (handle_err) {
+		int fdErr{};
+		if (handle_out && *handle_out == *handle_err) {
+			fdErr = _dup(fdOut);
+			if (fdErr == -1)
+				return 1;
+		}
+		else {
+			fdErr = _open_osfhandle(handle_err.value(), 0);
+			if (fdErr == -1)
+				return 1;
+		}
+		fErr = _fdopen(fdErr, "w");
+		if (fOut == nullptr)
+			return 1;
+		
+	}
+
+	if (wait_timeout) {
+		if (event_info.has_value())
+			event_info->wait_timeout = *wait_timeout;
+		else
+			fmt::print(stderr, "Warning: Option {}--wait-timeout{} ignored, because there is no event to generate.\n", quote_open, quote_close);
+	}
+
+	const std::size_t given_PIDs = PIDs.size();
+	if (pid_file) {
+		std::optional<std::vector<uint32_t>> listed = ReadPidFile(fErr, *pid_file);
+		if (!listed)
+			return 1;
+		PIDs.insert(PIDs.end(), listed->begin(), listed->end());
+	}
+
+	if (watch) {
+		if (PIDs.size() > 1 || pid_file || broker || event_info.has_value() || !change_mode.conin.unchanging() || !change_mode.conout.unchanging()) {
+			fmt::print(fErr, "Error: \"--watch\" only reads the properties of one console. "
+				"It does not go with more than one PID, \"--broker\", \"--set-in-mode\", \"--set-out-mode\" or \"--generate-event\".\n");
+			return 1;
+		}
+		if (format == output_format::binary) {
+			fmt::print(fErr, "Error: \"--watch\" writes \"text\" or \"json\".\n");
+			return 1;
+		}
+		if (PIDs.empty())
+			return WatchConsole(fOut, fErr, format, *watch, nullptr) ? 0 : 1;
+		if (no_self_spawn || (!no_direct && shares_console_with(PIDs.front())))
+			return WatchAttached(fOut, fErr, PIDs.front(), format, *watch) ? 0 : 1;
+		return WatchThroughChild(fOut, fErr, PIDs.front(), format, *watch) ? 0 : 1;
+	}
+
+	// An event for each of many process groups.
+	if (event_info.has_value() && event_info->use_pid_as_group_id && (PIDs.size() > 1 || pid_file)) {
+		if (broker || !change_mode.conin.unchanging() || !change_mode.conout.unchanging() || format == output_format::binary) {
+			fmt::print(fErr, "Error: With more than one PID, \"--generate-event\" only generates events. "
+				"\"--broker\", \"--set-in-mode\", \"--set-out-mode\" and \"--format binary\" need a single \"--pid\".\n");
+			return 1;
+		}
+		// GenerateConsoleCtrlEvent() delivers CTRL_C_EVENT only to group 0, the whole console.
+		if (event_info->event == ConsoleCtrlEvent::ctrl_c_event) {
+			fmt::print(fErr, "Error: Windows does not deliver \"ctrl-c\" to a process group. "
+				"Use \"--generate-event ctrl-break\" with more than one PID.\n");
+			return 1;
+		}
+		if (PIDs.empty())
+			return 0;
+		if (no_self_spawn)
+			return GenerateCtrlEventBatch(fOut, fErr, PIDs, *event_info, format) ? 0 : 1;
+		return GenerateCtrlEventBatchThroughChild(fOut, fErr, PIDs, given_PIDs, pid_file, *event_info, format) ? 0 : 1;
+	}
+
+	// Many consoles, or one as JSON through a child: the survey.
+	if (PIDs.size() > 1 || pid_file || (format != output_format::text && !PIDs.empty() && !no_self_spawn)) {
+		if (broker || no_self_spawn || event_info.has_value() || !change_mode.conin.unchanging() || !change_mode.conout.unchanging()) {
+			fmt::print(fErr, "Error: With more than one PID, stty.exe only reads the properties of the consoles. "
+				"\"--broker\", \"--no-self-spawn\", \"--set-in-mode\", \"--set-out-mode\" and \"--generate-event\" without \"--use-pid-as-gid\" need a single \"--pid\".\n");
+			return 1;
+		}
+		// Text has no form for many consoles, so it is JSON then.
+		return SurveyConsoles(fOut, fErr, PIDs, jobs, format == output_format::text ? output_format::json : format, !no_direct) ? 0 : 1;
+	}
+	const std::optional<uint32_t> PID = PIDs.empty() ? std::nullopt : std::optional<uint32_t>{ PIDs.front() };
+
+	bool success = true;
+	auto update_success = [&] (bool new_success){
+		success = new_success && success;
+	};
+	if (broker) {
+		if (!PID.has_value() || no_self_spawn) {
+			fmt::print(fErr, "Error: The option \"--broker\" needs \"--pid\" and no \"--no-self-spawn\".\n");
+			return 1;
+		}
+		return RunBroker(fErr, *PID) ? 0 : 1;
+	}
+
+	if (PID.has_value()) {
+		if (no_self_spawn && format != output_format::text) {
+			// The child of a survey: one JSON line or record, also for errors.
+			const console_info info = AttachAndCollectConsoleInfo(*PID);
+			if (!WriteConsoleInfo(fOut, format, info))
+				return 1;
+			return info.error_code == 0 ? 0 : 1;
+		}
+		if (no_self_spawn) {
+			update_success(AttachToConsole(fOut, *PID, change_mode));
+			if (!success)
+				return 1;
+		}
+		else if (!no_direct && shares_console_with(*PID)) {
+			// Like the child after AttachToConsole(), but in this process.
+			fmt::print(fOut, "Shares the console of process {}\n", *PID);
+		}
+		else {
+			if (!no_broker) {
+				if (auto answered = QueryThroughBroker(fOut, fErr, *PID, query_request{ .change_mode{change_mode}, .event_info{event_info} })) {
+					return *answered ? 0 : 1;
+				}
+			}
+			update_success(SpawnSelf(fOut, fErr, *PID, change_mode, event_info, buffer_size, stats));
+			return success ? 0 : 1;
+		}
+	}
+
+	if (format != output_format::text) {
+		if (event_info.has_value() || !change_mode.conin.unchanging() || !change_mode.conout.unchanging()) {
+			fmt::print(fErr, "Error: \"--format {}\" only reads the properties of the console.\n", output_format_to_string(format));
+			return 1;
+		}
+		return WriteConsoleInfo(fOut, format, CollectConsoleInfo(GetCurrentProcessId())) ? 0 : 1;
+	}
+
+	update_success(PrintInfo(fOut, change_mode));
+
+	if (event_info.has_value()) {
+		fmt::print(fOut, "\n");
+
+		update_success(GenerateCtrlEvent(fOut, *event_info, PID));
+	}
+
+	return success ? 0 : 1;
+}
+
+int main_temp() {
+	if (false) {
+		fmt::print(stdout, "waiting for debugger.\n");
+		using namespace std::chrono_literals;
+		while (!IsDebuggerPresent()) std::this_thread::sleep_for(100ms);
+		DebugBreak();
+	}
+	fmt::print(stdout, "Tach ");
+	SECURITY_ATTRIBUTES sa{ .nLength{sizeof(sa)}, .lpSecurityDescriptor{nullptr}, .bInheritHandle{true} };
+	HANDLE conout = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+	if (conout == nullptr || conout == INVALID_HANDLE_VALUE)
+		return 1;
+
+	SetStdHandle(STD_OUTPUT_HANDLE, conout);
+
+	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(conout),0);
+	if (fd == -1)
+		return 1;
+
+	bool use_new_FILE = false;
+	FILE* f_stream{ nullptr };
+	if (use_new_FILE) {
+		 f_stream = _fdopen(fd, "w+");
+		 if (f_stream == nullptr)
+			 return 1;
+	}
+	else {
+		if (0 != _dup2(fd, _fileno(stdout)))
+			return 1;
+		f_stream = stdout;
+	}
+	fmt::print(f_stream, "Moin!\n");
+	return 0;
 }
\ No newline at end of file